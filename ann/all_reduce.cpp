@@ -0,0 +1,222 @@
+/*
+	Copyright (C) 2015 Matthew Lai
+
+	Giraffe is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	Giraffe is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "all_reduce.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+#include "socket_util.h"
+
+AllReduce::AllReduce()
+	: m_rank(0), m_numProcesses(1)
+{
+}
+
+AllReduce::~AllReduce()
+{
+	Close();
+}
+
+std::string AllReduce::Open(const std::string &address, int rank, int numProcesses)
+{
+	Close();
+
+	if (numProcesses < 1 || rank < 0 || rank >= numProcesses)
+	{
+		return "Invalid rank or number of processes";
+	}
+
+	std::string err;
+
+	try
+	{
+		if (rank == 0)
+		{
+			int listenFd = SocketUtil::Listen(address, numProcesses, err);
+
+			if (listenFd < 0)
+			{
+				return err;
+			}
+
+			m_listenAddress = address;
+
+			m_fds.resize(numProcesses - 1, -1);
+
+			// connections can come in any order, so each process starts by sending its rank
+			for (int i = 1; i < numProcesses && err.empty(); ++i)
+			{
+				int fd = SocketUtil::Accept(listenFd);
+
+				if (fd < 0)
+				{
+					err = "Failed to accept connection on " + address;
+					break;
+				}
+
+				int32_t peerRank = 0;
+
+				try
+				{
+					SocketUtil::RecvAll(fd, &peerRank, sizeof(peerRank));
+				}
+				catch (std::runtime_error &e)
+				{
+					err = e.what();
+				}
+
+				if (err.empty() && (peerRank < 1 || peerRank >= numProcesses || m_fds[peerRank - 1] != -1))
+				{
+					err = "Invalid or duplicate rank from peer: " + std::to_string(peerRank);
+				}
+
+				if (!err.empty())
+				{
+					SocketUtil::Close(fd);
+					break;
+				}
+
+				m_fds[peerRank - 1] = fd;
+			}
+
+			SocketUtil::Close(listenFd);
+		}
+		else
+		{
+			// rank 0 may not be listening yet
+			int fd = SocketUtil::Connect(address, ConnectTimeout, err);
+
+			if (fd < 0)
+			{
+				return err;
+			}
+
+			m_fds.push_back(fd);
+
+			int32_t myRank = rank;
+			SocketUtil::SendAll(fd, &myRank, sizeof(myRank));
+		}
+
+		if (err.empty())
+		{
+			m_rank = rank;
+			m_numProcesses = numProcesses;
+
+			// make sure everyone is connected before returning
+			Min(0);
+		}
+	}
+	catch (std::runtime_error &e)
+	{
+		err = e.what();
+	}
+
+	if (!err.empty())
+	{
+		Close();
+	}
+
+	return err;
+}
+
+void AllReduce::Close()
+{
+	for (auto fd : m_fds)
+	{
+		if (fd >= 0)
+		{
+			SocketUtil::Close(fd);
+		}
+	}
+
+	if (!m_listenAddress.empty())
+	{
+		SocketUtil::RemoveAddress(m_listenAddress);
+	}
+
+	m_fds.clear();
+	m_listenAddress.clear();
+	m_rank = 0;
+	m_numProcesses = 1;
+}
+
+void AllReduce::Sum(float *data, size_t size)
+{
+	Reduce_(data, size, [](float a, float b) { return a + b; });
+}
+
+void AllReduce::Broadcast(float *data, size_t size)
+{
+	if (m_numProcesses == 1)
+	{
+		return;
+	}
+
+	if (m_rank == 0)
+	{
+		for (auto fd : m_fds)
+		{
+			SocketUtil::SendAll(fd, data, size * sizeof(float));
+		}
+	}
+	else
+	{
+		SocketUtil::RecvAll(m_fds[0], data, size * sizeof(float));
+	}
+}
+
+int64_t AllReduce::Min(int64_t x)
+{
+	Reduce_(&x, 1, [](int64_t a, int64_t b) { return std::min(a, b); });
+	return x;
+}
+
+template <typename T, typename Op>
+void AllReduce::Reduce_(T *data, size_t size, Op op)
+{
+	if (m_numProcesses == 1)
+	{
+		return;
+	}
+
+	if (m_rank == 0)
+	{
+		m_recvBuffer.resize(size * sizeof(T));
+		T *other = reinterpret_cast<T *>(&m_recvBuffer[0]);
+
+		for (auto fd : m_fds)
+		{
+			SocketUtil::RecvAll(fd, other, size * sizeof(T));
+
+			for (size_t i = 0; i < size; ++i)
+			{
+				data[i] = op(data[i], other[i]);
+			}
+		}
+
+		for (auto fd : m_fds)
+		{
+			SocketUtil::SendAll(fd, data, size * sizeof(T));
+		}
+	}
+	else
+	{
+		SocketUtil::SendAll(m_fds[0], data, size * sizeof(T));
+		SocketUtil::RecvAll(m_fds[0], data, size * sizeof(T));
+	}
+}
@@ -0,0 +1,76 @@
+/*
+	Copyright (C) 2015 Matthew Lai
+
+	Giraffe is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	Giraffe is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ALL_REDUCE_H
+#define ALL_REDUCE_H
+
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+// Collective operations between a fixed group of processes (for data-parallel training), over TCP or Unix sockets.
+// Rank 0 listens, and all other ranks connect to it. Reductions are done by rank 0 (in rank order, so all processes get
+// bit-identical results), and sent back to everyone. This is only meant for a few processes (e.g. one per NUMA node or
+// per host), where rank 0's bandwidth is not a bottleneck.
+// All processes must make the same calls in the same order. Communication errors throw std::runtime_error.
+class AllReduce
+{
+public:
+	AllReduce();
+	~AllReduce();
+
+	AllReduce(const AllReduce&) = delete;
+	AllReduce &operator=(const AllReduce&) = delete;
+
+	// address is a Unix socket path if it has a '/', and host:port otherwise
+	// rank 0 waits for all other ranks to connect, and the other ranks retry until rank 0 is up (or ConnectTimeout)
+	// returns an empty string on success, and an error message otherwise
+	std::string Open(const std::string &address, int rank, int numProcesses);
+
+	void Close();
+
+	int GetRank() const { return m_rank; }
+	int GetNumProcesses() const { return m_numProcesses; }
+
+	// element-wise, with the result in data on all processes
+	void Sum(float *data, size_t size);
+
+	// all processes get rank 0's data
+	void Broadcast(float *data, size_t size);
+
+	int64_t Min(int64_t x);
+
+	const static int ConnectTimeout = 60; // seconds
+
+private:
+	template <typename T, typename Op>
+	void Reduce_(T *data, size_t size, Op op);
+
+	int m_rank;
+	int m_numProcesses;
+
+	// rank 0 has connections to all other ranks (in rank order), and other ranks have a connection to rank 0
+	std::vector<int> m_fds;
+
+	// only set on rank 0
+	std::string m_listenAddress;
+
+	std::vector<char> m_recvBuffer;
+};
+
+#endif // ALL_REDUCE_H
@@ -101,6 +101,11 @@ public:
 	template <typename Derived>
 	NNMatrixRM ForwardPropagateFast(const MatrixBase<Derived> &in);
 
+	// same, but the output is written into out, which must already be in.rows() x the number of outputs (it can be a
+	// block of a bigger matrix), so nothing is allocated once the internal buffers have grown to the batch size
+	template <typename Derived>
+	void ForwardPropagateFast(const MatrixBase<Derived> &in, Eigen::Ref<NNMatrixRM> out);
+
 	// special case for 1 board and single-valued output - this is used in gameplay (NOT REENTRANT!!)
 	template <typename Derived>
 	float ForwardPropagateSingle(const MatrixBase<Derived> &vec);
@@ -118,6 +123,12 @@ public:
 
 	void ApplyWeightUpdates(const Gradients &grad, float learningRate, float reg);
 
+	// called by TrainGDM with the gradients of each batch (sums over the rows) and the number of rows, before they are
+	// applied (eg. to combine them between processes)
+	// an empty function removes the hook
+	typedef std::function<void(Gradients &, int64_t)> GradientsHook;
+	void SetGradientsHook(GradientsHook hook) { m_gradientsHook = hook; }
+
 	float GetSparsity();
 
 	typedef NNVector BiasType;
@@ -173,6 +184,15 @@ private:
 	// this is used to ensure network stability
 	constexpr static FP MAX_WEIGHT = 1000.0f;
 
+	// masked layers are only trained and evaluated over the regions of the mask, unless the regions are so small (on
+	// average) or cover so much of the matrix that dense matrix operations would be faster
+	constexpr static int64_t MIN_AVG_COMPUTE_REGION_SIZE = 64;
+	constexpr static float MAX_COMPUTE_REGIONS_DENSITY = 0.75f;
+
+	// calls f(region) for all compute regions of the layer, clipped to columns [beginCol, beginCol + numCols)
+	template <typename F>
+	void ForEachComputeRegion_(size_t layer, int64_t beginCol, int64_t numCols, F f) const;
+
 	// these are network parameters that should be copied by copy ctor and assignment operator
 	struct Params
 	{
@@ -184,7 +204,10 @@ private:
 		// optimized form of weight masks (in lists of regions)
 		std::vector<std::vector<MatrixRegion> > weightMasksRegions;
 
-		// optimized form of weight matrices (semi-sparse)
+		// regions of the weight matrices that are trained and evaluated (either weightMasksRegions, or the whole matrix)
+		std::vector<std::vector<MatrixRegion> > computeRegions;
+
+		// optimized form of weight matrices (the compute regions, packed)
 		bool weightsSemiSparseCurrent;
 		std::vector<SemiSparseMatrix<WeightType>> weightsSemiSparse;
 
@@ -202,6 +225,21 @@ private:
 		std::vector<NNVector> outputBiasRMSd2;
 		std::vector<NNMatrix> weightsRMSd2;
 	} m_params;
+
+	// per-thread activations and gradients for TrainGDM, allocated on first use and re-allocated if the number of
+	// threads changes
+	// these are not part of the net, so copies start with empty buffers
+	struct TrainingBuffers
+	{
+		TrainingBuffers() {}
+		TrainingBuffers(const TrainingBuffers &/*other*/) {}
+		TrainingBuffers &operator=(const TrainingBuffers &/*other*/) { return *this; }
+
+		std::vector<Gradients> gradLocal;
+		std::vector<Activations> actLocal;
+	} m_trainingBuffers;
+
+	GradientsHook m_gradientsHook;
 };
 
 typedef FCANN<Relu, Tanh> EvalNet;
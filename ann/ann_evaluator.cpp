@@ -18,6 +18,7 @@
 #include "ann_evaluator.h"
 
 #include <fstream>
+#include <algorithm>
 
 #include "consts.h"
 
@@ -25,18 +26,18 @@ constexpr float ANNEvaluator::BoundNetErrorAsymmetry;
 constexpr float ANNEvaluator::BoundNetTargetShift;
 
 ANNEvaluator::ANNEvaluator()
-	: m_evalHash(EvalHashSize)
+	: m_convTmp(FeaturesConv::Layout::NumBoardFeatures), m_evalHash(EvalHashSize)
 {
 	InvalidateCache();
 }
 
-void ANNEvaluator::ReinitializeMainANN(int64_t inputDims)
+void ANNEvaluator::ReinitializeMainANN(int64_t inputDims, bool student)
 {
-	m_mainAnn = LearnAnn::BuildEvalNet(inputDims, 1, false);
+	m_mainAnn = student ? LearnAnn::BuildStudentEvalNet(inputDims, 1) : LearnAnn::BuildEvalNet(inputDims, 1, false);
 }
 
 ANNEvaluator::ANNEvaluator(const std::string &filename)
-	: m_evalHash(EvalHashSize)
+	: m_convTmp(FeaturesConv::Layout::NumBoardFeatures), m_evalHash(EvalHashSize)
 {
 	std::ifstream netfIn(filename);
 	Deserialize(netfIn);
@@ -65,7 +66,7 @@ void ANNEvaluator::Deserialize(std::istream &is)
 	InvalidateCache();
 }
 
-void ANNEvaluator::Train(const std::vector<std::string> &positions, const NNMatrixRM &y, const std::vector<FeaturesConv::FeatureDescription> &featureDescriptions, float learningRate)
+void ANNEvaluator::Train(Span<const PackedPosition> positions, const NNMatrixRM &y, const std::vector<FeaturesConv::FeatureDescription> &featureDescriptions, float learningRate)
 {
     //std::cout << "3" << std::endl;
 	auto x = BoardsToFeatureRepresentation_(positions, featureDescriptions);
@@ -93,7 +94,7 @@ void ANNEvaluator::Train(const std::vector<std::string> &positions, const NNMatr
 
 }
 
-void ANNEvaluator::TrainLoop(const std::vector<std::string> &positions, const NNMatrixRM &y, int64_t epochs, const std::vector<FeaturesConv::FeatureDescription> &featureDescriptions)
+void ANNEvaluator::TrainLoop(Span<const PackedPosition> positions, const NNMatrixRM &y, int64_t epochs, const std::vector<FeaturesConv::FeatureDescription> &featureDescriptions)
 {
 	auto x = BoardsToFeatureRepresentation_(positions, featureDescriptions);
 
@@ -102,7 +103,28 @@ void ANNEvaluator::TrainLoop(const std::vector<std::string> &positions, const NN
 	InvalidateCache();
 }
 
-void ANNEvaluator::TrainBounds(const std::vector<std::string> &positions, const std::vector<FeaturesConv::FeatureDescription> &featureDescriptions, float learningRate)
+void ANNEvaluator::TrainLoop(const FeatureShard &features, const NNMatrixRM &y, int64_t epochs)
+{
+	LearnAnn::TrainANN(features.GetMatrix(), y, m_mainAnn, epochs);
+
+	InvalidateCache();
+}
+
+void ANNEvaluator::TrainLoop(const NNMatrixRM &x, const NNMatrixRM &y, int64_t epochs)
+{
+	LearnAnn::TrainANN(x, y, m_mainAnn, epochs);
+
+	InvalidateCache();
+}
+
+void ANNEvaluator::TrainLoopStreaming(const std::vector<std::string> &featureFiles, const std::vector<std::string> &labelFiles, int64_t epochs, AllReduce *allReduce)
+{
+	LearnAnn::TrainANNStreaming(featureFiles, labelFiles, m_mainAnn, epochs, allReduce);
+
+	InvalidateCache();
+}
+
+void ANNEvaluator::TrainBounds(Span<const PackedPosition> positions, const std::vector<FeaturesConv::FeatureDescription> &featureDescriptions, float learningRate)
 {
 	auto x = BoardsToFeatureRepresentation_(positions, featureDescriptions);
 
@@ -142,6 +164,42 @@ void ANNEvaluator::TrainBounds(const std::vector<std::string> &positions, const
 	InvalidateCache();
 }
 
+NNMatrixRM ANNEvaluator::EvaluateMainANN(const NNMatrixRM &x)
+{
+	const int64_t BatchSize = 1024;
+
+	NNMatrixRM ret(x.rows(), 1);
+
+	#pragma omp parallel
+	{
+		// ForwardPropagateFast() is not reentrant, so each thread needs its own copy of the net
+		EvalNet net = m_mainAnn;
+
+		#pragma omp for schedule(dynamic)
+		for (int64_t begin = 0; begin < x.rows(); begin += BatchSize)
+		{
+			int64_t numRows = std::min(BatchSize, x.rows() - begin);
+
+			auto out = ret.middleRows(begin, numRows);
+
+			net.ForwardPropagateFast(x.middleRows(begin, numRows), out);
+		}
+	}
+
+	return ret;
+}
+
+void ANNEvaluator::PruneMainANN(Span<const PackedPosition> positions, float fraction)
+{
+	Board dummy;
+	std::vector<FeaturesConv::FeatureDescription> featureDescriptions;
+	FeaturesConv::ConvertBoardToNN(dummy, featureDescriptions);
+
+	LearnAnn::PruneNeurons(m_mainAnn, BoardsToFeatureRepresentation_(positions, featureDescriptions), fraction);
+
+	InvalidateCache();
+}
+
 Score ANNEvaluator::EvaluateForWhiteImpl(Board &b, Score lowerBound, Score upperBound)
 {
 	auto hashResult = HashProbe_(b, lowerBound, upperBound);
@@ -151,13 +209,10 @@ Score ANNEvaluator::EvaluateForWhiteImpl(Board &b, Score lowerBound, Score upper
 		return *hashResult;
 	}
 
-	FeaturesConv::ConvertBoardToNN(b, m_convTmp);
-
-	// we have to map every time because the vector's buffer could have moved
-	Eigen::Map<NNVector> mappedVec(&m_convTmp[0], 1, m_convTmp.size());
+	FeaturesConv::ConvertBoardToNN(b, m_convTmp.data());
 
 #ifdef LAZY_EVAL
-	Score ub = (m_ubAnn.ForwardPropagateSingle(mappedVec) + BoundEvalShift) * EvalFullScale;
+	Score ub = (m_ubAnn.ForwardPropagateSingle(m_convTmp) + BoundEvalShift) * EvalFullScale;
 
 	if (ub <= lowerBound)
 	{
@@ -165,7 +220,7 @@ Score ANNEvaluator::EvaluateForWhiteImpl(Board &b, Score lowerBound, Score upper
 		return ub;
 	}
 
-	Score lb = (m_lbAnn.ForwardPropagateSingle(mappedVec) - BoundEvalShift) * EvalFullScale;
+	Score lb = (m_lbAnn.ForwardPropagateSingle(m_convTmp) - BoundEvalShift) * EvalFullScale;
 
 	if (lb >= upperBound)
 	{
@@ -174,7 +229,7 @@ Score ANNEvaluator::EvaluateForWhiteImpl(Board &b, Score lowerBound, Score upper
 	}
 #endif
 
-	float annOut = m_mainAnn.ForwardPropagateSingle(mappedVec);
+	float annOut = m_mainAnn.ForwardPropagateSingle(m_convTmp);
 
 	Score nnRet = annOut * EvalFullScale;
 
@@ -183,15 +238,21 @@ Score ANNEvaluator::EvaluateForWhiteImpl(Board &b, Score lowerBound, Score upper
 	return nnRet;
 }
 
-void ANNEvaluator::BatchEvaluateForWhiteImpl(std::vector<Board> &positions, std::vector<Score> &results, Score lowerBound, Score upperBound)
+void ANNEvaluator::BatchEvaluateForWhiteImpl(Span<Board> positions, Span<Score> results, Score lowerBound, Score upperBound)
+{
+	BatchEvaluateForWhite(positions, results, m_batchFeatures, lowerBound, upperBound);
+}
+
+void ANNEvaluator::BatchEvaluateForWhite(Span<Board> positions, Span<Score> results, NNMatrixRM &featureBuffer, Score lowerBound, Score upperBound)
 {
+	assert(results.GetSize() == positions.GetSize());
+
 	// some entries may already be in cache
 	// these are the ones we need to evaluate
-	std::vector<size_t> toEvaluate;
-
-	results.resize(positions.size());
+	// (clear() doesn't deallocate, so this only allocates the first few times)
+	m_batchToEvaluate.clear();
 
-	for (size_t i = 0; i < positions.size(); ++i)
+	for (size_t i = 0; i < positions.GetSize(); ++i)
 	{
 		auto hashResult = HashProbe_(positions[i], lowerBound, upperBound);
 
@@ -201,49 +262,53 @@ void ANNEvaluator::BatchEvaluateForWhiteImpl(std::vector<Board> &positions, std:
 		}
 		else
 		{
-			toEvaluate.push_back(i);
+			m_batchToEvaluate.push_back(i);
 		}
 	}
 
-	if (m_convTmp.size() == 0)
+	if (m_batchToEvaluate.empty())
 	{
-		Board b;
-		FeaturesConv::ConvertBoardToNN(b, m_convTmp);
+		return;
 	}
 
-	NNMatrixRM xNN(static_cast<int64_t>(toEvaluate.size()), static_cast<int64_t>(m_convTmp.size()));
+	int64_t numRows = static_cast<int64_t>(m_batchToEvaluate.size());
+	int64_t numFeatures = static_cast<int64_t>(FeaturesConv::Layout::NumBoardFeatures);
 
-	for (size_t idx = 0; idx < toEvaluate.size(); ++idx)
+	// only grow the buffer - we use the top rows if it's bigger than we need
+	if (featureBuffer.rows() < numRows || featureBuffer.cols() != numFeatures)
 	{
-		FeaturesConv::ConvertBoardToNN(positions[toEvaluate[idx]], m_convTmp);
+		featureBuffer.resize(std::max<int64_t>(numRows, featureBuffer.rows()), numFeatures);
+	}
 
-		for (size_t i = 0; i < m_convTmp.size(); ++i)
-		{
-			xNN(idx, i) = m_convTmp[i];
-		}
+	FeaturesConv::ConvertBoardsToNN(positions, Span<size_t>(m_batchToEvaluate), featureBuffer);
+
+	// same as the feature buffer, this is only ever grown
+	if (m_batchOutputs.rows() < numRows)
+	{
+		m_batchOutputs.resize(numRows, 1);
 	}
 
-	auto annResults = m_mainAnn.ForwardPropagateFast(xNN);
+	auto annResults = m_batchOutputs.topRows(numRows);
 
-	for (size_t idx = 0; idx < toEvaluate.size(); ++idx)
+	m_mainAnn.ForwardPropagateFast(featureBuffer.topRows(numRows), annResults);
+
+	for (int64_t idx = 0; idx < numRows; ++idx)
 	{
 		Score result = annResults(idx, 0) * EvalFullScale;
 
-		results[toEvaluate[idx]] = result;
+		results[m_batchToEvaluate[idx]] = result;
 
-		HashStore_(positions[toEvaluate[idx]], result, EvalHashEntry::EntryType::EXACT);
+		HashStore_(positions[m_batchToEvaluate[idx]], result, EvalHashEntry::EntryType::EXACT);
 	}
 }
 
 void ANNEvaluator::PrintDiag(Board &board)
 {
-	FeaturesConv::ConvertBoardToNN(board, m_convTmp);
-
-	Eigen::Map<NNVector> mappedVec(&m_convTmp[0], 1, m_convTmp.size());
+	FeaturesConv::ConvertBoardToNN(board, m_convTmp.data());
 
-	std::cout << "Val: " << m_mainAnn.ForwardPropagateSingle(mappedVec) << std::endl;
-	std::cout << "UB: " << m_ubAnn.ForwardPropagateSingle(mappedVec) << std::endl;
-	std::cout << "LB: " << m_lbAnn.ForwardPropagateSingle(mappedVec) << std::endl;
+	std::cout << "Val: " << m_mainAnn.ForwardPropagateSingle(m_convTmp) << std::endl;
+	std::cout << "UB: " << m_ubAnn.ForwardPropagateSingle(m_convTmp) << std::endl;
+	std::cout << "LB: " << m_lbAnn.ForwardPropagateSingle(m_convTmp) << std::endl;
 }
 
 void ANNEvaluator::InvalidateCache()
@@ -256,13 +321,11 @@ void ANNEvaluator::InvalidateCache()
 
 bool ANNEvaluator::CheckBounds(Board &board, float &windowSize)
 {
-	FeaturesConv::ConvertBoardToNN(board, m_convTmp);
-
-	Eigen::Map<NNVector> mappedVec(&m_convTmp[0], 1, m_convTmp.size());
+	FeaturesConv::ConvertBoardToNN(board, m_convTmp.data());
 
-	auto exact = m_mainAnn.ForwardPropagateSingle(mappedVec);
-	auto ub = m_ubAnn.ForwardPropagateSingle(mappedVec) + BoundEvalShift;
-	auto lb = m_lbAnn.ForwardPropagateSingle(mappedVec) - BoundEvalShift;
+	auto exact = m_mainAnn.ForwardPropagateSingle(m_convTmp);
+	auto ub = m_ubAnn.ForwardPropagateSingle(m_convTmp) + BoundEvalShift;
+	auto lb = m_lbAnn.ForwardPropagateSingle(m_convTmp) - BoundEvalShift;
 
 	windowSize = fabs(ub - lb);
 
@@ -277,35 +340,25 @@ bool ANNEvaluator::CheckBounds(Board &board, float &windowSize)
 	return (exact <= ub) && (exact >= lb);
 }
 
-NNMatrixRM ANNEvaluator::BoardsToFeatureRepresentation_(const std::vector<std::string> &positions, const std::vector<FeaturesConv::FeatureDescription> &featureDescriptions)
+NNMatrixRM ANNEvaluator::BoardsToFeatureRepresentation_(Span<const PackedPosition> positions, const std::vector<FeaturesConv::FeatureDescription> &featureDescriptions)
 {
-	NNMatrixRM ret(positions.size(), featureDescriptions.size());
-
+	if (featureDescriptions.size() != FeaturesConv::Layout::NumBoardFeatures)
 	{
-		ScopedThreadLimiter tlim(8);
-
-		#pragma omp parallel
-		{
-			std::vector<float> features; // each thread reuses a vector to avoid needless allocation/deallocation
-
-			#pragma omp for
-			for (size_t i = 0; i < positions.size(); ++i)
-			{
-				Board b(positions[i]);
-				FeaturesConv::ConvertBoardToNN(b, features);
+		std::stringstream msg;
 
-				if (features.size() != featureDescriptions.size())
-				{
-					std::stringstream msg;
+		msg << "Wrong feature vector size! " << FeaturesConv::Layout::NumBoardFeatures << " (Expecting: " << featureDescriptions.size() << ")";
 
-					msg << "Wrong feature vector size! " << features.size() << " (Expecting: " << featureDescriptions.size() << ")";
+		throw std::runtime_error(msg.str());
+	}
 
-					throw std::runtime_error(msg.str());
-				}
+	NNMatrixRM ret(positions.GetSize(), featureDescriptions.size());
 
-				ret.row(i) = Eigen::Map<NNMatrixRM>(&features[0], 1, static_cast<int64_t>(features.size()));
-			}
-		}
+	// each row is written in place, so there is no per-thread scratch space, and no reason to limit the number of threads
+	#pragma omp parallel for
+	for (size_t i = 0; i < positions.GetSize(); ++i)
+	{
+		Board b(positions[i]);
+		FeaturesConv::ConvertBoardToNN(b, &ret(i, 0));
 	}
 
 	return ret;
@@ -26,6 +26,7 @@
 #include "evaluator.h"
 #include "ann/ann.h"
 #include "ann/features_conv.h"
+#include "ann/feature_shard.h"
 #include "matrix_ops.h"
 #include "consts.h"
 
@@ -68,25 +69,49 @@ public:
 
 	void Deserialize(std::istream &is);
     
-    void ReinitializeMainANN(int64_t inputDims);
+    // student gives a much smaller and faster main net, to be trained by distillation
+    void ReinitializeMainANN(int64_t inputDims, bool student = false);
 
-	void Train(const std::vector<std::string> &positions, const NNMatrixRM &y, const std::vector<FeaturesConv::FeatureDescription> &featureDescriptions, float learningRate);
+	void Train(Span<const PackedPosition> positions, const NNMatrixRM &y, const std::vector<FeaturesConv::FeatureDescription> &featureDescriptions, float learningRate);
 
-	void TrainLoop(const std::vector<std::string> &positions, const NNMatrixRM &y, int64_t epochs, const std::vector<FeaturesConv::FeatureDescription> &featureDescriptions);
+	void TrainLoop(Span<const PackedPosition> positions, const NNMatrixRM &y, int64_t epochs, const std::vector<FeaturesConv::FeatureDescription> &featureDescriptions);
 
-	void TrainBounds(const std::vector<std::string> &positions, const std::vector<FeaturesConv::FeatureDescription> &featureDescriptions, float learningRate);
+	// same as above, but with features that have already been computed (and cached on disk)
+	void TrainLoop(const FeatureShard &features, const NNMatrixRM &y, int64_t epochs);
+
+	// same as above, with features in memory
+	void TrainLoop(const NNMatrixRM &x, const NNMatrixRM &y, int64_t epochs);
+
+	// for datasets that don't fit in memory, optionally with multiple processes (see LearnAnn::TrainANNStreaming())
+	void TrainLoopStreaming(const std::vector<std::string> &featureFiles, const std::vector<std::string> &labelFiles, int64_t epochs, AllReduce *allReduce = nullptr);
+
+	void TrainBounds(Span<const PackedPosition> positions, const std::vector<FeaturesConv::FeatureDescription> &featureDescriptions, float learningRate);
+
+	// raw (unscaled) main net outputs for features x, computed in batches on all threads (no eval hash)
+	NNMatrixRM EvaluateMainANN(const NNMatrixRM &x);
+
+	// removes the least important neurons of the main net, using positions to rank them (see LearnAnn::PruneNeurons())
+	void PruneMainANN(Span<const PackedPosition> positions, float fraction);
 
 	Score EvaluateForWhiteImpl(Board &b, Score lowerBound, Score upperBound) override;
 
 	// we override this function to provide faster implementation using matrix-matrix multiplications instead of matrix-vector
-	void BatchEvaluateForWhiteImpl(std::vector<Board> &positions, std::vector<Score> &results, Score lowerBound, Score upperBound) override;
+	void BatchEvaluateForWhiteImpl(Span<Board> positions, Span<Score> results, Score lowerBound, Score upperBound) override;
+
+	using EvaluatorIface::BatchEvaluateForWhiteImpl;
+
+	// same as above, but features are written into a caller-provided buffer, which is only ever grown
+	// (Eigen matrices are aligned, and batched callers can keep one around to avoid all allocations)
+	void BatchEvaluateForWhite(Span<Board> positions, Span<Score> results, NNMatrixRM &featureBuffer, Score lowerBound = SCORE_MIN, Score upperBound = SCORE_MAX);
+
+	using EvaluatorIface::BatchEvaluateForWhite;
 
 	void PrintDiag(Board &board) override;
 
 	void InvalidateCache();
 
 	bool CheckBounds(Board &board, float &windowSize);
-	NNMatrixRM BoardsToFeatureRepresentation_(const std::vector<std::string> &positions, const std::vector<FeaturesConv::FeatureDescription> &featureDescriptions);
+	NNMatrixRM BoardsToFeatureRepresentation_(Span<const PackedPosition> positions, const std::vector<FeaturesConv::FeatureDescription> &featureDescriptions);
 
 private:
 
@@ -171,7 +196,13 @@ private:
 
 	EvalNet m_lbAnn;
 
-	std::vector<float> m_convTmp;
+	// features of the position being evaluated (sized for the fixed feature layout)
+	NNVector m_convTmp;
+
+	// scratch space for batch evaluation
+	NNMatrixRM m_batchFeatures;
+	NNMatrixRM m_batchOutputs;
+	std::vector<size_t> m_batchToEvaluate;
 
 	std::vector<EvalHashEntry> m_evalHash;
 };
@@ -28,7 +28,6 @@
 // for floating point interrupts
 #include <xmmintrin.h>
 
-#include "omp_scoped_thread_limiter.h"
 #include "random_device.h"
 
 inline void EnableNanInterrupt()
@@ -206,32 +205,53 @@ template <ActivationFunc ACTF, ActivationFunc ACTFLast>
 template <typename Derived>
 NNMatrixRM FCANN<ACTF, ACTFLast>::ForwardPropagateFast(const MatrixBase<Derived> &in)
 {
-	/*
-	if (!m_params.weightsSemiSparseCurrent)
-	{
-		UpdateWeightSemiSparse_();
-	}
-	*/
+	NNMatrixRM out(in.rows(), m_params.weights[m_params.weights.size() - 1].cols());
 
-	for (size_t layer = 0; layer < m_params.weights.size(); ++layer)
+	ForwardPropagateFast(in, out);
+
+	return out;
+}
+
+template <ActivationFunc ACTF, ActivationFunc ACTFLast>
+template <typename Derived>
+void FCANN<ACTF, ACTFLast>::ForwardPropagateFast(const MatrixBase<Derived> &in, Eigen::Ref<NNMatrixRM> out)
+{
+	size_t lastLayer = m_params.weights.size() - 1;
+
+	assert(out.rows() == in.rows());
+	assert(out.cols() == m_params.weights[lastLayer].cols());
+
+	// unlike the single row case, this uses dense products - with the eval net masks, the first layer compute regions are
+	// only 7-19 columns wide, and with that few columns Eigen's matrix products are no faster than one dense product
+	for (size_t layer = 0; layer < lastLayer; ++layer)
 	{
 		if (layer == 0)
 		{
 			m_params.evalTmp[layer].noalias() = in * m_params.weights[layer];
-			//MatrixMultiplyWithSemiSparse(in, m_params.weightsSemiSparse[layer], m_params.evalTmp[layer]);
 		}
 		else
 		{
 			m_params.evalTmp[layer].noalias() = m_params.evalTmp[layer - 1] * m_params.weights[layer];
-			//MatrixMultiplyWithSemiSparse(m_params.evalTmp[layer - 1], m_params.weightsSemiSparse[layer], m_params.evalTmp[layer]);
 		}
 
 		m_params.evalTmp[layer].rowwise() += m_params.outputBias[layer];
 
-		Activate_(m_params.evalTmp[layer], layer == (m_params.weights.size() - 1));
+		Activate_(m_params.evalTmp[layer], false);
+	}
+
+	// the last layer is written straight into the output
+	if (lastLayer == 0)
+	{
+		out.noalias() = in * m_params.weights[lastLayer];
+	}
+	else
+	{
+		out.noalias() = m_params.evalTmp[lastLayer - 1] * m_params.weights[lastLayer];
 	}
 
-	return m_params.evalTmp[m_params.weights.size() - 1];
+	out.rowwise() += m_params.outputBias[lastLayer];
+
+	Activate_(out, true);
 }
 
 template <ActivationFunc ACTF, ActivationFunc ACTFLast>
@@ -248,16 +268,14 @@ float FCANN<ACTF, ACTFLast>::ForwardPropagateSingle(const MatrixBase<Derived> &v
 		if (layer == 0)
 		{
 			//m_params.evalSingleTmp[layer].noalias() = vec * m_params.weights[layer];
-			MultiplyWithSemiSparse(vec, m_params.weightsSemiSparse[layer], m_params.evalSingleTmp[layer]);
+			MultiplyWithSemiSparse(vec, m_params.weightsSemiSparse[layer], m_params.outputBias[layer], m_params.evalSingleTmp[layer]);
 		}
 		else
 		{
 			//m_params.evalSingleTmp[layer].noalias() = m_params.evalSingleTmp[layer - 1] * m_params.weights[layer];
-			MultiplyWithSemiSparse(m_params.evalSingleTmp[layer - 1], m_params.weightsSemiSparse[layer], m_params.evalSingleTmp[layer]);
+			MultiplyWithSemiSparse(m_params.evalSingleTmp[layer - 1], m_params.weightsSemiSparse[layer], m_params.outputBias[layer], m_params.evalSingleTmp[layer]);
 		}
 
-		m_params.evalSingleTmp[layer] += m_params.outputBias[layer];
-
 		Activate_(m_params.evalSingleTmp[layer], layer == (m_params.weights.size() - 1));
 	}
 
@@ -277,15 +295,13 @@ float FCANN<ACTF, ACTFLast>::ForwardPropagateSingleWithSignature(const MatrixBas
 	{
 		if (layer == 0)
 		{
-			MultiplyWithSemiSparse(vec, m_params.weightsSemiSparse[layer], m_params.evalSingleTmp[layer]);
+			MultiplyWithSemiSparse(vec, m_params.weightsSemiSparse[layer], m_params.outputBias[layer], m_params.evalSingleTmp[layer]);
 		}
 		else
 		{
-			MultiplyWithSemiSparse(m_params.evalSingleTmp[layer - 1], m_params.weightsSemiSparse[layer], m_params.evalSingleTmp[layer]);
+			MultiplyWithSemiSparse(m_params.evalSingleTmp[layer - 1], m_params.weightsSemiSparse[layer], m_params.outputBias[layer], m_params.evalSingleTmp[layer]);
 		}
 
-		m_params.evalSingleTmp[layer] += m_params.outputBias[layer];
-
 		Activate_(m_params.evalSingleTmp[layer], layer == (m_params.weights.size() - 1));
 
 		if (layer == (m_params.weights.size() - 2))
@@ -323,17 +339,37 @@ void FCANN<ACTF, ACTFLast>::BackwardPropagateComputeGrad(const MatrixBase<Derive
 		// first we calculate weight gradients for the current layer,
 		// which is the transpose of each input to this layer, multiplied
 		// by errorTerms
-		grad.weightGradients[layer].noalias() = act.act[layer].transpose() * errorTerms;
+		// gradients of masked out weights are never used, so we only calculate them in the compute regions
+		ForEachComputeRegion_(layer, 0, m_params.weights[layer].cols(), [&](const MatrixRegion &region)
+		{
+			grad.weightGradients[layer].block(region.i, region.j, region.rows, region.cols).noalias() =
+				act.act[layer].middleCols(region.i, region.rows).transpose() * errorTerms.middleCols(region.j, region.cols);
+		});
 
 		// bias gradients are just errorTerms
 		grad.biasGradients[layer].noalias() = errorTerms.colwise().sum();
 
+		// nothing uses the error of the inputs
+		if (layer == 0)
+		{
+			break;
+		}
+
 		NNMatrixRM derivatives = act.actIn[layer];
 		ActivateDerivative_(derivatives);
 
-		// then we calculate error for the next (previous) layer
-		errorTerms *= m_params.weights[layer].transpose();
-		errorTerms.array() *= derivatives.array();
+		// then we calculate error for the next (previous) layer, again only through weights that are not masked out
+		NNMatrixRM prevErrorTerms = NNMatrixRM::Zero(errorTerms.rows(), m_params.weights[layer].rows());
+
+		ForEachComputeRegion_(layer, 0, m_params.weights[layer].cols(), [&](const MatrixRegion &region)
+		{
+			prevErrorTerms.middleCols(region.i, region.rows).noalias() +=
+				errorTerms.middleCols(region.j, region.cols) * m_params.weights[layer].block(region.i, region.j, region.rows, region.cols).transpose();
+		});
+
+		prevErrorTerms.array() *= derivatives.array();
+
+		errorTerms.swap(prevErrorTerms);
 	}
 }
 
@@ -341,26 +377,22 @@ template <ActivationFunc ACTF, ActivationFunc ACTFLast>
 template <typename Derived1, typename Derived2>
 float FCANN<ACTF, ACTFLast>::TrainGDM(const MatrixBase<Derived1> &x, const MatrixBase<Derived2> &y, float learningRate, float reg)
 {
-	static std::vector<Gradients> gradLocal;
-	static std::vector<Activations> actLocal;
-	static bool initialized = false;
+	std::vector<Gradients> &gradLocal = m_trainingBuffers.gradLocal;
+	std::vector<Activations> &actLocal = m_trainingBuffers.actLocal;
 
-	// we limit to 8 threads for the current block size of 256
-	ScopedThreadLimiter tlim(8);
+	size_t maxThreads = omp_get_max_threads();
 
-	if (!initialized)
+	if (gradLocal.size() != maxThreads)
 	{
-		gradLocal = std::vector<Gradients>(omp_get_max_threads());
-		actLocal = std::vector<Activations>(omp_get_max_threads());
+		gradLocal = std::vector<Gradients>(maxThreads);
+		actLocal = std::vector<Activations>(maxThreads);
 
-		for (int64_t i = 0; i < omp_get_max_threads(); ++i)
+		for (size_t i = 0; i < maxThreads; ++i)
 		{
 			InitializeActivations(actLocal[i]);
 
 			InitializeGradients(gradLocal[i]);
 		}
-
-		initialized = true;
 	}
 
 	float errorsMeasureTotal = 0.0f;
@@ -377,23 +409,57 @@ float FCANN<ACTF, ACTFLast>::TrainGDM(const MatrixBase<Derived1> &x, const Matri
 
 		auto pred = ForwardPropagate(x.block(begin, 0, numRows, x.cols()), actLocal[threadId]);
 
-		errorsMeasureTotal += ErrorFunc(pred, y.block(begin, 0, numRows, y.cols())).sum();
+		float errorsMeasure = ErrorFunc(pred, y.block(begin, 0, numRows, y.cols())).sum();
+
+		#pragma omp atomic
+		errorsMeasureTotal += errorsMeasure;
 
 		NNMatrixRM errorsDerivative = ErrorFuncDerivative(pred, y.block(begin, 0, numRows, y.cols()), actLocal[threadId].actIn[actLocal[threadId].actIn.size() - 1]);
 
 		BackwardPropagateComputeGrad(errorsDerivative, actLocal[threadId], gradLocal[threadId]);
 
-		// reduce all the local gradients into total, using log(n) steps
-		for (size_t skip = 2; skip <= numThreads; skip *= 2)
+		#pragma omp barrier
+
+		// reduce all the local gradients into gradLocal[0]
+		// each thread sums a block of columns (contiguous in the column-major gradients) from all threads, so all threads
+		// work at the same time, and there is no barrier between steps
+		// like everything else in training, this is only done in the compute regions
+		for (size_t layer = 0; layer < gradLocal[0].weightGradients.size(); ++layer)
 		{
-			if ((threadId % skip) == 0 && (threadId + skip / 2) < numThreads)
+			int64_t beginCol;
+			int64_t numCols;
+
+			GetThreadBlock_(gradLocal[0].weightGradients[layer].cols(), beginCol, numCols);
+
+			if (numCols == 0)
 			{
-				gradLocal[threadId] += gradLocal[threadId + skip / 2];
+				continue;
+			}
+
+			ForEachComputeRegion_(layer, beginCol, numCols, [&](const MatrixRegion &region)
+			{
+				auto weightGradientsBlock = gradLocal[0].weightGradients[layer].block(region.i, region.j, region.rows, region.cols);
+
+				for (size_t i = 1; i < numThreads; ++i)
+				{
+					weightGradientsBlock += gradLocal[i].weightGradients[layer].block(region.i, region.j, region.rows, region.cols);
+				}
+			});
+
+			auto biasGradientsBlock = gradLocal[0].biasGradients[layer].middleCols(beginCol, numCols);
+
+			for (size_t i = 1; i < numThreads; ++i)
+			{
+				biasGradientsBlock += gradLocal[i].biasGradients[layer].middleCols(beginCol, numCols);
 			}
-			#pragma omp barrier
 		}
 	}
 
+	if (m_gradientsHook)
+	{
+		m_gradientsHook(gradLocal[0], x.rows());
+	}
+
 	ApplyWeightUpdates(gradLocal[0], learningRate, reg);
 
 	return errorsMeasureTotal / x.rows();
@@ -415,6 +481,10 @@ void FCANN<ACTF, ACTFLast>::ApplyWeightUpdates(const Gradients &grad, float lear
 	m_params.weightsRMSd2.resize(m_params.weights.size());
 	m_params.outputBiasRMSd2.resize(m_params.outputBias.size());
 
+	// ADADELTA
+	float decay = 0.99f;
+	float e = 1e-8f;
+
 	for (size_t layer = 0; layer < m_params.weights.size(); ++layer)
 	{
 		#pragma omp parallel
@@ -422,95 +492,110 @@ void FCANN<ACTF, ACTFLast>::ApplyWeightUpdates(const Gradients &grad, float lear
 			int64_t begin;
 			int64_t numCols;
 
-			size_t inSize = m_params.weights[layer].rows();
 			size_t outSize = m_params.weights[layer].cols();
 
 			GetThreadBlock_(outSize, begin, numCols);
 
 			if (numCols != 0) // if numCols is less than num threads, some threads won't have anything to do
 			{
-				auto weightsBlock = m_params.weights[layer].block(0, begin, inSize, numCols);
-				auto biasBlock = m_params.outputBias[layer].block(0, begin, 1, numCols);
-
-				auto weightsGradientsBlock = grad.weightGradients[layer].block(0, begin, inSize, numCols);
-				auto biasGradientsBlock = grad.biasGradients[layer].block(0, begin, 1, numCols);
-
-				auto weightsEg2Block = m_params.weightsEg2[layer].block(0, begin, inSize, numCols);
-				auto biasEg2Block = m_params.outputBiasEg2[layer].block(0, begin, 1, numCols);
+				FP weightMax = 0.0f;
 
-				auto weightsRMSd2Block = m_params.weightsRMSd2[layer].block(0, begin, inSize, numCols);
-				auto biasRMSd2Block = m_params.outputBiasRMSd2[layer].block(0, begin, 1, numCols);
-
-				auto weightMaskBlock = m_params.weightMasks[layer].block(0, begin, inSize, numCols);
-
-				#define L1_REG
-				#ifdef L1_REG
-				NNMatrix weightReg(weightsBlock.rows(), weightsBlock.cols());
-
-				for (int64_t i = 0; i < (weightReg.rows() * weightReg.cols()); ++i)
+				// weights outside the compute regions are masked out, so there is nothing to update there
+				ForEachComputeRegion_(layer, begin, numCols, [&](const MatrixRegion &region)
 				{
-					float w = weightsBlock.data()[i];
-					float x;
+					auto weightsBlock = m_params.weights[layer].block(region.i, region.j, region.rows, region.cols);
+					auto weightsGradientsBlock = grad.weightGradients[layer].block(region.i, region.j, region.rows, region.cols);
+					auto weightsEg2Block = m_params.weightsEg2[layer].block(region.i, region.j, region.rows, region.cols);
+					auto weightsRMSd2Block = m_params.weightsRMSd2[layer].block(region.i, region.j, region.rows, region.cols);
+					auto weightMaskBlock = m_params.weightMasks[layer].block(region.i, region.j, region.rows, region.cols);
 
-					if (w > 0.0f)
-					{
-						if (w > reg)
-						{
-							x = -reg;
-						}
-						else
-						{
-							x = -w;
-						}
-					}
-					else
+					#define L1_REG
+					#ifdef L1_REG
+					NNMatrix weightReg(weightsBlock.rows(), weightsBlock.cols());
+
+					for (int64_t j = 0; j < weightReg.cols(); ++j)
 					{
-						if (w < -reg)
-						{
-							x = reg;
-						}
-						else
+						for (int64_t i = 0; i < weightReg.rows(); ++i)
 						{
-							x = -w;
+							float w = weightsBlock(i, j);
+							float x;
+
+							if (w > 0.0f)
+							{
+								if (w > reg)
+								{
+									x = -reg;
+								}
+								else
+								{
+									x = -w;
+								}
+							}
+							else
+							{
+								if (w < -reg)
+								{
+									x = reg;
+								}
+								else
+								{
+									x = -w;
+								}
+							}
+
+							weightReg(i, j) = x;
 						}
 					}
+					#elif defined(L2_REG)
+					NNMatrix weightReg =  -reg * weightsBlock;
+					#else
+					NNMatrix weightReg = NNMatrix::Zero(weightsBlock.rows(), weightsBlock.cols());
+					#endif
 
-					weightReg.data()[i] = x;
-				}
-				#elif defined(L2_REG)
-				NNMatrix weightReg =  -reg * weightsBlock;
-				#else
-				NNMatrix weightReg = NNMatrix::Zero(weightsBlock.rows(), weightsBlock.cols());
-				#endif
+					// update Eg2 (ADADELTA)
+					weightsEg2Block.array() *= decay;
+					weightsEg2Block.array() += (weightsGradientsBlock.array() * weightsGradientsBlock.array()) * (1.0f - decay);
+
+					// ADADELTA
+					NNMatrix weightDelta = -weightsGradientsBlock.array() * (weightsRMSd2Block.array() + e).sqrt() / (weightsEg2Block.array() + e).sqrt() + weightReg.array();
+
+					//NNMatrix weightDelta = -weightsGradientsBlock.array() * learningRate /*+ weightReg.array()*/;
+
+					weightsBlock += weightDelta * learningRate;
+
+					// this is only necessary when the layer is trained as dense
+					weightsBlock.array() *= weightMaskBlock.array();
+
+					weightMax = std::max(weightMax, std::max(weightsBlock.maxCoeff(), -weightsBlock.minCoeff()));
+
+					// ADADELTA
+					weightsRMSd2Block *= decay;
+					weightsRMSd2Block.array() += weightDelta.array() * weightDelta.array() * (1.0f - decay);
+				});
+
+				auto biasBlock = m_params.outputBias[layer].block(0, begin, 1, numCols);
+				auto biasGradientsBlock = grad.biasGradients[layer].block(0, begin, 1, numCols);
+				auto biasEg2Block = m_params.outputBiasEg2[layer].block(0, begin, 1, numCols);
+				auto biasRMSd2Block = m_params.outputBiasRMSd2[layer].block(0, begin, 1, numCols);
 
 				// update Eg2 (ADADELTA)
-				float decay = 0.99f;
-				float e = 1e-8f;
-				weightsEg2Block.array() *= decay;
-				weightsEg2Block.array() += (weightsGradientsBlock.array() * weightsGradientsBlock.array()) * (1.0f - decay);
 				biasEg2Block.array() *= decay;
 				biasEg2Block.array() += (biasGradientsBlock.array() * biasGradientsBlock.array()) * (1.0f - decay);
 
 				// ADADELTA
-				NNMatrix weightDelta = -weightsGradientsBlock.array() * (weightsRMSd2Block.array() + e).sqrt() / (weightsEg2Block.array() + e).sqrt() + weightReg.array();
 				NNVector biasDelta = -biasGradientsBlock.array() * (biasRMSd2Block.array() + e).sqrt() / (biasEg2Block.array() + e).sqrt();
 
-				//NNMatrix weightDelta = -weightsGradientsBlock.array() * learningRate /*+ weightReg.array()*/;
 				//NNVector biasDelta = -biasGradientsBlock.array() * learningRate;
 
-				weightsBlock += weightDelta * learningRate;
-				weightsBlock.array() *= weightMaskBlock.array();
 				biasBlock += biasDelta * learningRate;
 
-				FP weightMax = std::max(std::max(weightsBlock.maxCoeff(), -weightsBlock.minCoeff()), std::max(biasBlock.maxCoeff(), -biasBlock.minCoeff()));
+				weightMax = std::max(weightMax, std::max(biasBlock.maxCoeff(), -biasBlock.minCoeff()));
 				if (weightMax > MAX_WEIGHT)
 				{
 					throw LearningRateException();
 				}
 
 				// ADADELTA
-				weightsRMSd2Block *= decay;
-				weightsRMSd2Block.array() += weightDelta.array() * weightDelta.array() * (1.0f - decay);
 				biasRMSd2Block *= decay;
 				biasRMSd2Block.array() += biasDelta.array() * biasDelta.array() * (1.0f - decay);
 			}
@@ -747,6 +832,7 @@ template <ActivationFunc ACTF, ActivationFunc ACTFLast>
 void FCANN<ACTF, ACTFLast>::UpdateWeightMasksRegions_()
 {
 	m_params.weightMasksRegions.resize(m_params.weightMasks.size());
+	m_params.computeRegions.resize(m_params.weightMasks.size());
 
 	for (size_t layer = 0; layer < m_params.weightMasks.size(); ++layer)
 	{
@@ -759,11 +845,44 @@ void FCANN<ACTF, ACTFLast>::UpdateWeightMasksRegions_()
 		{
 			totalSize += region.rows * region.cols;
 		}
+
+		int64_t numRegions = m_params.weightMasksRegions[layer].size();
+		int64_t matrixSize = m_params.weightMasks[layer].rows() * m_params.weightMasks[layer].cols();
+
+		if (numRegions != 0 &&
+			(totalSize / numRegions) >= MIN_AVG_COMPUTE_REGION_SIZE &&
+			totalSize <= (matrixSize * MAX_COMPUTE_REGIONS_DENSITY))
+		{
+			m_params.computeRegions[layer] = m_params.weightMasksRegions[layer];
+		}
+		else
+		{
+			m_params.computeRegions[layer] = { MatrixRegion{ 0, 0, m_params.weightMasks[layer].rows(), m_params.weightMasks[layer].cols() } };
+		}
+
+		// training never touches weights outside the compute regions, so masked out weights have to start at 0
+		m_params.weights[layer].array() *= m_params.weightMasks[layer].array();
 	}
 
 	m_params.weightsSemiSparseCurrent = false;
 }
 
+template <ActivationFunc ACTF, ActivationFunc ACTFLast>
+template <typename F>
+void FCANN<ACTF, ACTFLast>::ForEachComputeRegion_(size_t layer, int64_t beginCol, int64_t numCols, F f) const
+{
+	for (const auto &region : m_params.computeRegions[layer])
+	{
+		int64_t clippedBegin = std::max(region.j, beginCol);
+		int64_t clippedEnd = std::min(region.j + region.cols, beginCol + numCols);
+
+		if (clippedBegin < clippedEnd)
+		{
+			f(MatrixRegion{ region.i, clippedBegin, region.rows, clippedEnd - clippedBegin });
+		}
+	}
+}
+
 template <ActivationFunc ACTF, ActivationFunc ACTFLast>
 void FCANN<ACTF, ACTFLast>::UpdateWeightSemiSparse_()
 {
@@ -773,7 +892,7 @@ void FCANN<ACTF, ACTFLast>::UpdateWeightSemiSparse_()
 	{
 		WeightType toConvert = m_params.weights[layer];
 
-		m_params.weightsSemiSparse[layer] = ToSemiSparse(toConvert, m_params.weightMasksRegions[layer]);
+		m_params.weightsSemiSparse[layer] = ToSemiSparse(toConvert, m_params.computeRegions[layer]);
 	}
 
 	m_params.weightsSemiSparseCurrent = true;
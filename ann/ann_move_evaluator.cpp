@@ -53,19 +53,19 @@ ANNMoveEvaluator::ANNMoveEvaluator(ANNEvaluator &annEval)
 	m_ann = LearnAnn::BuildMoveEvalNet(fds.size(), 1);
 }
 
-void ANNMoveEvaluator::Train(const std::vector<std::string> &positions, const std::vector<std::string> &bestMoves)
+void ANNMoveEvaluator::Train(Span<const PackedPosition> positions)
 {
 	NNMatrixRM trainingSet;
 	std::vector<float> trainingTarget;
 
 	// training set size is approx 35 * positionsPerBatch
-	size_t positionsPerBatch = std::min<size_t>(positions.size(), 16);
+	size_t positionsPerBatch = std::min<size_t>(positions.GetSize(), 16);
 
 	const static size_t NumIterations = 100000;
 	const static size_t IterationsPerPrint = 100;
 
 	auto rng = gRd.MakeMT();
-	auto positionDist = std::uniform_int_distribution<size_t>(0, positions.size() - 1);
+	auto positionDist = std::uniform_int_distribution<size_t>(0, positions.GetSize() - 1);
 	auto positionDrawFunc = std::bind(positionDist, rng);
 
 	for (size_t iter = 0; iter < NumIterations; ++iter)
@@ -82,7 +82,7 @@ void ANNMoveEvaluator::Train(const std::vector<std::string> &positions, const st
 		{
 			size_t idx = positionDrawFunc();
 			Board pos = Board(positions[idx]);
-			Move bestMove = pos.ParseMove(bestMoves[idx]);
+			Move bestMove = PackedPositions::UnpackMove(pos, positions[idx].bestMove);
 
 			MoveList ml;
 			pos.GenerateAllLegalMoves<Board::ALL>(ml);
@@ -152,7 +152,7 @@ void ANNMoveEvaluator::Train(const std::vector<std::string> &positions, const st
 	}
 }
 
-void ANNMoveEvaluator::Test(const std::vector<std::string> &positions, const std::vector<std::string> &bestMoves)
+void ANNMoveEvaluator::Test(Span<const PackedPosition> positions)
 {
 	// where in the list is the best move found
 	int64_t orderPosCount[100] = { 0 };
@@ -161,10 +161,10 @@ void ANNMoveEvaluator::Test(const std::vector<std::string> &positions, const std
 
 	size_t totalPositions = 0;
 
-	for (size_t posNum = 0; posNum < positions.size(); ++posNum)
+	for (size_t posNum = 0; posNum < positions.GetSize(); ++posNum)
 	{
 		Board board(positions[posNum]);
-		Move bestMove = board.ParseMove(bestMoves[posNum]);
+		Move bestMove = PackedPositions::UnpackMove(board, positions[posNum].bestMove);
 
 		// don't use positions where the best move is a winning capture
 		if (SEE::StaticExchangeEvaluation(board, bestMove) > 0)
@@ -487,10 +487,5 @@ void ANNMoveEvaluator::GenerateMoveConvInfo_(Board &board, MoveList &ml, Feature
 	convInfo.see.resize(ml.GetSize());
 	convInfo.nmSee.resize(ml.GetSize());
 
-	for (size_t i = 0; i < ml.GetSize(); ++i)
-	{
-		convInfo.see[i] = SEE::StaticExchangeEvaluation(board, ml[i]);
-
-		convInfo.nmSee[i] = SEE::NMStaticExchangeEvaluation(board, ml[i]);
-	}
+	SEE::StaticExchangeEvaluationBatch(board, ml, convInfo.see, convInfo.nmSee);
 }
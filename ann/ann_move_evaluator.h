@@ -40,9 +40,10 @@ public:
 
 	ANNMoveEvaluator(ANNEvaluator &annEval);
 
-	void Train(const std::vector<std::string> &positions, const std::vector<std::string> &bestMoves);
+	// all positions must be labelled with best moves
+	void Train(Span<const PackedPosition> positions);
 
-	void Test(const std::vector<std::string> &positions, const std::vector<std::string> &bestMoves);
+	void Test(Span<const PackedPosition> positions);
 
 	virtual void NotifyBestMove(Board &board, SearchInfo &si, MoveInfoList &list, Move bestMove, size_t movesSearched) override;
 
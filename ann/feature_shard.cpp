@@ -0,0 +1,315 @@
+/*
+	Copyright (C) 2015 Matthew Lai
+
+	Giraffe is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	Giraffe is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "feature_shard.h"
+
+#include <fstream>
+#include <sstream>
+
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+const char NpyMagic[] = "\x93NUMPY";
+const size_t NpyMagicSize = 6;
+
+// numpy aligns the data to 64 bytes, and so do we
+const size_t NpyAlignment = 64;
+
+// parses the header dictionary, and returns the offset of the data (0 on error)
+size_t ParseNpyHeader(std::istream &is, int64_t &rows, int64_t &cols)
+{
+	char prefix[NpyMagicSize + 2];
+
+	if (!is.read(prefix, sizeof(prefix)) || memcmp(prefix, NpyMagic, NpyMagicSize) != 0)
+	{
+		return 0;
+	}
+
+	uint8_t majorVersion = prefix[NpyMagicSize];
+
+	// version 1 has a 2 bytes header length, and version 2 and 3 have 4 bytes
+	size_t headerLenSize = (majorVersion == 1) ? 2 : 4;
+
+	unsigned char headerLenBytes[4] = {};
+
+	if (!is.read(reinterpret_cast<char *>(headerLenBytes), headerLenSize))
+	{
+		return 0;
+	}
+
+	size_t headerLen = 0;
+
+	for (size_t i = 0; i < headerLenSize; ++i)
+	{
+		headerLen |= static_cast<size_t>(headerLenBytes[i]) << (8 * i);
+	}
+
+	std::string header(headerLen, '\0');
+
+	if (!is.read(&header[0], headerLen))
+	{
+		return 0;
+	}
+
+	if (header.find("'<f4'") == std::string::npos || header.find("'fortran_order': False") == std::string::npos)
+	{
+		return 0;
+	}
+
+	size_t shapePos = header.find("'shape': (");
+
+	if (shapePos == std::string::npos)
+	{
+		return 0;
+	}
+
+	const char *shape = header.c_str() + shapePos + strlen("'shape': (");
+	char *end = nullptr;
+
+	rows = strtoll(shape, &end, 10);
+
+	if (end == shape || *end != ',')
+	{
+		return 0;
+	}
+
+	const char *colsBegin = end + 1;
+
+	while (*colsBegin == ' ')
+	{
+		++colsBegin;
+	}
+
+	if (*colsBegin == ')')
+	{
+		// 1D (N,), eg. a label vector saved by numpy, is a single column
+		cols = 1;
+	}
+	else
+	{
+		cols = strtoll(colsBegin, &end, 10);
+
+		if (end == colsBegin || *end != ')')
+		{
+			return 0;
+		}
+	}
+
+	if (rows < 0 || cols <= 0)
+	{
+		return 0;
+	}
+
+	return sizeof(prefix) + headerLenSize + headerLen;
+}
+
+}
+
+FeatureShard::FeatureShard()
+	: m_data(nullptr), m_rows(0), m_cols(0), m_mappedSize(0), m_mappedAddr(nullptr)
+{
+}
+
+FeatureShard::~FeatureShard()
+{
+	Close();
+}
+
+std::string FeatureShard::Open(const std::string &filename)
+{
+	Close();
+
+	std::ifstream f(filename, std::ios::binary);
+
+	if (!f)
+	{
+		return "Failed to open " + filename;
+	}
+
+	int64_t rows = 0;
+	int64_t cols = 0;
+
+	size_t dataOffset = ParseNpyHeader(f, rows, cols);
+
+	if (dataOffset == 0)
+	{
+		return filename + " is not a 1D or 2D float32 .npy file";
+	}
+
+	size_t dataSize = rows * cols * sizeof(float);
+
+	f.seekg(0, std::ios::end);
+
+	if (static_cast<size_t>(f.tellg()) < (dataOffset + dataSize))
+	{
+		return filename + " is truncated";
+	}
+
+#ifndef _WIN32
+	int fd = open(filename.c_str(), O_RDONLY);
+
+	if (fd >= 0)
+	{
+		void *addr = mmap(nullptr, dataOffset + dataSize, PROT_READ, MAP_SHARED, fd, 0);
+
+		if (addr != MAP_FAILED)
+		{
+			m_mappedAddr = addr;
+			m_mappedSize = dataOffset + dataSize;
+			m_data = reinterpret_cast<const float *>(static_cast<const char *>(addr) + dataOffset);
+		}
+
+		close(fd);
+	}
+#endif
+
+	if (m_data == nullptr)
+	{
+		m_buffer.resize(rows, cols);
+
+		f.seekg(dataOffset, std::ios::beg);
+		f.read(reinterpret_cast<char *>(m_buffer.data()), dataSize);
+
+		if (!f)
+		{
+			Close();
+			return "Failed to read " + filename;
+		}
+
+		m_data = m_buffer.data();
+	}
+
+	m_rows = rows;
+	m_cols = cols;
+
+	return "";
+}
+
+void FeatureShard::Close()
+{
+#ifndef _WIN32
+	if (m_mappedSize != 0)
+	{
+		munmap(m_mappedAddr, m_mappedSize);
+	}
+#endif
+
+	m_data = nullptr;
+	m_rows = 0;
+	m_cols = 0;
+	m_mappedSize = 0;
+	m_mappedAddr = nullptr;
+
+	m_buffer.resize(0, 0);
+}
+
+void FeatureShard::Prefetch(int64_t beginRow, int64_t numRows) const
+{
+#ifndef _WIN32
+	if (m_mappedSize == 0 || numRows <= 0)
+	{
+		return;
+	}
+
+	// madvise() wants a page aligned address
+	uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+	uintptr_t begin = reinterpret_cast<uintptr_t>(m_data + beginRow * m_cols);
+	uintptr_t end = reinterpret_cast<uintptr_t>(m_data + (beginRow + numRows) * m_cols);
+
+	begin &= ~(pageSize - 1);
+
+	madvise(reinterpret_cast<void *>(begin), end - begin, MADV_WILLNEED);
+#else
+	(void) beginRow; (void) numRows;
+#endif
+}
+
+std::string FeatureShard::Write(const std::string &filename, const NNMatrixRM &x, const std::string &sourceTag)
+{
+	// if we fail (or crash) part way, there must not be a tag for the old data left behind
+	std::string tagFilename = filename + SourceTagSuffix;
+	std::remove(tagFilename.c_str());
+
+	std::ofstream f(filename, std::ios::binary | std::ios::trunc);
+
+	if (!f)
+	{
+		return "Failed to open " + filename + " for writing";
+	}
+
+	std::stringstream header;
+	header << "{'descr': '<f4', 'fortran_order': False, 'shape': (" << x.rows() << ", " << x.cols() << "), }";
+
+	std::string headerStr = header.str();
+
+	// magic, version, header length, header, and a terminating newline
+	size_t totalSize = NpyMagicSize + 2 + 2 + headerStr.size() + 1;
+
+	headerStr.append((NpyAlignment - totalSize % NpyAlignment) % NpyAlignment, ' ');
+	headerStr.push_back('\n');
+
+	unsigned char headerLenBytes[2] = { static_cast<unsigned char>(headerStr.size() & 0xff), static_cast<unsigned char>(headerStr.size() >> 8) };
+
+	f.write(NpyMagic, NpyMagicSize);
+	f.put(1);
+	f.put(0);
+	f.write(reinterpret_cast<const char *>(headerLenBytes), sizeof(headerLenBytes));
+	f.write(headerStr.c_str(), headerStr.size());
+	f.write(reinterpret_cast<const char *>(x.data()), x.size() * sizeof(float));
+
+	if (!f)
+	{
+		return "Failed to write " + filename;
+	}
+
+	f.close();
+
+	if (sourceTag != "")
+	{
+		std::ofstream tagFile(tagFilename, std::ios::trunc);
+
+		tagFile << sourceTag << '\n';
+
+		if (!tagFile)
+		{
+			return "Failed to write " + tagFilename;
+		}
+	}
+
+	return "";
+}
+
+std::string FeatureShard::ReadSourceTag(const std::string &filename)
+{
+	std::ifstream tagFile(filename + SourceTagSuffix);
+
+	std::string tag;
+	std::getline(tagFile, tag);
+
+	return tag;
+}
@@ -0,0 +1,84 @@
+/*
+	Copyright (C) 2015 Matthew Lai
+
+	Giraffe is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	Giraffe is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FEATURE_SHARD_H
+#define FEATURE_SHARD_H
+
+#include <string>
+
+#include <cstdint>
+
+#include "Eigen/Core"
+
+#include "matrix_ops.h"
+
+// A feature matrix (one row per position) cached on disk, so features only have to be computed once for
+// multi-epoch training.
+// Files are .npy (version 1.0, little endian float32, C order, 2 dimensions), so they can also be loaded from numpy
+// directly (numpy.load(filename, mmap_mode='r')). 1D files (eg. label vectors saved by numpy) are read as one column.
+// Files are memory-mapped for reading, so only the pages actually used are ever loaded.
+class FeatureShard
+{
+public:
+	typedef Eigen::Map<const NNMatrixRM> MatrixType;
+
+	FeatureShard();
+	~FeatureShard();
+
+	FeatureShard(const FeatureShard&) = delete;
+	FeatureShard &operator=(const FeatureShard&) = delete;
+
+	// returns an empty string on success, and an error message otherwise
+	std::string Open(const std::string &filename);
+
+	void Close();
+
+	bool IsOpen() const { return m_data != nullptr; }
+
+	MatrixType GetMatrix() const { return MatrixType(m_data, m_rows, m_cols); }
+
+	int64_t Rows() const { return m_rows; }
+	int64_t Cols() const { return m_cols; }
+
+	// asks the OS to start reading the given rows in the background (if the file is mapped), and returns immediately
+	void Prefetch(int64_t beginRow, int64_t numRows) const;
+
+	// returns an empty string on success, and an error message otherwise
+	// a non-empty sourceTag describes what the features were computed from, and is saved next to the file (numpy
+	// rejects extra keys in the .npy header), so callers can tell whether a cached shard is stale
+	static std::string Write(const std::string &filename, const NNMatrixRM &x, const std::string &sourceTag = "");
+
+	// the tag saved with the shard, or an empty string if there is none
+	static std::string ReadSourceTag(const std::string &filename);
+
+private:
+	// the tag is saved in filename + SourceTagSuffix
+	constexpr static const char *SourceTagSuffix = ".source";
+
+	const float *m_data;
+	int64_t m_rows;
+	int64_t m_cols;
+
+	// 0 if the file is not mapped
+	size_t m_mappedSize;
+	void *m_mappedAddr;
+
+	// only used if we can't map the file
+	NNMatrixRM m_buffer;
+};
+
+#endif // FEATURE_SHARD_H
@@ -17,11 +17,12 @@
 
 #include "features_conv.h"
 
-#include <functional>
 #include <iomanip>
 
 #include "see.h"
 #include "move.h"
+#include "slider_attacks.h"
+#include "board_consts.h"
 
 #include "bit_ops.h"
 
@@ -32,47 +33,38 @@ using namespace FeaturesConv;
 
 typedef FixedVector<std::pair<Move, Score>, 31> MoveSEEList;
 
-struct AttackMaps
+// attack information used by the features, derived from the board's attack maps
+struct AttackFeatures
 {
-	PieceType whiteLeastValuableAttackers[64];
-	PieceType blackLeastValuableAttackers[64];
-
-	uint8_t whiteNumAttackers[64];
-	uint8_t blackNumAttackers[64];
+	const AttackMaps *maps;
 
 	// normalized maximum value of pieces white and black can put on each square
 	float whiteCtrl[64];
 	float blackCtrl[64];
 
-	// is it safe to move a piece of type pt to sq?
-	bool IsSafe(PieceType pt, Square sq)
+	// squares where it's safe to move a piece of type pt to
+	// here we are doing a very simple form of SEE, on all squares at once
+	// if the opponent has no attacker, the piece is safe
+	// if the opponent has an attacker and it's lower valued, we are not safe
+	// if the opponent has an attacker and it's equal or higher valued, we are
+	// safe as long as we also have an attacker (that's not ourselves)
+	// we don't have to worry about winning captures, because qsearch will take care of that
+	uint64_t SafeSquares(PieceType pt) const
 	{
-		// here we are doing a very simple form of SEE
-		// if the opponent has no attacker, the piece is safe
-		// if the opponent has an attacker and it's lower valued, we are not safe
-		// if the opponent has an attacker and it's equal or higher valued, we are
-		// safe as long as we also have an attacker (that's not ourselves)
-
-		// we don't have to worry about winning captures, because qsearch will take care of that
-		// here we are only looking at moving to empty squares
-
 		Color c = GetColor(pt);
-		PieceType opponentAttacker = (c == WHITE) ? blackLeastValuableAttackers[sq] : whiteLeastValuableAttackers[sq];
-		PieceType friendlyAttacker = (c == WHITE) ? whiteLeastValuableAttackers[sq] : blackLeastValuableAttackers[sq];
-		uint8_t numFriendlyAttackers = (c == WHITE) ? whiteNumAttackers[sq] : blackNumAttackers[sq];
+		Color opp = c ^ COLOR_MASK;
 
-		if (opponentAttacker == EMPTY)
-		{
-			return true;
-		}
-		else if (SEE::SEE_MAT[opponentAttacker] < SEE::SEE_MAT[pt])
-		{
-			return false;
-		}
-		else
+		uint64_t attackedByLowerValued = 0ULL;
+
+		for (PieceType attacker = WK; attacker <= WP; ++attacker)
 		{
-			return friendlyAttacker != EMPTY && (numFriendlyAttackers > 1);
+			if (SEE::SEE_MAT[attacker] < SEE::SEE_MAT[pt])
+			{
+				attackedByLowerValued |= maps->attacks[attacker | opp];
+			}
 		}
+
+		return ~maps->GetAttacks(opp) | (~attackedByLowerValued & maps->GetMultiplyAttacked(c));
 	}
 };
 
@@ -87,224 +79,164 @@ float NormalizeCount(int x, int typicalMaxCount)
 	return static_cast<float>(x) / static_cast<float>(typicalMaxCount);
 }
 
-template <typename T> void PushGlobalBool(std::vector<T> &ret, bool x, int32_t group);
-template<> void PushGlobalBool<float>(std::vector<float> &ret, bool x, int32_t /*group*/)
+// writes features sequentially into a preallocated buffer
+// the float version writes feature values, and the FeatureDescription version writes descriptions
+template <typename T>
+struct FeatureWriter
 {
-	if (x)
-	{
-		ret.push_back(1.0f);
-	}
-	else
+	T *out;
+
+	void PushGlobalBool(bool x, int32_t group);
+	void PushGlobalFloat(float x, int32_t group);
+	void PushPosFloat(Square pos, float x, int32_t group);
+
+	// sections are contiguous, so in debug builds we check that the previous one ended
+	// exactly where the new one starts
+	void BeginSection(T *sectionStart)
 	{
-		ret.push_back(0.0f);
+#ifdef DEBUG
+		assert(out == sectionStart);
+#endif
+		out = sectionStart;
 	}
+};
+
+template <> void FeatureWriter<float>::PushGlobalBool(bool x, int32_t /*group*/)
+{
+	*out++ = x ? 1.0f : 0.0f;
+}
+
+template <> void FeatureWriter<float>::PushGlobalFloat(float x, int32_t /*group*/)
+{
+	*out++ = x;
 }
 
-template<> void PushGlobalBool<FeatureDescription>(std::vector<FeatureDescription> &ret, bool /*x*/, int32_t group)
+template <> void FeatureWriter<float>::PushPosFloat(Square /*pos*/, float x, int32_t /*group*/)
 {
-	FeatureDescription fd;
-	fd.featureType = FeatureDescription::FeatureType_global;
-	fd.group = group;
-	ret.push_back(fd);
+	*out++ = x;
 }
 
-template <typename T> void PushGlobalFloat(std::vector<T> &ret, float x, int32_t group);
-template<> void PushGlobalFloat<float>(std::vector<float> &ret, float x, int32_t /*group*/)
+template <> void FeatureWriter<FeatureDescription>::PushGlobalBool(bool /*x*/, int32_t group)
 {
-	ret.push_back(x);
+	out->featureType = FeatureDescription::FeatureType_global;
+	out->group = group;
+	++out;
 }
 
-template<> void PushGlobalFloat<FeatureDescription>(std::vector<FeatureDescription> &ret, float /*x*/, int32_t group)
+template <> void FeatureWriter<FeatureDescription>::PushGlobalFloat(float /*x*/, int32_t group)
 {
-	FeatureDescription fd;
-	fd.featureType = FeatureDescription::FeatureType_global;
-	fd.group = group;
-	ret.push_back(fd);
+	out->featureType = FeatureDescription::FeatureType_global;
+	out->group = group;
+	++out;
+}
+
+template <> void FeatureWriter<FeatureDescription>::PushPosFloat(Square pos, float /*x*/, int32_t group)
+{
+	out->featureType = FeatureDescription::FeatureType_pos;
+	out->sq = pos;
+	out->group = group;
+	++out;
 }
 
 template <typename T>
-void PushGlobalCoords(std::vector<T> &ret, bool exists, Square sq, int32_t group, bool mustExist = false)
+void PushGlobalCoords(FeatureWriter<T> &w, bool exists, Square sq, int32_t group, bool mustExist = false)
 {
 	if (!mustExist)
 	{
-		PushGlobalBool(ret, exists, group);
+		w.PushGlobalBool(exists, group);
 	}
 
 	uint32_t x = GetX(sq);
 	uint32_t y = GetY(sq);
 
-	PushGlobalFloat(ret, exists ? NormalizeCoord(x) : 0.0f, group);
-	PushGlobalFloat(ret, exists ? NormalizeCoord(y) : 0.0f, group);
+	w.PushGlobalFloat(exists ? NormalizeCoord(x) : 0.0f, group);
+	w.PushGlobalFloat(exists ? NormalizeCoord(y) : 0.0f, group);
 
 #if 0
-	PushGlobalFloat(ret, exists ? NormalizeCount(GetDiag0(sq), 14) : 0.0f, group);
-	PushGlobalFloat(ret, exists ? NormalizeCount(GetDiag1(sq), 14) : 0.0f, group);
+	w.PushGlobalFloat(exists ? NormalizeCount(GetDiag0(sq), 14) : 0.0f, group);
+	w.PushGlobalFloat(exists ? NormalizeCount(GetDiag1(sq), 14) : 0.0f, group);
 #endif
 }
 
-template <typename T> void PushMobility(
-		std::vector<T> &ret,
-		float mob,
-		int32_t group);
-template<> void PushMobility<float>(
-		std::vector<float> &ret,
-		float mob,
-		int32_t /*group*/)
-{
-	ret.push_back(mob);
-}
-
-template<> void PushMobility<FeatureDescription>(
-		std::vector<FeatureDescription> &ret,
-		float /*mob*/,
-		int32_t group)
-{
-	FeatureDescription fd;
-
-	fd.featureType = FeatureDescription::FeatureType_global;
-	fd.group = group;
-
-	ret.push_back(fd);
-}
-
-template <typename T> void PushPosFloat(std::vector<T> &ret, Square pos, float x, int group);
-template<> void PushPosFloat<float>(std::vector<float> &ret, Square /*pos*/, float x, int /*group*/)
-{
-	ret.push_back(x);
-}
-
-template<> void PushPosFloat<FeatureDescription>(std::vector<FeatureDescription> &ret, Square pos, float /*x*/, int group)
-{
-	FeatureDescription fd;
-	fd.featureType = FeatureDescription::FeatureType_pos;
-	fd.sq = pos;
-	fd.group = group;
-	ret.push_back(fd);
-}
-
 template <typename T>
-void PushAttacks(std::vector<T> &ret, Square sq, PieceType pt, bool exists, const Board &board, AttackMaps &atkMaps, int32_t group)
+void PushAttacks(FeatureWriter<T> &w, Square sq, PieceType pt, bool exists, const Board &board, AttackFeatures &atkMaps, int32_t group)
 {
-	int32_t safeMovesCount = 0;
+	// all attacks are computed with bitboards - for sliders, the number of squares we can go to in each
+	// direction (up to and including the first piece) is the number of attacked squares on the ray
+	uint64_t occupancy = board.GetOccupiedBitboard<WHITE>() | board.GetOccupiedBitboard<BLACK>();
+	uint64_t attacks = 0ULL;
 
-	int32_t xStart = GetX(sq);
-	int32_t yStart = GetY(sq);
+	auto pushDirectionFcn = [&w, sq, group](uint64_t dirAttacks, RayDirection dir)
+	{
+		w.PushGlobalFloat(NormalizeCount(PopCount(dirAttacks & RAY[dir][sq]), 7), group);
+	};
 
 	if (pt == WR || pt == BR || pt == WQ || pt == BQ)
 	{
-		// figure out how far we can go in each direction
-		const int32_t DirXOffsets[4] = { 1, -1, 0, 0 };
-		const int32_t DirYOffsets[4] = { 0, 0, 1, -1 };
-
-		for (int32_t i = 0; i < 4; ++i)
-		{
-			// for each direction, keep going until we hit either the board edge or another piece
-			int32_t count = 0;
-			int32_t x = xStart + DirXOffsets[i];
-			int32_t y = yStart + DirYOffsets[i];
-
-			while (Valid(x) && Valid(y) && exists)
-			{
-				++count;
+		uint64_t rookAttacks = exists ? SliderAttacks::RookAttacks(sq, occupancy) : 0ULL;
 
-				if (atkMaps.IsSafe(pt, Sq(x, y)))
-				{
-					++safeMovesCount;
-				}
+		pushDirectionFcn(rookAttacks, RAY_E);
+		pushDirectionFcn(rookAttacks, RAY_W);
+		pushDirectionFcn(rookAttacks, RAY_N);
+		pushDirectionFcn(rookAttacks, RAY_S);
 
-				if (board.GetPieceAtSquare(Sq(x, y)) != EMPTY)
-				{
-					break;
-				}
-
-				x += DirXOffsets[i];
-				y += DirYOffsets[i];
-			}
-
-			PushMobility(ret, NormalizeCount(count, 7), group);
-		}
+		attacks |= rookAttacks;
 	}
 
 	if (pt == WB || pt == BB || pt == WQ || pt == BQ)
 	{
-		// figure out how far we can go in each direction
-		const int32_t DirXOffsets[4] = { 1, -1, 1, -1 };
-		const int32_t DirYOffsets[4] = { 1, 1, -1, -1 };
-
-		for (int32_t i = 0; i < 4; ++i)
-		{
-			// for each direction, keep going until we hit either the board edge or another piece
-			int32_t count = 0;
-			int32_t x = xStart + DirXOffsets[i];
-			int32_t y = yStart + DirYOffsets[i];
-
-			while (Valid(x) && Valid(y) && exists)
-			{
-				++count;
-
-				if (atkMaps.IsSafe(pt, Sq(x, y)))
-				{
-					++safeMovesCount;
-				}
+		uint64_t bishopAttacks = exists ? SliderAttacks::BishopAttacks(sq, occupancy) : 0ULL;
 
-				if (board.GetPieceAtSquare(Sq(x, y)) != EMPTY)
-				{
-					break;
-				}
+		pushDirectionFcn(bishopAttacks, RAY_NE);
+		pushDirectionFcn(bishopAttacks, RAY_NW);
+		pushDirectionFcn(bishopAttacks, RAY_SE);
+		pushDirectionFcn(bishopAttacks, RAY_SW);
 
-				x += DirXOffsets[i];
-				y += DirYOffsets[i];
-			}
-
-			PushMobility(ret, NormalizeCount(count, 7), group);
-		}
+		attacks |= bishopAttacks;
 	}
 
 	if (pt == WN || pt == BN)
 	{
-		const int32_t DirXOffsets[8] = { 2, -2, 1, -1, -2, 2, -1, 1 };
-		const int32_t DirYOffsets[8] = { 1, 1, 2, 2, -1, -1, -2, -2 };
-
-		for (int i = 0; i < 8; ++i)
-		{
-			int32_t x = xStart + DirXOffsets[i];
-			int32_t y = yStart + DirYOffsets[i];
-
-			if (Valid(x) && Valid(y) && exists)
-			{
-				if (atkMaps.IsSafe(pt, Sq(x, y)))
-				{
-					++safeMovesCount;
-				}
-			}
-		}
+		attacks = exists ? KNIGHT_ATK[sq] : 0ULL;
 	}
 
+	int32_t safeMovesCount = PopCount(attacks & atkMaps.SafeSquares(pt));
+
 	// 16 is the "reasonably maximum", though queens in the centre of an empty board can have up to 27. That's fine.
-	PushMobility(ret, NormalizeCount(exists ? safeMovesCount : 0, 16), group);
+	w.PushGlobalFloat(NormalizeCount(safeMovesCount, 16), group);
 }
 
 template <typename T>
-void PushSquareFeatures(std::vector<T> &ret, const Board &/*board*/, AttackMaps &atkMaps, int &group)
+void PushSquareFeatures(FeatureWriter<T> &w, AttackFeatures &atkMaps, int32_t &group)
 {
 	for (Square sq = 0; sq < 64; ++sq)
 	{
-		PushPosFloat(ret, sq, atkMaps.whiteCtrl[sq], group);
-		PushPosFloat(ret, sq, atkMaps.blackCtrl[sq], group + 1);
+		w.PushPosFloat(sq, atkMaps.whiteCtrl[sq], group);
+		w.PushPosFloat(sq, atkMaps.blackCtrl[sq], group + 1);
 	}
 
 	group += 2;
 }
 
-template <Color color, typename T>
-void PushPawns(std::vector<T> &ret, uint64_t pawns, AttackMaps &atkMaps, int32_t &group)
+template <typename T>
+void PushThreat(
+	FeatureWriter<T> &w,
+	Square sq,
+	bool exists,
+	AttackFeatures &atkMaps,
+	int32_t group)
 {
-	std::tuple<bool, Square> assignments[8];
+	// we push both black and white control because one would be defending the piece,
+	// and one attacking
+	w.PushGlobalFloat(exists ? atkMaps.whiteCtrl[sq] : 0.0f, group);
+	w.PushGlobalFloat(exists ? atkMaps.blackCtrl[sq] : 0.0f, group);
+}
 
-	for (size_t i = 0; i < 8; ++i)
-	{
-		std::get<0>(assignments[i]) = false;
-	}
+template <typename T>
+void PushPawns(FeatureWriter<T> &w, uint64_t pawns, AttackFeatures &atkMaps, int32_t group)
+{
+	bool slotUsed[8] = { false };
+	Square slotSq[8] = { 0 };
 
 	// in the first pass, we assign each pawn to the corresponding file if possible,
 	// and keep a list (in a bitboard) of pawns that still need to be assigned
@@ -316,10 +248,10 @@ void PushPawns(std::vector<T> &ret, uint64_t pawns, AttackMaps &atkMaps, int32_t
 
 		uint32_t x = GetX(thisPawn);
 
-		if (std::get<0>(assignments[x]) == false)
+		if (!slotUsed[x])
 		{
-			std::get<0>(assignments[x]) = true;
-			std::get<1>(assignments[x]) = thisPawn;
+			slotUsed[x] = true;
+			slotSq[x] = thisPawn;
 		}
 		else
 		{
@@ -343,59 +275,32 @@ void PushPawns(std::vector<T> &ret, uint64_t pawns, AttackMaps &atkMaps, int32_t
 		{
 			int32_t dist = abs(static_cast<int32_t>(x) - i);
 
-			if (std::get<0>(assignments[i]) == false && dist < shortestDistance)
+			if (!slotUsed[i] && dist < shortestDistance)
 			{
 				shortestDistance = dist;
 				bestSlot = i;
 			}
 		}
 
-		std::get<0>(assignments[bestSlot]) = true;
-		std::get<1>(assignments[bestSlot]) = thisPawn;
+		slotUsed[bestSlot] = true;
+		slotSq[bestSlot] = thisPawn;
 	}
 
 	for (size_t i = 0; i < 8; ++i)
 	{
-		bool exists = std::get<0>(assignments[i]);
-		Square sq = std::get<1>(assignments[i]);
-
-		PushGlobalCoords(ret, exists, sq, group);
-		PushThreat(ret, sq, color, exists, atkMaps, group);
-	}
-}
-
-template <typename T>
-void PushThreat(
-	std::vector<T> &ret,
-	Square sq,
-	Color /*c*/,
-	bool exists,
-	AttackMaps &atkMaps,
-	int32_t group)
-{
-	if (exists)
-	{
-		// we push both black and white control because one would be defending the piece,
-		// and one attacking
-		PushGlobalFloat(ret, atkMaps.whiteCtrl[sq], group);
-		PushGlobalFloat(ret, atkMaps.blackCtrl[sq], group);
-	}
-	else
-	{
-		PushGlobalFloat(ret, 0.0f, group);
-		PushGlobalFloat(ret, 0.0f, group);
+		PushGlobalCoords(w, slotUsed[i], slotSq[i], group);
+		PushThreat(w, slotSq[i], slotUsed[i], atkMaps, group);
 	}
 }
 
 template <typename T>
 void PushQueens(
-	std::vector<T> &ret,
+	FeatureWriter<T> &w,
 	uint64_t queens,
 	PieceType pt,
 	const Board &board,
 	int32_t group,
-	std::function<void(std::vector<T> &, int32_t)> pushFCFeaturesFcn,
-	AttackMaps &atkMaps)
+	AttackFeatures &atkMaps)
 {
 	// queens (we only push the first queen for each side)
 	bool exists = false;
@@ -407,21 +312,19 @@ void PushQueens(
 		sq = BitScanForward(queens);
 	}
 
-	PushGlobalCoords(ret, exists, sq, group);
-	PushAttacks(ret, sq, pt, exists, board, atkMaps, group);
-	PushThreat(ret, sq, GetColor(pt), exists, atkMaps, group);
-	pushFCFeaturesFcn(ret, group);
+	PushGlobalCoords(w, exists, sq, group);
+	PushAttacks(w, sq, pt, exists, board, atkMaps, group);
+	PushThreat(w, sq, exists, atkMaps, group);
 }
 
 template <typename T>
 void PushPairPieces(
-	std::vector<T> &ret,
+	FeatureWriter<T> &w,
 	uint64_t pieces,
 	PieceType pt,
 	const Board &board,
 	int32_t &group,
-	std::function<void(std::vector<T> &, int32_t)> pushFCFeaturesFcn,
-	AttackMaps &atkMaps)
+	AttackFeatures &atkMaps)
 {
 	// this is for rooks, bishops, and knights
 	// for these pieces, we only look at the first 2, so there are
@@ -469,35 +372,51 @@ void PushPairPieces(
 		}
 	}
 
-	PushGlobalCoords(ret, firstExists, firstSq, group);
-	PushAttacks(ret, firstSq, pt, firstExists, board, atkMaps, group);
-	PushThreat(ret, firstSq, GetColor(pt), firstExists, atkMaps, group);
-	pushFCFeaturesFcn(ret, group);
+	PushGlobalCoords(w, firstExists, firstSq, group);
+	PushAttacks(w, firstSq, pt, firstExists, board, atkMaps, group);
+	PushThreat(w, firstSq, firstExists, atkMaps, group);
 	++group;
-	PushGlobalCoords(ret, secondExists, secondSq, group);
-	PushAttacks(ret, secondSq, pt, secondExists, board, atkMaps, group);
-	PushThreat(ret, secondSq, GetColor(pt), secondExists, atkMaps, group);
-	pushFCFeaturesFcn(ret, group);
+	PushGlobalCoords(w, secondExists, secondSq, group);
+	PushAttacks(w, secondSq, pt, secondExists, board, atkMaps, group);
+	PushThreat(w, secondSq, secondExists, atkMaps, group);
 }
 
-AttackMaps ComputeAttackMaps(Board &board)
+AttackFeatures ComputeAttackFeatures(const Board &board)
 {
-	AttackMaps ret;
+	AttackFeatures ret;
 
-	board.ComputeLeastValuableAttackers(ret.whiteLeastValuableAttackers, ret.whiteNumAttackers, WHITE);
-	board.ComputeLeastValuableAttackers(ret.blackLeastValuableAttackers, ret.blackNumAttackers, BLACK);
+	ret.maps = &board.GetAttackMaps();
 
-	// convert them to control values
-	for (Square sq = 0; sq < 64; ++sq)
+	// convert least valuable attackers to control values
+	// if a side doesn't attack the square, control is 0
+	// if a side attacks with a piece, control is higher the lower valued the piece is
+	auto fillCtrlFcn = [&ret](Color c, float ctrl[64])
 	{
-		PieceType whitePt = ret.whiteLeastValuableAttackers[sq];
-		PieceType blackPt = ret.blackLeastValuableAttackers[sq];
+		const static PieceType ATTACKER_ORDER[6] = { WP, WN, WB, WR, WQ, WK };
 
-		// if a side doesn't attack the square, control is 0
-		// if a side attacks with a piece, control is higher the lower valued the piece is
-		ret.whiteCtrl[sq] = (whitePt == EMPTY) ? 0.0f : NormalizeCount(SEE::SEE_MAT[WK] + SEE::SEE_MAT[WK] / 2 - SEE::SEE_MAT[whitePt], SEE::SEE_MAT[WK] * 2);
-		ret.blackCtrl[sq] = (blackPt == EMPTY) ? 0.0f : NormalizeCount(SEE::SEE_MAT[WK] + SEE::SEE_MAT[WK] / 2 - SEE::SEE_MAT[blackPt], SEE::SEE_MAT[WK] * 2);
-	}
+		uint64_t remaining = ret.maps->GetAttacks(c);
+
+		for (Square sq = 0; sq < 64; ++sq)
+		{
+			ctrl[sq] = 0.0f;
+		}
+
+		for (PieceType pt : ATTACKER_ORDER)
+		{
+			uint64_t lvaSquares = ret.maps->attacks[pt | c] & remaining;
+			remaining &= ~lvaSquares;
+
+			float val = NormalizeCount(SEE::SEE_MAT[WK] + SEE::SEE_MAT[WK] / 2 - SEE::SEE_MAT[pt], SEE::SEE_MAT[WK] * 2);
+
+			while (lvaSquares)
+			{
+				ctrl[Extract(lvaSquares)] = val;
+			}
+		}
+	};
+
+	fillCtrlFcn(WHITE, ret.whiteCtrl);
+	fillCtrlFcn(BLACK, ret.blackCtrl);
 
 	return ret;
 }
@@ -536,57 +455,12 @@ namespace FeaturesConv
 {
 
 template <typename T>
-void ConvertBoardToNN(Board &board, std::vector<T> &ret)
+void ConvertBoardToNN(const Board &board, T *out)
 {
-	ret.clear(); // this shouldn't actually deallocate memory
-
-	// we start by computing values that will be used later
-	size_t WQCount = board.GetPieceCount(WQ);
-	size_t WRCount = board.GetPieceCount(WR);
-	size_t WBCount = board.GetPieceCount(WB);
-	size_t WNCount = board.GetPieceCount(WN);
-	size_t WPCount = board.GetPieceCount(WP);
-
-	size_t BQCount = board.GetPieceCount(BQ);
-	size_t BRCount = board.GetPieceCount(BR);
-	size_t BBCount = board.GetPieceCount(BB);
-	size_t BNCount = board.GetPieceCount(BN);
-	size_t BPCount = board.GetPieceCount(BP);
-
-	float WMatNP =
-		SEE::SEE_MAT[WQ] * WQCount +
-		SEE::SEE_MAT[WR] * WRCount +
-		SEE::SEE_MAT[WB] * WBCount +
-		SEE::SEE_MAT[WN] * WNCount;
-
-	float BMatNP =
-		SEE::SEE_MAT[BQ] * BQCount +
-		SEE::SEE_MAT[BR] * BRCount +
-		SEE::SEE_MAT[BB] * BBCount +
-		SEE::SEE_MAT[BN] * BNCount;
-
-	float WMatP = SEE::SEE_MAT[WP] * WPCount;
-	float BMatP = SEE::SEE_MAT[BP] * BPCount;
-
-	int64_t MaxTotalMatNP = SEE::SEE_MAT[WQ] + 2 * SEE::SEE_MAT[WR] + 2 * SEE::SEE_MAT[WB] + 2 * SEE::SEE_MAT[WN];
-	int64_t MaxTotalMatP = 8 * SEE::SEE_MAT[WP];
-
-	WMatNP = NormalizeCount(static_cast<int64_t>(WMatNP), MaxTotalMatNP);
-	BMatNP = NormalizeCount(static_cast<int64_t>(BMatNP), MaxTotalMatNP);
-	WMatP = NormalizeCount(static_cast<int64_t>(WMatP), MaxTotalMatP);
-	BMatP = NormalizeCount(static_cast<int64_t>(BMatP), MaxTotalMatP);
-
-	float totalMat = NormalizeCount(static_cast<int64_t>(WMatNP + BMatNP + WMatP + BMatP), MaxTotalMatNP * 2 + MaxTotalMatP * 2);
-
-	// this function pushes important features that should go into all groups (currently empty)
-	auto PushFCFeatures = [totalMat](std::vector<T> &/*ret*/, int32_t /*group*/)
-	{
-		//PushGlobalFloat(ret, totalMat, group);
-	};
+	FeatureWriter<T> w = { out };
 
-	AttackMaps atkMaps = ComputeAttackMaps(board);
+	AttackFeatures atkMaps = ComputeAttackFeatures(board);
 
-	// now we can start actually forming the groups
 	int32_t group = 0;
 
 	// first group contains piece counts, side to move, and king positions
@@ -594,88 +468,131 @@ void ConvertBoardToNN(Board &board, std::vector<T> &ret)
 	// these can also be calculated from "pieces exist" flags, they are
 	// almost entirely redundant (except for set-up illegal positions, and promotions)
 	// in evaluator, they are passed directly to second layer, because they are very important (game phase information)
-	PushGlobalFloat(ret, NormalizeCount(WQCount, 1.0f), group);
-	PushGlobalFloat(ret, NormalizeCount(WRCount, 2.0f), group);
-	PushGlobalFloat(ret, NormalizeCount(WBCount, 2.0f), group);
-	PushGlobalFloat(ret, NormalizeCount(WNCount, 2.0f), group);
-	PushGlobalFloat(ret, NormalizeCount(WPCount, 8.0f), group);
-	PushGlobalFloat(ret, NormalizeCount(BQCount, 1.0f), group);
-	PushGlobalFloat(ret, NormalizeCount(BRCount, 2.0f), group);
-	PushGlobalFloat(ret, NormalizeCount(BBCount, 2.0f), group);
-	PushGlobalFloat(ret, NormalizeCount(BNCount, 2.0f), group);
-	PushGlobalFloat(ret, NormalizeCount(BPCount, 8.0f), group);
+	w.BeginSection(out + Layout::GlobalOffset);
+	w.PushGlobalFloat(NormalizeCount(board.GetPieceCount(WQ), 1.0f), group);
+	w.PushGlobalFloat(NormalizeCount(board.GetPieceCount(WR), 2.0f), group);
+	w.PushGlobalFloat(NormalizeCount(board.GetPieceCount(WB), 2.0f), group);
+	w.PushGlobalFloat(NormalizeCount(board.GetPieceCount(WN), 2.0f), group);
+	w.PushGlobalFloat(NormalizeCount(board.GetPieceCount(WP), 8.0f), group);
+	w.PushGlobalFloat(NormalizeCount(board.GetPieceCount(BQ), 1.0f), group);
+	w.PushGlobalFloat(NormalizeCount(board.GetPieceCount(BR), 2.0f), group);
+	w.PushGlobalFloat(NormalizeCount(board.GetPieceCount(BB), 2.0f), group);
+	w.PushGlobalFloat(NormalizeCount(board.GetPieceCount(BN), 2.0f), group);
+	w.PushGlobalFloat(NormalizeCount(board.GetPieceCount(BP), 8.0f), group);
 
 	// which side to move
-	PushGlobalBool(ret, board.GetSideToMove() == WHITE, group);
+	w.PushGlobalBool(board.GetSideToMove() == WHITE, group);
 
 	// king positions
 	uint32_t wkPos = board.GetFirstPiecePos(WK);
 	uint32_t bkPos = board.GetFirstPiecePos(BK);
 
-	PushGlobalCoords(ret, true, wkPos, group, true);
-	PushGlobalBool(ret, board.HasCastlingRight(W_SHORT_CASTLE), group);
-	PushGlobalBool(ret, board.HasCastlingRight(W_LONG_CASTLE), group);
+	PushGlobalCoords(w, true, wkPos, group, true);
+	w.PushGlobalBool(board.HasCastlingRight(W_SHORT_CASTLE), group);
+	w.PushGlobalBool(board.HasCastlingRight(W_LONG_CASTLE), group);
 
-	PushGlobalCoords(ret, true, bkPos, group, true);
-	PushGlobalBool(ret, board.HasCastlingRight(B_SHORT_CASTLE), group);
-	PushGlobalBool(ret, board.HasCastlingRight(B_LONG_CASTLE), group);
+	PushGlobalCoords(w, true, bkPos, group, true);
+	w.PushGlobalBool(board.HasCastlingRight(B_SHORT_CASTLE), group);
+	w.PushGlobalBool(board.HasCastlingRight(B_LONG_CASTLE), group);
 
 	// pawns (all pawns are in the same group)
 	++group;
-	PushPawns<WHITE>(ret, board.GetPieceTypeBitboard(WP), atkMaps, group);
-	PushPawns<BLACK>(ret, board.GetPieceTypeBitboard(BP), atkMaps, group);
-	PushFCFeatures(ret, group);
+	w.BeginSection(out + Layout::PawnsOffset);
+	PushPawns(w, board.GetPieceTypeBitboard(WP), atkMaps, group);
+	PushPawns(w, board.GetPieceTypeBitboard(BP), atkMaps, group);
 
 	// queens
 	++group;
-	PushQueens<T>(ret, board.GetPieceTypeBitboard(WQ), WQ, board, group, PushFCFeatures, atkMaps);
+	w.BeginSection(out + Layout::QueensOffset);
+	PushQueens(w, board.GetPieceTypeBitboard(WQ), WQ, board, group, atkMaps);
 	++group;
-	PushQueens<T>(ret, board.GetPieceTypeBitboard(BQ), BQ, board, group, PushFCFeatures, atkMaps);
+	PushQueens(w, board.GetPieceTypeBitboard(BQ), BQ, board, group, atkMaps);
 
 	// rooks
 	++group;
-	PushPairPieces<T>(ret, board.GetPieceTypeBitboard(WR), WR, board, group, PushFCFeatures, atkMaps);
-	PushGlobalBool(ret, board.HasCastlingRight(W_SHORT_CASTLE), group);
-	PushGlobalBool(ret, board.HasCastlingRight(W_LONG_CASTLE), group);
+	w.BeginSection(out + Layout::RooksOffset);
+	PushPairPieces(w, board.GetPieceTypeBitboard(WR), WR, board, group, atkMaps);
+	w.PushGlobalBool(board.HasCastlingRight(W_SHORT_CASTLE), group);
+	w.PushGlobalBool(board.HasCastlingRight(W_LONG_CASTLE), group);
 	++group;
-	PushPairPieces<T>(ret, board.GetPieceTypeBitboard(BR), BR, board, group, PushFCFeatures, atkMaps);
-	PushGlobalBool(ret, board.HasCastlingRight(B_SHORT_CASTLE), group);
-	PushGlobalBool(ret, board.HasCastlingRight(B_LONG_CASTLE), group);
+	PushPairPieces(w, board.GetPieceTypeBitboard(BR), BR, board, group, atkMaps);
+	w.PushGlobalBool(board.HasCastlingRight(B_SHORT_CASTLE), group);
+	w.PushGlobalBool(board.HasCastlingRight(B_LONG_CASTLE), group);
 
 	// bishops
 	++group;
-	PushPairPieces<T>(ret, board.GetPieceTypeBitboard(WB), WB, board, group, PushFCFeatures, atkMaps);
+	w.BeginSection(out + Layout::BishopsOffset);
+	PushPairPieces(w, board.GetPieceTypeBitboard(WB), WB, board, group, atkMaps);
 	++group;
-	PushPairPieces<T>(ret, board.GetPieceTypeBitboard(BB), BB, board, group, PushFCFeatures, atkMaps);
+	PushPairPieces(w, board.GetPieceTypeBitboard(BB), BB, board, group, atkMaps);
 
 	// knights
 	++group;
-	PushPairPieces<T>(ret, board.GetPieceTypeBitboard(WN), WN, board, group, PushFCFeatures, atkMaps);
+	w.BeginSection(out + Layout::KnightsOffset);
+	PushPairPieces(w, board.GetPieceTypeBitboard(WN), WN, board, group, atkMaps);
 	++group;
-	PushPairPieces<T>(ret, board.GetPieceTypeBitboard(BN), BN, board, group, PushFCFeatures, atkMaps);
+	PushPairPieces(w, board.GetPieceTypeBitboard(BN), BN, board, group, atkMaps);
+
+	w.BeginSection(out + Layout::SquaresOffset);
+	PushSquareFeatures(w, atkMaps, group);
+
+	w.BeginSection(out + Layout::NumBoardFeatures);
+}
+
+template <typename T>
+void ConvertBoardToNN(const Board &board, std::vector<T> &ret)
+{
+	ret.resize(Layout::NumBoardFeatures);
 
-	PushSquareFeatures(ret, board, atkMaps, group);
+	ConvertBoardToNN(board, &ret[0]);
 }
 
-template void ConvertBoardToNN<float>(Board &board, std::vector<float> &ret);
-template void ConvertBoardToNN<FeatureDescription>(Board &board, std::vector<FeatureDescription> &ret);
+template void ConvertBoardToNN<float>(const Board &board, float *out);
+template void ConvertBoardToNN<FeatureDescription>(const Board &board, FeatureDescription *out);
+template void ConvertBoardToNN<float>(const Board &board, std::vector<float> &ret);
+template void ConvertBoardToNN<FeatureDescription>(const Board &board, std::vector<FeatureDescription> &ret);
+
+void ConvertBoardsToNN(Span<Board> positions, Span<size_t> indices, NNMatrixRM &ret)
+{
+#ifdef DEBUG
+	assert(static_cast<size_t>(ret.rows()) >= indices.GetSize());
+	assert(static_cast<size_t>(ret.cols()) == Layout::NumBoardFeatures);
+#endif
+
+	// rows are contiguous in row-major matrices, so we can write into them directly
+	for (size_t i = 0; i < indices.GetSize(); ++i)
+	{
+		ConvertBoardToNN(positions[indices[i]], &ret(i, 0));
+	}
+}
 
 void ConvertMovesToNN(Board &board, ConvertMovesInfo &convInfo, MoveList &ml, NNMatrixRM &ret)
 {
-	// first we generate the eval features to be shared between all moves
-	// these features have to go to the end for performance, because all our new features will be group 0
-	std::vector<float> sharedFeaturesBoard;
-	ConvertBoardToNN(board, sharedFeaturesBoard);
+	int64_t numMoves = static_cast<int64_t>(ml.GetSize());
 
-	// shared features not specific to the board
-	std::vector<float> sharedFeaturesOthers;
+	if (ret.rows() != numMoves || static_cast<size_t>(ret.cols()) != Layout::NumMoveRowFeatures)
+	{
+		ret.resize(numMoves, Layout::NumMoveRowFeatures);
+	}
 
-	// number of legal moves
-	sharedFeaturesOthers.push_back(NormalizeCount(ml.GetSize(), 40));
+	if (numMoves == 0)
+	{
+		return;
+	}
 
-	sharedFeaturesOthers.push_back(board.InCheck() ? 1.0f : 0.0f);
+	// board features are shared between all moves
+	// these features have to go to the end for performance, because all our new features will be group 0
+	// we write them into the first row, and copy them to the others
+	ConvertBoardToNN(board, &ret(0, Layout::NumMoveFeatures));
 
-	std::vector<float> moveFeatures;
+	for (int64_t moveNum = 1; moveNum < numMoves; ++moveNum)
+	{
+		ret.row(moveNum).tail(Layout::NumBoardFeatures) = ret.row(0).tail(Layout::NumBoardFeatures);
+	}
+
+	// shared features not specific to the board
+	float numLegalMoves = NormalizeCount(ml.GetSize(), 40);
+	float inCheck = board.InCheck() ? 1.0f : 0.0f;
 
 	// don't crash if the caller doesn't set SEE values
 	convInfo.see.resize(ml.GetSize(), 0);
@@ -683,79 +600,54 @@ void ConvertMovesToNN(Board &board, ConvertMovesInfo &convInfo, MoveList &ml, NN
 
 	Color stm = board.GetSideToMove();
 
-	for (size_t moveNum = 0; moveNum < ml.GetSize(); ++moveNum)
+	for (int64_t moveNum = 0; moveNum < numMoves; ++moveNum)
 	{
-		moveFeatures.clear();
+		float *moveFeatures = &ret(moveNum, 0);
 
 		Move mv = ml[moveNum];
 
 		Square from = GetFromSquare(mv);
 		Square to = GetToSquare(mv);
 
-		moveFeatures.push_back(NormalizeCoord(GetX(from)));
-		moveFeatures.push_back(NormalizeCoord(GetEqY(from, stm)));
-		moveFeatures.push_back(NormalizeCoord(GetX(to)));
-		moveFeatures.push_back(NormalizeCoord(GetEqY(to, stm)));
+		*moveFeatures++ = NormalizeCoord(GetX(from));
+		*moveFeatures++ = NormalizeCoord(GetEqY(from, stm));
+		*moveFeatures++ = NormalizeCoord(GetX(to));
+		*moveFeatures++ = NormalizeCoord(GetEqY(to, stm));
 
-		moveFeatures.push_back(board.IsViolent(mv) ? 1.0f : 0.0f);
+		*moveFeatures++ = board.IsViolent(mv) ? 1.0f : 0.0f;
 
-		moveFeatures.push_back(board.IsChecking(mv) ? 1.0f : 0.0f);
+		*moveFeatures++ = board.IsChecking(mv) ? 1.0f : 0.0f;
 
-		moveFeatures.push_back(convInfo.see[moveNum] > 0 ? 1.0f : 0.0f);
-		moveFeatures.push_back(convInfo.see[moveNum] < 0 ? 1.0f : 0.0f);
+		*moveFeatures++ = convInfo.see[moveNum] > 0 ? 1.0f : 0.0f;
+		*moveFeatures++ = convInfo.see[moveNum] < 0 ? 1.0f : 0.0f;
 
 		// positive value means we should move this, otherwise opponent can win it
-		moveFeatures.push_back(convInfo.nmSee[moveNum] > 0 ? 1.0f : 0.0f);
+		*moveFeatures++ = convInfo.nmSee[moveNum] > 0 ? 1.0f : 0.0f;
 
 		PieceType pt = GetPieceType(mv);
 
-		bool isPT[6] = { false };
-
 		assert(pt != EMPTY);
 
-		isPT[COMPRESS_PT_IDX[StripColor(pt)]] = true;
+		size_t ptIdx = COMPRESS_PT_IDX[StripColor(pt)];
 
 		for (size_t i = 0; i < 6; ++i)
 		{
-			moveFeatures.push_back(isPT[i] ? 1.0f : 0.0f);
+			*moveFeatures++ = (i == ptIdx) ? 1.0f : 0.0f;
 		}
 
-		moveFeatures.insert(moveFeatures.end(), sharedFeaturesOthers.begin(), sharedFeaturesOthers.end());
-		moveFeatures.insert(moveFeatures.end(), sharedFeaturesBoard.begin(), sharedFeaturesBoard.end());
+		*moveFeatures++ = numLegalMoves;
+		*moveFeatures++ = inCheck;
 
-		if (static_cast<size_t>(ret.cols()) != moveFeatures.size() || static_cast<size_t>(ret.rows()) != ml.GetSize())
-		{
-			ret.resize(ml.GetSize(), moveFeatures.size());
-		}
-
-		for (size_t i = 0; i < moveFeatures.size(); ++i)
-		{
-			ret(moveNum, i) = moveFeatures[i];
-		}
+#ifdef DEBUG
+		assert(moveFeatures == &ret(moveNum, Layout::NumMoveFeatures));
+#endif
 	}
 }
 
 void GetMovesFeatureDescriptions(std::vector<FeaturesConv::FeatureDescription> &fds)
 {
-	ConvertMovesInfo convInfo;
-	Board b;
-
-	MoveList ml;
-	b.GenerateAllLegalMoves<Board::ALL>(ml);
-
-	NNMatrixRM x;
-
-	ConvertMovesToNN(b, convInfo, ml, x);
-
-	// this is the subset of features from ConvertBoardToNN
-	std::vector<FeaturesConv::FeatureDescription> boardDescriptions;
-	ConvertBoardToNN(b, boardDescriptions);
-
-	int64_t numTotalFeatures = x.cols();
-	int64_t numExtraFeatures = numTotalFeatures - boardDescriptions.size();
-
 	// first we add the extra features (they are all group 0 global)
-	for (int64_t featureNum = 0; featureNum < numExtraFeatures; ++featureNum)
+	for (size_t featureNum = 0; featureNum < Layout::NumMoveFeatures; ++featureNum)
 	{
 		FeaturesConv::FeatureDescription fd;
 		fd.featureType = FeatureDescription::FeatureType_global;
@@ -765,6 +657,10 @@ void GetMovesFeatureDescriptions(std::vector<FeaturesConv::FeatureDescription> &
 	}
 
 	// now we add the features shared with ConvertBoardToNN
+	Board b;
+	std::vector<FeaturesConv::FeatureDescription> boardDescriptions;
+	ConvertBoardToNN(b, boardDescriptions);
+
 	fds.insert(fds.end(), boardDescriptions.begin(), boardDescriptions.end());
 }
 
@@ -91,11 +91,67 @@ struct FeatureDescription
     }
 };
 
+// Feature layout
+// The layout is fixed at compile time, so the writer can fill a preallocated buffer at static
+// offsets, instead of growing a vector one feature at a time.
+namespace Layout
+{
+	// change this whenever the meaning of any feature changes, even if the number of features doesn't
+	// (features cached on disk are recomputed if it doesn't match)
+	const static int32_t Version = 1;
+
+	// per-piece building blocks
+	const static size_t Coords = 2; // x, y
+	const static size_t OptionalCoords = 1 + Coords; // exists flag, x, y
+	const static size_t Threat = 2; // white and black control of the piece's square
+	const static size_t SliderDirections = 4; // how far the piece can go in each direction
+	const static size_t SafeMobility = 1;
+
+	const static size_t PawnSlot = OptionalCoords + Threat;
+	const static size_t QueenSlot = OptionalCoords + 2 * SliderDirections + SafeMobility + Threat;
+	const static size_t RookSlot = OptionalCoords + SliderDirections + SafeMobility + Threat;
+	const static size_t BishopSlot = OptionalCoords + SliderDirections + SafeMobility + Threat;
+	const static size_t KnightSlot = OptionalCoords + SafeMobility + Threat;
+
+	// material counts, side to move, and king positions with castling rights
+	const static size_t GlobalSize = 10 + 1 + 2 * (Coords + 2);
+	const static size_t PawnsSize = 2 * 8 * PawnSlot;
+	const static size_t QueensSize = 2 * QueenSlot;
+	const static size_t RooksSize = 2 * (2 * RookSlot + 2); // rooks also get castling rights
+	const static size_t BishopsSize = 2 * 2 * BishopSlot;
+	const static size_t KnightsSize = 2 * 2 * KnightSlot;
+	const static size_t SquaresSize = 2 * 64;
+
+	const static size_t GlobalOffset = 0;
+	const static size_t PawnsOffset = GlobalOffset + GlobalSize;
+	const static size_t QueensOffset = PawnsOffset + PawnsSize;
+	const static size_t RooksOffset = QueensOffset + QueensSize;
+	const static size_t BishopsOffset = RooksOffset + RooksSize;
+	const static size_t KnightsOffset = BishopsOffset + BishopsSize;
+	const static size_t SquaresOffset = KnightsOffset + KnightsSize;
+
+	const static size_t NumBoardFeatures = SquaresOffset + SquaresSize;
+
+	// move features are followed by a copy of the board features
+	const static size_t NumMoveFeatures = 4 + 1 + 1 + 2 + 1 + 6 + 2;
+	const static size_t NumMoveRowFeatures = NumMoveFeatures + NumBoardFeatures;
+}
+
 // convert to NN input format
 // T can either be float (to get actual values) or
 // FeatureDescription (to get feature descriptions)
+// out must have space for Layout::NumBoardFeatures elements
 template <typename T>
-void ConvertBoardToNN(Board &board, std::vector<T> &ret);
+void ConvertBoardToNN(const Board &board, T *out);
+
+// same as above, but resizes ret to Layout::NumBoardFeatures first (this only allocates the first time
+// if the same vector is reused)
+template <typename T>
+void ConvertBoardToNN(const Board &board, std::vector<T> &ret);
+
+// batch version - row i of ret is set to the features of positions[indices[i]]
+// ret must already have at least indices.GetSize() rows and Layout::NumBoardFeatures columns
+void ConvertBoardsToNN(Span<Board> positions, Span<size_t> indices, NNMatrixRM &ret);
 
 // additional info for conversion
 struct ConvertMovesInfo
@@ -29,6 +29,7 @@
 #include <sstream>
 #include <tuple>
 #include <type_traits>
+#include <memory>
 #include <omp.h>
 
 #include <cmath>
@@ -36,10 +37,6 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
-#ifndef _WIN32
-#include <sys/mman.h>
-#endif
-
 #include <fcntl.h>
 
 #include "ann.h"
@@ -52,14 +49,20 @@ namespace
 {
 const int64_t KMeanNumIterations = 1;
 
-const size_t MaxBatchSize = 256;
-
-const size_t MaxMemory = 32ULL*1024*1024*1024; // limit dataset size if we have many features
+// each batch is split between all threads
+// this is fixed (instead of scaling with the number of threads) because the learning rate and ADADELTA parameters are
+// tuned for it, and the same data and net should train the same way on any machine
+const size_t BatchSize = 256;
 
-const size_t MaxIterationsPerCheck = 500000 / MaxBatchSize;
+const size_t ExamplesPerCheck = 500000;
 
 const float ExclusionFactor = 0.99f; // when computing test performance, ignore 1% of outliers
 
+// for streaming training, this is the unit of shuffling and prefetching
+const int64_t StreamBlockSize = 65536;
+
+const int64_t StreamMaxVal = 5000;
+
 typedef std::vector<int32_t> Group;
 
 struct Rows
@@ -118,9 +121,11 @@ void Train(
 
 	bool done = false;
 
-	size_t NumBatches = xTrain.rows() / MaxBatchSize;
+	size_t batchSize = BatchSize;
 
-	if ((xTrain.rows() % MaxBatchSize) != 0)
+	size_t NumBatches = xTrain.rows() / batchSize;
+
+	if ((xTrain.rows() % batchSize) != 0)
 	{
 		++NumBatches;
 	}
@@ -128,7 +133,7 @@ void Train(
 	int64_t epoch = 0;
 
 	// we want to check at least once per epoch
-	size_t iterationsPerCheck = std::min(MaxIterationsPerCheck, NumBatches);
+	size_t iterationsPerCheck = std::min(ExamplesPerCheck / batchSize, NumBatches);
 
 	size_t examplesSeen = 0;
 
@@ -136,17 +141,17 @@ void Train(
 	{
 		size_t batchNum = iter % NumBatches;
 
-		size_t begin = batchNum * MaxBatchSize;
+		size_t begin = batchNum * batchSize;
 
-		size_t batchSize = std::min(MaxBatchSize, xTrain.rows() - begin);
+		size_t thisBatchSize = std::min<size_t>(batchSize, xTrain.rows() - begin);
 
-		examplesSeen += batchSize;
+		examplesSeen += thisBatchSize;
 
 		epoch = examplesSeen / xTrain.rows();
 
 		trainingErrorAccum += nn.TrainGDM(
-			xTrain.block(begin, 0, batchSize, xTrain.cols()),
-			yTrain.block(begin, 0, batchSize, yTrain.cols()),
+			xTrain.block(begin, 0, thisBatchSize, xTrain.cols()),
+			yTrain.block(begin, 0, thisBatchSize, yTrain.cols()),
 			1.0f,
 			0.000001f);
 
@@ -308,12 +313,18 @@ void AnalyzeFeatureDescriptions(const std::vector<FeaturesConv::FeatureDescripti
 	assert(group0.size() > 5 && group0.size() < 40);
 }
 
-} // namespace
-
-namespace LearnAnn
+struct StreamBlock
 {
+	size_t shard;
+	int64_t begin;
+	int64_t num;
+};
 
-EvalNet BuildEvalNet(int64_t inputDims, int64_t outputDims, bool smallNet)
+typedef std::vector<std::unique_ptr<FeatureShard>> ShardList;
+
+// first layer has mixed nodes for the global and square feature groups (mixedNodeMultiplier nodes per feature in the
+// group), and pass-through nodes for group 0, second layer is fully connected
+EvalNet BuildGroupedEvalNet(int64_t inputDims, int64_t outputDims, float mixedNodeMultiplier, size_t secondLayerSize)
 {
 	std::vector<size_t> layerSizes;
 	std::vector<std::vector<Eigen::Triplet<float> > > connMatrices;
@@ -332,62 +343,75 @@ EvalNet BuildEvalNet(int64_t inputDims, int64_t outputDims, bool smallNet)
 									squareGroup,
 									group0);
 
-	if (!smallNet)
-	{
-		LayerDescription layer0;
+	LayerDescription layer0;
 
-		Group layer0Group0;
-		Group layer0GlobalGroup;
-		Group layer0SquareGroup;
+	Group layer0Group0;
+	Group layer0GlobalGroup;
+	Group layer0SquareGroup;
 
-		// first we add the mixed global group
-		AddSingleNodesGroup(layer0, globalGroup, layer0GlobalGroup, 0.05f);
+	// first we add the mixed global group
+	AddSingleNodesGroup(layer0, globalGroup, layer0GlobalGroup, mixedNodeMultiplier);
 
-		// mixed square group
-		AddSingleNodesGroup(layer0, squareGroup, layer0SquareGroup, 0.05f);
+	// mixed square group
+	AddSingleNodesGroup(layer0, squareGroup, layer0SquareGroup, mixedNodeMultiplier);
 
-		// pass through group 0 (this contains game phase information)
-		AddSingleNodesGroup(layer0, group0, layer0Group0, 1.0f);
+	// pass through group 0 (this contains game phase information)
+	AddSingleNodesGroup(layer0, group0, layer0Group0, 1.0f);
 
-		layerSizes.push_back(layer0.layerSize);
-		connMatrices.push_back(layer0.connections);
+	layerSizes.push_back(layer0.layerSize);
+	connMatrices.push_back(layer0.connections);
 
-		// in the second layer, we just fully connect everything
-		layerSizes.push_back(BoardSignatureSize);
-		connMatrices.push_back(std::vector<Eigen::Triplet<float> >());
+	// in the second layer, we just fully connect everything
+	layerSizes.push_back(secondLayerSize);
+	connMatrices.push_back(std::vector<Eigen::Triplet<float> >());
 
-		// fully connected output layer
-		connMatrices.push_back(std::vector<Eigen::Triplet<float> >());
-	}
-	else
+	// fully connected output layer
+	connMatrices.push_back(std::vector<Eigen::Triplet<float> >());
+
+	return EvalNet(inputDims, outputDims, layerSizes, connMatrices);
+}
+
+// returns m with only the listed columns (in order)
+template <typename T>
+T SelectCols(const T &m, const std::vector<int64_t> &cols)
+{
+	T ret(m.rows(), cols.size());
+
+	for (size_t i = 0; i < cols.size(); ++i)
 	{
-		LayerDescription layer0;
+		ret.col(i) = m.col(cols[i]);
+	}
 
-		Group layer0Group0;
-		Group layer0GlobalGroup;
-		Group layer0SquareGroup;
+	return ret;
+}
 
-		// first we add the mixed global group
-		AddSingleNodesGroup(layer0, globalGroup, layer0GlobalGroup, 0.1f);
+// returns m with only the listed rows (in order)
+template <typename T>
+T SelectRows(const T &m, const std::vector<int64_t> &rows)
+{
+	T ret(rows.size(), m.cols());
 
-		// mixed square group
-		AddSingleNodesGroup(layer0, squareGroup, layer0SquareGroup, 0.1f);
+	for (size_t i = 0; i < rows.size(); ++i)
+	{
+		ret.row(i) = m.row(rows[i]);
+	}
 
-		// pass through group 0 (this contains game phase information)
-		AddSingleNodesGroup(layer0, group0, layer0Group0, 1.0f);
+	return ret;
+}
 
-		layerSizes.push_back(layer0.layerSize);
-		connMatrices.push_back(layer0.connections);
+} // namespace
 
-		// in the second layer, we just fully connect everything
-		layerSizes.push_back(BoardSignatureSize);
-		connMatrices.push_back(std::vector<Eigen::Triplet<float> >());
+namespace LearnAnn
+{
 
-		// fully connected output layer
-		connMatrices.push_back(std::vector<Eigen::Triplet<float> >());
-	}
+EvalNet BuildEvalNet(int64_t inputDims, int64_t outputDims, bool smallNet)
+{
+	return BuildGroupedEvalNet(inputDims, outputDims, smallNet ? 0.1f : 0.05f, BoardSignatureSize);
+}
 
-	return EvalNet(inputDims, outputDims, layerSizes, connMatrices);
+EvalNet BuildStudentEvalNet(int64_t inputDims, int64_t outputDims)
+{
+	return BuildGroupedEvalNet(inputDims, outputDims, 0.02f, 16);
 }
 
 MoveEvalNet BuildMoveEvalNet(int64_t inputDims, int64_t outputDims)
@@ -462,8 +486,364 @@ void TrainANN(
 	Train(nn, epochs, xTrain, yTrain, xVal, yVal, xTest, yTest);
 }
 
+void TrainANNStreaming(
+	const std::vector<std::string> &xFiles,
+	const std::vector<std::string> &yFiles,
+	EvalNet &nn,
+	int64_t epochs,
+	AllReduce *allReduce)
+{
+	if (xFiles.size() != yFiles.size() || xFiles.empty())
+	{
+		throw std::runtime_error("Each feature file must have a label file");
+	}
+
+	ShardList xShards;
+	ShardList yShards;
+
+	int64_t totalRows = 0;
+
+	for (size_t i = 0; i < xFiles.size(); ++i)
+	{
+		xShards.emplace_back(new FeatureShard);
+		yShards.emplace_back(new FeatureShard);
+
+		std::string err = xShards.back()->Open(xFiles[i]);
+
+		if (err == "")
+		{
+			err = yShards.back()->Open(yFiles[i]);
+		}
+
+		if (err != "")
+		{
+			throw std::runtime_error(err);
+		}
+
+		if (xShards.back()->Rows() != yShards.back()->Rows() || xShards.back()->Cols() != xShards[0]->Cols())
+		{
+			throw std::runtime_error(xFiles[i] + " doesn't match " + yFiles[i] + " or " + xFiles[0]);
+		}
+
+		if (yShards.back()->Cols() != nn.OutputCols())
+		{
+			throw std::runtime_error(yFiles[i] + " doesn't have one column per net output");
+		}
+
+		totalRows += xShards.back()->Rows();
+	}
+
+	// the validation set is the beginning of the first shard (and is not trained on)
+	int64_t valSize = std::min<int64_t>(StreamMaxVal, xShards[0]->Rows() / 5);
+
+	if (valSize == 0)
+	{
+		throw std::runtime_error(xFiles[0] + " is too small for a validation set");
+	}
+
+	NNMatrixRM xVal = xShards[0]->GetMatrix().topRows(valSize);
+	NNMatrixRM yVal = yShards[0]->GetMatrix().topRows(valSize);
+
+	std::vector<StreamBlock> blocks;
+
+	for (size_t shard = 0; shard < xShards.size(); ++shard)
+	{
+		int64_t begin = (shard == 0) ? valSize : 0;
+
+		for (; begin < xShards[shard]->Rows(); begin += StreamBlockSize)
+		{
+			blocks.push_back(StreamBlock{ shard, begin, std::min(StreamBlockSize, xShards[shard]->Rows() - begin) });
+		}
+	}
+
+	bool distributed = (allReduce != nullptr) && (allReduce->GetNumProcesses() > 1);
+
+	// only the first process prints progress (and all processes print the same values)
+	bool verbose = !distributed || allReduce->GetRank() == 0;
+
+	int64_t batchSize = BatchSize;
+
+	// number of batches we train on in each epoch - in distributed training, all processes have to train on the same
+	// number of batches, so processes with more data use a different random subset every epoch
+	int64_t batchesPerEpoch = 0;
+
+	for (const auto &block : blocks)
+	{
+		batchesPerEpoch += (block.num + batchSize - 1) / batchSize;
+	}
+
+	size_t iterationsPerCheck = ExamplesPerCheck / batchSize;
+
+	std::vector<FP> gradientsBuffer;
+
+	if (distributed)
+	{
+		batchesPerEpoch = allReduce->Min(batchesPerEpoch);
+		iterationsPerCheck = allReduce->Min(iterationsPerCheck);
+
+		// everyone starts with the first process's net
+		for (auto &w : nn.Weights())
+		{
+			allReduce->Broadcast(w.data(), w.size());
+		}
+
+		for (auto &wm : nn.WeightMasks())
+		{
+			allReduce->Broadcast(wm.data(), wm.size());
+		}
+
+		for (auto &b : nn.Biases())
+		{
+			allReduce->Broadcast(b.data(), b.size());
+		}
+
+		nn.NotifyWeightMasksChanged();
+
+		// gradients (sums over the rows of the batch) are summed over all processes in one message per batch, along
+		// with the number of rows, so every row has the same weight even if batches have different sizes (the last
+		// batch of each block is short)
+		// the result is scaled to the size of a full batch, so the steps are the same size as in single process
+		// training, and all processes make the same updates
+		nn.SetGradientsHook([allReduce, batchSize, &gradientsBuffer](EvalNet::Gradients &grad, int64_t rows)
+		{
+			gradientsBuffer.clear();
+			gradientsBuffer.push_back(static_cast<FP>(rows));
+
+			for (size_t layer = 0; layer < grad.weightGradients.size(); ++layer)
+			{
+				gradientsBuffer.insert(gradientsBuffer.end(), grad.weightGradients[layer].data(), grad.weightGradients[layer].data() + grad.weightGradients[layer].size());
+				gradientsBuffer.insert(gradientsBuffer.end(), grad.biasGradients[layer].data(), grad.biasGradients[layer].data() + grad.biasGradients[layer].size());
+			}
+
+			allReduce->Sum(gradientsBuffer.data(), gradientsBuffer.size());
+
+			FP scale = batchSize / gradientsBuffer[0];
+
+			const FP *p = gradientsBuffer.data() + 1;
+
+			for (size_t layer = 0; layer < grad.weightGradients.size(); ++layer)
+			{
+				grad.weightGradients[layer] = Eigen::Map<const NNMatrix>(p, grad.weightGradients[layer].rows(), grad.weightGradients[layer].cols()) * scale;
+				p += grad.weightGradients[layer].size();
+
+				grad.biasGradients[layer] = Eigen::Map<const NNVector>(p, 1, grad.biasGradients[layer].cols()) * scale;
+				p += grad.biasGradients[layer].size();
+			}
+		});
+	}
+
+	// in distributed training, this is the error over the union of all processes' validation sets (which can have
+	// different sizes), so they all keep the same best net
+	auto getValScore = [&]() -> FP
+	{
+		NNMatrix pred = nn.ForwardPropagateFast(xVal);
+
+		FP errorsAndRows[2] = { nn.ErrorFunc(pred, yVal).sum(), static_cast<FP>(xVal.rows()) };
+
+		if (distributed)
+		{
+			allReduce->Sum(errorsAndRows, 2);
+		}
+
+		return errorsAndRows[0] / errorsAndRows[1];
+	};
+
+	if (verbose)
+	{
+		if (distributed)
+		{
+			std::cout << "Processes: " << allReduce->GetNumProcesses() << " (" << batchesPerEpoch << " batches per epoch each)" << std::endl;
+		}
+
+		std::cout << "Train: " << (totalRows - valSize) << " (" << blocks.size() << " blocks in " << xShards.size() << " shards)" << std::endl;
+		std::cout << "Val: " << valSize << std::endl;
+		std::cout << "Features: " << xShards[0]->Cols() << std::endl;
+
+		std::cout << "Beginning training..." << std::endl;
+	}
+
+	auto mt = gRd.MakeMT();
+
+	std::chrono::system_clock::time_point startTime = std::chrono::system_clock::now();
+
+	EvalNet bestNet = nn;
+	FP bestValScore = std::numeric_limits<FP>::max();
+
+	size_t iter = 0;
+	float trainingErrorAccum = 0.0f;
+	size_t iterationsSinceCheck = 0;
+
+	std::vector<int64_t> batchBegins;
+
+	for (int64_t epoch = 0; epoch < epochs; ++epoch)
+	{
+		std::shuffle(blocks.begin(), blocks.end(), mt);
+
+		int64_t batchesThisEpoch = 0;
+
+		for (size_t blockNum = 0; blockNum < blocks.size() && batchesThisEpoch < batchesPerEpoch; ++blockNum)
+		{
+			const StreamBlock &block = blocks[blockNum];
+
+			// the OS reads the next block in the background while we train on this one
+			if ((blockNum + 1) < blocks.size())
+			{
+				const StreamBlock &nextBlock = blocks[blockNum + 1];
+
+				xShards[nextBlock.shard]->Prefetch(nextBlock.begin, nextBlock.num);
+				yShards[nextBlock.shard]->Prefetch(nextBlock.begin, nextBlock.num);
+			}
+
+			FeatureShard::MatrixType x = xShards[block.shard]->GetMatrix();
+			FeatureShard::MatrixType y = yShards[block.shard]->GetMatrix();
+
+			// batches are trained on directly from the mapped files (copying the rows out to shuffle them costs about
+			// as much as a training step), so we only shuffle the order of batches within the block
+			batchBegins.clear();
+
+			for (int64_t begin = block.begin; begin < (block.begin + block.num); begin += batchSize)
+			{
+				batchBegins.push_back(begin);
+			}
+
+			std::shuffle(batchBegins.begin(), batchBegins.end(), mt);
+
+			for (size_t batchNum = 0; batchNum < batchBegins.size() && batchesThisEpoch < batchesPerEpoch; ++batchNum)
+			{
+				int64_t begin = batchBegins[batchNum];
+				int64_t thisBatchSize = std::min<int64_t>(batchSize, block.begin + block.num - begin);
+
+				trainingErrorAccum += nn.TrainGDM(
+					x.block(begin, 0, thisBatchSize, x.cols()),
+					y.block(begin, 0, thisBatchSize, y.cols()),
+					1.0f,
+					0.000001f);
+
+				++iterationsSinceCheck;
+				++batchesThisEpoch;
+
+				if ((iter % iterationsPerCheck) == 0)
+				{
+					FP valScore = getValScore();
+
+					if (valScore < bestValScore)
+					{
+						bestValScore = valScore;
+						bestNet = nn;
+					}
+
+					std::chrono::seconds t = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now() - startTime);
+
+					if (verbose)
+					{
+						std::cout << "Iteration: " << iter << ", ";
+						std::cout << "Epoch: " << epoch << ", ";
+						std::cout << "Block: " << blockNum << "/" << blocks.size() << ", ";
+						std::cout << "Val: " << valScore << ", ";
+						std::cout << "Train: " << (trainingErrorAccum / iterationsSinceCheck) << ", ";
+						std::cout << "Time: " << (static_cast<float>(t.count()) / 60.0f) << " minutes, ";
+						std::cout << "Best Val: " << bestValScore << std::endl;
+					}
+
+					trainingErrorAccum = 0.0f;
+					iterationsSinceCheck = 0;
+				}
+
+				++iter;
+			}
+		}
+	}
+
+	// final check, since the last check may have been long ago
+	if (getValScore() < bestValScore)
+	{
+		bestNet = nn;
+	}
+
+	nn = bestNet;
+
+	nn.SetGradientsHook(EvalNet::GradientsHook());
+}
+
+void PruneNeurons(EvalNet &nn, const NNMatrixRM &x, float fraction)
+{
+	std::vector<EvalNet::WeightType> weights = nn.Weights();
+	std::vector<EvalNet::BiasType> biases = nn.Biases();
+	std::vector<EvalNet::WeightMaskType> weightMasks = nn.WeightMasks();
+
+	EvalNet::Activations act;
+	nn.InitializeActivations(act);
+	nn.ForwardPropagate(x, act);
+
+	// act.act[layer + 1] is the output of the hidden layer [layer], computed with the original net
+	for (size_t layer = 0; layer < (weights.size() - 1); ++layer)
+	{
+		// neurons in this layer are the columns of weights[layer], and the rows of weights[layer + 1]
+		int64_t numNeurons = weights[layer].cols();
+		int64_t numToRemove = std::min<int64_t>(numNeurons * fraction, numNeurons - 1);
+
+		NNVector meanAct = act.act[layer + 1].colwise().mean();
+		NNVector meanAbsAct = act.act[layer + 1].cwiseAbs().colwise().mean();
+
+		// importance is the average magnitude of the neuron's contribution to the next layer
+		std::vector<std::pair<float, int64_t>> importance;
+
+		for (int64_t neuron = 0; neuron < numNeurons; ++neuron)
+		{
+			importance.push_back(std::make_pair(meanAbsAct(neuron) * weights[layer + 1].row(neuron).norm(), neuron));
+		}
+
+		std::sort(importance.begin(), importance.end());
+
+		std::vector<int64_t> toKeep;
+
+		for (int64_t i = 0; i < numNeurons; ++i)
+		{
+			int64_t neuron = importance[i].second;
+
+			if (i < numToRemove)
+			{
+				// the next layer gets the average output of the removed neuron through its bias
+				biases[layer + 1] += meanAct(neuron) * weights[layer + 1].row(neuron);
+			}
+			else
+			{
+				toKeep.push_back(neuron);
+			}
+		}
+
+		std::sort(toKeep.begin(), toKeep.end());
+
+		weights[layer] = SelectCols(weights[layer], toKeep);
+		weightMasks[layer] = SelectCols(weightMasks[layer], toKeep);
+		biases[layer] = SelectCols(biases[layer], toKeep);
+
+		weights[layer + 1] = SelectRows(weights[layer + 1], toKeep);
+		weightMasks[layer + 1] = SelectRows(weightMasks[layer + 1], toKeep);
+	}
+
+	// the layer sizes changed, so we have to build a new net (the same way as DeserializeNet())
+	std::vector<size_t> hiddenLayerSizes;
+
+	for (size_t layer = 1; layer < weights.size(); ++layer)
+	{
+		hiddenLayerSizes.push_back(weights[layer].rows());
+	}
+
+	std::vector<std::vector<Eigen::Triplet<FP> > > connections(hiddenLayerSizes.size() + 1);
+
+	nn = EvalNet(weights[0].rows(), weights[weights.size() - 1].cols(), hiddenLayerSizes, connections);
+
+	nn.Weights() = weights;
+	nn.Biases() = biases;
+	nn.WeightMasks() = weightMasks;
+
+	nn.NotifyWeightMasksChanged();
+}
+
 // here we have to list all instantiations used (except for in this file)
 template void TrainANN<NNMatrixRM, NNVector>(const Eigen::MatrixBase<NNMatrixRM>&, const Eigen::MatrixBase<NNVector>&, EvalNet &, int64_t);
 template void TrainANN<NNMatrixRM, NNMatrixRM>(const Eigen::MatrixBase<NNMatrixRM>&, const Eigen::MatrixBase<NNMatrixRM>&, EvalNet &, int64_t);
+template void TrainANN<FeatureShard::MatrixType, NNMatrixRM>(const Eigen::MatrixBase<FeatureShard::MatrixType>&, const Eigen::MatrixBase<NNMatrixRM>&, EvalNet &, int64_t);
 
 }
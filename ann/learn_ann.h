@@ -18,15 +18,24 @@
 #ifndef LEARN_ANN_H
 #define LEARN_ANN_H
 
+#include <string>
+#include <vector>
+
 #include "Eigen/Core"
 
 #include "ann.h"
+#include "feature_shard.h"
+#include "all_reduce.h"
 
 namespace LearnAnn
 {
 
 EvalNet BuildEvalNet(int64_t inputDims, int64_t outputDims, bool smallNet);
 
+// same topology as BuildEvalNet(), with fewer mixed nodes and a much narrower second layer, for distillation
+// (with the current features, the smallNet variant is actually larger than the main net)
+EvalNet BuildStudentEvalNet(int64_t inputDims, int64_t outputDims);
+
 MoveEvalNet BuildMoveEvalNet(int64_t inputDims, int64_t outputDims);
 
 template <typename Derived1, typename Derived2>
@@ -36,6 +45,28 @@ void TrainANN(
 	EvalNet &nn,
 	int64_t epochs);
 
+// Same as TrainANN, but for datasets larger than memory.
+// Each file in xFiles (features) is paired with a file in yFiles (labels), both in FeatureShard format.
+// The shards are memory-mapped, and trained on in blocks, in a different random order every epoch (and with the batches
+// of each block in a random order). The OS is asked to read the next block while the current one is being trained on.
+// Only the validation set is copied into memory.
+// Throws std::runtime_error if the files can't be opened or don't match.
+// With allReduce, this is one of a group of processes training the same net on different files (data-parallel). All
+// processes start from the first process's net, and gradients are averaged every batch, so they always have the same
+// weights.
+void TrainANNStreaming(
+	const std::vector<std::string> &xFiles,
+	const std::vector<std::string> &yFiles,
+	EvalNet &nn,
+	int64_t epochs,
+	AllReduce *allReduce = nullptr);
+
+// Structured pruning - removes the given fraction of the neurons in each hidden layer, to make the net smaller and faster.
+// Neurons are ranked by the average magnitude of their contribution to the next layer on x (features of a calibration
+// set), and the average output of removed neurons is folded into the biases of the next layer.
+// Weight masks are cut down with the weights, and mask regions are re-derived.
+void PruneNeurons(EvalNet &nn, const NNMatrixRM &x, float fraction);
+
 }
 
 #endif // LEARN_ANN_H
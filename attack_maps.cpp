@@ -0,0 +1,166 @@
+/*
+	Copyright (C) 2015 Matthew Lai
+
+	Giraffe is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	Giraffe is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "attack_maps.h"
+
+#include "board_consts.h"
+
+namespace
+{
+
+const static uint64_t NOT_A_FILE = ~FILES[A_FILE];
+const static uint64_t NOT_H_FILE = ~FILES[H_FILE];
+const static uint64_t NOT_AB_FILES = ~(FILES[A_FILE] | FILES[B_FILE]);
+const static uint64_t NOT_GH_FILES = ~(FILES[G_FILE] | FILES[H_FILE]);
+
+// positive shifts go up the board (towards higher square indices)
+template <int32_t SHIFT>
+inline uint64_t Shift(uint64_t bb)
+{
+	return (SHIFT > 0) ? (bb << (SHIFT > 0 ? SHIFT : 0)) : (bb >> (SHIFT > 0 ? 0 : -SHIFT));
+}
+
+// squares that can be reached by a 1 step shift without wrapping around the board
+template <int32_t SHIFT>
+inline uint64_t NoWrapMask()
+{
+	// all shifts we use are 1 file away at most (x offset is -1, 0, or 1)
+	switch ((SHIFT + 64) % 8)
+	{
+	case 1: // east (+1, +9, -7)
+		return NOT_A_FILE;
+	case 7: // west (-1, +7, -9)
+		return NOT_H_FILE;
+	default: // north and south
+		return ALL;
+	}
+}
+
+// attacks in one direction of all sliders in gen (Kogge-Stone occluded fill)
+template <int32_t SHIFT>
+inline uint64_t SlidingAttacks(uint64_t gen, uint64_t empty)
+{
+	const uint64_t mask = NoWrapMask<SHIFT>();
+
+	empty &= mask;
+	gen |= empty & Shift<SHIFT>(gen);
+	empty &= Shift<SHIFT>(empty);
+	gen |= empty & Shift<2 * SHIFT>(gen);
+	empty &= Shift<2 * SHIFT>(empty);
+	gen |= empty & Shift<4 * SHIFT>(gen);
+
+	return Shift<SHIFT>(gen) & mask;
+}
+
+// add 1 to the counters of all squares in bb
+inline void AddToCount(uint64_t planes[AttackMaps::NumCountPlanes], uint64_t bb)
+{
+	for (size_t i = 0; bb && i < AttackMaps::NumCountPlanes; ++i)
+	{
+		uint64_t carry = planes[i] & bb;
+		planes[i] ^= bb;
+		bb = carry;
+	}
+}
+
+template <Color C>
+void ComputeSide(AttackMaps &maps, const uint64_t *pieces, uint64_t empty)
+{
+	uint64_t *planes = maps.countPlanes[AttackMaps::SideIdx(C)];
+
+	for (size_t i = 0; i < AttackMaps::NumCountPlanes; ++i)
+	{
+		planes[i] = 0ULL;
+	}
+
+	// every bitboard we add here comes from a single direction, so a square can only be in it once
+	auto addAttacks = [&maps, planes](PieceType pt, uint64_t bb)
+	{
+		maps.attacks[pt | C] |= bb;
+		AddToCount(planes, bb);
+	};
+
+	for (PieceType pt = WK; pt <= WP; ++pt)
+	{
+		maps.attacks[pt | C] = 0ULL;
+	}
+
+	uint64_t pawns = pieces[WP | C];
+
+	if (C == WHITE)
+	{
+		addAttacks(WP, Shift<9>(pawns) & NOT_A_FILE);
+		addAttacks(WP, Shift<7>(pawns) & NOT_H_FILE);
+	}
+	else
+	{
+		addAttacks(WP, Shift<-7>(pawns) & NOT_A_FILE);
+		addAttacks(WP, Shift<-9>(pawns) & NOT_H_FILE);
+	}
+
+	uint64_t knights = pieces[WN | C];
+
+	addAttacks(WN, Shift<17>(knights) & NOT_A_FILE);
+	addAttacks(WN, Shift<15>(knights) & NOT_H_FILE);
+	addAttacks(WN, Shift<10>(knights) & NOT_AB_FILES);
+	addAttacks(WN, Shift<6>(knights) & NOT_GH_FILES);
+	addAttacks(WN, Shift<-6>(knights) & NOT_AB_FILES);
+	addAttacks(WN, Shift<-10>(knights) & NOT_GH_FILES);
+	addAttacks(WN, Shift<-15>(knights) & NOT_A_FILE);
+	addAttacks(WN, Shift<-17>(knights) & NOT_H_FILE);
+
+	uint64_t bishops = pieces[WB | C];
+
+	addAttacks(WB, SlidingAttacks<9>(bishops, empty));
+	addAttacks(WB, SlidingAttacks<7>(bishops, empty));
+	addAttacks(WB, SlidingAttacks<-7>(bishops, empty));
+	addAttacks(WB, SlidingAttacks<-9>(bishops, empty));
+
+	uint64_t rooks = pieces[WR | C];
+
+	addAttacks(WR, SlidingAttacks<8>(rooks, empty));
+	addAttacks(WR, SlidingAttacks<-8>(rooks, empty));
+	addAttacks(WR, SlidingAttacks<1>(rooks, empty));
+	addAttacks(WR, SlidingAttacks<-1>(rooks, empty));
+
+	uint64_t queens = pieces[WQ | C];
+
+	addAttacks(WQ, SlidingAttacks<9>(queens, empty));
+	addAttacks(WQ, SlidingAttacks<7>(queens, empty));
+	addAttacks(WQ, SlidingAttacks<-7>(queens, empty));
+	addAttacks(WQ, SlidingAttacks<-9>(queens, empty));
+	addAttacks(WQ, SlidingAttacks<8>(queens, empty));
+	addAttacks(WQ, SlidingAttacks<-8>(queens, empty));
+	addAttacks(WQ, SlidingAttacks<1>(queens, empty));
+	addAttacks(WQ, SlidingAttacks<-1>(queens, empty));
+
+	// there is at most 1 king
+	uint64_t king = pieces[WK | C];
+
+	if (king)
+	{
+		addAttacks(WK, KING_ATK[BitScanForward(king)]);
+	}
+}
+
+}
+
+void AttackMaps::Compute(const uint64_t *pieces, uint64_t occupancy)
+{
+	ComputeSide<WHITE>(*this, pieces, ~occupancy);
+	ComputeSide<BLACK>(*this, pieces, ~occupancy);
+}
@@ -0,0 +1,95 @@
+/*
+	Copyright (C) 2015 Matthew Lai
+
+	Giraffe is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	Giraffe is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ATTACK_MAPS_H
+#define ATTACK_MAPS_H
+
+#include <cstdint>
+
+#include "types.h"
+#include "bit_ops.h"
+
+// Whole-board attack information for both sides.
+// Everything is computed with bitboard operations on all squares at once -
+// - attacks of all pieces of a type are generated with shifts (pawns, knights, kings) and
+//   occluded fills (sliders), one direction at a time
+// - since each direction can contribute at most one attacker to a square, the direction
+//   bitboards are summed into bit-sliced counters (countPlanes[side][i] holds bit i of the
+//   number of attackers on each square)
+// Board caches the maps of the current position, see Board::GetAttackMaps().
+struct AttackMaps
+{
+	// max attackers of a square is 8 sliders + 8 knights + 2 pawns + 1 king = 19
+	const static size_t NumCountPlanes = 5;
+
+	// indexed by piece type, union of the attacks of all pieces of that type
+	// (0x6 and 0x7 are not used)
+	uint64_t attacks[PIECE_TYPE_LAST + 1];
+
+	// indexed by SideIdx(color)
+	uint64_t countPlanes[2][NumCountPlanes];
+
+	// pieces is indexed by piece type (like the board description array)
+	void Compute(const uint64_t *pieces, uint64_t occupancy);
+
+	static size_t SideIdx(Color c) { return (c == WHITE) ? 0 : 1; }
+
+	uint64_t GetAttacks(Color c) const
+	{
+		return attacks[WK | c] | attacks[WQ | c] | attacks[WR | c] | attacks[WB | c] | attacks[WN | c] | attacks[WP | c];
+	}
+
+	// returns the least valuable piece type of color c (as a white piece type) attacking sq, or EMPTY
+	PieceType GetLeastValuableAttacker(Color c, Square sq) const
+	{
+		const static PieceType ATTACKER_ORDER[6] = { WP, WN, WB, WR, WQ, WK };
+
+		uint64_t bit = Bit(sq);
+
+		for (PieceType pt : ATTACKER_ORDER)
+		{
+			if (attacks[pt | c] & bit)
+			{
+				return pt;
+			}
+		}
+
+		return EMPTY;
+	}
+
+	uint32_t GetNumAttackers(Color c, Square sq) const
+	{
+		uint32_t ret = 0;
+
+		for (size_t i = 0; i < NumCountPlanes; ++i)
+		{
+			ret |= ((countPlanes[SideIdx(c)][i] >> sq) & 1ULL) << i;
+		}
+
+		return ret;
+	}
+
+	// squares attacked by at least 2 pieces of color c
+	uint64_t GetMultiplyAttacked(Color c) const
+	{
+		const uint64_t *planes = countPlanes[SideIdx(c)];
+
+		return planes[1] | planes[2] | planes[3] | planes[4];
+	}
+};
+
+#endif // ATTACK_MAPS_H
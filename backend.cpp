@@ -19,6 +19,7 @@
 
 #include <iostream>
 #include <string>
+#include <sstream>
 
 #include "board.h"
 #include "timeallocator.h"
@@ -111,8 +112,7 @@ void Backend::Usermove(std::string move)
 
 	if (m_mode == EngineMode_playingWhite || m_mode == EngineMode_playingBlack)
 	{
-		StartSearch_(Search::SearchType_makeMove);
-
+		// clocks have to be switched first, since a book move is made (and clocks switched back) immediately
 		if (m_mode == EngineMode_playingWhite)
 		{
 			m_blackClock.Stop();
@@ -123,6 +123,8 @@ void Backend::Usermove(std::string move)
 			m_whiteClock.Stop();
 			m_blackClock.Start();
 		}
+
+		StartSearch_(Search::SearchType_makeMove);
 	}
 	else if (m_mode == EngineMode_analyzing)
 	{
@@ -267,6 +269,34 @@ std::string Backend::DebugGTB()
 	}
 }
 
+std::string Backend::DebugBook()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (!m_book.IsOpen())
+	{
+		return "No book";
+	}
+
+	std::stringstream ss;
+
+	ss << "Key: " << std::hex << Book::PolyglotKey(m_currentBoard) << std::dec << std::endl;
+
+	for (const auto &entry : m_book.GetMoves(m_currentBoard))
+	{
+		ss << m_currentBoard.MoveToAlg(entry.first) << " " << entry.second << std::endl;
+	}
+
+	return ss.str();
+}
+
+std::string Backend::SetBook(const std::string &filename)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	return m_book.Open(filename);
+}
+
 void Backend::Quit()
 {
 	std::lock_guard<std::mutex> lock(m_mutex);
@@ -312,6 +342,17 @@ void Backend::StopSearch_(std::lock_guard<std::mutex> &/*lock*/)
 
 void Backend::StartSearch_(Search::SearchType searchType)
 {
+	if (searchType == Search::SearchType_makeMove && m_book.IsOpen())
+	{
+		Move bookMove = m_book.Probe(m_currentBoard);
+
+		if (bookMove)
+		{
+			MakeMove_(m_currentBoard.MoveToAlg(bookMove));
+			return;
+		}
+	}
+
 	m_searchInProgress = true;
 
 	m_searchContext.reset(new Search::RootSearchContext());
@@ -338,6 +379,7 @@ void Backend::StartSearch_(Search::SearchType searchType)
 	m_searchContext->killer = &m_killer;
 	m_searchContext->counter = &m_counter;
 	m_searchContext->history = &m_history;
+	m_searchContext->materialTable = &m_materialTable;
 
 	m_searchContext->evaluator = m_evaluator;
 	m_searchContext->moveEvaluator = m_moveEvaluator;
@@ -361,44 +403,49 @@ void Backend::StartSearch_(Search::SearchType searchType)
 	{
 		std::lock_guard<std::mutex> lock(m_mutex);
 
-		m_currentBoard.ApplyMove(m_currentBoard.ParseMove(mv));
+		MakeMove_(mv);
+	};
 
-		// if we want to claim a draw, we have to send it before sending the move
-		if (m_currentBoard.Is3Fold() || m_currentBoard.Is50Moves())
-		{
-			// here we use the offer draw command instead of claiming a result
-			// it's safer this way because if the GUI doesn't agree this is a draw
-			// we can simply play on
-			std::cout << "offer draw" << std::endl;
-		}
+	m_search.reset(new Search::AsyncSearch(*m_searchContext));
 
-		std::cout << "move " << mv << std::endl;
+	m_search->Start();
+}
 
-		if (!CheckDeclareGameResult_())
-		{
-			m_mode = EngineMode_force;
-			return;
-		}
+void Backend::MakeMove_(const std::string &mv)
+{
+	m_currentBoard.ApplyMove(m_currentBoard.ParseMove(mv));
 
-		m_tTable.AgeTable();
-		m_killer.MoveMade();
-		m_history.NotifyMoveMade();
+	// if we want to claim a draw, we have to send it before sending the move
+	if (m_currentBoard.Is3Fold() || m_currentBoard.Is50Moves())
+	{
+		// here we use the offer draw command instead of claiming a result
+		// it's safer this way because if the GUI doesn't agree this is a draw
+		// we can simply play on
+		std::cout << "offer draw" << std::endl;
+	}
 
-		if (m_mode == EngineMode_playingBlack)
-		{
-			m_blackClock.Stop();
-			m_whiteClock.Start();
-		}
-		else
-		{
-			m_whiteClock.Stop();
-			m_blackClock.Start();
-		}
-	};
+	std::cout << "move " << mv << std::endl;
 
-	m_search.reset(new Search::AsyncSearch(*m_searchContext));
+	if (!CheckDeclareGameResult_())
+	{
+		m_mode = EngineMode_force;
+		return;
+	}
 
-	m_search->Start();
+	m_tTable.AgeTable();
+	m_killer.MoveMade();
+	m_history.NotifyMoveMade();
+
+	if (m_mode == EngineMode_playingBlack)
+	{
+		m_blackClock.Stop();
+		m_whiteClock.Start();
+	}
+	else
+	{
+		m_whiteClock.Stop();
+		m_blackClock.Start();
+	}
 }
 
 bool Backend::CheckDeclareGameResult_()
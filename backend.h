@@ -30,6 +30,7 @@
 #include "move_evaluator.h"
 #include "static_move_evaluator.h"
 #include "countermove.h"
+#include "book.h"
 
 class Backend
 {
@@ -89,6 +90,12 @@ public:
 
 	std::string DebugGTB();
 
+	std::string DebugBook();
+
+	// returns an empty string on success, and an error message otherwise
+	// with a book, book moves are played immediately instead of searching
+	std::string SetBook(const std::string &filename);
+
 	void Quit();
 
 	bool IsAMove(const std::string &s);
@@ -104,6 +111,9 @@ private:
 
 	void StartSearch_(Search::SearchType searchType);
 
+	// called with m_mutex locked, when we have decided on a move (from search or the book)
+	void MakeMove_(const std::string &mv);
+
 	// returns whether the game is still ongoing
 	bool CheckDeclareGameResult_();
 
@@ -129,6 +139,9 @@ private:
 	Killer m_killer;
 	CounterMove m_counter;
 	History m_history;
+	MaterialTable m_materialTable;
+
+	Book m_book;
 
 	EvaluatorIface *m_evaluator;
 	MoveEvaluatorIface *m_moveEvaluator;
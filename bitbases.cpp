@@ -0,0 +1,416 @@
+/*
+	Copyright (C) 2015 Matthew Lai
+
+	Giraffe is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	Giraffe is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "bitbases.h"
+
+#include <vector>
+#include <algorithm>
+#include <initializer_list>
+
+#include <cstdlib>
+
+#include "bit_ops.h"
+#include "board_consts.h"
+#include "slider_attacks.h"
+#include "see.h"
+
+namespace
+{
+
+// all generated endings are king + 1 piece vs king
+// the strong side is always white in the tables, Probe() flips the board if necessary
+enum Ending
+{
+	Ending_KQK,
+	Ending_KRK,
+	Ending_KPK, // must be generated after KQK and KRK, since it looks up promotions in them
+
+	Ending_num
+};
+
+// indexed by [stm (0 = strong side)][strong king][weak king][piece]
+const static size_t TableSize = 2 * 64 * 64 * 64;
+
+// bit set = win for the strong side
+std::vector<uint64_t> gTables[Ending_num];
+
+enum GenState : uint8_t
+{
+	GenState_invalid,
+	GenState_unknown, // draw if still unknown when generation is done
+	GenState_win
+};
+
+inline size_t Index(size_t stm, Square wk, Square bk, Square p)
+{
+	return ((stm * 64 + wk) * 64 + bk) * 64 + p;
+}
+
+inline bool LookupWin(Ending e, size_t stm, Square wk, Square bk, Square p)
+{
+	size_t idx = Index(stm, wk, bk, p);
+
+	return (gTables[e][idx / 64] >> (idx % 64)) & 1;
+}
+
+inline uint64_t PieceAttacks(Ending e, Square p, uint64_t occupancy)
+{
+	switch (e)
+	{
+	case Ending_KQK:
+		return SliderAttacks::QueenAttacks(p, occupancy);
+	case Ending_KRK:
+		return SliderAttacks::RookAttacks(p, occupancy);
+	case Ending_KPK:
+		return PAWN_ATK[p][0];
+	default:
+		abort();
+	}
+}
+
+bool StrongSideWins(Ending e, Square wk, Square bk, Square p, const std::vector<GenState> &states)
+{
+	uint64_t kingMoves = KING_ATK[wk] & ~KING_ATK[bk] & ~Bit(p);
+
+	while (kingMoves)
+	{
+		if (states[Index(1, Extract(kingMoves), bk, p)] == GenState_win)
+		{
+			return true;
+		}
+	}
+
+	uint64_t kings = Bit(wk) | Bit(bk);
+
+	if (e == Ending_KPK)
+	{
+		Square to = p + 8;
+
+		if (kings & Bit(to))
+		{
+			return false;
+		}
+
+		if (to >= A8)
+		{
+			// underpromotion to a rook is sometimes necessary to avoid stalemate
+			return LookupWin(Ending_KQK, 1, wk, bk, to) || LookupWin(Ending_KRK, 1, wk, bk, to);
+		}
+
+		if (states[Index(1, wk, bk, to)] == GenState_win)
+		{
+			return true;
+		}
+
+		return p < A3 && !(kings & Bit(to + 8)) && states[Index(1, wk, bk, to + 8)] == GenState_win;
+	}
+
+	// the weak king can't be attacked since the position is legal
+	uint64_t pieceMoves = PieceAttacks(e, p, kings) & ~kings;
+
+	while (pieceMoves)
+	{
+		if (states[Index(1, wk, bk, Extract(pieceMoves))] == GenState_win)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool WeakSideLoses(Ending e, Square wk, Square bk, Square p, const std::vector<GenState> &states)
+{
+	// the weak king is removed from occupancy, so it can't step back along a slider's line
+	uint64_t attacked = KING_ATK[wk] | PieceAttacks(e, p, Bit(wk) | Bit(p));
+
+	uint64_t moves = KING_ATK[bk] & ~attacked;
+
+	if (!moves)
+	{
+		// mate or stalemate
+		return (attacked & Bit(bk)) != 0;
+	}
+
+	if (moves & Bit(p))
+	{
+		// the piece is hanging
+		return false;
+	}
+
+	while (moves)
+	{
+		if (states[Index(0, wk, Extract(moves), p)] != GenState_win)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void Generate(Ending e)
+{
+	std::vector<GenState> states(TableSize, GenState_unknown);
+
+	for (size_t stm = 0; stm < 2; ++stm)
+	{
+		for (Square wk = 0; wk < 64; ++wk)
+		{
+			for (Square bk = 0; bk < 64; ++bk)
+			{
+				for (Square p = 0; p < 64; ++p)
+				{
+					bool invalid = wk == bk || wk == p || bk == p || (KING_ATK[wk] & Bit(bk));
+
+					invalid = invalid || (e == Ending_KPK && (p < A2 || p >= A8));
+
+					// the weak king can't be in check with the strong side to move
+					invalid = invalid || (stm == 0 && (PieceAttacks(e, p, Bit(wk) | Bit(bk)) & Bit(bk)));
+
+					if (invalid)
+					{
+						states[Index(stm, wk, bk, p)] = GenState_invalid;
+					}
+				}
+			}
+		}
+	}
+
+	// positions can only go from unknown to win, so we are done when nothing changes
+	bool changed = true;
+
+	while (changed)
+	{
+		changed = false;
+
+		for (size_t idx = 0; idx < TableSize; ++idx)
+		{
+			if (states[idx] != GenState_unknown)
+			{
+				continue;
+			}
+
+			Square p = idx % 64;
+			Square bk = (idx / 64) % 64;
+			Square wk = (idx / (64 * 64)) % 64;
+			size_t stm = idx / (64 * 64 * 64);
+
+			bool win = (stm == 0) ? StrongSideWins(e, wk, bk, p, states) : WeakSideLoses(e, wk, bk, p, states);
+
+			if (win)
+			{
+				states[idx] = GenState_win;
+				changed = true;
+			}
+		}
+	}
+
+	gTables[e].assign(TableSize / 64, 0ULL);
+
+	for (size_t idx = 0; idx < TableSize; ++idx)
+	{
+		if (states[idx] == GenState_win)
+		{
+			gTables[e][idx / 64] |= Bit(idx % 64);
+		}
+	}
+}
+
+int32_t Distance(Square a, Square b)
+{
+	return std::max(std::abs(GetX(a) - GetX(b)), std::abs(GetY(a) - GetY(b)));
+}
+
+// 0 for the 4 center squares, 6 for corners
+int32_t CenterDistance(Square sq)
+{
+	return std::max(3 - GetX(sq), GetX(sq) - 4) + std::max(3 - GetY(sq), GetY(sq) - 4);
+}
+
+Score StrongSideScore(Color strong, const Board &b, Score score)
+{
+	return (b.GetSideToMove() == strong) ? score : -score;
+}
+
+Bitbases::Result StrongSideResult(Color strong, const Board &b)
+{
+	return (b.GetSideToMove() == strong) ? Bitbases::Result_win : Bitbases::Result_loss;
+}
+
+// help the search drive the weak king to the edge, and bring the strong king closer
+Score MatingBonus(Square strongKing, Square weakKing)
+{
+	return 20 * CenterDistance(weakKing) + 10 * (7 - Distance(strongKing, weakKing));
+}
+
+Square KingSquare(const Board &b, Color c)
+{
+	return BitScanForward(b.GetPieceTypeBitboard(WK | c));
+}
+
+Bitbases::Result ProbeTable(const Board &b, Ending e, PieceType pt, Color strong, Score &score)
+{
+	Color weak = strong ^ COLOR_MASK;
+
+	// flip vertically if the strong side is black
+	auto normalize = [strong](Square sq) { return (strong == WHITE) ? sq : FLIP[sq]; };
+
+	Square wk = normalize(KingSquare(b, strong));
+	Square bk = normalize(KingSquare(b, weak));
+	Square p = normalize(BitScanForward(b.GetPieceTypeBitboard(pt | strong)));
+
+	size_t stm = (b.GetSideToMove() == strong) ? 0 : 1;
+
+	if (!LookupWin(e, stm, wk, bk, p))
+	{
+		score = 0;
+		return Bitbases::Result_draw;
+	}
+
+	Score bonus;
+
+	if (e == Ending_KPK)
+	{
+		// pushing the pawn is progress, and promoting should look better than any KPK position
+		bonus = SEE::SEE_MAT[WP] + 10 * (GetY(p) - 1);
+	}
+	else
+	{
+		bonus = SEE::SEE_MAT[pt] + MatingBonus(wk, bk);
+	}
+
+	score = StrongSideScore(strong, b, Bitbases::KnownWinScore + bonus);
+
+	return StrongSideResult(strong, b);
+}
+
+Bitbases::Result ProbeKQK(const Board &b, Color strong, Score &score) { return ProbeTable(b, Ending_KQK, WQ, strong, score); }
+Bitbases::Result ProbeKRK(const Board &b, Color strong, Score &score) { return ProbeTable(b, Ending_KRK, WR, strong, score); }
+Bitbases::Result ProbeKPK(const Board &b, Color strong, Score &score) { return ProbeTable(b, Ending_KPK, WP, strong, score); }
+
+Bitbases::Result ProbeKBNK(const Board &b, Color strong, Score &score)
+{
+	Square strongKing = KingSquare(b, strong);
+	Square weakKing = KingSquare(b, strong ^ COLOR_MASK);
+
+	// mate is only possible in the corners of the bishop's colour
+	bool darkBishop = (b.GetPieceTypeBitboard(WB | strong) & BLACK_SQUARES) != 0;
+
+	int32_t cornerDistance = darkBishop ?
+		std::min(Distance(weakKing, A1), Distance(weakKing, H8)) :
+		std::min(Distance(weakKing, A8), Distance(weakKing, H1));
+
+	Score bonus = SEE::SEE_MAT[WB] + SEE::SEE_MAT[WN] + 20 * (7 - cornerDistance) + 10 * (7 - Distance(strongKing, weakKing));
+
+	score = StrongSideScore(strong, b, Bitbases::KnownWinScore + bonus);
+
+	return StrongSideResult(strong, b);
+}
+
+// number of pieces of each type, 4 bits each, kings excluded
+uint64_t MaterialSignature(const Board &b)
+{
+	uint64_t ret = 0;
+
+	for (PieceType pt = WQ; pt <= WP; ++pt)
+	{
+		ret |= static_cast<uint64_t>(b.GetPieceCount(pt)) << (4 * pt);
+		ret |= static_cast<uint64_t>(b.GetPieceCount(pt | BLACK)) << (4 * (pt | BLACK));
+	}
+
+	return ret;
+}
+
+uint64_t MaterialSignature(std::initializer_list<PieceType> pieces)
+{
+	uint64_t ret = 0;
+
+	for (PieceType pt : pieces)
+	{
+		ret += 1ULL << (4 * pt);
+	}
+
+	return ret;
+}
+
+struct DispatchEntry
+{
+	uint64_t signature;
+	Bitbases::Handler handler;
+};
+
+std::vector<DispatchEntry> gDispatchTable;
+
+// pieces are the strong side's (as white pieces), and we add entries for both colours
+void AddDispatchEntries(std::initializer_list<PieceType> pieces, Bitbases::ProbeFunc probe)
+{
+	uint64_t whiteSignature = MaterialSignature(pieces);
+
+	// black piece types are white piece types | BLACK
+	uint64_t blackSignature = whiteSignature << (4 * BLACK);
+
+	gDispatchTable.push_back(DispatchEntry{ whiteSignature, Bitbases::Handler{ probe, WHITE } });
+	gDispatchTable.push_back(DispatchEntry{ blackSignature, Bitbases::Handler{ probe, BLACK } });
+}
+
+}
+
+namespace Bitbases
+{
+
+void Init()
+{
+	for (int32_t e = 0; e < Ending_num; ++e)
+	{
+		Generate(static_cast<Ending>(e));
+	}
+
+	gDispatchTable.clear();
+
+	AddDispatchEntries({ WQ }, &ProbeKQK);
+	AddDispatchEntries({ WR }, &ProbeKRK);
+	AddDispatchEntries({ WP }, &ProbeKPK);
+	AddDispatchEntries({ WB, WN }, &ProbeKBNK);
+}
+
+Handler FindHandler(const Board &b)
+{
+	uint64_t occupancy = b.GetOccupiedBitboard<WHITE>() | b.GetOccupiedBitboard<BLACK>();
+
+	if (PopCount(occupancy) <= MaxPieces)
+	{
+		uint64_t signature = MaterialSignature(b);
+
+		for (const DispatchEntry &entry : gDispatchTable)
+		{
+			if (entry.signature == signature)
+			{
+				return entry.handler;
+			}
+		}
+	}
+
+	return Handler{ nullptr, WHITE };
+}
+
+Result Probe(const Board &b, Score &score)
+{
+	return FindHandler(b).Probe(b, score);
+}
+
+}
@@ -0,0 +1,73 @@
+/*
+	Copyright (C) 2015 Matthew Lai
+
+	Giraffe is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	Giraffe is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BITBASES_H
+#define BITBASES_H
+
+#include "types.h"
+#include "board.h"
+
+// In-memory win/draw bitbases for trivial endings, so we don't need an evaluator (or tablebase files) for them.
+// KPK, KRK, and KQK are generated by retrograde analysis on startup (1 bit per position, 64KB each).
+// KBNK is too big to generate on startup, but it's always a win unless a piece is lost immediately
+// (which search will see), so it only has a rule that drives the weak king to the right corner.
+// Positions are dispatched to the right bitbase by material signature.
+namespace Bitbases
+{
+
+static const size_t MaxPieces = 4;
+
+// wins are scored above any evaluation (but below tablebase and mate scores), with a bonus for
+// progress towards mate (or promotion), so search can find its way
+static const Score KnownWinScore = 15000;
+
+// from the side to move's perspective
+enum Result
+{
+	Result_unknown, // not covered by any bitbase
+	Result_draw, // exact
+	Result_win,
+	Result_loss
+};
+
+typedef Result (*ProbeFunc)(const Board &b, Color strong, Score &score);
+
+// the bitbase (or rule) for one material configuration
+struct Handler
+{
+	ProbeFunc probe; // nullptr if the material configuration is not covered
+	Color strong;
+
+	// score is set for all results except Result_unknown (it's always 0 for draws)
+	Result Probe(const Board &b, Score &score) const
+	{
+		return probe ? probe(b, strong, score) : Result_unknown;
+	}
+};
+
+// SliderAttacks::Init() and BoardConstsInit() must have been called first
+void Init();
+
+// this only depends on piece counts, so the result can be cached by material key (see MaterialTable)
+Handler FindHandler(const Board &b);
+
+// FindHandler() and probe
+Result Probe(const Board &b, Score &score);
+
+}
+
+#endif // BITBASES_H
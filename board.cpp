@@ -23,6 +23,7 @@
 #include <regex>
 #include <tuple>
 #include <iostream>
+#include <algorithm>
 
 #include <cassert>
 #include <cstdlib>
@@ -30,7 +31,7 @@
 
 #include "bit_ops.h"
 #include "containers.h"
-#include "magic_moves.h"
+#include "slider_attacks.h"
 #include "util.h"
 #include "zobrist.h"
 
@@ -89,21 +90,9 @@ PieceType CharToPieceType(char c)
 }
 
 Board::Board(const std::string &fen)
+	: m_attackMapsHash(0), m_attackMapsValid(false)
 {
-	for (uint32_t i = 0; i < BOARD_DESC_BB_SIZE; ++i)
-	{
-		m_boardDescBB[i] = 0;
-	}
-
-	for (uint32_t i = 0; i < BOARD_DESC_U8_SIZE; ++i)
-	{
-		m_boardDescU8[i] = 0;
-	}
-
-	for (Square sq = 0; sq < 64; ++sq)
-	{
-		RemovePiece(sq);
-	}
+	Clear_();
 
 	// the board desc is up to 64 squares + 7 rank separators + 1 NUL
 	char boardDesc[72];
@@ -206,6 +195,104 @@ Board::Board(const std::string &fen)
 #endif
 }
 
+Board::Board(const PackedPosition &pos)
+	: m_attackMapsHash(0), m_attackMapsValid(false)
+{
+#ifdef DEBUG
+	assert(PackedPositions::IsValid(pos));
+#endif
+
+	Clear_();
+
+	uint64_t occupied = pos.occupied;
+
+	// Pack() never writes more than 32 pieces, but records may come from elsewhere
+	for (size_t i = 0; occupied && i < 32; ++i)
+	{
+		Square sq = Extract(occupied);
+
+		PlacePiece(sq, (pos.pieces[i / 2] >> (4 * (i % 2))) & 0xf);
+	}
+
+	m_boardDescU8[SIDE_TO_MOVE] = (pos.flags & PackedPosition::Flag_blackToMove) ? BLACK : WHITE;
+
+	m_boardDescU8[W_SHORT_CASTLE] = (pos.flags & PackedPosition::Flag_whiteShortCastle) != 0;
+	m_boardDescU8[W_LONG_CASTLE] = (pos.flags & PackedPosition::Flag_whiteLongCastle) != 0;
+	m_boardDescU8[B_SHORT_CASTLE] = (pos.flags & PackedPosition::Flag_blackShortCastle) != 0;
+	m_boardDescU8[B_LONG_CASTLE] = (pos.flags & PackedPosition::Flag_blackLongCastle) != 0;
+
+	if (pos.epSquare != PackedPosition::NoEpSquare)
+	{
+		m_boardDescBB[EN_PASS_SQUARE] = Bit(pos.epSquare);
+	}
+
+	m_boardDescU8[HALF_MOVES_CLOCK] = pos.halfMoves;
+
+	UpdateInCheck_();
+	UpdateHashFull_();
+
+#ifdef DEBUG
+	CheckBoardConsistency();
+#endif
+}
+
+PackedPosition Board::Pack() const
+{
+	PackedPosition ret;
+
+	memset(&ret, 0, sizeof(ret));
+
+	ret.occupied = m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED];
+
+	// there can't be more than 32 pieces in a legal position, but boards set up from FENs can have more
+	// pieces that don't fit are dropped (from the occupancy bitboard as well, so unpacking doesn't read past the end)
+	uint64_t occupied = ret.occupied;
+
+	for (size_t i = 0; occupied && i < 32; ++i)
+	{
+		Square sq = Extract(occupied);
+
+		ret.pieces[i / 2] |= m_boardDescU8[sq] << (4 * (i % 2));
+	}
+
+	ret.occupied &= ~occupied;
+
+	ret.flags = (m_boardDescU8[SIDE_TO_MOVE] == BLACK) ? PackedPosition::Flag_blackToMove : 0;
+
+	ret.flags |= m_boardDescU8[W_SHORT_CASTLE] ? PackedPosition::Flag_whiteShortCastle : 0;
+	ret.flags |= m_boardDescU8[W_LONG_CASTLE] ? PackedPosition::Flag_whiteLongCastle : 0;
+	ret.flags |= m_boardDescU8[B_SHORT_CASTLE] ? PackedPosition::Flag_blackShortCastle : 0;
+	ret.flags |= m_boardDescU8[B_LONG_CASTLE] ? PackedPosition::Flag_blackLongCastle : 0;
+
+	ret.epSquare = IsEpAvailable() ? GetEpSquare() : PackedPosition::NoEpSquare;
+
+	ret.halfMoves = std::min<uint64_t>(m_boardDescU8[HALF_MOVES_CLOCK], 255);
+
+	ret.result = PackedPosition::Result_unknown;
+	ret.score = PackedPosition::NoScore;
+	ret.bestMove = 0;
+
+	return ret;
+}
+
+void Board::Clear_()
+{
+	for (uint32_t i = 0; i < BOARD_DESC_BB_SIZE; ++i)
+	{
+		m_boardDescBB[i] = 0;
+	}
+
+	for (uint32_t i = 0; i < BOARD_DESC_U8_SIZE; ++i)
+	{
+		m_boardDescU8[i] = 0;
+	}
+
+	for (Square sq = 0; sq < 64; ++sq)
+	{
+		RemovePiece(sq);
+	}
+}
+
 void Board::RemovePiece(Square sq)
 {
 	m_boardDescBB[m_boardDescU8[sq]] &= InvBit(sq);
@@ -240,18 +327,61 @@ void Board::PlacePiece(Square sq, PieceType pt)
 template <Board::MOVE_TYPES MT>
 void Board::GenerateAllLegalMoves(MoveList &moveList)
 {
-	MoveList pseudoLegalMoves;
-	GenerateAllPseudoLegalMoves_<MT>(pseudoLegalMoves);
-
+	// pins, checks, and squares the king can't go to are computed once here, and the generators
+	// use them to only generate legal moves (so we never have to make moves to check legality)
 	CheckInfo ci = ComputeCheckInfo();
 
-	for (size_t i = 0; i < pseudoLegalMoves.GetSize(); ++i)
+	Color sideToMove = m_boardDescU8[SIDE_TO_MOVE];
+
+	// in double check, only the king can move
+	if (PopCount(ci.checkers) < 2)
 	{
-		if (CheckLegal(ci, pseudoLegalMoves[i]))
+		if (sideToMove == WHITE)
+		{
+			GeneratePawnMoves_<MT, WHITE>(ci, moveList);
+			GenerateKnightMoves_<MT, WHITE>(ci, moveList);
+			GenerateBishopMoves_<MT, WHITE>(ci, moveList);
+			GenerateRookMoves_<MT, WHITE>(ci, moveList);
+			GenerateQueenMoves_<MT, WHITE>(ci, moveList);
+		}
+		else
 		{
-			moveList.PushBack(pseudoLegalMoves[i]);
+			GeneratePawnMoves_<MT, BLACK>(ci, moveList);
+			GenerateKnightMoves_<MT, BLACK>(ci, moveList);
+			GenerateBishopMoves_<MT, BLACK>(ci, moveList);
+			GenerateRookMoves_<MT, BLACK>(ci, moveList);
+			GenerateQueenMoves_<MT, BLACK>(ci, moveList);
 		}
 	}
+
+	if (sideToMove == WHITE)
+	{
+		GenerateKingMoves_<MT, WHITE>(ci, moveList);
+	}
+	else
+	{
+		GenerateKingMoves_<MT, BLACK>(ci, moveList);
+	}
+
+#ifdef DEBUG
+	for (size_t i = 0; i < moveList.GetSize(); ++i)
+	{
+		bool givesCheck = IsChecking(moveList[i]);
+
+		assert(ApplyMove(moveList[i]));
+		assert(givesCheck == InCheck());
+		UndoMove();
+	}
+
+	if (MT == ALL)
+	{
+		MoveList mlQuiet;
+		MoveList mlViolent;
+		GenerateAllLegalMoves<QUIET>(mlQuiet);
+		GenerateAllLegalMoves<VIOLENT>(mlViolent);
+		assert((mlQuiet.GetSize() + mlViolent.GetSize()) == moveList.GetSize());
+	}
+#endif
 }
 
 template void Board::GenerateAllLegalMoves<Board::ALL>(MoveList &);
@@ -323,6 +453,7 @@ void Board::CheckBoardConsistency()
 	}
 
 	uint64_t oldHash = GetHash();
+	uint64_t oldMaterialKey = GetMaterialKey();
 	UpdateHashFull_();
 
 	if (oldHash != GetHash())
@@ -330,6 +461,7 @@ void Board::CheckBoardConsistency()
 		std::cout << GetFen() << std::endl;
 	}
 	assert(oldHash == GetHash());
+	assert(oldMaterialKey == GetMaterialKey());
 }
 
 std::string Board::GetFen(bool omitMoveNums) const
@@ -475,6 +607,10 @@ bool Board::ApplyMove(Move mv)
 
 	ulU8.PushBack(std::make_pair(IN_CHECK, m_boardDescU8[IN_CHECK]));
 
+	bool isEp = !IsCastling(mv) && (pt == WP || pt == BP) && Bit(to) == currentEp;
+
+	UpdateMaterialKey_(mv, isEp, ulBB);
+
 	if (IsCastling(mv))
 	{
 		if (GetCastlingType(mv) == MoveConstants::CASTLE_WHITE_SHORT)
@@ -610,7 +746,7 @@ bool Board::ApplyMove(Move mv)
 			m_boardDescBB[BLACK_OCCUPIED] ^= Bit(E8) | Bit(C8) | Bit(A8) | Bit(D8);
 		}
 	}
-	else if ((pt == WP || pt == BP) && Bit(to) == currentEp) // en passant
+	else if (isEp)
 	{
 		if (pt == WP)
 		{
@@ -818,16 +954,18 @@ bool Board::ApplyMove(Move mv)
 		entries.insert(ulU8[i].first);
 	}
 
-	// verify that we have updated the hash correctly
+	// verify that we have updated the hash (and other keys) correctly
 	uint64_t oldHash = GetHash();
+	uint64_t oldMaterialKey = GetMaterialKey();
 	UpdateHashFull_();
 
-	if (oldHash != GetHash())
+	if (oldHash != GetHash() || oldMaterialKey != GetMaterialKey())
 	{
 		std::cout << GetFen() << std::endl;
 		std::cout << MoveToAlg(mv) << std::endl;
 	}
 	assert(oldHash == GetHash());
+	assert(oldMaterialKey == GetMaterialKey());
 #endif
 
 	UpdateInCheck_();
@@ -868,144 +1006,194 @@ bool Board::ApplyMove(Move mv)
 #undef REMOVE_PIECE
 }
 
-Board::CheckInfo Board::ComputeCheckInfo()
+Board::CheckInfo Board::ComputeCheckInfo() const
 {
 	CheckInfo ret;
 
-	Square kingPos = (GetSideToMove() == WHITE ? BitScanForward(m_boardDescBB[WK]) : BitScanForward(m_boardDescBB[BK]));
-	int32_t kingX = GetX(kingPos);
-	int32_t kingY = GetY(kingPos);
-	int32_t kingDiag0 = GetDiag0(kingPos);
-	int32_t kingDiag1 = GetDiag1(kingPos);
+	Color stm = m_boardDescU8[SIDE_TO_MOVE];
+	Color enemyColor = stm ^ COLOR_MASK;
+
+	uint64_t occupied = m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED];
+	uint64_t ourPieces = m_boardDescBB[WHITE_OCCUPIED | stm];
 
-	uint64_t opponentQueens = (GetSideToMove() == WHITE ? m_boardDescBB[BQ] : m_boardDescBB[WQ]);
-	uint64_t opponentRooks = (GetSideToMove() == WHITE ? m_boardDescBB[BR] : m_boardDescBB[WR]);
-	uint64_t opponentBishops = (GetSideToMove() == WHITE ? m_boardDescBB[BB] : m_boardDescBB[WB]);
+	uint64_t enemyRQ = m_boardDescBB[WR | enemyColor] | m_boardDescBB[WQ | enemyColor];
+	uint64_t enemyBQ = m_boardDescBB[WB | enemyColor] | m_boardDescBB[WQ | enemyColor];
 
-	while (opponentQueens)
+	Square kingPos = BitScanForward(m_boardDescBB[WK | stm]);
+	ret.kingPos = kingPos;
+
+	ret.checkers = (stm == WHITE) ? GetAllAttackers<BLACK>(kingPos, occupied) : GetAllAttackers<WHITE>(kingPos, occupied);
+
+	// pinned pieces are our pieces that are the only piece between an enemy slider and our king
+	uint64_t snipers = (SliderAttacks::RookAttacks(kingPos, 0ULL) & enemyRQ) | (SliderAttacks::BishopAttacks(kingPos, 0ULL) & enemyBQ);
+
+	while (snipers)
 	{
-		Square pos = Extract(opponentQueens);
+		Square sniperPos = Extract(snipers);
 
-		// all the cases are mutually exclusive
-		if (GetX(pos) == kingX)
-		{
-			ret.opponentRQOnSameX = true;
-		}
-		else if (GetY(pos) == kingY)
-		{
-			ret.opponentRQOnSameY = true;
-		}
-		else if (GetDiag0(pos) == kingDiag0)
-		{
-			ret.opponentBQOnSameDiag0 = true;
-		}
-		else if (GetDiag1(pos) == kingDiag1)
+		uint64_t blockers = BETWEEN[kingPos][sniperPos] & occupied;
+
+		if (blockers && !(blockers & (blockers - 1)) && (blockers & ourPieces))
 		{
-			ret.opponentBQOnSameDiag1 = true;
+			ret.pinned |= blockers;
 		}
 	}
 
-	while (opponentRooks)
+	if (ret.checkers == 0)
+	{
+		ret.checkMask = ::ALL;
+	}
+	else if (!(ret.checkers & (ret.checkers - 1)))
+	{
+		// single check - we can either capture the checker or block
+		ret.checkMask = ret.checkers | BETWEEN[kingPos][BitScanForward(ret.checkers)];
+	}
+	else
 	{
-		Square pos = Extract(opponentRooks);
+		// double check - only king moves
+		ret.checkMask = 0;
+	}
 
-		// all the cases are mutually exclusive
-		if (GetX(pos) == kingX)
-		{
-			ret.opponentRQOnSameX = true;
-		}
-		else if (GetY(pos) == kingY)
-		{
-			ret.opponentRQOnSameY = true;
-		}
+	// the king is removed so squares behind it (on the ray of a checking slider) are also marked as attacked
+	if (stm == WHITE)
+	{
+		ret.kingDanger = ComputeAttackedSquares_<BLACK>(occupied & InvBit(kingPos));
+	}
+	else
+	{
+		ret.kingDanger = ComputeAttackedSquares_<WHITE>(occupied & InvBit(kingPos));
 	}
 
-	while (opponentBishops)
+	return ret;
+}
+
+template <Color COLOR>
+bool Board::IsEpLegal_(const CheckInfo &ci, Square from, Square to) const
+{
+	const Color enemyColor = COLOR ^ COLOR_MASK;
+	Square capturedSq = (COLOR == WHITE) ? (to - 8) : (to + 8);
+
+	uint64_t occupied = ((m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED]) & InvBit(from) & InvBit(capturedSq)) | Bit(to);
+
+	// after the capture, no slider can be attacking our king (this covers discovered attacks along the rank,
+	// as well as existing slider checks that are not blocked by the capturing pawn)
+	if (SliderAttacks::RookAttacks(ci.kingPos, occupied) & (m_boardDescBB[WR | enemyColor] | m_boardDescBB[WQ | enemyColor]))
 	{
-		Square pos = Extract(opponentBishops);
+		return false;
+	}
 
-		// all the cases are mutually exclusive
-		if (GetDiag0(pos) == kingDiag0)
-		{
-			ret.opponentBQOnSameDiag0 = true;
-		}
-		else if (GetDiag1(pos) == kingDiag1)
-		{
-			ret.opponentBQOnSameDiag1 = true;
-		}
+	if (SliderAttacks::BishopAttacks(ci.kingPos, occupied) & (m_boardDescBB[WB | enemyColor] | m_boardDescBB[WQ | enemyColor]))
+	{
+		return false;
 	}
 
-	return ret;
+	// a knight or pawn giving check must be the captured pawn
+	return (ci.checkers & InvBit(capturedSq) & (m_boardDescBB[WN | enemyColor] | m_boardDescBB[WP | enemyColor])) == 0;
 }
 
-bool Board::CheckLegal(const CheckInfo &ci, Move mv)
+template <Color SIDE>
+uint64_t Board::ComputeAttackedSquares_(uint64_t occupancy) const
 {
-	// in this function we try to determine legality of moves quickly without doing a full check (by applying the move)
-	PieceType pt = GetPieceType(mv);
+	uint64_t ret = 0;
 
-	bool doFullCheck = false;
+	uint64_t kings = m_boardDescBB[WK | SIDE];
+	uint64_t knights = m_boardDescBB[WN | SIDE];
+	uint64_t diagonalSliders = m_boardDescBB[WB | SIDE] | m_boardDescBB[WQ | SIDE];
+	uint64_t straightSliders = m_boardDescBB[WR | SIDE] | m_boardDescBB[WQ | SIDE];
+	uint64_t pawns = m_boardDescBB[WP | SIDE];
 
-	if (InCheck())
+	while (kings)
 	{
-		// if we are in check, do a full check because there are many potential ways to get out of check, and we are lazy
-		doFullCheck = true;
+		ret |= KING_ATK[Extract(kings)];
+	}
+
+	while (knights)
+	{
+		ret |= KNIGHT_ATK[Extract(knights)];
+	}
+
+	while (diagonalSliders)
+	{
+		ret |= SliderAttacks::BishopAttacks(Extract(diagonalSliders), occupancy);
+	}
+
+	while (straightSliders)
+	{
+		ret |= SliderAttacks::RookAttacks(Extract(straightSliders), occupancy);
+	}
+
+	// pawn attacks can be done all at once
+	if (SIDE == WHITE)
+	{
+		ret |= ((pawns << 7) & ~FILES[H_FILE]) | ((pawns << 9) & ~FILES[A_FILE]);
 	}
 	else
 	{
-		switch (pt)
-		{
-		case WK:
-		case BK:
-			// if this is a king move, we do a full check because any king move can potentially put the king in check
-			// this includes castling
-			doFullCheck = true;
-			break;
-		case WP:
-		case BP:
-			if (Bit(GetToSquare(mv)) == m_boardDescBB[EN_PASS_SQUARE])
-			{
-				// if this is EP, we do a full check... because EPs are rare, and we are lazy
-				doFullCheck = true;
-				break;
-			}
-			// fall through if this is a pawn move that's not EP
-		default:
-			{
-				doFullCheck = false;
+		ret |= ((pawns >> 9) & ~FILES[H_FILE]) | ((pawns >> 7) & ~FILES[A_FILE]);
+	}
 
-				// now we know we are not moving the king, this is not EP, and the king is not already in check
-				// in this case, the only way this move can put the king in check is if we just moved away a pinned piece
-				// besides EP and castling (both have been dealt with), the only square that will be vacated after a move is the from square
+	return ret;
+}
 
-				Square vacatedSquare = GetFromSquare(mv);
-				Square kingPos = BitScanForward(GetSideToMove() == WHITE ? m_boardDescBB[WK] : m_boardDescBB[BK]);
+bool Board::IsChecking(Move mv) const
+{
+	PieceType pt = GetPieceType(mv);
+	Color color = pt & COLOR_MASK;
+	Color enemyColor = color ^ COLOR_MASK;
+	Square from = GetFromSquare(mv);
+	Square to = GetToSquare(mv);
+	PieceType finalPt = IsPromotion(mv) ? GetPromoType(mv) : pt;
 
-				if ((ci.opponentRQOnSameX && (GetX(vacatedSquare) == GetX(kingPos))) ||
-					(ci.opponentRQOnSameY && (GetY(vacatedSquare) == GetY(kingPos))) ||
-					(ci.opponentBQOnSameDiag0 && (GetDiag0(vacatedSquare) == GetDiag0(kingPos))) ||
-					(ci.opponentBQOnSameDiag1 && (GetDiag1(vacatedSquare) == GetDiag1(kingPos))))
-				{
-					doFullCheck = true;
-				}
-			}
-		}
+	Square enemyKingPos = BitScanForward(m_boardDescBB[WK | enemyColor]);
+
+	// occupancy after the move (the captured piece, if any, is replaced by our piece)
+	uint64_t occupied = ((m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED]) & InvBit(from)) | Bit(to);
+
+	// our pieces after the move
+	uint64_t pieces[6];
+	for (PieceType i = WK; i <= WP; ++i)
+	{
+		pieces[i] = m_boardDescBB[i | color];
 	}
 
-	if (doFullCheck)
+	pieces[StripColor(pt)] &= InvBit(from);
+	pieces[StripColor(finalPt)] |= Bit(to);
+
+	if (IsCastling(mv))
 	{
-		bool ret = ApplyMove(mv);
-		if (ret)
-		{
-			UndoMove();
-			return true;
-		}
-		else
+		Square rookFrom = 0;
+		Square rookTo = 0;
+
+		switch (GetCastlingType(mv))
 		{
-			return false;
+		case MoveConstants::CASTLE_WHITE_SHORT:
+			rookFrom = H1; rookTo = F1;
+			break;
+		case MoveConstants::CASTLE_WHITE_LONG:
+			rookFrom = A1; rookTo = D1;
+			break;
+		case MoveConstants::CASTLE_BLACK_SHORT:
+			rookFrom = H8; rookTo = F8;
+			break;
+		default: // MoveConstants::CASTLE_BLACK_LONG
+			rookFrom = A8; rookTo = D8;
+			break;
 		}
+
+		occupied = (occupied & InvBit(rookFrom)) | Bit(rookTo);
+		pieces[WR] = (pieces[WR] & InvBit(rookFrom)) | Bit(rookTo);
+	}
+	else if (StripColor(pt) == WP && Bit(to) == m_boardDescBB[EN_PASS_SQUARE])
+	{
+		// en passant - the captured pawn is not on the destination square
+		occupied &= InvBit((color == WHITE) ? (to - 8) : (to + 8));
 	}
 
-	return true;
+	// this covers both direct and discovered checks
+	return (SliderAttacks::RookAttacks(enemyKingPos, occupied) & (pieces[WQ] | pieces[WR])) ||
+		(SliderAttacks::BishopAttacks(enemyKingPos, occupied) & (pieces[WQ] | pieces[WB])) ||
+		(KNIGHT_ATK[enemyKingPos] & pieces[WN]) ||
+		(PAWN_ATK[enemyKingPos][enemyColor == WHITE ? 0 : 1] & pieces[WP]);
 }
 
 void Board::UndoMove()
@@ -1262,17 +1450,17 @@ bool Board::CheckPseudoLegal(Move mv)
 	else if (ptNoColor == WR)
 	{
 		// for rooks, we actually have to do move generation, because there may be an additional blocker
-		return Rmagic(from, totalOccupancy) & Bit(to);
+		return SliderAttacks::RookAttacks(from, totalOccupancy) & Bit(to);
 	}
 	else if (ptNoColor == WB)
 	{
 		// for bishops, we actually have to do move generation, because there may be an additional blocker
-		return Bmagic(from, totalOccupancy) & Bit(to);
+		return SliderAttacks::BishopAttacks(from, totalOccupancy) & Bit(to);
 	}
 	else if (ptNoColor == WQ)
 	{
 		// for queens, we actually have to do move generation, because there may be an additional blocker
-		return Qmagic(from, totalOccupancy) & Bit(to);
+		return SliderAttacks::QueenAttacks(from, totalOccupancy) & Bit(to);
 	}
 	else if (ptNoColor == WP)
 	{
@@ -1509,153 +1697,6 @@ Board::GameStatus Board::GetGameStatus()
 	}
 }
 
-PieceType Board::ApplyMoveSee(PieceType pt, Square from, Square to)
-{
-	PieceType capturedPiece = m_boardDescU8[to];
-
-	UndoListBB &ulBB = m_undoStackBB.PrePush();
-	UndoListU8 &ulU8 = m_undoStackU8.PrePush();
-
-	// no need to clear them because we know exactly how many elements will be on the list
-
-	// we need to update the to-square MB because next ApplyMoveSee call will use it to determine captured piece
-	ulU8[0].first = to;
-	ulU8[0].second = m_boardDescU8[to];
-	m_boardDescU8[to] = pt;
-
-	// we need to update the PT BB because otherwise GenerateSmallestCapture will see it again
-	ulBB[0].first = pt;
-	ulBB[0].second = m_boardDescBB[pt];
-	m_boardDescBB[pt] &= InvBit(from);
-
-	// we need to update occupancy for discovered attacks
-	// borrow a space on the undo list for our own occupancy BB
-	ulBB[1].second = m_boardDescBB[pt];
-	m_seeTotalOccupancy &= InvBit(from);
-
-	m_boardDescU8[SIDE_TO_MOVE] ^= COLOR_MASK;
-
-	return capturedPiece;
-}
-
-bool Board::IsSeeEligible(Move mv)
-{
-	Square to = GetToSquare(mv);
-
-	return m_boardDescU8[to] != EMPTY;
-}
-
-void Board::UndoMoveSee()
-{
-	UndoListBB &ulBB = m_undoStackBB.Top();
-	UndoListU8 &ulU8 = m_undoStackU8.Top();
-
-	m_boardDescU8[ulU8[0].first] = ulU8[0].second;
-	m_boardDescBB[ulBB[0].first] = ulBB[0].second;
-	m_seeTotalOccupancy = ulBB[1].second;
-
-	m_boardDescU8[SIDE_TO_MOVE] ^= COLOR_MASK;
-
-	m_undoStackBB.Pop();
-	m_undoStackU8.Pop();
-}
-
-bool Board::GenerateSmallestCaptureSee(PieceType &pt, Square &from, Square to)
-{
-	Color stm = m_boardDescU8[SIDE_TO_MOVE];
-	PieceType lastPT = stm == WHITE ? m_seeLastWhitePT : m_seeLastBlackPT;
-
-	uint64_t attackers = 0ULL;
-
-	switch (lastPT)
-	{
-	case WP:
-		attackers = PAWN_ATK[to][stm == WHITE ? 1 : 0] & m_boardDescBB[WP | stm];
-
-		if (attackers)
-		{
-			pt = WP | stm;
-			from = BitScanForward(attackers);
-			return true;
-		}
-		else
-		{
-			UpdateseeLastPT_(WN);
-		}
-		// fallthrough
-	case WN:
-		attackers = KNIGHT_ATK[to] & m_boardDescBB[WN | stm];
-
-		if (attackers)
-		{
-			pt = WN | stm;
-			from = BitScanForward(attackers);
-			return true;
-		}
-		else
-		{
-			UpdateseeLastPT_(WB);
-		}
-		// fall through
-	case WB:
-		attackers = Bmagic(to, m_seeTotalOccupancy) & m_boardDescBB[WB | stm];
-
-		if (attackers)
-		{
-			pt = WB | stm;
-			from = BitScanForward(attackers);
-			return true;
-		}
-		else
-		{
-			UpdateseeLastPT_(WR);
-		}
-		// fall through
-	case WR:
-		attackers = Rmagic(to, m_seeTotalOccupancy) & m_boardDescBB[WR | stm];
-
-		if (attackers)
-		{
-			pt = WR | stm;
-			from = BitScanForward(attackers);
-			return true;
-		}
-		else
-		{
-			UpdateseeLastPT_(WQ);
-		}
-		// fall through
-	case WQ:
-		attackers = Qmagic(to, m_seeTotalOccupancy) & m_boardDescBB[WQ | stm];
-
-		if (attackers)
-		{
-			pt = WQ | stm;
-			from = BitScanForward(attackers);
-			return true;
-		}
-		else
-		{
-			UpdateseeLastPT_(WK);
-		}
-		// fall through
-	case WK:
-		attackers = KING_ATK[to] & m_boardDescBB[WK | stm];
-
-		if (attackers)
-		{
-			pt = WK | stm;
-			from = BitScanForward(attackers);
-			return true;
-		}
-		break;
-	default:
-		assert(false);
-	}
-
-	return false;
-}
-
 PieceType Board::GetCapturedPieceType(Move violentMove)
 {
 	Square to = GetToSquare(violentMove);
@@ -1716,15 +1757,15 @@ uint64_t Board::GetAttackers(Square sq) const
 	}
 	else if (PT == WB || PT == BB)
 	{
-		atkMask = Bmagic(sq, m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED] | (1ULL << sq));
+		atkMask = SliderAttacks::BishopAttacks(sq, m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED] | (1ULL << sq));
 	}
 	else if (PT == WR || PT == BR)
 	{
-		atkMask = Rmagic(sq, m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED] | (1ULL << sq));
+		atkMask = SliderAttacks::RookAttacks(sq, m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED] | (1ULL << sq));
 	}
 	else if (PT == WQ || PT == BQ)
 	{
-		atkMask = Qmagic(sq, m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED] | (1ULL << sq));
+		atkMask = SliderAttacks::QueenAttacks(sq, m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED] | (1ULL << sq));
 	}
 	else if (PT == WP)
 	{
@@ -1757,6 +1798,20 @@ template uint64_t Board::GetAttackers<BB>(Square sq) const;
 template uint64_t Board::GetAttackers<BN>(Square sq) const;
 template uint64_t Board::GetAttackers<BP>(Square sq) const;
 
+template <Color COLOR>
+uint64_t Board::GetAllAttackers(Square sq, uint64_t occupied) const
+{
+	// for pawns we pretend we are a pawn of the other color on sq, and see which of our pawns we would be attacking
+	return (KING_ATK[sq] & m_boardDescBB[WK | COLOR]) |
+		(KNIGHT_ATK[sq] & m_boardDescBB[WN | COLOR]) |
+		(PAWN_ATK[sq][(COLOR == WHITE) ? 1 : 0] & m_boardDescBB[WP | COLOR]) |
+		(SliderAttacks::RookAttacks(sq, occupied) & (m_boardDescBB[WR | COLOR] | m_boardDescBB[WQ | COLOR])) |
+		(SliderAttacks::BishopAttacks(sq, occupied) & (m_boardDescBB[WB | COLOR] | m_boardDescBB[WQ | COLOR]));
+}
+
+template uint64_t Board::GetAllAttackers<WHITE>(Square sq, uint64_t occupied) const;
+template uint64_t Board::GetAllAttackers<BLACK>(Square sq, uint64_t occupied) const;
+
 void Board::ApplyVariation(const std::vector<Move> &moves)
 {
 	std::string original = GetFen();
@@ -1776,78 +1831,33 @@ void Board::ApplyVariation(const std::vector<Move> &moves)
 	}
 }
 
-void Board::ComputeLeastValuableAttackers(PieceType attackers[64], uint8_t numAttackers[64], Color side)
+const AttackMaps &Board::GetAttackMaps() const
 {
-	uint64_t kings = m_boardDescBB[WK | side];
-	uint64_t queens = m_boardDescBB[WQ | side];
-	uint64_t rooks = m_boardDescBB[WR | side];
-	uint64_t bishops = m_boardDescBB[WB | side];
-	uint64_t knights = m_boardDescBB[WN | side];
-	uint64_t pawns = m_boardDescBB[WP | side];
-
-	// initialize everything to empty
-	for (Square sq = 0; sq < 64; ++sq)
+	if (!m_attackMapsValid || m_attackMapsHash != m_boardDescBB[HASH])
 	{
-		attackers[sq] = EMPTY;
-		numAttackers[sq] = 0;
+		m_attackMaps.Compute(m_boardDescBB, m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED]);
+		m_attackMapsHash = m_boardDescBB[HASH];
+		m_attackMapsValid = true;
 	}
 
-	auto updateTableFcn = [&attackers, &numAttackers](PieceType pt, uint64_t bb)
-	{
-		while (bb)
-		{
-			Square sq = Extract(bb);
-			attackers[sq] = pt;
-			++numAttackers[sq];
-		}
-	};
-
-	uint64_t occupied = m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED];
-
-	// now we start from the most valuable and go to least, and just keep overwriting
-	while (kings)
-	{
-		Square sq = Extract(kings);
-
-		updateTableFcn(WK, KING_ATK[sq]);
-	}
-
-	while (queens)
-	{
-		Square sq = Extract(queens);
-
-		updateTableFcn(WQ, Qmagic(sq, occupied));
-	}
-
-	while (rooks)
-	{
-		Square sq = Extract(rooks);
-
-		updateTableFcn(WR, Rmagic(sq, occupied));
-	}
-
-	while (bishops)
-	{
-		Square sq = Extract(bishops);
-
-		updateTableFcn(WB, Bmagic(sq, occupied));
-	}
-
-	while (knights)
-	{
-		Square sq = Extract(knights);
+	return m_attackMaps;
+}
 
-		updateTableFcn(WN, KNIGHT_ATK[sq]);
-	}
+template <Color SIDE>
+void Board::ComputeLeastValuableAttackers(PieceType attackers[64], uint8_t numAttackers[64]) const
+{
+	const AttackMaps &maps = GetAttackMaps();
 
-	while (pawns)
+	for (Square sq = 0; sq < 64; ++sq)
 	{
-		Square sq = Extract(pawns);
-
-		updateTableFcn(WP, PAWN_ATK[sq][(side == WHITE) ? 0 : 1]);
+		attackers[sq] = maps.GetLeastValuableAttacker(SIDE, sq);
+		numAttackers[sq] = maps.GetNumAttackers(SIDE, sq);
 	}
 }
 
+template void Board::ComputeLeastValuableAttackers<WHITE>(PieceType attackers[64], uint8_t numAttackers[64]) const;
+template void Board::ComputeLeastValuableAttackers<BLACK>(PieceType attackers[64], uint8_t numAttackers[64]) const;
+
 Optional<Move> Board::GetMoveFromLast(int32_t n)
 {
 	Optional<Move> ret;
@@ -1860,48 +1870,24 @@ Optional<Move> Board::GetMoveFromLast(int32_t n)
 	return ret;
 }
 
-template <Board::MOVE_TYPES MT>
-void Board::GenerateAllPseudoLegalMoves_(MoveList &moveList) const
-{
-	Color sideToMove = m_boardDescU8[SIDE_TO_MOVE];
-
-	GeneratePawnMoves_<MT>(sideToMove, moveList);
-	GenerateKnightMoves_<MT>(sideToMove, moveList);
-	GenerateBishopMoves_<MT>(sideToMove, moveList);
-	GenerateRookMoves_<MT>(sideToMove, moveList);
-	GenerateQueenMoves_<MT>(sideToMove, moveList);
-	GenerateKingMoves_<MT>(sideToMove, moveList);
-
-#ifdef DEBUG
-	if (MT == ALL)
-	{
-		MoveList mlQuiet;
-		MoveList mlViolent;
-		GenerateAllPseudoLegalMoves_<QUIET>(mlQuiet);
-		GenerateAllPseudoLegalMoves_<VIOLENT>(mlViolent);
-		assert((mlQuiet.GetSize() + mlViolent.GetSize()) == moveList.GetSize());
-	}
-#endif
-}
-
-template <Board::MOVE_TYPES MT>
-void Board::GenerateKingMoves_(Color color, MoveList &moveList) const
+template <Board::MOVE_TYPES MT, Color COLOR>
+void Board::GenerateKingMoves_(const CheckInfo &ci, MoveList &moveList) const
 {
 	// there can only be one king
 #ifdef DEBUG
-	assert(PopCount(m_boardDescBB[WK | color]) == 1);
+	assert(PopCount(m_boardDescBB[WK | COLOR]) == 1);
 #endif
-	PieceType pt = WK | color;
+	const PieceType pt = WK | COLOR;
 
 	uint64_t dstMask = 0;
 	if (MT == ALL)
 	{
-		dstMask |= m_boardDescBB[WHITE_OCCUPIED | (color ^ COLOR_MASK)];
+		dstMask |= m_boardDescBB[WHITE_OCCUPIED | (COLOR ^ COLOR_MASK)];
 		dstMask |= ~(m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED]);
 	}
 	else if (MT == VIOLENT)
 	{
-		dstMask |= m_boardDescBB[WHITE_OCCUPIED | (color ^ COLOR_MASK)];
+		dstMask |= m_boardDescBB[WHITE_OCCUPIED | (COLOR ^ COLOR_MASK)];
 	}
 	else
 	{
@@ -1910,7 +1896,7 @@ void Board::GenerateKingMoves_(Color color, MoveList &moveList) const
 
 	uint64_t kings = m_boardDescBB[pt];
 	uint32_t idx = BitScanForward(kings);
-	uint64_t dsts = KING_ATK[idx] & dstMask;
+	uint64_t dsts = KING_ATK[idx] & dstMask & ~ci.kingDanger;
 
 	Move mvTemplate = 0;
 	SetFromSquare(mvTemplate, idx);
@@ -1936,10 +1922,9 @@ void Board::GenerateKingMoves_(Color color, MoveList &moveList) const
 				m_boardDescU8[H1] == WR &&
 				m_boardDescU8[F1] == EMPTY &&
 				m_boardDescU8[G1] == EMPTY &&
-				!IsUnderAttack_(F1))
+				!(ci.kingDanger & (Bit(F1) | Bit(G1))))
 			{
 				// we don't have to check current king pos for under attack because we checked that already
-				// we don't have to check destination because we are generating pseudo-legal moves
 				Move mv = mvTemplate;
 				SetCastlingType(mv, MoveConstants::CASTLE_WHITE_SHORT);
 				SetToSquare(mv, G1);
@@ -1951,10 +1936,10 @@ void Board::GenerateKingMoves_(Color color, MoveList &moveList) const
 				m_boardDescU8[B1] == EMPTY &&
 				m_boardDescU8[C1] == EMPTY &&
 				m_boardDescU8[D1] == EMPTY &&
-				!IsUnderAttack_(D1))
+				!(ci.kingDanger & (Bit(D1) | Bit(C1))))
 			{
 				// we don't have to check current king pos for under attack because we checked that already
-				// we don't have to check destination because we are generating pseudo-legal moves
+				// B1/B8 only needs to be empty (the king doesn't pass through it)
 				Move mv = mvTemplate;
 				SetCastlingType(mv, MoveConstants::CASTLE_WHITE_LONG);
 				SetToSquare(mv, C1);
@@ -1967,10 +1952,9 @@ void Board::GenerateKingMoves_(Color color, MoveList &moveList) const
 				m_boardDescU8[H8] == BR &&
 				m_boardDescU8[F8] == EMPTY &&
 				m_boardDescU8[G8] == EMPTY &&
-				!IsUnderAttack_(F8))
+				!(ci.kingDanger & (Bit(F8) | Bit(G8))))
 			{
 				// we don't have to check current king pos for under attack because we checked that already
-				// we don't have to check destination because we are generating pseudo-legal moves
 				Move mv = mvTemplate;
 				SetCastlingType(mv, MoveConstants::CASTLE_BLACK_SHORT);
 				SetToSquare(mv, G8);
@@ -1982,10 +1966,10 @@ void Board::GenerateKingMoves_(Color color, MoveList &moveList) const
 				m_boardDescU8[B8] == EMPTY &&
 				m_boardDescU8[C8] == EMPTY &&
 				m_boardDescU8[D8] == EMPTY &&
-				!IsUnderAttack_(D8))
+				!(ci.kingDanger & (Bit(D8) | Bit(C8))))
 			{
 				// we don't have to check current king pos for under attack because we checked that already
-				// we don't have to check destination because we are generating pseudo-legal moves
+				// B1/B8 only needs to be empty (the king doesn't pass through it)
 				Move mv = mvTemplate;
 				SetCastlingType(mv, MoveConstants::CASTLE_BLACK_LONG);
 				SetToSquare(mv, C8);
@@ -1995,24 +1979,27 @@ void Board::GenerateKingMoves_(Color color, MoveList &moveList) const
 	}
 }
 
-template void Board::GenerateKingMoves_<Board::QUIET>(Color color, MoveList &moveList) const;
-template void Board::GenerateKingMoves_<Board::VIOLENT>(Color color, MoveList &moveList) const;
-template void Board::GenerateKingMoves_<Board::ALL>(Color color, MoveList &moveList) const;
+template void Board::GenerateKingMoves_<Board::QUIET, WHITE>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateKingMoves_<Board::QUIET, BLACK>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateKingMoves_<Board::VIOLENT, WHITE>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateKingMoves_<Board::VIOLENT, BLACK>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateKingMoves_<Board::ALL, WHITE>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateKingMoves_<Board::ALL, BLACK>(const CheckInfo &ci, MoveList &moveList) const;
 
-template <Board::MOVE_TYPES MT>
-void Board::GenerateQueenMoves_(Color color, MoveList &moveList) const
+template <Board::MOVE_TYPES MT, Color COLOR>
+void Board::GenerateQueenMoves_(const CheckInfo &ci, MoveList &moveList) const
 {
-	PieceType pt = WQ | color;
+	const PieceType pt = WQ | COLOR;
 
 	uint64_t dstMask = 0;
 	if (MT == ALL)
 	{
-		dstMask |= m_boardDescBB[WHITE_OCCUPIED | (color ^ COLOR_MASK)];
+		dstMask |= m_boardDescBB[WHITE_OCCUPIED | (COLOR ^ COLOR_MASK)];
 		dstMask |= ~(m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED]);
 	}
 	else if (MT == VIOLENT)
 	{
-		dstMask |= m_boardDescBB[WHITE_OCCUPIED | (color ^ COLOR_MASK)];
+		dstMask |= m_boardDescBB[WHITE_OCCUPIED | (COLOR ^ COLOR_MASK)];
 	}
 	else
 	{
@@ -2025,7 +2012,7 @@ void Board::GenerateQueenMoves_(Color color, MoveList &moveList) const
 	{
 		uint32_t idx = Extract(queens);
 
-		uint64_t dsts = Qmagic(idx, m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED]) & dstMask;
+		uint64_t dsts = SliderAttacks::QueenAttacks(idx, m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED]) & dstMask & LegalDstMask_(ci, idx);
 
 		Move mvTemplate = 0;
 		SetFromSquare(mvTemplate, idx);
@@ -2044,24 +2031,27 @@ void Board::GenerateQueenMoves_(Color color, MoveList &moveList) const
 	}
 }
 
-template void Board::GenerateQueenMoves_<Board::QUIET>(Color color, MoveList &moveList) const;
-template void Board::GenerateQueenMoves_<Board::VIOLENT>(Color color, MoveList &moveList) const;
-template void Board::GenerateQueenMoves_<Board::ALL>(Color color, MoveList &moveList) const;
+template void Board::GenerateQueenMoves_<Board::QUIET, WHITE>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateQueenMoves_<Board::QUIET, BLACK>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateQueenMoves_<Board::VIOLENT, WHITE>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateQueenMoves_<Board::VIOLENT, BLACK>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateQueenMoves_<Board::ALL, WHITE>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateQueenMoves_<Board::ALL, BLACK>(const CheckInfo &ci, MoveList &moveList) const;
 
-template <Board::MOVE_TYPES MT>
-void Board::GenerateBishopMoves_(Color color, MoveList &moveList) const
+template <Board::MOVE_TYPES MT, Color COLOR>
+void Board::GenerateBishopMoves_(const CheckInfo &ci, MoveList &moveList) const
 {
-	PieceType pt = WB | color;
+	const PieceType pt = WB | COLOR;
 
 	uint64_t dstMask = 0;
 	if (MT == ALL)
 	{
-		dstMask |= m_boardDescBB[WHITE_OCCUPIED | (color ^ COLOR_MASK)];
+		dstMask |= m_boardDescBB[WHITE_OCCUPIED | (COLOR ^ COLOR_MASK)];
 		dstMask |= ~(m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED]);
 	}
 	else if (MT == VIOLENT)
 	{
-		dstMask |= m_boardDescBB[WHITE_OCCUPIED | (color ^ COLOR_MASK)];
+		dstMask |= m_boardDescBB[WHITE_OCCUPIED | (COLOR ^ COLOR_MASK)];
 	}
 	else
 	{
@@ -2074,7 +2064,7 @@ void Board::GenerateBishopMoves_(Color color, MoveList &moveList) const
 	{
 		uint32_t idx = Extract(bishops);
 
-		uint64_t dsts = Bmagic(idx, m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED]) & dstMask;
+		uint64_t dsts = SliderAttacks::BishopAttacks(idx, m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED]) & dstMask & LegalDstMask_(ci, idx);
 
 		Move mvTemplate = 0;
 		SetFromSquare(mvTemplate, idx);
@@ -2093,24 +2083,27 @@ void Board::GenerateBishopMoves_(Color color, MoveList &moveList) const
 	}
 }
 
-template void Board::GenerateBishopMoves_<Board::QUIET>(Color color, MoveList &moveList) const;
-template void Board::GenerateBishopMoves_<Board::VIOLENT>(Color color, MoveList &moveList) const;
-template void Board::GenerateBishopMoves_<Board::ALL>(Color color, MoveList &moveList) const;
+template void Board::GenerateBishopMoves_<Board::QUIET, WHITE>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateBishopMoves_<Board::QUIET, BLACK>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateBishopMoves_<Board::VIOLENT, WHITE>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateBishopMoves_<Board::VIOLENT, BLACK>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateBishopMoves_<Board::ALL, WHITE>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateBishopMoves_<Board::ALL, BLACK>(const CheckInfo &ci, MoveList &moveList) const;
 
-template <Board::MOVE_TYPES MT>
-void Board::GenerateKnightMoves_(Color color, MoveList &moveList) const
+template <Board::MOVE_TYPES MT, Color COLOR>
+void Board::GenerateKnightMoves_(const CheckInfo &ci, MoveList &moveList) const
 {
-	PieceType pt = WN | color;
+	const PieceType pt = WN | COLOR;
 
 	uint64_t dstMask = 0;
 	if (MT == ALL)
 	{
-		dstMask |= m_boardDescBB[WHITE_OCCUPIED | (color ^ COLOR_MASK)];
+		dstMask |= m_boardDescBB[WHITE_OCCUPIED | (COLOR ^ COLOR_MASK)];
 		dstMask |= ~(m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED]);
 	}
 	else if (MT == VIOLENT)
 	{
-		dstMask |= m_boardDescBB[WHITE_OCCUPIED | (color ^ COLOR_MASK)];
+		dstMask |= m_boardDescBB[WHITE_OCCUPIED | (COLOR ^ COLOR_MASK)];
 	}
 	else
 	{
@@ -2123,7 +2116,7 @@ void Board::GenerateKnightMoves_(Color color, MoveList &moveList) const
 	{
 		uint32_t idx = Extract(knights);
 
-		uint64_t dsts = KNIGHT_ATK[idx] & dstMask;
+		uint64_t dsts = KNIGHT_ATK[idx] & dstMask & LegalDstMask_(ci, idx);
 
 		Move mvTemplate = 0;
 		SetFromSquare(mvTemplate, idx);
@@ -2142,24 +2135,27 @@ void Board::GenerateKnightMoves_(Color color, MoveList &moveList) const
 	}
 }
 
-template void Board::GenerateKnightMoves_<Board::QUIET>(Color color, MoveList &moveList) const;
-template void Board::GenerateKnightMoves_<Board::VIOLENT>(Color color, MoveList &moveList) const;
-template void Board::GenerateKnightMoves_<Board::ALL>(Color color, MoveList &moveList) const;
+template void Board::GenerateKnightMoves_<Board::QUIET, WHITE>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateKnightMoves_<Board::QUIET, BLACK>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateKnightMoves_<Board::VIOLENT, WHITE>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateKnightMoves_<Board::VIOLENT, BLACK>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateKnightMoves_<Board::ALL, WHITE>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateKnightMoves_<Board::ALL, BLACK>(const CheckInfo &ci, MoveList &moveList) const;
 
-template <Board::MOVE_TYPES MT>
-void Board::GenerateRookMoves_(Color color, MoveList &moveList) const
+template <Board::MOVE_TYPES MT, Color COLOR>
+void Board::GenerateRookMoves_(const CheckInfo &ci, MoveList &moveList) const
 {
-	PieceType pt = WR | color;
+	const PieceType pt = WR | COLOR;
 
 	uint64_t dstMask = 0;
 	if (MT == ALL)
 	{
-		dstMask |= m_boardDescBB[WHITE_OCCUPIED | (color ^ COLOR_MASK)];
+		dstMask |= m_boardDescBB[WHITE_OCCUPIED | (COLOR ^ COLOR_MASK)];
 		dstMask |= ~(m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED]);
 	}
 	else if (MT == VIOLENT)
 	{
-		dstMask |= m_boardDescBB[WHITE_OCCUPIED | (color ^ COLOR_MASK)];
+		dstMask |= m_boardDescBB[WHITE_OCCUPIED | (COLOR ^ COLOR_MASK)];
 	}
 	else
 	{
@@ -2172,7 +2168,7 @@ void Board::GenerateRookMoves_(Color color, MoveList &moveList) const
 	{
 		uint32_t idx = Extract(rooks);
 
-		uint64_t dsts = Rmagic(idx, m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED]) & dstMask;
+		uint64_t dsts = SliderAttacks::RookAttacks(idx, m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED]) & dstMask & LegalDstMask_(ci, idx);
 
 		Move mvTemplate = 0;
 		SetFromSquare(mvTemplate, idx);
@@ -2191,19 +2187,26 @@ void Board::GenerateRookMoves_(Color color, MoveList &moveList) const
 	}
 }
 
-template void Board::GenerateRookMoves_<Board::QUIET>(Color color, MoveList &moveList) const;
-template void Board::GenerateRookMoves_<Board::VIOLENT>(Color color, MoveList &moveList) const;
-template void Board::GenerateRookMoves_<Board::ALL>(Color color, MoveList &moveList) const;
+template void Board::GenerateRookMoves_<Board::QUIET, WHITE>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateRookMoves_<Board::QUIET, BLACK>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateRookMoves_<Board::VIOLENT, WHITE>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateRookMoves_<Board::VIOLENT, BLACK>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateRookMoves_<Board::ALL, WHITE>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GenerateRookMoves_<Board::ALL, BLACK>(const CheckInfo &ci, MoveList &moveList) const;
 
-template <Board::MOVE_TYPES MT>
-void Board::GeneratePawnMoves_(Color color, MoveList &moveList) const
+template <Board::MOVE_TYPES MT, Color COLOR>
+void Board::GeneratePawnMoves_(const CheckInfo &ci, MoveList &moveList) const
 {
-	PieceType pt = WP | color;
+	const PieceType pt = WP | COLOR;
+
+	// these are all compile time constants, so there is no branching on color in the loop
+	const size_t dirIdx = (COLOR == WHITE) ? 0 : 1;
+	const uint64_t promoRank = (COLOR == WHITE) ? RANKS[RANK_8] : RANKS[RANK_1];
 
 	uint64_t pawns = m_boardDescBB[pt];
 
 	uint64_t empty = ~(m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED]);
-	uint64_t enemy = m_boardDescBB[WHITE_OCCUPIED | (color ^ COLOR_MASK)];
+	uint64_t enemy = m_boardDescBB[WHITE_OCCUPIED | (COLOR ^ COLOR_MASK)];
 
 	while (pawns)
 	{
@@ -2213,24 +2216,36 @@ void Board::GeneratePawnMoves_(Color color, MoveList &moveList) const
 		SetFromSquare(mvTemplate, idx);
 		SetPieceType(mvTemplate, pt);
 
-		uint64_t dsts = PAWN_MOVE_1[idx][color == WHITE ? 0 : 1] & empty;
+		uint64_t legalMask = LegalDstMask_(ci, idx);
+
+		uint64_t dsts = PAWN_MOVE_1[idx][dirIdx] & empty;
 
 		// if we can move 1 square, try 2 squares
 		// we don't have to check whether we are in rank 2 or 7 or not, because entries are 0 otherwise
-		dsts |= (dsts != 0ULL) ? (PAWN_MOVE_2[idx][color == WHITE ? 0 : 1] & empty) : 0ULL;
+		dsts |= (dsts != 0ULL) ? (PAWN_MOVE_2[idx][dirIdx] & empty) : 0ULL;
+
+		dsts &= legalMask;
 
 		if (MT == VIOLENT)
 		{
 			// if we are generating violent moves, only include promotions
-			dsts &= RANKS[RANK_1] | RANKS[RANK_8];
+			dsts &= promoRank;
 		}
 
-		uint64_t captures = PAWN_ATK[idx][color == WHITE ? 0 : 1] & (enemy | m_boardDescBB[EN_PASS_SQUARE]);
+		uint64_t captures = PAWN_ATK[idx][dirIdx] & enemy & legalMask;
+
+		// en passant is special because the captured pawn is not on the destination square
+		uint64_t epCapture = PAWN_ATK[idx][dirIdx] & m_boardDescBB[EN_PASS_SQUARE];
+
+		if (epCapture && IsEpLegal_<COLOR>(ci, idx, BitScanForward(epCapture)))
+		{
+			captures |= epCapture;
+		}
 
 		// only add captures if they are promotions in quiet mode
 		if (MT == QUIET)
 		{
-			dsts |= captures & (RANKS[RANK_1] | RANKS[RANK_8]);
+			dsts |= captures & promoRank;
 		}
 		else
 		{
@@ -2243,24 +2258,24 @@ void Board::GeneratePawnMoves_(Color color, MoveList &moveList) const
 
 			Move mv = 0;
 
-			if (RANK_OF_SQ[dst] & (RANKS[RANK_1] | RANKS[RANK_8]))
+			if (Bit(dst) & promoRank)
 			{
 				if (MT == QUIET || MT == ALL)
 				{
 					// under-promotion
 					mv = mvTemplate;
 					SetToSquare(mv, dst);
-					SetPromoType(mv, WR | color);
+					SetPromoType(mv, WR | COLOR);
 					moveList.PushBack(mv);
 
 					mv = mvTemplate;
 					SetToSquare(mv, dst);
-					SetPromoType(mv, WN | color);
+					SetPromoType(mv, WN | COLOR);
 					moveList.PushBack(mv);
 
 					mv = mvTemplate;
 					SetToSquare(mv, dst);
-					SetPromoType(mv, WB | color);
+					SetPromoType(mv, WB | COLOR);
 					moveList.PushBack(mv);
 				}
 
@@ -2268,7 +2283,7 @@ void Board::GeneratePawnMoves_(Color color, MoveList &moveList) const
 				{
 					mv = mvTemplate;
 					SetToSquare(mv, dst);
-					SetPromoType(mv, WQ | color);
+					SetPromoType(mv, WQ | COLOR);
 					moveList.PushBack(mv);
 				}
 			}
@@ -2282,9 +2297,12 @@ void Board::GeneratePawnMoves_(Color color, MoveList &moveList) const
 	}
 }
 
-template void Board::GeneratePawnMoves_<Board::QUIET>(Color color, MoveList &moveList) const;
-template void Board::GeneratePawnMoves_<Board::VIOLENT>(Color color, MoveList &moveList) const;
-template void Board::GeneratePawnMoves_<Board::ALL>(Color color, MoveList &moveList) const;
+template void Board::GeneratePawnMoves_<Board::QUIET, WHITE>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GeneratePawnMoves_<Board::QUIET, BLACK>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GeneratePawnMoves_<Board::VIOLENT, WHITE>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GeneratePawnMoves_<Board::VIOLENT, BLACK>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GeneratePawnMoves_<Board::ALL, WHITE>(const CheckInfo &ci, MoveList &moveList) const;
+template void Board::GeneratePawnMoves_<Board::ALL, BLACK>(const CheckInfo &ci, MoveList &moveList) const;
 
 bool Board::IsUnderAttack_(Square sq) const
 {
@@ -2302,12 +2320,12 @@ bool Board::IsUnderAttack_(Square sq) const
 		return true;
 	}
 
-	if (Rmagic(sq, allOccupied) & (m_boardDescBB[WQ | enemyColor] | m_boardDescBB[WR | enemyColor]))
+	if (SliderAttacks::RookAttacks(sq, allOccupied) & (m_boardDescBB[WQ | enemyColor] | m_boardDescBB[WR | enemyColor]))
 	{
 		return true;
 	}
 
-	if (Bmagic(sq, allOccupied) & (m_boardDescBB[WQ | enemyColor] | m_boardDescBB[WB | enemyColor]))
+	if (SliderAttacks::BishopAttacks(sq, allOccupied) & (m_boardDescBB[WQ | enemyColor] | m_boardDescBB[WB | enemyColor]))
 	{
 		return true;
 	}
@@ -2372,6 +2390,61 @@ void Board::UpdateHashFull_()
 	}
 
 	m_boardDescBB[HASH] = newHash;
+	uint64_t materialKey = 0;
+
+	for (PieceType pt = WK; pt <= BP; ++pt)
+	{
+		if (pt == WHITE_OCCUPIED || pt == (WHITE_OCCUPIED + 1))
+		{
+			continue;
+		}
+
+		size_t count = PopCount(m_boardDescBB[pt]);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			materialKey ^= MATERIAL_ZOBRIST[pt][i];
+		}
+	}
+
+	m_boardDescBB[MATERIAL_KEY] = materialKey;
+}
+
+void Board::UpdateMaterialKey_(Move mv, bool isEp, UndoListBB &ulBB)
+{
+	if (IsCastling(mv))
+	{
+		return;
+	}
+
+	PieceType pt = GetPieceType(mv);
+	Square to = GetToSquare(mv);
+	Color color = pt & COLOR_MASK;
+	PieceType promoType = GetPromoType(mv);
+
+	PieceType captured = isEp ? (WP | (color ^ COLOR_MASK)) : m_boardDescU8[to];
+
+	uint64_t materialKey = m_boardDescBB[MATERIAL_KEY];
+
+	// removing a piece takes out the key at (count - 1), and adding one puts in the key at count
+	auto count = [this](PieceType type) { return PopCount(m_boardDescBB[type]); };
+
+	if (captured != EMPTY)
+	{
+		materialKey ^= MATERIAL_ZOBRIST[captured][count(captured) - 1];
+	}
+
+	if (promoType != 0)
+	{
+		materialKey ^= MATERIAL_ZOBRIST[pt][count(pt) - 1];
+		materialKey ^= MATERIAL_ZOBRIST[promoType][count(promoType)];
+	}
+
+	if (materialKey != m_boardDescBB[MATERIAL_KEY])
+	{
+		ulBB.PushBack(std::make_pair(MATERIAL_KEY, m_boardDescBB[MATERIAL_KEY]));
+		m_boardDescBB[MATERIAL_KEY] = materialKey;
+	}
 }
 
 uint64_t Perft(Board &b, uint32_t depth)
@@ -2379,6 +2452,13 @@ uint64_t Perft(Board &b, uint32_t depth)
 	MoveList ml;
 	b.GenerateAllLegalMoves<Board::ALL>(ml);
 
+	// the move generator only generates legal moves, so we don't have to make the moves at the last ply
+	// (this "bulk counting" makes perft about 10x faster, so its NPS is not comparable with versions that make every move)
+	if (depth == 1)
+	{
+		return ml.GetSize();
+	}
+
 	uint64_t sum = 0;
 
 #ifdef DEBUG
@@ -2395,14 +2475,7 @@ uint64_t Perft(Board &b, uint32_t depth)
 
 		if (b.ApplyMove(ml[i]))
 		{
-			if (depth == 1)
-			{
-				++sum;
-			}
-			else
-			{
-				sum += Perft(b, depth - 1);
-			}
+			sum += Perft(b, depth - 1);
 
 			b.UndoMove();
 
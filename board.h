@@ -24,6 +24,8 @@
 #include "board_consts.h"
 #include "move.h"
 #include "bit_ops.h"
+#include "attack_maps.h"
+#include "packed_position.h"
 
 const static std::string DEFAULT_POSITION_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 
@@ -38,7 +40,10 @@ const static uint32_t BOARD_HASH = 0x11;
 
 const static uint32_t HASH = 0x12;
 
-const static uint32_t BOARD_DESC_BB_SIZE = 0x13;
+// key that only depends on piece counts (see zobrist.h)
+const static uint32_t MATERIAL_KEY = 0x13;
+
+const static uint32_t BOARD_DESC_BB_SIZE = 0x14;
 
 // we also keep a mailbox representation of the board, from 0x0 to 0x3F (64 squares)
 
@@ -79,15 +84,16 @@ public:
 
 	struct CheckInfo
 	{
-		// this struct contains things that can be precomputed once per position, and makes checking all the moves easier
-		bool opponentRQOnSameX = false;
-		bool opponentRQOnSameY = false;
-		bool opponentBQOnSameDiag0 = false;
-		bool opponentBQOnSameDiag1 = false;
+		// this struct contains things that can be precomputed once per position, and makes generating only legal moves easy
+		uint64_t checkers = 0; // opponent pieces giving check
+		uint64_t pinned = 0; // our pieces that are pinned to our king (they can only move along the pin line)
+		uint64_t checkMask = 0; // non-king moves must end on one of these squares (all squares if not in check, none if double check)
+		uint64_t kingDanger = 0; // squares attacked by the opponent, computed with our king removed (so it can't step back along a ray)
+		Square kingPos = 0;
 	};
 
-	typedef FixedVector<std::pair<uint8_t, uint64_t>, 7> UndoListBB; // list of bitboards to revert on undo
-	// 6 maximum bitboards (black occupied, white occupied, source piece type, captured piece type, promotion/castling piece type, en passant, hash)
+	typedef FixedVector<std::pair<uint8_t, uint64_t>, 8> UndoListBB; // list of bitboards to revert on undo
+	// 8 maximum bitboards (black occupied, white occupied, source piece type, captured piece type, promotion/castling piece type, en passant, hash, material key)
 
 	typedef FixedVector<std::pair<uint8_t, uint8_t>, 8> UndoListU8;
 	// For en passant (en passants cannot result in promotion, or reducing castling rights):
@@ -102,6 +108,9 @@ public:
 
 	Board(const std::string &fen);
 	Board() : Board(DEFAULT_POSITION_FEN) {}
+
+	// this is much faster than going through FEN, and is used for training data
+	explicit Board(const PackedPosition &pos);
 	~Board() {}
 
 	void RemovePiece(Square sq);
@@ -114,6 +123,9 @@ public:
 
 	std::string GetFen(bool omitMoveNums = false) const;
 
+	// score, result, and best move are left unlabelled
+	PackedPosition Pack() const;
+
 	std::string PrintBoard() const;
 
 	bool InCheck() const { return m_boardDescU8[IN_CHECK]; }
@@ -121,11 +133,7 @@ public:
 	// returns whether the move is legal (if not, the move is reverted)
 	bool ApplyMove(Move mv);
 
-	CheckInfo ComputeCheckInfo();
-
-	// same as ApplyMove, but doesn't apply the move
-	// it also uses a few shortcuts to do the check faster
-	bool CheckLegal(const CheckInfo &ci, Move mv);
+	CheckInfo ComputeCheckInfo() const;
 
 	void UndoMove();
 
@@ -149,6 +157,7 @@ public:
 	int32_t PossibleUndo() { return m_undoStackBB.GetSize(); }
 
 	uint64_t GetHash() const { return m_boardDescBB[HASH]; }
+	uint64_t GetMaterialKey() const { return m_boardDescBB[MATERIAL_KEY]; }
 
 	// is it probable that this position is zugzwang (used in null move)
 	bool IsZugzwangProbable();
@@ -193,24 +202,6 @@ public:
 
 	GameStatus GetGameStatus();
 
-	/*
-		SEE helpers
-		- Highly efficient limited ApplyMove/UndoMove for SEE only
-		- Move must be a legal regular capture
-		- No en passant, castling, or non-capture moves
-		- Move legality is not checked, and king is allowed to be captured
-		- Same number of UndoMoveSee() must be called before
-			any other function can be called (board is in an intentionally corrupted
-			state while in SEE mode)
-		- ApplyMoveSee returns the captured piecetype
-		- ResetSee resets SEE status
-	*/
-	void ResetSee() { m_seeLastWhitePT = WP; m_seeLastBlackPT = WP; m_seeTotalOccupancy = m_boardDescBB[WHITE_OCCUPIED] | m_boardDescBB[BLACK_OCCUPIED]; }
-	PieceType ApplyMoveSee(PieceType pt, Square from, Square to);
-	bool IsSeeEligible(Move mv);
-	void UndoMoveSee();
-	bool GenerateSmallestCaptureSee(PieceType &pt, Square &from, Square to); // to doesn't need to be returned, because it's the target square
-
 	// undefined behaviour if move is not violent
 	PieceType GetCapturedPieceType(Move violentMove);
 
@@ -223,45 +214,68 @@ public:
 	// get the position of any piece of piece type (this is mostly used for kings)
 	size_t GetFirstPiecePos(PieceType pt) const { return BitScanForward(m_boardDescBB[pt]); }
 
+	// PT includes color, so each side already gets its own instantiation
 	template <PieceType PT>
 	uint64_t GetAttackers(Square sq) const;
 
+	// all pieces of COLOR attacking sq, with the given occupancy
+	template <Color COLOR>
+	uint64_t GetAllAttackers(Square sq, uint64_t occupied) const;
+
 	void ApplyVariation(const std::vector<Move> &moves);
 
+	// attack maps of the current position, computed on first use and cached until the position changes
+	const AttackMaps &GetAttackMaps() const;
+
 	// get the least valuable attacker
 	// all piece types are white
-	void ComputeLeastValuableAttackers(PieceType attackers[64], uint8_t numAttackers[64], Color side);
+	template <Color SIDE>
+	void ComputeLeastValuableAttackers(PieceType attackers[64], uint8_t numAttackers[64]) const;
 
 	// 0 = last move, 1 = last move - 1, etc
 	Optional<Move> GetMoveFromLast(int32_t n);
 
-	bool IsChecking(Move mv)
-	{
-		// TODO: re-implement more efficiently if this becomes a bottleneck
-		ApplyMove(mv);
-		bool ret = InCheck();
-		UndoMove();
-
-		return ret;
-	}
+	// whether the move (which must be legal) gives check, computed directly from bitboards
+	// (direct checks, discovered checks, promotions, castling, and en passant are all handled)
+	bool IsChecking(Move mv) const;
 
 private:
-	template <MOVE_TYPES MT> void GenerateAllPseudoLegalMoves_(MoveList &moveList) const;
-	template <MOVE_TYPES MT> void GenerateKingMoves_(Color color, MoveList &moveList) const;
-	template <MOVE_TYPES MT> void GenerateQueenMoves_(Color color, MoveList &moveList) const;
-	template <MOVE_TYPES MT> void GenerateBishopMoves_(Color color, MoveList &moveList) const;
-	template <MOVE_TYPES MT> void GenerateKnightMoves_(Color color, MoveList &moveList) const;
-	template <MOVE_TYPES MT> void GenerateRookMoves_(Color color, MoveList &moveList) const;
+	// empty board, with nothing set
+	void Clear_();
+
+	// all generators only generate legal moves, using the pin and check information in ci
+	// they are also specialized on color, so there is no branching on color (pawn direction, promotion rank, etc)
+	template <MOVE_TYPES MT, Color COLOR> void GenerateKingMoves_(const CheckInfo &ci, MoveList &moveList) const;
+	template <MOVE_TYPES MT, Color COLOR> void GenerateQueenMoves_(const CheckInfo &ci, MoveList &moveList) const;
+	template <MOVE_TYPES MT, Color COLOR> void GenerateBishopMoves_(const CheckInfo &ci, MoveList &moveList) const;
+	template <MOVE_TYPES MT, Color COLOR> void GenerateKnightMoves_(const CheckInfo &ci, MoveList &moveList) const;
+	template <MOVE_TYPES MT, Color COLOR> void GenerateRookMoves_(const CheckInfo &ci, MoveList &moveList) const;
 
 	// non-quiet only generates captures and promotion to queen
 	// quiet only generates non-captures and under-promotions (including captures that result in under-promotion)
-	template <MOVE_TYPES MT> void GeneratePawnMoves_(Color color, MoveList &moveList) const;
+	template <MOVE_TYPES MT, Color COLOR> void GeneratePawnMoves_(const CheckInfo &ci, MoveList &moveList) const;
+
+	// destinations a non-king piece on sq can move to without leaving the king in check
+	uint64_t LegalDstMask_(const CheckInfo &ci, Square sq) const
+	{ return ci.checkMask & ((ci.pinned & Bit(sq)) ? LINE[ci.kingPos][sq] : ::ALL); }
+
+	// whether an en passant capture leaves our king safe (the 2 pawns leaving the same rank can expose the king)
+	template <Color COLOR>
+	bool IsEpLegal_(const CheckInfo &ci, Square from, Square to) const;
+
+	// all squares attacked by SIDE, with the given occupancy
+	template <Color SIDE>
+	uint64_t ComputeAttackedSquares_(uint64_t occupancy) const;
 
 	bool IsUnderAttack_(Square sq) const;
 	void UpdateInCheck_();
 
+	// recomputes hash, material key, and pawn key from scratch
 	void UpdateHashFull_();
 
+	// incrementally updates material and pawn keys for a move, before the move is applied
+	void UpdateMaterialKey_(Move mv, bool isEp, UndoListBB &ulBB);
+
 	uint64_t m_boardDescBB[BOARD_DESC_BB_SIZE];
 
 	// yes, we are using uint64_t to store these u8 values
@@ -277,11 +291,10 @@ private:
 
 	GrowableStack<Move> m_moveStack;
 
-	// both these fields are stored as white piece types
-	void UpdateseeLastPT_(PieceType lastPT) { if (m_boardDescU8[SIDE_TO_MOVE] == WHITE) m_seeLastWhitePT = lastPT; else m_seeLastBlackPT = lastPT; }
-	PieceType m_seeLastWhitePT;
-	PieceType m_seeLastBlackPT;
-	uint64_t m_seeTotalOccupancy;
+	// the cache is keyed on position hash, so we don't have to invalidate it on every board update
+	mutable AttackMaps m_attackMaps;
+	mutable uint64_t m_attackMapsHash;
+	mutable bool m_attackMapsValid;
 };
 
 uint64_t DebugPerft(Board &b, uint32_t depth);
@@ -33,6 +33,10 @@ uint64_t RANK_OF_SQ[64];
 uint64_t FILE_OF_SQ[64];
 uint64_t ADJACENT_FILES_OF_SQ[64];
 
+uint64_t BETWEEN[64][64];
+uint64_t LINE[64][64];
+uint64_t RAY[RAY_NUM][64];
+
 uint64_t SqOffset(int32_t sq, int32_t xOffset, int32_t yOffset)
 {
 	int32_t x = GetX(sq) + xOffset;
@@ -96,6 +100,51 @@ void BoardConstsInit()
 			ADJACENT_FILES_OF_SQ[sq] = FILES[GetFile(sq) + 1] | FILES[GetFile(sq) - 1];
 		}
 	}
+
+	// between, line, and ray tables are built by walking in all 8 directions from each square
+	// (in RayDirection order)
+	const static int32_t DIRECTIONS[RAY_NUM][2] = { {1, 0}, {-1, 0}, {0, 1}, {0, -1}, {1, 1}, {1, -1}, {-1, 1}, {-1, -1} };
+
+	for (int32_t sq = 0; sq < 64; ++sq)
+	{
+		for (int32_t sq2 = 0; sq2 < 64; ++sq2)
+		{
+			BETWEEN[sq][sq2] = 0ULL;
+			LINE[sq][sq2] = 0ULL;
+		}
+
+		for (int32_t d = 0; d < RAY_NUM; ++d)
+		{
+			const int32_t *dir = DIRECTIONS[d];
+
+			// the full line is the ray in this direction, the ray in the opposite direction, and the square itself
+			uint64_t line = Bit(sq);
+
+			for (int32_t i = 1; SqOffset(sq, dir[0] * i, dir[1] * i); ++i)
+			{
+				line |= SqOffset(sq, dir[0] * i, dir[1] * i);
+			}
+
+			for (int32_t i = 1; SqOffset(sq, -dir[0] * i, -dir[1] * i); ++i)
+			{
+				line |= SqOffset(sq, -dir[0] * i, -dir[1] * i);
+			}
+
+			uint64_t between = 0ULL;
+
+			for (int32_t i = 1; SqOffset(sq, dir[0] * i, dir[1] * i); ++i)
+			{
+				Square sq2 = BitScanForward(SqOffset(sq, dir[0] * i, dir[1] * i));
+
+				BETWEEN[sq][sq2] = between;
+				LINE[sq][sq2] = line;
+
+				between |= Bit(sq2);
+			}
+
+			RAY[d][sq] = between;
+		}
+	}
 }
 
 void DebugPrint(uint64_t bb)
@@ -37,6 +37,29 @@ extern uint64_t RANK_OF_SQ[64];
 extern uint64_t FILE_OF_SQ[64];
 extern uint64_t ADJACENT_FILES_OF_SQ[64];
 
+// squares strictly between 2 squares on the same rank, file, or diagonal (0 if they are not aligned)
+extern uint64_t BETWEEN[64][64];
+
+// the whole line (edge to edge) going through 2 aligned squares (0 if they are not aligned)
+extern uint64_t LINE[64][64];
+
+enum RayDirection
+{
+	RAY_E,
+	RAY_W,
+	RAY_N,
+	RAY_S,
+	RAY_NE,
+	RAY_SE,
+	RAY_NW,
+	RAY_SW,
+
+	RAY_NUM
+};
+
+// all squares from a square (exclusive) to the edge of the board in one direction
+extern uint64_t RAY[RAY_NUM][64];
+
 const static uint64_t ALL = 0xffffffffffffffffULL;
 
 const static uint64_t BLACK_SQUARES = 0xaa55aa55aa55aa55ULL;
@@ -0,0 +1,89 @@
+/*
+	Copyright (C) 2015 Matthew Lai
+
+	Giraffe is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	Giraffe is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BOOK_H
+#define BOOK_H
+
+#include <string>
+#include <vector>
+#include <random>
+
+#include <cstdint>
+
+#include "types.h"
+#include "board.h"
+#include "move.h"
+
+// Polyglot (.bin) opening book.
+// The file is a sorted array of 16 bytes big endian entries (key, move, weight, learn), so we map it
+// into memory and binary search for the position's key, without loading or parsing anything on startup.
+// Not thread-safe.
+class Book
+{
+public:
+	Book();
+	~Book();
+
+	Book(const Book&) = delete;
+	Book &operator=(const Book&) = delete;
+
+	// returns an empty string on success, and an error message otherwise
+	// the previous book (if any) is closed either way
+	std::string Open(const std::string &filename);
+
+	void Close();
+
+	bool IsOpen() const { return m_numEntries != 0; }
+
+	// picks a move with probability proportional to its weight
+	// returns 0 if the position is not in the book (or none of the book moves is legal)
+	Move Probe(Board &b);
+
+	// all book moves for the position, in file order
+	std::vector<std::pair<Move, uint16_t>> GetMoves(Board &b);
+
+	// this is different from Board::GetHash() - it uses the random numbers from the Polyglot book format
+	static uint64_t PolyglotKey(const Board &b);
+
+private:
+	struct Entry
+	{
+		uint64_t key;
+		uint16_t move;
+		uint16_t weight;
+	};
+
+	Entry GetEntry_(size_t idx) const;
+
+	// index of the first entry with the key, or m_numEntries if there isn't one
+	size_t FindFirst_(uint64_t key) const;
+
+	static Move ConvertMove_(Board &b, uint16_t polyglotMove);
+
+	const unsigned char *m_data;
+	size_t m_numEntries;
+
+	// 0 if the file is not mapped
+	size_t m_mappedSize;
+
+	// only used when we can't mmap
+	std::vector<unsigned char> m_buffer;
+
+	std::mt19937 m_mt;
+};
+
+#endif // BOOK_H
@@ -20,6 +20,7 @@
 
 #include <vector>
 #include <set>
+#include <type_traits>
 
 #include <cstdint>
 #include <cassert>
@@ -171,6 +172,14 @@ public:
 		return m_data[i];
 	}
 
+	const T &operator[](size_t i) const
+	{
+#ifdef DEBUG
+		assert(i < MAX_SIZE);
+#endif
+		return m_data[i];
+	}
+
 	void Clear()
 	{
 		m_size = 0;
@@ -226,4 +235,46 @@ private:
 	size_t m_size;
 };
 
+// Span is a non-owning view of a contiguous range of elements (usually part of a std::vector or an array)
+// it's used to pass batches around without copying, or forcing callers to use a particular container
+template <typename T>
+class Span
+{
+public:
+	Span() : m_data(nullptr), m_size(0) {}
+	Span(T *data, size_t size) : m_data(data), m_size(size) {}
+	Span(std::vector<T> &v) : m_data(v.data()), m_size(v.size()) {}
+
+	// only usable for spans of const elements
+	Span(const std::vector<typename std::remove_const<T>::type> &v) : m_data(v.data()), m_size(v.size()) {}
+
+	T &operator[](size_t i) const
+	{
+#ifdef DEBUG
+		assert(i < m_size);
+#endif
+		return m_data[i];
+	}
+
+	// returns a view of [begin, begin + size)
+	Span<T> SubSpan(size_t begin, size_t size) const
+	{
+#ifdef DEBUG
+		assert((begin + size) <= m_size);
+#endif
+		return Span<T>(m_data + begin, size);
+	}
+
+	size_t GetSize() const { return m_size; }
+
+	T *Data() const { return m_data; }
+
+	T *begin() const { return m_data; }
+	T *end() const { return m_data + m_size; }
+
+private:
+	T *m_data;
+	size_t m_size;
+};
+
 #endif // CONTAINERS_H
@@ -1,7 +1,5 @@
 import os
 import argparse
-import pandas as pd
-import numpy as np
 from subprocess import call
 
 parser = argparse.ArgumentParser()
@@ -15,13 +13,8 @@ args = parser.parse_args()
 for fname in os.listdir(args.input_path):
     if args.input_ext in fname:
         input_full = args.input_path + '/' + fname
-        feats_full = args.output_path + '/' + fname + '.feats'
-        xie_full = args.output_path + '/' + fname + args.output_ext
-        command = "./giraffe conv_file " + input_full + " " + feats_full
-        print('Calling ' + command + '...')
-        call(command.split())
-        feat_file = pd.read_table(feats_full, delimiter=' ').as_matrix()
-        np.save(xie_full, feat_file[:,:-1].astype(np.float32))
-        command = "rm -rf " + feats_full
+        # conv_file writes .npy directly (same as np.save(xie_full, ...))
+        xie_full = args.output_path + '/' + fname + args.output_ext + '.npy'
+        command = "./giraffe conv_file " + input_full + " " + xie_full
         print('Calling ' + command + '...')
         call(command.split())
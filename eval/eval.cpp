@@ -18,7 +18,7 @@
 #include "eval.h"
 #include "types.h"
 #include "bit_ops.h"
-#include "magic_moves.h"
+#include "slider_attacks.h"
 #include "evaluator.h"
 
 #include <cmath>
@@ -34,7 +34,7 @@ Score ScalePhase(Score openingScore, Score endgameScore, Phase phase)
 }
 
 template <Color COLOR>
-Score EvaluatePawns(uint64_t bb, Phase phase, uint64_t &pawnAttacksOut)
+Score EvaluatePawns(uint64_t bb, Phase phase)
 {
 	Score ret = 0;
 
@@ -42,15 +42,6 @@ Score EvaluatePawns(uint64_t bb, Phase phase, uint64_t &pawnAttacksOut)
 	{
 		uint32_t idx = Extract(bb);
 
-		if (COLOR == WHITE)
-		{
-			pawnAttacksOut |= PAWN_ATK[idx][0];
-		}
-		else
-		{
-			pawnAttacksOut |= PAWN_ATK[idx][1];
-		}
-
 		if (COLOR == BLACK)
 		{
 			idx = FLIP[idx];
@@ -101,7 +92,7 @@ Score EvaluateBishops(uint64_t bb, Phase phase, uint64_t safeDestinations, uint6
 	{
 		uint32_t idx = Extract(bb);
 
-		uint32_t mobility = PopCount(Bmagic(idx, occupancy) & safeDestinations);
+		uint32_t mobility = PopCount(SliderAttacks::BishopAttacks(idx, occupancy) & safeDestinations);
 
 		ret += ScalePhase(BISHOP_MOBILITY[0][mobility] * MOBILITY_MULTIPLIERS[0],
 						  BISHOP_MOBILITY[1][mobility] * MOBILITY_MULTIPLIERS[1], phase);
@@ -126,7 +117,7 @@ Score EvaluateRooks(uint64_t bb, Phase phase, uint64_t safeDestinations, uint64_
 	{
 		uint32_t idx = Extract(bb);
 
-		uint32_t mobility = PopCount(Rmagic(idx, occupancy) & safeDestinations);
+		uint32_t mobility = PopCount(SliderAttacks::RookAttacks(idx, occupancy) & safeDestinations);
 
 		ret += ScalePhase(ROOK_MOBILITY[0][mobility] * MOBILITY_MULTIPLIERS[0],
 						  ROOK_MOBILITY[1][mobility] * MOBILITY_MULTIPLIERS[1], phase);
@@ -151,7 +142,7 @@ Score EvaluateQueens(uint64_t bb, Phase phase, uint64_t safeDestinations, uint64
 	{
 		uint32_t idx = Extract(bb);
 
-		uint32_t mobility = PopCount(Qmagic(idx, occupancy) & safeDestinations);
+		uint32_t mobility = PopCount(SliderAttacks::QueenAttacks(idx, occupancy) & safeDestinations);
 
 		ret += ScalePhase(QUEEN_MOBILITY[0][mobility] * MOBILITY_MULTIPLIERS[0],
 						  QUEEN_MOBILITY[1][mobility] * MOBILITY_MULTIPLIERS[1], phase);
@@ -235,11 +226,13 @@ Score StaticEvaluate(const Board &b, Score /*lowerBound*/, Score /*upperBound*/)
 
 	uint64_t occupancy = b.GetOccupiedBitboard<WHITE>() | b.GetOccupiedBitboard<BLACK>();
 
-	uint64_t attackedByWhitePawns = 0ULL;
-	uint64_t attackedByBlackPawns = 0ULL;
+	// pawn attacks come from the board's cached attack maps, which are shared with feature conversion
+	const AttackMaps &attackMaps = b.GetAttackMaps();
+	uint64_t attackedByWhitePawns = attackMaps.attacks[WP];
+	uint64_t attackedByBlackPawns = attackMaps.attacks[BP];
 
-	ret += EvaluatePawns<WHITE>(b.GetPieceTypeBitboard(WP), phase, attackedByWhitePawns);
-	ret -= EvaluatePawns<BLACK>(b.GetPieceTypeBitboard(BP), phase, attackedByBlackPawns);
+	ret += EvaluatePawns<WHITE>(b.GetPieceTypeBitboard(WP), phase);
+	ret -= EvaluatePawns<BLACK>(b.GetPieceTypeBitboard(BP), phase);
 
 	// safe destinations are empty squares or squares with enemy pieces
 	// these squares must not be defended by enemy pawns
@@ -21,6 +21,7 @@
 #include "types.h"
 #include "board.h"
 #include "see.h"
+#include "containers.h"
 
 #include <limits>
 
@@ -70,10 +71,31 @@ public:
 
 	virtual void BatchEvaluateForSTMGEE(std::vector<Board> &positions, std::vector<Score> &results, Score lowerBound = SCORE_MIN, Score upperBound = SCORE_MAX)
 	{
+		results.resize(positions.size());
+
+		BatchEvaluateForSTMGEE(Span<Board>(positions), Span<Score>(results), lowerBound, upperBound);
+	}
+
+	virtual void BatchEvaluateForWhiteGEE(std::vector<Board> &positions, std::vector<Score> &results, Score lowerBound = SCORE_MIN, Score upperBound = SCORE_MAX)
+	{
+		results.resize(positions.size());
+
+		BatchEvaluateForWhiteGEEImpl(Span<Board>(positions), Span<Score>(results), lowerBound, upperBound);
+	}
+
+	// span versions of GEE batch evaluation
+	// results must have the same size as positions, and nothing is allocated once the leaf buffer is big enough
+	virtual void BatchEvaluateForSTMGEE(Span<Board> positions, Span<Score> results, Score lowerBound = SCORE_MIN, Score upperBound = SCORE_MAX)
+	{
+		if (positions.GetSize() == 0)
+		{
+			return;
+		}
+
 		// check that they all have the same stm
 		Color stm = positions[0].GetSideToMove();
 
-		for (size_t i = 1; i < positions.size(); ++i)
+		for (size_t i = 1; i < positions.GetSize(); ++i)
 		{
 			assert(positions[i].GetSideToMove() == stm);
 		}
@@ -93,11 +115,48 @@ public:
 		}
 	}
 
-	virtual void BatchEvaluateForWhiteGEE(std::vector<Board> &positions, std::vector<Score> &results, Score lowerBound = SCORE_MIN, Score upperBound = SCORE_MAX)
+	virtual void BatchEvaluateForWhiteGEE(Span<Board> positions, Span<Score> results, Score lowerBound = SCORE_MIN, Score upperBound = SCORE_MAX)
 	{
 		BatchEvaluateForWhiteGEEImpl(positions, results, lowerBound, upperBound);
 	}
 
+	// span versions of batch evaluation
+	// results must have the same size as positions, and no allocation is done here
+	virtual void BatchEvaluateForSTM(Span<Board> positions, Span<Score> results, Score lowerBound = SCORE_MIN, Score upperBound = SCORE_MAX)
+	{
+		if (positions.GetSize() == 0)
+		{
+			return;
+		}
+
+		// check that they all have the same stm
+		Color stm = positions[0].GetSideToMove();
+
+		for (size_t i = 1; i < positions.GetSize(); ++i)
+		{
+			assert(positions[i].GetSideToMove() == stm);
+		}
+
+		if (stm == WHITE)
+		{
+			BatchEvaluateForWhiteImpl(positions, results, lowerBound, upperBound);
+		}
+		else
+		{
+			BatchEvaluateForWhiteImpl(positions, results, -upperBound, -lowerBound);
+
+			for (auto &x : results)
+			{
+				x *= -1;
+			}
+		}
+	}
+
+	virtual void BatchEvaluateForWhite(Span<Board> positions, Span<Score> results, Score lowerBound = SCORE_MIN, Score upperBound = SCORE_MAX)
+	{
+		BatchEvaluateForWhiteImpl(positions, results, lowerBound, upperBound);
+	}
+
 	virtual float UnScale(float x)
 	{
 		float ret = x / EvalFullScale;
@@ -113,16 +172,24 @@ public:
 
 	// this allows evaluators to evaluate multiple positions at once
 	// default implementation does it one at a time
-	virtual void BatchEvaluateForWhiteImpl(std::vector<Board> &positions, std::vector<Score> &results, Score lowerBound, Score upperBound)
+	// evaluators that can do better should override the span version
+	virtual void BatchEvaluateForWhiteImpl(Span<Board> positions, Span<Score> results, Score lowerBound, Score upperBound)
 	{
-		results.resize(positions.size());
+		assert(results.GetSize() == positions.GetSize());
 
-		for (size_t i = 0; i < positions.size(); ++i)
+		for (size_t i = 0; i < positions.GetSize(); ++i)
 		{
 			results[i] = EvaluateForWhiteImpl(positions[i], lowerBound, upperBound);
 		}
 	}
 
+	void BatchEvaluateForWhiteImpl(std::vector<Board> &positions, std::vector<Score> &results, Score lowerBound, Score upperBound)
+	{
+		results.resize(positions.size());
+
+		BatchEvaluateForWhiteImpl(Span<Board>(positions), Span<Score>(results), lowerBound, upperBound);
+	}
+
 	// evaluates the board from the perspective of the moving side by running eval on the leaf of a GEE
 	// this is a generic implementation that can be overridden
 	virtual Score EvaluateForWhiteGEEImpl(Board &board, Score lowerBound, Score upperBound)
@@ -134,32 +201,40 @@ public:
 			result = EvaluateForWhiteImpl(board, lowerBound, upperBound);
 		};
 
-		SEE::GEERunFunc(board, staticEvalCallback);
+		SEE::GEERunFunc(board, staticEvalCallback, &m_geeCache);
 
 		return result;
 	}
 
-	virtual void BatchEvaluateForWhiteGEEImpl(std::vector<Board> &positions, std::vector<Score> &results, Score lowerBound, Score upperBound)
+	virtual void BatchEvaluateForWhiteGEEImpl(Span<Board> positions, Span<Score> results, Score lowerBound, Score upperBound)
 	{
-		std::vector<Board> leafPositions;
+		assert(results.GetSize() == positions.GetSize());
 
-		leafPositions.reserve(positions.size());
+		// clear() doesn't deallocate, so this only allocates until the buffer has grown to the largest batch
+		m_geeLeaves.clear();
 
-		auto vectorInsertCallback = [this, &leafPositions](Board &board)
+		auto leafInsertCallback = [this](Board &board)
 		{
-			leafPositions.push_back(board);
+			m_geeLeaves.push_back(board);
 		};
 
-		for (size_t i = 0; i < positions.size(); ++i)
+		for (size_t i = 0; i < positions.GetSize(); ++i)
 		{
-			SEE::GEERunFunc(positions[i], vectorInsertCallback);
+			SEE::GEERunFunc(positions[i], leafInsertCallback, &m_geeCache);
 		}
 
-		BatchEvaluateForWhiteImpl(leafPositions, results, lowerBound, upperBound);
+		BatchEvaluateForWhiteImpl(Span<Board>(m_geeLeaves), results, lowerBound, upperBound);
 	}
 
 	// this is optional
 	virtual void PrintDiag(Board &/*board*/) {}
+
+protected:
+	// GEE leaves of positions we have seen before (only allocated if GEE evaluation is used)
+	SEE::GEECache m_geeCache;
+
+	// scratch space for batch GEE evaluation
+	std::vector<Board> m_geeLeaves;
 };
 
 #endif // EVALUATOR_H
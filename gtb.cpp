@@ -18,11 +18,34 @@
 #include "gtb.h"
 
 #include <iostream>
+#include <iomanip>
+#include <fstream>
 #include <string>
 #include <sstream>
+#include <vector>
+#include <algorithm>
 
 #include <cassert>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+
+#include <omp.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+extern "C"
+{
+#include "gtb/compression/wrap.h"
+#include "gtb/compression/huffman/hzip.h"
+}
+
+#include "omp_scoped_thread_limiter.h"
 
 namespace
 {
@@ -129,6 +152,690 @@ void FillPieceLists(
 	piecesListBlack[numBlack] = tb_NOPIECE;
 }
 
+// everything the library needs to probe a position
+struct TBPosition
+{
+	unsigned int stm;
+	unsigned int eps;
+	unsigned int castle;
+
+	unsigned int squareListWhite[17];
+	unsigned char piecesListWhite[17];
+	unsigned int squareListBlack[17];
+	unsigned char piecesListBlack[17];
+};
+
+// returns false if the position has too many pieces to be in the tablebases
+bool MakeTBPosition(const Board &b, TBPosition &pos)
+{
+	pos.stm = (b.GetSideToMove() == WHITE) ? tb_WHITE_TO_MOVE : tb_BLACK_TO_MOVE;
+	pos.eps = b.IsEpAvailable() ? SquareToTBSquare(b.GetEpSquare()) : tb_NOSQUARE;
+
+	pos.castle = 0;
+	if (b.HasCastlingRight(W_SHORT_CASTLE)) pos.castle |= tb_WOO;
+	if (b.HasCastlingRight(W_LONG_CASTLE)) pos.castle |= tb_WOOO;
+	if (b.HasCastlingRight(B_SHORT_CASTLE)) pos.castle |= tb_BOO;
+	if (b.HasCastlingRight(B_LONG_CASTLE)) pos.castle |= tb_BOOO;
+
+	bool tooMany = false;
+	FillPieceLists(b, pos.squareListWhite, pos.piecesListWhite, pos.squareListBlack, pos.piecesListBlack, tooMany);
+
+	return !tooMany;
+}
+
+// info is tb_DRAW, tb_WMATE, or tb_BMATE, and plies is only used for mates
+Score InfoToScore(const Board &b, unsigned int info, unsigned int plies, bool hasDistance)
+{
+	Color winner;
+
+	if (info == tb_DRAW)
+	{
+		return 0;
+	}
+	else if (info == tb_WMATE)
+	{
+		winner = WHITE;
+	}
+	else if (info == tb_BMATE)
+	{
+		winner = BLACK;
+	}
+	else
+	{
+		std::cout << b.GetFen() << std::endl;
+		assert(false);
+		return 0;
+	}
+
+	if (winner == b.GetSideToMove())
+	{
+		return hasDistance ? MakeWinningScore(plies) : GTB::WdlWinScore;
+	}
+	else
+	{
+		return hasDistance ? MakeLosingScore(plies) : -GTB::WdlWinScore;
+	}
+}
+
+// Probe results keyed by Zobrist hash, so repeated probes of the same position (which are very common
+// in search) don't have to build piece lists and go through the library (and its lock) again.
+// There is no locking - the check word is the hash xor'ed with the data, so an entry that was torn by
+// a concurrent write just looks like a miss.
+enum ResultType
+{
+	ResultType_none,
+	ResultType_exact, // draw or distance to mate
+	ResultType_wdl, // win or loss (WdlWinScore), but distance is not known yet
+	ResultType_notFound // hard probe failed (table not available)
+};
+
+struct ResultCacheEntry
+{
+	uint64_t check;
+	uint64_t data;
+};
+
+std::vector<ResultCacheEntry> gResultCache;
+
+ResultType LookupResult(uint64_t hash, Score &score)
+{
+	if (gResultCache.empty())
+	{
+		return ResultType_none;
+	}
+
+	const ResultCacheEntry &entry = gResultCache[hash % gResultCache.size()];
+
+	uint64_t data = entry.data;
+
+	if ((entry.check ^ data) != hash)
+	{
+		return ResultType_none;
+	}
+
+	score = static_cast<Score>(static_cast<uint16_t>(data & 0xffff));
+
+	return static_cast<ResultType>(data >> 16);
+}
+
+void StoreResult(uint64_t hash, ResultType type, Score score)
+{
+	if (gResultCache.empty())
+	{
+		return;
+	}
+
+	ResultCacheEntry &entry = gResultCache[hash % gResultCache.size()];
+
+	uint64_t data = (static_cast<uint64_t>(type) << 16) | static_cast<uint16_t>(score);
+
+	entry.check = hash ^ data;
+	entry.data = data;
+}
+
+void ClearResultCache()
+{
+	std::fill(gResultCache.begin(), gResultCache.end(), ResultCacheEntry{ 0, 0 });
+}
+
+struct SchemeInfo
+{
+	int scheme; // TB_compression_scheme
+	const char *name;
+	const char *description;
+	const char *extension;
+};
+
+// in order of preference (fastest to decompress first)
+const static SchemeInfo Schemes[] =
+{
+	{ tb_UNCOMPRESSED, "none", "uncompressed", ".gtb" },
+	{ tb_CP2, "cp2", "LZF", ".gtb.cp2" },
+	{ tb_CP3, "cp3", "zlib", ".gtb.cp3" },
+	{ tb_CP1, "cp1", "Huffman", ".gtb.cp1" },
+	{ tb_CP4, "cp4", "LZMA", ".gtb.cp4" }
+};
+
+const SchemeInfo *gScheme = nullptr;
+
+const SchemeInfo *FindScheme(const std::string &name)
+{
+	for (const SchemeInfo &info : Schemes)
+	{
+		if (name == info.name)
+		{
+			return &info;
+		}
+	}
+
+	return nullptr;
+}
+
+std::string JoinPath(const std::string &dir, const std::string &filename)
+{
+	if (dir == "" || dir.back() == '/' || dir.back() == '\\')
+	{
+		return dir + filename;
+	}
+
+	return dir + "/" + filename;
+}
+
+bool FileExists(const std::string &filename)
+{
+	std::ifstream f(filename, std::ios::binary);
+	return f.good();
+}
+
+// Names of all tables the library may look for ("kqkr", etc). The library only uses one of each
+// pair of mirrored tables, but we don't need to know which, since we only look for existing files.
+std::vector<std::string> TableNames()
+{
+	// piece letters in the order they appear in table names
+	const static std::string Letters = "qrbnp";
+
+	// all multisets of up to 3 pieces, in table name order
+	std::vector<std::string> sides(1, "");
+
+	for (size_t i = 0; i < sides.size(); ++i)
+	{
+		// copy, since we are appending to sides
+		std::string side = sides[i];
+
+		if (side.size() == (GTB::MaxPieces - 2))
+		{
+			continue;
+		}
+
+		size_t first = side.empty() ? 0 : Letters.find(side.back());
+
+		for (size_t l = first; l < Letters.size(); ++l)
+		{
+			sides.push_back(side + Letters[l]);
+		}
+	}
+
+	std::vector<std::string> ret;
+
+	for (const auto &strongSide : sides)
+	{
+		for (const auto &weakSide : sides)
+		{
+			if (!strongSide.empty() && (strongSide.size() + weakSide.size()) <= (GTB::MaxPieces - 2))
+			{
+				ret.push_back("k" + strongSide + "k" + weakSide);
+			}
+		}
+	}
+
+	return ret;
+}
+
+// the scheme with the most tables in path, or nullptr if there aren't any
+const SchemeInfo *DetectScheme(const std::string &path)
+{
+	std::vector<std::string> names = TableNames();
+
+	const SchemeInfo *ret = nullptr;
+	size_t bestCount = 0;
+
+	for (const SchemeInfo &info : Schemes)
+	{
+		size_t count = 0;
+
+		for (const auto &name : names)
+		{
+			if (FileExists(JoinPath(path, name + info.extension)))
+			{
+				++count;
+			}
+		}
+
+		if (count > bestCount)
+		{
+			ret = &info;
+			bestCount = count;
+		}
+	}
+
+	return ret;
+}
+
+// Tables pinned in memory. The library still reads them through stdio, but from the OS cache instead of the disk.
+struct PreloadedFile
+{
+	void *addr;
+	size_t size;
+};
+
+std::vector<PreloadedFile> gPreloaded;
+
+bool PreloadFile(const std::string &filename, size_t &size)
+{
+#ifndef _WIN32
+	int fd = open(filename.c_str(), O_RDONLY);
+
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct stat st;
+
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	size = static_cast<size_t>(st.st_size);
+
+	int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+	flags |= MAP_POPULATE;
+#endif
+
+	void *addr = mmap(nullptr, size, PROT_READ, flags, fd, 0);
+
+	close(fd);
+
+	if (addr == MAP_FAILED)
+	{
+		return false;
+	}
+
+	madvise(addr, size, MADV_WILLNEED);
+
+	// this fails without the privilege (or RLIMIT_MEMLOCK), in which case the pages can still be evicted under memory
+	// pressure, but the mapping will keep them hot otherwise
+	mlock(addr, size);
+
+	gPreloaded.push_back(PreloadedFile{ addr, size });
+
+	return true;
+#else
+	// no mmap - read the whole file once, so at least it starts in the OS cache
+	std::ifstream f(filename, std::ios::binary);
+
+	if (!f)
+	{
+		return false;
+	}
+
+	std::vector<char> buf(1*MB);
+
+	size = 0;
+
+	while (f.read(&buf[0], buf.size()) || f.gcount() > 0)
+	{
+		size += f.gcount();
+	}
+
+	return true;
+#endif
+}
+
+void ReleasePreloadedFiles()
+{
+#ifndef _WIN32
+	for (const auto &file : gPreloaded)
+	{
+		munmap(file.addr, file.size);
+	}
+#endif
+
+	gPreloaded.clear();
+}
+
+std::string PreloadTables(const std::string &path, const SchemeInfo &scheme, int32_t maxPieces)
+{
+	size_t numTables = 0;
+	size_t totalSize = 0;
+
+	for (const auto &name : TableNames())
+	{
+		// 1 letter per piece
+		if (static_cast<int32_t>(name.size()) > maxPieces)
+		{
+			continue;
+		}
+
+		size_t size = 0;
+
+		if (PreloadFile(JoinPath(path, name + scheme.extension), size))
+		{
+			++numTables;
+			totalSize += size;
+		}
+	}
+
+	std::stringstream ss;
+
+	ss << "# Preloaded " << numTables << " tables with up to " << maxPieces << " pieces ("
+		<< (totalSize / MB) << " MB)" << std::endl;
+
+	return ss.str();
+}
+
+// Compressed files start with a header of 10 little endian 32-bit words (the ones we care about are
+// the block size at 2, and offset of the first block at 8), followed by the file offsets of all blocks,
+// plus one more for the end of the last block. Each block is one byte we don't use, followed by the compressed data.
+// Uncompressed files are all the decompressed blocks, in the same order.
+const static size_t HeaderSize = 40;
+const static size_t HeaderBlockSizeOffset = 2 * 4;
+const static size_t HeaderFirstBlockOffset = 8 * 4;
+
+uint32_t ReadUint32(const std::vector<unsigned char> &data, size_t offset)
+{
+	return static_cast<uint32_t>(data[offset]) |
+		(static_cast<uint32_t>(data[offset + 1]) << 8) |
+		(static_cast<uint32_t>(data[offset + 2]) << 16) |
+		(static_cast<uint32_t>(data[offset + 3]) << 24);
+}
+
+bool DecodeBlock(int scheme, const unsigned char *in, size_t inSize, unsigned char *out, size_t outMax, size_t &outSize)
+{
+	switch (scheme)
+	{
+	case tb_CP1:
+		return huff_decode(in, inSize, out, &outSize, outMax);
+	case tb_CP2:
+		return lzf_decode(in, inSize, out, &outSize, outMax);
+	case tb_CP3:
+		return zlib_decode(in, inSize, out, &outSize, outMax);
+	case tb_CP4:
+	{
+		// LZMA needs to be told exactly how much to decode, which is in the Lzma86 header
+		// (1 byte filter, 5 bytes properties, then 8 bytes unpacked size)
+		const static size_t Lzma86HeaderSize = 14;
+		const static size_t Lzma86SizeOffset = 6;
+
+		if (inSize < Lzma86HeaderSize)
+		{
+			return false;
+		}
+
+		uint64_t unpackedSize = 0;
+
+		for (size_t i = 0; i < 8; ++i)
+		{
+			unpackedSize |= static_cast<uint64_t>(in[Lzma86SizeOffset + i]) << (i * 8);
+		}
+
+		if (unpackedSize > outMax)
+		{
+			return false;
+		}
+
+		outSize = unpackedSize;
+
+		return lzma_decode(in, inSize, out, &outSize, outSize);
+	}
+	default:
+		return false;
+	}
+}
+
+bool EncodeBlock(int scheme, const unsigned char *in, size_t inSize, unsigned char *out, size_t outMax, size_t &outSize)
+{
+	switch (scheme)
+	{
+	case tb_CP1:
+		return huff_encode(in, inSize, out, &outSize, outMax);
+	case tb_CP2:
+		// this fails if the block doesn't get smaller - the library decodes all blocks of a file with the same scheme
+		// (the byte in front of each block is not used), so there is no way to store a block as is, and the caller
+		// reports an error instead
+		return lzf_encode(in, inSize, out, &outSize, outMax);
+	case tb_CP3:
+		return zlib_encode(in, inSize, out, &outSize, outMax);
+	case tb_CP4:
+		return lzma_encode(in, inSize, out, &outSize, outMax);
+	default:
+		return false;
+	}
+}
+
+bool ReadFile(const std::string &filename, std::vector<unsigned char> &data)
+{
+	std::ifstream f(filename, std::ios::binary);
+
+	if (!f)
+	{
+		return false;
+	}
+
+	data.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+
+	return true;
+}
+
+struct CompressedFile
+{
+	std::vector<unsigned char> data;
+
+	size_t blockSize;
+	size_t firstBlockOffset;
+
+	// file offsets of all blocks, plus one for the end of the last block
+	std::vector<uint32_t> index;
+
+	size_t NumBlocks() const { return index.size() - 1; }
+};
+
+// reads a compressed file and its block index, and returns an empty string on success
+std::string ReadCompressedFile(const std::string &filename, CompressedFile &file)
+{
+	if (!ReadFile(filename, file.data))
+	{
+		return "failed to read " + filename;
+	}
+
+	if (file.data.size() < HeaderSize)
+	{
+		return filename + " is too short";
+	}
+
+	file.blockSize = ReadUint32(file.data, HeaderBlockSizeOffset);
+	file.firstBlockOffset = ReadUint32(file.data, HeaderFirstBlockOffset);
+
+	if (file.firstBlockOffset < (HeaderSize + 8) || file.firstBlockOffset > file.data.size() || file.blockSize == 0)
+	{
+		return filename + " has an invalid header";
+	}
+
+	size_t numBlocks = (file.firstBlockOffset - HeaderSize) / 4 - 1;
+
+	file.index.resize(numBlocks + 1);
+
+	for (size_t i = 0; i <= numBlocks; ++i)
+	{
+		file.index[i] = ReadUint32(file.data, HeaderSize + i * 4);
+	}
+
+	for (size_t i = 0; i < numBlocks; ++i)
+	{
+		if (file.index[i + 1] <= file.index[i] || file.index[i + 1] > file.data.size())
+		{
+			return filename + " has an invalid block index";
+		}
+	}
+
+	return "";
+}
+
+// out must have room for a whole block
+bool DecodeFileBlock(const CompressedFile &file, int scheme, size_t block, std::vector<unsigned char> &out, size_t &outSize)
+{
+	size_t begin = file.index[block];
+	size_t end = file.index[block + 1];
+
+	// skip the first byte of the block
+	return DecodeBlock(scheme, &file.data[begin + 1], end - begin - 1, &out[0], out.size(), outSize);
+}
+
+// reads back a file written by RecompressFile, and checks that every block decodes to the same data as the source
+// returns an empty string on success
+std::string VerifyFile(const std::string &srcFilename, const CompressedFile &src, const SchemeInfo &srcScheme, const std::string &dstFilename, const SchemeInfo &dstScheme)
+{
+	std::vector<unsigned char> srcDecoded(src.blockSize);
+	std::vector<unsigned char> dstDecoded(src.blockSize);
+
+	CompressedFile dst;
+
+	if (dstScheme.scheme == tb_UNCOMPRESSED)
+	{
+		if (!ReadFile(dstFilename, dst.data))
+		{
+			return "failed to read back " + dstFilename;
+		}
+	}
+	else
+	{
+		std::string err = ReadCompressedFile(dstFilename, dst);
+
+		if (err != "")
+		{
+			return err;
+		}
+
+		if (dst.blockSize != src.blockSize || dst.NumBlocks() != src.NumBlocks())
+		{
+			return dstFilename + " has a different block layout from " + srcFilename;
+		}
+	}
+
+	// only used for uncompressed files
+	size_t offset = 0;
+
+	for (size_t block = 0; block < src.NumBlocks(); ++block)
+	{
+		size_t srcSize = 0;
+
+		if (!DecodeFileBlock(src, srcScheme.scheme, block, srcDecoded, srcSize))
+		{
+			return "failed to decode block " + std::to_string(block) + " of " + srcFilename;
+		}
+
+		const unsigned char *dstData = nullptr;
+		size_t dstSize = 0;
+
+		if (dstScheme.scheme == tb_UNCOMPRESSED)
+		{
+			dstData = dst.data.data() + offset;
+			dstSize = std::min(srcSize, dst.data.size() - offset);
+			offset += dstSize;
+		}
+		else
+		{
+			if (!DecodeFileBlock(dst, dstScheme.scheme, block, dstDecoded, dstSize))
+			{
+				return "failed to decode block " + std::to_string(block) + " of " + dstFilename;
+			}
+
+			dstData = dstDecoded.data();
+		}
+
+		if (dstSize != srcSize || memcmp(dstData, srcDecoded.data(), srcSize) != 0)
+		{
+			return "block " + std::to_string(block) + " of " + dstFilename + " doesn't match " + srcFilename;
+		}
+	}
+
+	if (dstScheme.scheme == tb_UNCOMPRESSED && offset != dst.data.size())
+	{
+		return dstFilename + " is longer than " + srcFilename + " decoded";
+	}
+
+	return "";
+}
+
+// returns an empty string on success
+std::string RecompressFile(const std::string &srcFilename, const SchemeInfo &srcScheme, const std::string &dstFilename, const SchemeInfo &dstScheme)
+{
+	CompressedFile src;
+
+	std::string err = ReadCompressedFile(srcFilename, src);
+
+	if (err != "")
+	{
+		return err;
+	}
+
+	std::vector<unsigned char> dst;
+
+	if (dstScheme.scheme != tb_UNCOMPRESSED)
+	{
+		// the header doesn't depend on the compression scheme, and we have the same number of blocks
+		dst.assign(src.data.begin(), src.data.begin() + src.firstBlockOffset);
+	}
+
+	std::vector<unsigned char> decoded(src.blockSize);
+
+	// some encoders need a bit more space than the input when data is incompressible
+	std::vector<unsigned char> encoded(src.blockSize * 2 + 1024);
+
+	for (size_t block = 0; block < src.NumBlocks(); ++block)
+	{
+		size_t decodedSize = 0;
+
+		if (!DecodeFileBlock(src, srcScheme.scheme, block, decoded, decodedSize))
+		{
+			return "failed to decode block " + std::to_string(block) + " of " + srcFilename;
+		}
+
+		if (dstScheme.scheme == tb_UNCOMPRESSED)
+		{
+			dst.insert(dst.end(), decoded.begin(), decoded.begin() + decodedSize);
+			continue;
+		}
+
+		size_t encodedSize = 0;
+
+		if (!EncodeBlock(dstScheme.scheme, &decoded[0], decodedSize, &encoded[0], encoded.size(), encodedSize))
+		{
+			return "failed to encode block " + std::to_string(block) + " of " + srcFilename + " with " + dstScheme.name;
+		}
+
+		dst.push_back(static_cast<unsigned char>(dstScheme.scheme));
+		dst.insert(dst.end(), encoded.begin(), encoded.begin() + encodedSize);
+
+		size_t indexOffset = HeaderSize + (block + 1) * 4;
+
+		if (dst.size() > 0xffffffffULL)
+		{
+			return dstFilename + " is too big for the file format";
+		}
+
+		for (size_t i = 0; i < 4; ++i)
+		{
+			dst[indexOffset + i] = static_cast<unsigned char>(dst.size() >> (i * 8));
+		}
+	}
+
+	{
+		std::ofstream outfile(dstFilename, std::ios::binary);
+
+		outfile.write(reinterpret_cast<const char *>(&dst[0]), dst.size());
+
+		if (!outfile)
+		{
+			return "failed to write " + dstFilename;
+		}
+	}
+
+	// this decodes the source again, but we don't want to keep a whole decoded table in memory
+	err = VerifyFile(srcFilename, src, srcScheme, dstFilename, dstScheme);
+
+	if (err != "")
+	{
+		// so it's not used by mistake
+		std::remove(dstFilename.c_str());
+	}
+
+	return err;
+}
+
 }
 
 namespace GTB
@@ -137,7 +844,7 @@ namespace GTB
 static bool initialized = false;
 static const char **paths;
 
-std::string Init(std::string path)
+std::string Init(std::string path, int32_t preloadPieces)
 {
 	if (path == "")
 	{
@@ -155,13 +862,33 @@ std::string Init(std::string path)
 		return std::string();
 	}
 
+	if (preloadPieces < 0)
+	{
+		const char *envRet = getenv("GTBPreload");
+		preloadPieces = (envRet != nullptr) ? atoi(envRet) : 0;
+	}
+
+	// re-initializing with a different path
+	DeInit();
+
+	std::stringstream ssOut;
+
+	gScheme = DetectScheme(path);
+
+	if (gScheme == nullptr)
+	{
+		// let the library report missing files
+		ssOut << "# No tablebase files found in " << path << std::endl;
+		gScheme = FindScheme("cp4");
+	}
+
+	ssOut << "# Using compression scheme " << gScheme->name << " (" << gScheme->description << ")" << std::endl;
+
 	paths = tbpaths_init();
 
 	paths = tbpaths_add(paths, path.c_str());
 
-	char *initInfo = tb_init(1, tb_CP4, paths);
-
-	std::stringstream ssOut;
+	char *initInfo = tb_init(1, gScheme->scheme, paths);
 
 	if (initInfo != nullptr)
 	{
@@ -178,12 +905,20 @@ std::string Init(std::string path)
 
 	tbstats_reset();
 
+	gResultCache.resize(ResultCacheSize / sizeof(ResultCacheEntry));
+	ClearResultCache();
+
+	if (preloadPieces > 0)
+	{
+		ssOut << PreloadTables(path, *gScheme, preloadPieces);
+	}
+
 	initialized = true;
 
 	return ssOut.str();
 }
 
-ProbeResult Probe(const Board &b)
+ProbeResult Probe(const Board &b, bool allowHard)
 {
 	ProbeResult ret;
 
@@ -192,31 +927,30 @@ ProbeResult Probe(const Board &b)
 		return ret;
 	}
 
-	// first we check total number of pawns, to rule out the majority of positions
-	// if we have more than MaxPieces-2 pawns, the position won't be in TB (2 for 2 kings)
-	if ((b.GetPieceCount(WP) + b.GetPieceCount(BP)) > (MaxPieces - 2))
+	// first we check total number of pieces, to rule out the majority of positions without touching the cache
+	if (PopCount(b.GetOccupiedBitboard<WHITE>() | b.GetOccupiedBitboard<BLACK>()) > MaxPieces)
 	{
 		return ret;
 	}
 
-	uint32_t stm = (b.GetSideToMove() == WHITE) ? tb_WHITE_TO_MOVE : tb_BLACK_TO_MOVE;
-	unsigned int eps = b.IsEpAvailable() ? SquareToTBSquare(b.GetEpSquare()) : tb_NOSQUARE;
+	uint64_t hash = b.GetHash();
 
-	unsigned int castle = 0;
-	if (b.HasCastlingRight(W_SHORT_CASTLE)) castle |= tb_WOO;
-	if (b.HasCastlingRight(W_LONG_CASTLE)) castle |= tb_WOOO;
-	if (b.HasCastlingRight(B_SHORT_CASTLE)) castle |= tb_BOO;
-	if (b.HasCastlingRight(B_LONG_CASTLE)) castle |= tb_BOOO;
+	Score cachedScore = 0;
+	ResultType cachedType = LookupResult(hash, cachedScore);
 
-	unsigned int squareListWhite[17];
-	unsigned char piecesListWhite[17];
-	unsigned int squareListBlack[17];
-	unsigned char piecesListBlack[17];
+	if (cachedType == ResultType_exact || (cachedType == ResultType_wdl && !allowHard))
+	{
+		ret = cachedScore;
+		return ret;
+	}
+	else if (cachedType == ResultType_notFound)
+	{
+		return ret;
+	}
 
-	bool tooMany = false;
-	FillPieceLists(b, squareListWhite, piecesListWhite, squareListBlack, piecesListBlack, tooMany);
+	TBPosition pos;
 
-	if (tooMany)
+	if (!MakeTBPosition(b, pos))
 	{
 		return ret;
 	}
@@ -224,45 +958,204 @@ ProbeResult Probe(const Board &b)
 	unsigned int info = 0;
 	unsigned int plies = 0;
 
-	bool avail = false;
-
-	#pragma omp critical(tbProbe)
+	// no need for our own lock here - the library locks its cache internally, and releases
+	// the lock while reading and decompressing blocks, so probes from different threads can overlap
+	if (allowHard)
 	{
-		avail = tb_probe_hard(
-			stm,
-			eps,
-			castle,
-			squareListWhite,
-			squareListBlack,
-			piecesListWhite,
-			piecesListBlack,
-			&info,
-			&plies);
+		bool avail = tb_probe_hard(
+			pos.stm, pos.eps, pos.castle,
+			pos.squareListWhite, pos.squareListBlack, pos.piecesListWhite, pos.piecesListBlack,
+			&info, &plies);
+
+		if (!avail)
+		{
+			// the table is not available, and won't be next time either
+			StoreResult(hash, ResultType_notFound, 0);
+			return ret;
+		}
+
+		ret = InfoToScore(b, info, plies, true);
+		StoreResult(hash, ResultType_exact, *ret);
+
+		return ret;
 	}
 
+	// soft probes only look at blocks that are already in the library's caches
+	// WDL first, since the WDL cache is much denser, and most positions in practice are draws
+	bool avail = tb_probe_WDL_soft(
+		pos.stm, pos.eps, pos.castle,
+		pos.squareListWhite, pos.squareListBlack, pos.piecesListWhite, pos.piecesListBlack,
+		&info);
+
 	if (!avail)
 	{
+		// not cached, since it may be available next time
 		return ret;
 	}
-	else if (info == tb_DRAW)
+
+	if (info == tb_DRAW)
 	{
 		ret = 0;
+		StoreResult(hash, ResultType_exact, 0);
+		return ret;
 	}
-	else if ((info == tb_WMATE && b.GetSideToMove() == WHITE) || (info == tb_BMATE && b.GetSideToMove() == BLACK))
+
+	// we know who wins, and may also be able to get the distance without IO
+	avail = tb_probe_soft(
+		pos.stm, pos.eps, pos.castle,
+		pos.squareListWhite, pos.squareListBlack, pos.piecesListWhite, pos.piecesListBlack,
+		&info, &plies);
+
+	ret = InfoToScore(b, info, plies, avail);
+	StoreResult(hash, avail ? ResultType_exact : ResultType_wdl, *ret);
+
+	return ret;
+}
+
+void DebugRunProbeBenchmark(const std::string &epdFilename)
+{
+	if (!initialized)
 	{
-		ret = MakeWinningScore(plies);
+		std::cout << "GTB not initialized" << std::endl;
+		return;
 	}
-	else if ((info == tb_WMATE && b.GetSideToMove() == BLACK) || (info == tb_BMATE && b.GetSideToMove() == WHITE))
+
+	std::ifstream infile(epdFilename);
+
+	if (!infile)
 	{
-		ret = MakeLosingScore(plies);
+		std::cout << "Failed to open " << epdFilename << " for reading" << std::endl;
+		return;
 	}
-	else
+
+	std::vector<Board> boards;
+	std::string fen;
+
+	while (std::getline(infile, fen))
 	{
-		std::cout << b.GetFen() << std::endl;
-		assert(false);
+		if (fen != "")
+		{
+			boards.push_back(Board(fen));
+		}
 	}
 
-	return ret;
+	std::cout << "Probing " << boards.size() << " positions, compression scheme " << gScheme->name
+		<< " (" << gScheme->description << ")" << std::endl;
+
+	double singleThreadRate = 0.0;
+
+	for (int32_t numThreads = 1; ; numThreads *= 2)
+	{
+		// all runs start with a cold cache, so they do the same amount of IO
+		tbcache_flush();
+		ClearResultCache();
+
+		int64_t found = 0;
+
+		double startTime = CurrentTime();
+
+		{
+			ScopedThreadLimiter tlim(numThreads);
+
+			#pragma omp parallel for schedule(dynamic) reduction(+:found)
+			for (size_t i = 0; i < boards.size(); ++i)
+			{
+				if (Probe(boards[i]))
+				{
+					++found;
+				}
+			}
+		}
+
+		double elapsed = CurrentTime() - startTime;
+		double rate = boards.size() / elapsed;
+
+		if (numThreads == 1)
+		{
+			singleThreadRate = rate;
+		}
+
+		std::cout << std::setw(3) << numThreads << " thread(s): "
+			<< std::fixed << std::setprecision(0) << rate << " probes/s, "
+			<< std::setprecision(2) << (rate / singleThreadRate) << "x, "
+			<< found << " found";
+
+		if (numThreads == 1)
+		{
+			std::cout << ", " << std::setprecision(2) << (elapsed / boards.size() * 1000000.0) << " us/probe";
+		}
+
+		std::cout << std::endl;
+
+		if (numThreads >= omp_get_max_threads())
+		{
+			break;
+		}
+	}
+}
+
+bool Recompress(const std::string &srcPath, const std::string &dstPath, const std::string &schemeName)
+{
+	const SchemeInfo *dstScheme = FindScheme(schemeName);
+
+	if (dstScheme == nullptr)
+	{
+		std::cout << "Unknown compression scheme " << schemeName << std::endl;
+		return false;
+	}
+
+	const SchemeInfo *srcScheme = DetectScheme(srcPath);
+
+	if (srcScheme == nullptr || srcScheme->scheme == tb_UNCOMPRESSED)
+	{
+		std::cout << "No compressed tablebase files found in " << srcPath << std::endl;
+		return false;
+	}
+
+	std::vector<std::string> names;
+
+	for (const auto &name : TableNames())
+	{
+		if (FileExists(JoinPath(srcPath, name + srcScheme->extension)))
+		{
+			names.push_back(name);
+		}
+	}
+
+	std::cout << "Recompressing " << names.size() << " tables from " << srcScheme->name << " to " << dstScheme->name << std::endl;
+
+	// the Huffman coder uses global state
+	bool reentrant = srcScheme->scheme != tb_CP1 && dstScheme->scheme != tb_CP1;
+
+	bool ok = true;
+
+	double startTime = CurrentTime();
+
+	#pragma omp parallel for schedule(dynamic) if(reentrant)
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		std::string srcFilename = JoinPath(srcPath, names[i] + srcScheme->extension);
+		std::string dstFilename = JoinPath(dstPath, names[i] + dstScheme->extension);
+
+		std::string error = RecompressFile(srcFilename, *srcScheme, dstFilename, *dstScheme);
+
+		#pragma omp critical(recompressOutput)
+		{
+			if (error == "")
+			{
+				std::cout << names[i] << std::endl;
+			}
+			else
+			{
+				std::cout << "Error: " << error << std::endl;
+				ok = false;
+			}
+		}
+	}
+
+	std::cout << "Done in " << (CurrentTime() - startTime) << " seconds" << std::endl;
+
+	return ok;
 }
 
 void DeInit()
@@ -275,6 +1168,13 @@ void DeInit()
 	tbpaths_done(paths);
 	tbcache_done();
 	tb_done();
+
+	ReleasePreloadedFiles();
+
+	gResultCache.clear();
+	gResultCache.shrink_to_fit();
+
+	initialized = false;
 }
 
 }
@@ -34,12 +34,38 @@ namespace GTB
 static const size_t CacheSize = 32*MB;
 static const size_t WdlFraction = 96; // use 3/4 of the cache for WDL
 static const size_t MaxPieces = 5;
+static const size_t ResultCacheSize = 4*MB; // our own cache of probe results, in front of the library
+
+// score for tablebase wins when we only know the result and not the distance to mate (from soft probes)
+// it's higher than any evaluation, but lower than all mate scores, so search still prefers a known mate
+static const Score WdlWinScore = MATE_MOVING_SIDE_THRESHOLD - 1000;
 
 typedef Optional<Score> ProbeResult;
 
-std::string Init(std::string path = "");
+// The compression scheme is detected from the files in path - if there are tables in more than one scheme, we use
+// the one with the most tables (and the one fastest to decompress if there's a tie). See Recompress().
+// Tables with up to preloadPieces pieces are mapped into memory on startup, so probes into them never wait
+// for the disk (-1 = use the GTBPreload environment variable, 0 = don't preload anything).
+std::string Init(std::string path = "", int32_t preloadPieces = -1);
+
+// thread-safe
+// with allowHard, the result is always a draw or exact distance to mate, and the library reads from disk if necessary
+// without allowHard, only results already in memory are used (this is for interior nodes in search, where we can't
+// afford IO), and wins and losses may come back as +/- WdlWinScore if we don't have the distance yet
+ProbeResult Probe(const Board &b, bool allowHard = true);
+
+// probes all positions in the file with 1, 2, 4, ... threads (up to the OpenMP limit), starting
+// from a cold cache each time, and reports throughput and single-thread latency for the scheme in use
+void DebugRunProbeBenchmark(const std::string &epdFilename);
 
-ProbeResult Probe(const Board &b);
+// Re-encodes all tables found in srcPath with another compression scheme, and writes them to dstPath.
+// LZMA (cp4, the scheme tables are usually distributed in) is slow to decompress, and decompression
+// dominates probe latency once the files are in the OS cache. LZF (cp2) files are about twice as big,
+// but decompress many times faster.
+// schemeName is one of none (uncompressed), cp1 (Huffman), cp2 (LZF), cp3 (zlib), and cp4 (LZMA).
+// Every block of each new file is read back, decoded, and compared with the source.
+// Returns false on error (including when a block can't be encoded with the scheme, or fails verification).
+bool Recompress(const std::string &srcPath, const std::string &dstPath, const std::string &schemeName);
 
 void DeInit();
 
@@ -300,9 +300,17 @@ static int GTB_scheme = 4;
 
 static int GTB_MAXOPEN = 4;
 
+#if defined(_MSC_VER)
+	#define GTB_THREAD_LOCAL __declspec(thread)
+#else
+	#define GTB_THREAD_LOCAL __thread
+#endif
+
 static bool_t 			Uncompressed = TRUE;
-static unsigned char 	Buffer_zipped [EGTB_MAXBLOCKSIZE];
-static unsigned char 	Buffer_packed [EGTB_MAXBLOCKSIZE];
+
+/* per thread, so blocks can be read and decoded concurrently (see preload_cache) */
+static GTB_THREAD_LOCAL unsigned char 	Buffer_zipped [EGTB_MAXBLOCKSIZE];
+static GTB_THREAD_LOCAL unsigned char 	Buffer_packed [EGTB_MAXBLOCKSIZE];
 static unsigned int		zipinfo_init (void);
 static void 			zipinfo_done (void);
 
@@ -331,7 +339,14 @@ static size_t			WDL_cache_size = 0;
 static unsigned int		TB_AVAILABILITY = 0;
 
 /* LOCKS */
+/* 
+|	Egtb_lock protects the caches, the egkey table, and the list of open files.
+|	Egtb_io_lock protects file positions (all fseek/fread on tablebase files) and
+|	closing of files. It's only ever acquired while holding Egtb_lock (and
+|	Egtb_lock is then released), so there is no lock order inversion.
+\*/
 static mythread_mutex_t	Egtb_lock;
+static mythread_mutex_t	Egtb_io_lock;
 
 
 /****************************************************************************\
@@ -1155,6 +1170,7 @@ tb_init (int verbosity, int decoding_sch, const char **paths)
 	Bytes_read = 0;
 
 	mythread_mutex_init (&Egtb_lock);
+	mythread_mutex_init (&Egtb_io_lock);
 
 	TB_INITIALIZED = TRUE;
 
@@ -1182,6 +1198,7 @@ tb_done (void)
 	zipinfo_done();
 	path_system_done();
 	mythread_mutex_destroy (&Egtb_lock);
+	mythread_mutex_destroy (&Egtb_io_lock);
 	TB_INITIALIZED = FALSE;
 
 	/*
@@ -1702,8 +1719,10 @@ egtb_filepeek (tbkey_t key, unsigned side, index_t idx, dtm_t *out_dtm)
 		}	
 	#endif
 
+	mythread_mutex_lock (&Egtb_io_lock);
 	ok = fpark_entry_packed (finp, side, maxindex, idx);
 	ok = ok && fread_entry_packed (finp, side, &x);
+	mythread_mutex_unlock (&Egtb_io_lock);
 
 	if (ok) {
 		*out_dtm = x;		
@@ -1870,12 +1889,15 @@ fd_openit (tbkey_t key)
 	if (fd.n == GTB_MAXOPEN) {
 
 		/* fclose the last accessed, first in the list */
+		/* another thread may still be reading from it (see preload_cache) */
+		mythread_mutex_lock (&Egtb_io_lock);
 		closingkey = fd.key[0];
 		finp = egkey [closingkey].fd;
 		assert (finp != NULL);
 		fclose (finp);
 		egkey[closingkey].fd = NULL;
 		finp = NULL;
+		mythread_mutex_unlock (&Egtb_io_lock);
 
 		for (i = 1; i < fd.n; i++) {
 			fd.key[i-1] = fd.key[i]; 		
@@ -3133,13 +3155,31 @@ egtb_block_unpack (unsigned side, index_t n, const unsigned char *bp, dtm_t *out
 	return TRUE;
 }
 
+static bool_t
+decoding_is_reentrant (void)
+{
+	/* the huffman decoder keeps its state in static variables */
+	return decoding_scheme() != tb_CP1;
+}
+
 static bool_t
 preload_cache (tbkey_t key, unsigned side, index_t idx)
 /* output to the least used block of the cache */
+/* 
+|	Called with Egtb_lock held. The lock is released while the block is read
+|	and decoded (into this thread's buffers), so other threads can use the
+|	cache, and decode their own blocks, at the same time. File access is
+|	serialized by Egtb_io_lock.
+\*/
 {
 	dtm_block_t 	*pblock;
-	dtm_t 			*p;
 	bool_t 			ok;
+	bool_t			decoded;
+	index_t 		block = 0;
+	index_t 		n = 0;
+	index_t 		z = 0;
+	index_t 		offset;
+	index_t			remainder;
 
 	FOLLOW_label("preload_cache starts")
 
@@ -3147,70 +3187,73 @@ preload_cache (tbkey_t key, unsigned side, index_t idx)
 		FOLLOW_LULU("Wrong index", __LINE__, idx)	
 		return FALSE;
 	}
-	
-	/* find aged blocked in cache */
-	pblock = point_block_to_replace();
 
-	if (NULL == pblock)
+	/* no cache is being used */
+	if (dtm_cache.max_blocks == 0)
 		return FALSE;
 
-	p = pblock->p_arr;
-
-	if (Uncompressed) {
+	ok = egtb_file_beready (key);
 
-		index_t block = egtb_block_getnumber (key, side, idx);
-		index_t n     = egtb_block_getsize   (key, idx);
+	FOLLOW_LULU("preload_cache", __LINE__, ok)
 
-		ok =	   egtb_file_beready (key)
-				&& egtb_block_park   (key, block)
-				&& egtb_block_read   (key, n, Buffer_packed)
-				&& egtb_block_unpack (side, n, Buffer_packed, p);	
+	if (!ok)
+		return FALSE;
 
-		FOLLOW_LULU("preload_cache", __LINE__, ok)
+	block = egtb_block_getnumber (key, side, idx);
+	n     = egtb_block_getsize   (key, idx);
 
+	if (Uncompressed) {
 		assert (decoding_scheme() == 0 && GTB_scheme == 0);	
+		z = n;
+	} else {
+		z = egtb_block_getsize_zipped (key, block);
+	}
 
-		if (ok) { Bytes_read = Bytes_read + (uint64_t) n; }
+	/* 
+	|	take the io lock before releasing the cache lock, so the file
+	|	can't be closed by another thread in between 
+	*/
+	mythread_mutex_lock (&Egtb_io_lock);
+	mythread_mutex_unlock (&Egtb_lock);
 
-	} else {
+	ok =	   egtb_block_park   (key, block)
+			&& egtb_block_read   (key, z, Uncompressed ? Buffer_packed : Buffer_zipped);
+	FOLLOW_LULU("preload_cache", __LINE__, ok)
 
-        index_t block = 0;
-		index_t n = 0;
-		index_t z = 0;
-		
-		ok =	   egtb_file_beready (key);
+	decoded = Uncompressed;
 
-		FOLLOW_LULU("preload_cache", __LINE__, ok)
+	if (ok && !decoded && !decoding_is_reentrant()) {
+		ok = egtb_block_decode (key, z, Buffer_zipped, n, Buffer_packed);
+		decoded = TRUE;
+	}
 
-		if (ok) {
-			block = egtb_block_getnumber (key, side, idx);
-			n     = egtb_block_getsize   (key, idx);
-			z     = egtb_block_getsize_zipped (key, block);				
-		}
+	mythread_mutex_unlock (&Egtb_io_lock);
+
+	if (ok && !decoded) {
+		ok = egtb_block_decode (key, z, Buffer_zipped, n, Buffer_packed);
+	}
+	FOLLOW_LULU("preload_cache", __LINE__, ok)
+
+	mythread_mutex_lock (&Egtb_lock);
 
-		ok =	   ok
-				&& egtb_block_park   (key, block);
-		FOLLOW_LULU("preload_cache", __LINE__, ok)
+	if (!ok)
+		return FALSE;
 
-		ok =	   ok	
-				&& egtb_block_read   (key, z, Buffer_zipped);
-		FOLLOW_LULU("preload_cache", __LINE__, ok)
+	Bytes_read = Bytes_read + (uint64_t) z;
 
-		ok =	   ok		
-				&& egtb_block_decode (key, z, Buffer_zipped, n, Buffer_packed);
-		FOLLOW_LULU("preload_cache", __LINE__, ok)
+	/* another thread may have loaded the same block while we were decoding */
+	if (NULL != dtm_cache_pointblock (key, side, idx))
+		return TRUE;
 
-		ok =	   ok		 
-				&& egtb_block_unpack (side, n, Buffer_packed, p);	
-		FOLLOW_LULU("preload_cache", __LINE__, ok)
+	/* find aged blocked in cache */
+	pblock = point_block_to_replace();
 
-		if (ok) { Bytes_read = Bytes_read + (uint64_t) z; }
-	}
+	if (NULL == pblock)
+		return FALSE;
 
-	if (ok) {
+	ok = egtb_block_unpack (side, n, Buffer_packed, pblock->p_arr);
 
-		index_t 		offset;
-		index_t			remainder;
+	if (ok) {
 		split_index (dtm_cache.entries_per_block, idx, &offset, &remainder); 
 
 		pblock->key    = key;
@@ -23,13 +23,23 @@
 #include <algorithm>
 #include <random>
 #include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <deque>
+#include <list>
+#include <atomic>
+#include <chrono>
 
 #include <cmath>
+#include <cstring>
 
 #include <omp.h>
 
 #include "matrix_ops.h"
 #include "board.h"
+#include "packed_position.h"
 #include "ann/features_conv.h"
 #include "ann/learn_ann.h"
 #include "omp_scoped_thread_limiter.h"
@@ -45,6 +55,7 @@
 #include "static_move_evaluator.h"
 #include "util.h"
 #include "stats.h"
+#include "socket_util.h"
 
 namespace
 {
@@ -67,40 +78,651 @@ bool fileExists(const std::string &filename)
 	return is.good();
 }
 
+struct TrainingExample
+{
+	PackedPosition position;
+	float target;
+
+	// only examples that went through TD have errors (end positions don't)
+	bool hasError;
+	float absError;
+
+	// iteration of the net that generated this example
+	int64_t version;
+};
+
+// everything a generator thread needs to play, kept across examples
+struct GeneratorState
+{
+	GeneratorState() : ttable(1*MB), rng(gRd.MakeMT()), version(-1) {}
+
+	Killer killer;
+	TTable ttable; // we want the ttable to fit in L3
+	CounterMove counter;
+	History history;
+
+	std::mt19937 rng;
+
+	// each thread has its own copy of the net, updated when a new snapshot is published
+	ANNEvaluator annEvaluator;
+	int64_t version;
+};
+
+// plays from the root position, and computes the TD target for the leaf of the PV
+// returns false if the root position can't be used
+bool GenerateExample(GeneratorState &gs, const PackedPosition &root, TrainingExample &example)
+{
+	gs.ttable.ClearTable(); // this is a cheap clear that simply ages the table a bunch so all new positions have higher priority
+
+	Board rootPos(root);
+
+	if (rootPos.GetGameStatus() != Board::ONGOING)
+	{
+		return false;
+	}
+
+	{
+		// make 1 random move
+		// it's very important that we make an odd number of moves, so that if the move is something stupid, the
+		// opponent can take advantage of it (and we will learn that this position is bad) before we have a chance to
+		// fix it
+		MoveList ml;
+		rootPos.GenerateAllLegalMoves<Board::ALL>(ml);
+
+		auto movePickerDist = std::uniform_int_distribution<size_t>(0, ml.GetSize() - 1);
+
+		rootPos.ApplyMove(ml[movePickerDist(gs.rng)]);
+
+		if (rootPos.GetGameStatus() != Board::ONGOING)
+		{
+			return false;
+		}
+	}
+
+	Search::SearchResult rootResult = Search::SyncSearchNodeLimited(rootPos, SearchNodeBudget, &gs.annEvaluator, &gStaticMoveEvaluator, &gs.killer, &gs.ttable, &gs.counter, &gs.history);
+
+	Board leafPos = rootPos;
+	leafPos.ApplyVariation(rootResult.pv);
+
+	float leafScore = gs.annEvaluator.EvaluateForWhite(leafPos); // this should theoretically be the same as the search result, except for mates, etc
+
+	float rootScoreWhite = rootResult.score * (rootPos.GetSideToMove() == WHITE ? 1.0f : -1.0f);
+
+	example.position = leafPos.Pack();
+	example.version = gs.version;
+	example.hasError = false;
+
+	float leafScoreUnscaled = gs.annEvaluator.UnScale(leafScore);
+
+	if (rootResult.pv.size() > 0 && (leafScore == rootScoreWhite))
+	{
+		rootPos.ApplyMove(rootResult.pv[0]);
+		gs.killer.MoveMade();
+		gs.ttable.AgeTable();
+		gs.history.NotifyMoveMade();
+
+		// now we compute the error by making a few moves
+		float accumulatedError = 0.0f;
+		float lastScore = leafScoreUnscaled;
+		float tdDiscount = 1.0f;
+		float absoluteDiscount = AbsLambda;
+
+		for (int64_t m = 0; m < HalfMovesToMake; ++m)
+		{
+			Search::SearchResult result = Search::SyncSearchNodeLimited(rootPos, SearchNodeBudget, &gs.annEvaluator, &gStaticMoveEvaluator, &gs.killer, &gs.ttable, &gs.counter, &gs.history);
+
+			float scoreWhiteUnscaled = gs.annEvaluator.UnScale(result.score * (rootPos.GetSideToMove() == WHITE ? 1.0f : -1.0f)) * absoluteDiscount;
+
+			absoluteDiscount *= AbsLambda;
+
+			// compute error contribution (only if same side)
+			if (m % 2 == 1)
+			{
+				accumulatedError += tdDiscount * (scoreWhiteUnscaled - lastScore);
+				lastScore = scoreWhiteUnscaled;
+				tdDiscount *= TDLambda;
+			}
+
+			if ((rootPos.GetGameStatus() != Board::ONGOING) || (result.pv.size() == 0))
+			{
+				break;
+			}
+
+			rootPos.ApplyMove(result.pv[0]);
+			gs.killer.MoveMade();
+			gs.ttable.AgeTable();
+			gs.history.NotifyMoveMade();
+		}
+
+		example.hasError = true;
+		example.absError = fabs(accumulatedError);
+
+		accumulatedError = std::max(accumulatedError, -MaxError);
+		accumulatedError = std::min(accumulatedError, MaxError);
+
+		example.target = leafScoreUnscaled + LearningRate * accumulatedError;
+	}
+	else
+	{
+		// if PV is empty or leaf score is not the same as search score, this is an end position, and we don't need to train it
+		example.target = gs.annEvaluator.UnScale(leafScore);
+	}
+
+	return true;
 }
 
-namespace Learn
+// Self-play can also be farmed out to worker processes (TDLWorker()) on any number of hosts. Workers connect to the
+// trainer, and repeatedly ask for a batch of root positions (and the latest net, if they don't have it yet), and send
+// back the examples generated. Examples from workers go into the same queue as examples from local generator threads.
+// All messages start with a header. Everything is in native byte order, so workers must run the same build. Both sides
+// start with a hello (see TDLHandshake()) to make sure of that, and the trainer also checks every example it receives.
+enum TDLMessageType : uint32_t
 {
+	Msg_hello, // both ways, first message: TDLHello
+	Msg_requestWork, // worker -> trainer: WorkRequest
+	Msg_net, // trainer -> worker: net version (int64_t), followed by the serialized evaluator
+	Msg_roots, // trainer -> worker: root positions (PackedPosition[])
+	Msg_examples // worker -> trainer: TrainingExample[]
+};
+
+struct TDLMessageHeader
+{
+	uint32_t type;
+	uint32_t reserved;
+	uint64_t size; // of the payload
+};
 
-void TDL(const std::string &positionsFilename)
+struct WorkRequest
 {
-	std::cout << "Starting TDL training..." << std::endl;
+	int64_t netVersion; // -1 if the worker doesn't have a net yet
+	int64_t numRoots;
+};
+
+// change this whenever any message changes
+const uint32_t TDLProtocolVersion = 1;
+
+// also catches peers with a different byte order
+const uint32_t TDLHelloMagic = 0x4754444c; // "GTDL"
+
+struct TDLHello
+{
+	uint32_t magic;
+	uint32_t protocolVersion;
+	uint32_t exampleSize; // sizeof(TrainingExample)
+	uint32_t positionSize; // sizeof(PackedPosition)
+};
+
+// this is only a sanity check against garbage (serialized nets are a few MBs)
+const uint64_t MaxTDLMessageSize = 1ULL << 30;
+
+void SendTDLMessage(int fd, TDLMessageType type, const void *payload, size_t size)
+{
+	TDLMessageHeader header = { type, 0, size };
+
+	SocketUtil::SendAll(fd, &header, sizeof(header));
+	SocketUtil::SendAll(fd, payload, size);
+}
+
+// throws std::runtime_error on error or disconnection
+TDLMessageType RecvTDLMessage(int fd, std::string &payload)
+{
+	TDLMessageHeader header;
 
-	std::ifstream positionsFile(positionsFilename);
+	SocketUtil::RecvAll(fd, &header, sizeof(header));
 
-	if (!positionsFile)
+	if (header.type > Msg_examples || header.size > MaxTDLMessageSize)
 	{
-		throw std::runtime_error(std::string("Cannot open ") + positionsFilename + " for reading");
+		throw std::runtime_error("Invalid message");
 	}
 
-	// these are the root positions for training (they don't change)
-	std::vector<std::string> rootPositions;
+	payload.resize(header.size);
+
+	if (header.size > 0)
+	{
+		SocketUtil::RecvAll(fd, &payload[0], header.size);
+	}
+
+	return static_cast<TDLMessageType>(header.type);
+}
+
+// both sides send their hello first, and then check the other side's, so neither has to wait for the other
+// throws std::runtime_error if the peer is running an incompatible build
+void TDLHandshake(int fd)
+{
+	TDLHello hello = { TDLHelloMagic, TDLProtocolVersion, sizeof(TrainingExample), sizeof(PackedPosition) };
+
+	SendTDLMessage(fd, Msg_hello, &hello, sizeof(hello));
+
+	std::string payload;
+
+	if (RecvTDLMessage(fd, payload) != Msg_hello || payload.size() != sizeof(hello) || memcmp(payload.data(), &hello, sizeof(hello)) != 0)
+	{
+		throw std::runtime_error("Incompatible peer (the trainer and workers must run the same build)");
+	}
+}
+
+// we are built with -ffast-math, which lets the compiler assume std::isfinite() is always true, so we look at the bits
+bool IsFiniteFloat(float x)
+{
+	uint32_t bits;
+	memcpy(&bits, &x, sizeof(bits));
+
+	return (bits & 0x7f800000) != 0x7f800000;
+}
+
+// examples from workers are checked before they go anywhere near Board(const PackedPosition&) or the net
+bool IsValidExample(const TrainingExample &example)
+{
+	return PackedPositions::IsValid(example.position) && IsFiniteFloat(example.target) && (!example.hasError || IsFiniteFloat(example.absError));
+}
+
+// Generator threads keep playing with the latest published snapshot of the net, and push examples into a bounded
+// queue, which the trainer consumes. This way generation never waits for training, and vice versa.
+class TDLPipeline
+{
+public:
+	// if listenAddress is not empty, remote workers can connect to it (see TDLWorker())
+	// throws std::runtime_error if we can't listen on the address
+	TDLPipeline(Span<const PackedPosition> rootPositions, const ANNEvaluator &annEvaluator, int64_t version, size_t numThreads, const std::string &listenAddress)
+		: m_rootPositions(rootPositions), m_stopping(false), m_listenAddress(listenAddress), m_listenFd(-1), m_numRemoteExamples(0)
+	{
+		if (!m_listenAddress.empty())
+		{
+			std::string err;
+			m_listenFd = SocketUtil::Listen(m_listenAddress, 16, err);
+
+			if (m_listenFd < 0)
+			{
+				throw std::runtime_error(err);
+			}
+		}
+
+		PublishSnapshot(annEvaluator, version);
+
+		for (size_t i = 0; i < numThreads; ++i)
+		{
+			m_threads.emplace_back(&TDLPipeline::GeneratorThread_, this);
+		}
+
+		if (m_listenFd >= 0)
+		{
+			m_acceptThread = std::thread(&TDLPipeline::AcceptThread_, this);
+		}
+	}
+
+	~TDLPipeline()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_queueMutex);
+			m_stopping = true;
+		}
+
+		m_queueNotFull.notify_all();
+
+		if (m_listenFd >= 0)
+		{
+			SocketUtil::Shutdown(m_listenFd);
+			m_acceptThread.join();
+
+			SocketUtil::Close(m_listenFd);
+			SocketUtil::RemoveAddress(m_listenAddress);
+
+			{
+				std::lock_guard<std::mutex> lock(m_connectionsMutex);
+
+				for (auto &connection : m_connections)
+				{
+					if (!connection.done)
+					{
+						SocketUtil::Shutdown(connection.fd);
+					}
+				}
+			}
+
+			for (auto &connection : m_connections)
+			{
+				connection.thread.join();
+			}
+		}
+
+		for (auto &thread : m_threads)
+		{
+			thread.join();
+		}
+	}
+
+	TDLPipeline(const TDLPipeline&) = delete;
+	TDLPipeline &operator=(const TDLPipeline&) = delete;
+
+	void PublishSnapshot(const ANNEvaluator &annEvaluator, int64_t version)
+	{
+		std::shared_ptr<ANNEvaluator> snapshot = std::make_shared<ANNEvaluator>(annEvaluator);
+
+		// remote workers get the net in serialized form
+		std::shared_ptr<const std::string> serialized;
+
+		if (m_listenFd >= 0)
+		{
+			std::stringstream ss;
+			snapshot->Serialize(ss);
+			serialized = std::make_shared<std::string>(ss.str());
+		}
+
+		std::lock_guard<std::mutex> lock(m_snapshotMutex);
+		m_snapshot = snapshot;
+		m_snapshotSerialized = serialized;
+		m_snapshotVersion = version;
+	}
+
+	// number of examples received from remote workers since the last call
+	size_t GetAndResetNumRemoteExamples()
+	{
+		return m_numRemoteExamples.exchange(0);
+	}
+
+	// blocks until the batch is full
+	// examples generated by nets more than MaxStaleness iterations older than currentVersion are discarded (and counted
+	// in numStale)
+	void CollectBatch(int64_t currentVersion, std::vector<PackedPosition> &positions, NNMatrixRM &targets, Stat &errorStat, size_t &numStale)
+	{
+		for (size_t i = 0; i < positions.size();)
+		{
+			TrainingExample example;
+
+			{
+				std::unique_lock<std::mutex> lock(m_queueMutex);
+				m_queueNotEmpty.wait(lock, [this]() { return !m_queue.empty(); });
+
+				example = m_queue.front();
+				m_queue.pop_front();
+			}
+
+			m_queueNotFull.notify_one();
+
+			if ((currentVersion - example.version) > MaxStaleness)
+			{
+				++numStale;
+				continue;
+			}
+
+			if (example.hasError)
+			{
+				errorStat.AddNumber(example.absError);
+			}
+
+			positions[i] = example.position;
+			targets(i, 0) = example.target;
+			++i;
+		}
+	}
+
+private:
+	// a remote worker
+	struct Connection
+	{
+		int fd;
+		bool done; // the thread has finished (protected by m_connectionsMutex)
+		std::thread thread;
+	};
+
+	void GeneratorThread_()
+	{
+		GeneratorState gs;
+
+		auto positionDist = std::uniform_int_distribution<size_t>(0, m_rootPositions.GetSize() - 1);
+
+		while (true)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_snapshotMutex);
+
+				if (gs.version != m_snapshotVersion)
+				{
+					gs.annEvaluator = *m_snapshot;
+					gs.version = m_snapshotVersion;
+
+					// scores in the ttable came from the old net
+					gs.ttable.InvalidateAllEntries();
+				}
+			}
+
+			TrainingExample example;
+
+			if (!GenerateExample(gs, m_rootPositions[positionDist(gs.rng)], example))
+			{
+				continue;
+			}
+
+			if (!PushExample_(example))
+			{
+				return;
+			}
+		}
+	}
+
+	// blocks while the queue is full
+	// returns false if we are stopping
+	bool PushExample_(const TrainingExample &example)
+	{
+		std::unique_lock<std::mutex> lock(m_queueMutex);
+		m_queueNotFull.wait(lock, [this]() { return m_stopping || m_queue.size() < TDLQueueSize; });
+
+		if (m_stopping)
+		{
+			return false;
+		}
+
+		m_queue.push_back(example);
+
+		lock.unlock();
+		m_queueNotEmpty.notify_one();
+
+		return true;
+	}
+
+	void AcceptThread_()
+	{
+		while (true)
+		{
+			int fd = SocketUtil::Accept(m_listenFd);
+
+			if (fd < 0)
+			{
+				// the listening socket is shut down when we are stopping
+				if (m_stopping)
+				{
+					return;
+				}
+
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+				continue;
+			}
+
+			std::lock_guard<std::mutex> lock(m_connectionsMutex);
+
+			// workers may come and go over a long run, so we join the threads of the ones that are gone
+			for (auto it = m_connections.begin(); it != m_connections.end();)
+			{
+				if (it->done)
+				{
+					it->thread.join();
+					it = m_connections.erase(it);
+				}
+				else
+				{
+					++it;
+				}
+			}
+
+			m_connections.emplace_back();
+			m_connections.back().fd = fd;
+			m_connections.back().done = false;
+			m_connections.back().thread = std::thread(&TDLPipeline::ConnectionThread_, this, &m_connections.back());
+		}
+	}
+
+	// serves one remote worker until it disconnects
+	void ConnectionThread_(Connection *connection)
+	{
+		int fd = connection->fd;
+
+		auto rng = gRd.MakeMT();
+		auto positionDist = std::uniform_int_distribution<size_t>(0, m_rootPositions.GetSize() - 1);
+
+		std::cout << "Worker connected" << std::endl;
+
+		try
+		{
+			TDLHandshake(fd);
+
+			std::string payload;
+			std::vector<PackedPosition> roots;
+
+			while (true)
+			{
+				TDLMessageType type = RecvTDLMessage(fd, payload);
+
+				if (type == Msg_requestWork && payload.size() == sizeof(WorkRequest))
+				{
+					WorkRequest request;
+					memcpy(&request, payload.data(), sizeof(request));
+
+					int64_t version;
+					std::shared_ptr<const std::string> serialized;
+
+					{
+						std::lock_guard<std::mutex> lock(m_snapshotMutex);
+						version = m_snapshotVersion;
+						serialized = m_snapshotSerialized;
+					}
+
+					if (request.netVersion != version)
+					{
+						std::string netPayload(reinterpret_cast<const char *>(&version), sizeof(version));
+						netPayload += *serialized;
+
+						SendTDLMessage(fd, Msg_net, netPayload.data(), netPayload.size());
+					}
+
+					roots.resize(std::max<int64_t>(1, std::min<int64_t>(request.numRoots, MaxRootsPerWorkItem)));
+
+					for (auto &root : roots)
+					{
+						root = m_rootPositions[positionDist(rng)];
+					}
+
+					SendTDLMessage(fd, Msg_roots, roots.data(), roots.size() * sizeof(PackedPosition));
+				}
+				else if (type == Msg_examples && (payload.size() % sizeof(TrainingExample)) == 0)
+				{
+					const TrainingExample *examples = reinterpret_cast<const TrainingExample *>(payload.data());
+					size_t numExamples = payload.size() / sizeof(TrainingExample);
+
+					size_t numPushed = 0;
+					size_t numInvalid = 0;
+
+					for (size_t i = 0; i < numExamples; ++i)
+					{
+						if (!IsValidExample(examples[i]))
+						{
+							++numInvalid;
+							continue;
+						}
+
+						if (!PushExample_(examples[i]))
+						{
+							break;
+						}
+
+						++numPushed;
+					}
+
+					m_numRemoteExamples += numPushed;
+
+					if (numInvalid > 0)
+					{
+						std::cout << "Dropped " << numInvalid << " invalid examples from a worker" << std::endl;
+					}
+				}
+				else
+				{
+					throw std::runtime_error("Unexpected message");
+				}
+			}
+		}
+		catch (std::runtime_error &e)
+		{
+			if (!m_stopping)
+			{
+				std::cout << "Worker disconnected (" << e.what() << ")" << std::endl;
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(m_connectionsMutex);
+		SocketUtil::Close(fd);
+		connection->done = true;
+	}
+
+	Span<const PackedPosition> m_rootPositions;
+
+	std::mutex m_snapshotMutex;
+	std::shared_ptr<const ANNEvaluator> m_snapshot;
+	std::shared_ptr<const std::string> m_snapshotSerialized; // only if we are listening
+	int64_t m_snapshotVersion;
+
+	std::mutex m_queueMutex;
+	std::condition_variable m_queueNotEmpty;
+	std::condition_variable m_queueNotFull;
+	std::deque<TrainingExample> m_queue;
+	std::atomic<bool> m_stopping;
+
+	std::vector<std::thread> m_threads;
+
+	std::string m_listenAddress;
+	int m_listenFd; // -1 if we are not listening
+	std::thread m_acceptThread;
+
+	// a list, so connection threads can keep pointers to their entries
+	// fd is closed (and must not be used) once done is set, and only thread is left to be joined
+	std::mutex m_connectionsMutex;
+	std::list<Connection> m_connections;
+
+	std::atomic<size_t> m_numRemoteExamples;
+};
+
+}
+
+namespace Learn
+{
+
+void TDL(const std::string &positionsFilename, const std::string &listenAddress, int64_t localThreads, int64_t trainerThreads)
+{
+	if (trainerThreads < 1)
+	{
+		throw std::runtime_error("The trainer needs at least 1 thread");
+	}
+
+	std::cout << "Starting TDL training..." << std::endl;
+
+	PackedPositionFile positionsFile;
 
-	std::string fen;
+	std::cout << "Reading positions..." << std::endl;
 
-	std::cout << "Reading FENs..." << std::endl;
+	std::string err = positionsFile.Open(positionsFilename);
 
-	while (std::getline(positionsFile, fen))
+	if (err != "")
 	{
-		rootPositions.push_back(fen);
-		assert(fen != "");
+		throw std::runtime_error(err);
 	}
 
-	std::cout << "Positions read: " << rootPositions.size() << std::endl;
+	// these are the root positions for training (they don't change)
+	Span<const PackedPosition> rootPositions = positionsFile.GetPositions();
+
+	std::cout << "Positions read: " << rootPositions.GetSize() << std::endl;
 
 	// these are the leaf positions used in training
 	// they are initialized to root positions, but will change in second iteration
-	std::vector<std::string> trainingPositions(PositionsPerBatch);
+	std::vector<PackedPosition> trainingPositions(PositionsPerBatch);
 
 	NNMatrixRM trainingTargets(trainingPositions.size(), 1);
 
@@ -142,6 +764,12 @@ void TDL(const std::string &positionsFilename)
 
 	Stat errorStat;
 
+	// examples discarded for being too stale, since the last print
+	size_t numStale = 0;
+
+	// started after the bootstrap iteration
+	std::unique_ptr<TDLPipeline> pipeline;
+
 	for (; iter < NumIterations; ++iter)
 	{
 		double iterationStart = CurrentTime();
@@ -166,142 +794,36 @@ void TDL(const std::string &positionsFilename)
 		}
 		else
 		{
-            //`std::cout << "1" << std::endl;
-            size_t positionsProcessed = 0;
-
-			trainingPositions.resize(PositionsPerBatch);
-			trainingTargets.resize(trainingPositions.size(), 1);
-
-			#pragma omp parallel
+			if (!pipeline)
 			{
-				// each thread has her own ttable, killers, and counter, to save on page faults and allocations/deallocations
-				Killer thread_killer;
-				TTable thread_ttable(1*MB); // we want the ttable to fit in L3
-				CounterMove thread_counter;
-				History thread_history;
-
-				// we are being paranoid here - it's possible tha the memory we get happens to be where a TTable used to be,
-				// in which case we will have many valid entries with wrong scores (since evaluator changed)
-				//std::cout << "invalidate" << std::endl;
-                thread_ttable.InvalidateAllEntries();
-                //std::cout << "invalidated" << std::endl;
-				// each thread makes a copy of the evaluator to reduce sharing
-				ANNEvaluator thread_annEvaluator = annEvaluator;
-
-				auto rng = gRd.MakeMT();
-				auto positionDist = std::uniform_int_distribution<size_t>(0, rootPositions.size() - 1);
-				auto positionDrawFunc = std::bind(positionDist, rng);
-
-				//#pragma omp for schedule(dynamic, 1)
-				//std::cout << "for loop" << std::endl;
-                #pragma omp parallel for 
-                for (size_t i = 0; i < PositionsPerBatch; ++i)
-				{
-                    thread_ttable.ClearTable(); // this is a cheap clear that simply ages the table a bunch so all new positions have higher priority
-
-					Board rootPos(rootPositions[positionDrawFunc()]);
-
-					if (rootPos.GetGameStatus() != Board::ONGOING)
-					{
-						continue;
-					}
-
-					//if (realDrawFunc() < 0.3f)
-					{
-						// make 1 random move
-						// it's very important that we make an odd number of moves, so that if the move is something stupid, the
-						// opponent can take advantage of it (and we will learn that this position is bad) before we have a chance to
-						// fix it
-						MoveList ml;
-						rootPos.GenerateAllLegalMoves<Board::ALL>(ml);
-
-						auto movePickerDist = std::uniform_int_distribution<size_t>(0, ml.GetSize() - 1);
-
-						rootPos.ApplyMove(ml[movePickerDist(rng)]);
-
-						if (rootPos.GetGameStatus() != Board::ONGOING)
-						{
-							continue;
-						}
-					}
-
-					Search::SearchResult rootResult = Search::SyncSearchNodeLimited(rootPos, SearchNodeBudget, &thread_annEvaluator, &gStaticMoveEvaluator, &thread_killer, &thread_ttable, &thread_counter, &thread_history);
-
-					Board leafPos = rootPos;
-					leafPos.ApplyVariation(rootResult.pv);
-
-					float leafScore = thread_annEvaluator.EvaluateForWhite(leafPos); // this should theoretically be the same as the search result, except for mates, etc
+				// the generators get the cores the trainer doesn't use (the trainer is mostly waiting for examples, so
+				// it only gets 1 by default)
+				size_t numThreads = (localThreads < 0) ? std::max<int64_t>(1, omp_get_max_threads() - trainerThreads) : localThreads;
 
-					float rootScoreWhite = rootResult.score * (rootPos.GetSideToMove() == WHITE ? 1.0f : -1.0f);
-
-					trainingPositions[i] = leafPos.GetFen();
-
-					float leafScoreUnscaled = thread_annEvaluator.UnScale(leafScore);
-
-					if (rootResult.pv.size() > 0 && (leafScore == rootScoreWhite))
-					{
-						rootPos.ApplyMove(rootResult.pv[0]);
-						thread_killer.MoveMade();
-						thread_ttable.AgeTable();
-						thread_history.NotifyMoveMade();
-
-						// now we compute the error by making a few moves
-						float accumulatedError = 0.0f;
-						float lastScore = leafScoreUnscaled;
-						float tdDiscount = 1.0f;
-						float absoluteDiscount = AbsLambda;
-
-						for (int64_t m = 0; m < HalfMovesToMake; ++m)
-						{
-							Search::SearchResult result = Search::SyncSearchNodeLimited(rootPos, SearchNodeBudget, &thread_annEvaluator, &gStaticMoveEvaluator, &thread_killer, &thread_ttable, &thread_counter, &thread_history);
-
-							float scoreWhiteUnscaled = thread_annEvaluator.UnScale(result.score * (rootPos.GetSideToMove() == WHITE ? 1.0f : -1.0f)) * absoluteDiscount;
-
-							absoluteDiscount *= AbsLambda;
-
-							// compute error contribution (only if same side)
-							if (m % 2 == 1)
-							{
-								accumulatedError += tdDiscount * (scoreWhiteUnscaled - lastScore);
-								lastScore = scoreWhiteUnscaled;
-								tdDiscount *= TDLambda;
-							}
-
-							if ((rootPos.GetGameStatus() != Board::ONGOING) || (result.pv.size() == 0))
-							{
-								break;
-							}
-
-							rootPos.ApplyMove(result.pv[0]);
-							thread_killer.MoveMade();
-							thread_ttable.AgeTable();
-							thread_history.NotifyMoveMade();
-						}
+				if (numThreads == 0 && listenAddress.empty())
+				{
+					throw std::runtime_error("No generator threads and no remote workers");
+				}
 
-						float absError = fabs(accumulatedError);
+				std::cout << "Starting " << numThreads << " generator threads (and " << trainerThreads << " trainer threads)..." << std::endl;
 
-						#pragma omp critical(statUpdate)
-						{
-							errorStat.AddNumber(absError);
-						}
+				if (!listenAddress.empty())
+				{
+					std::cout << "Listening for workers on " << listenAddress << std::endl;
+				}
 
-						accumulatedError = std::max(accumulatedError, -MaxError);
-						accumulatedError = std::min(accumulatedError, MaxError);
+				pipeline.reset(new TDLPipeline(rootPositions, annEvaluator, iter, numThreads, listenAddress));
+			}
+			else if ((iter % SnapshotInterval) == 0)
+			{
+				pipeline->PublishSnapshot(annEvaluator, iter);
+			}
 
-						trainingTargets(i, 0) = leafScoreUnscaled + LearningRate * accumulatedError;
-					}
-					else
-					{
-						// if PV is empty or leaf score is not the same as search score, this is an end position, and we don't need to train it
-						trainingTargets(i, 0) = thread_annEvaluator.UnScale(leafScore);
-					}
+			trainingPositions.resize(PositionsPerBatch);
+			trainingTargets.resize(trainingPositions.size(), 1);
 
-					#pragma omp atomic
-					++positionsProcessed;
-				}
-			}
+			pipeline->CollectBatch(iter, trainingPositions, trainingTargets, errorStat, numStale);
 		}
-        //std::cout << "2" << std::endl;
 
 		if (iter == 0)
 		{
@@ -311,14 +833,14 @@ void TDL(const std::string &positionsFilename)
 		}
 		else
 		{
+			// the generators keep running while we train, so the trainer can't have a full OpenMP team
+			ScopedThreadLimiter tlim(trainerThreads);
+
 			annEvaluator.Train(trainingPositions, trainingTargets, featureDescriptions, LearningRateSGD);
 		}
 
 		if ((iter % EvaluatorSerializeInterval) == 0)
 		{
-			auto mt = gRd.MakeMT();
-			std::shuffle(rootPositions.begin(), rootPositions.end(), mt);
-
 			std::cout << "Serializing..." << std::endl;
 
 			std::ofstream annOut(getFilename(iter));
@@ -335,9 +857,146 @@ void TDL(const std::string &positionsFilename)
 			std::cout << "TD Error: " << errorStat.GetAvg() << ". ";
 			errorStat.Reset();
 
+			std::cout << "Stale: " << numStale << ". ";
+			numStale = 0;
+
+			if (pipeline && !listenAddress.empty())
+			{
+				std::cout << "From workers: " << pipeline->GetAndResetNumRemoteExamples() << ". ";
+			}
+
 			std::cout << std::endl;
 		}
 	}
 }
 
+void TDLWorker(const std::string &address)
+{
+	std::string err;
+
+	std::cout << "Connecting to " << address << "..." << std::endl;
+
+	int fd = SocketUtil::Connect(address, WorkerConnectTimeout, err);
+
+	if (fd < 0)
+	{
+		throw std::runtime_error(err);
+	}
+
+	try
+	{
+		TDLHandshake(fd);
+	}
+	catch (std::runtime_error &)
+	{
+		SocketUtil::Close(fd);
+		throw;
+	}
+
+	size_t numThreads = std::max(1, omp_get_max_threads());
+
+	std::cout << "Connected. Generating with " << numThreads << " threads..." << std::endl;
+
+	// one per thread, kept across work items (like the trainer's generator threads)
+	std::vector<std::unique_ptr<GeneratorState>> generatorStates;
+
+	for (size_t i = 0; i < numThreads; ++i)
+	{
+		generatorStates.emplace_back(new GeneratorState);
+	}
+
+	ANNEvaluator annEvaluator;
+	int64_t version = -1;
+
+	std::string payload;
+	std::vector<TrainingExample> examples;
+	std::vector<uint8_t> generated;
+
+	double timeStart = CurrentTime();
+	size_t numExamples = 0;
+
+	try
+	{
+		while (true)
+		{
+			WorkRequest request = { version, WorkerRootsPerThread * static_cast<int64_t>(numThreads) };
+			SendTDLMessage(fd, Msg_requestWork, &request, sizeof(request));
+
+			TDLMessageType type;
+
+			while ((type = RecvTDLMessage(fd, payload)) == Msg_net)
+			{
+				if (payload.size() < sizeof(version))
+				{
+					throw std::runtime_error("Invalid message");
+				}
+
+				memcpy(&version, payload.data(), sizeof(version));
+
+				std::stringstream ss(payload.substr(sizeof(version)));
+				annEvaluator.Deserialize(ss);
+			}
+
+			if (type != Msg_roots || (payload.size() % sizeof(PackedPosition)) != 0)
+			{
+				throw std::runtime_error("Unexpected message");
+			}
+
+			const PackedPosition *roots = reinterpret_cast<const PackedPosition *>(payload.data());
+			int64_t numRoots = payload.size() / sizeof(PackedPosition);
+
+			for (int64_t i = 0; i < numRoots; ++i)
+			{
+				if (!PackedPositions::IsValid(roots[i]))
+				{
+					throw std::runtime_error("Invalid root position");
+				}
+			}
+
+			examples.resize(numRoots);
+			generated.assign(numRoots, 0);
+
+			#pragma omp parallel for schedule(dynamic, 1)
+			for (int64_t i = 0; i < numRoots; ++i)
+			{
+				GeneratorState &gs = *generatorStates[omp_get_thread_num()];
+
+				if (gs.version != version)
+				{
+					gs.annEvaluator = annEvaluator;
+					gs.version = version;
+
+					// scores in the ttable came from the old net
+					gs.ttable.InvalidateAllEntries();
+				}
+
+				generated[i] = GenerateExample(gs, roots[i], examples[i]);
+			}
+
+			size_t numGenerated = 0;
+
+			for (int64_t i = 0; i < numRoots; ++i)
+			{
+				if (generated[i])
+				{
+					examples[numGenerated++] = examples[i];
+				}
+			}
+
+			SendTDLMessage(fd, Msg_examples, examples.data(), numGenerated * sizeof(TrainingExample));
+
+			numExamples += numGenerated;
+
+			std::cout << "Net: " << version << ". Examples: " << numExamples << ". ";
+			std::cout << "Examples/s: " << (numExamples / (CurrentTime() - timeStart)) << std::endl;
+		}
+	}
+	catch (std::runtime_error &e)
+	{
+		std::cout << "Trainer disconnected (" << e.what() << ")" << std::endl;
+	}
+
+	SocketUtil::Close(fd);
+}
+
 }
@@ -42,7 +42,30 @@ const static int64_t EvaluatorSerializeInterval = 10;
 const static int64_t IterationPrintInterval = 1;
 const static int64_t BoundTrainingEpochs = 10;
 
-void TDL(const std::string &positionsFilename);
+// the trainer publishes a new snapshot of the net for the generator threads every SnapshotInterval iterations
+const static int64_t SnapshotInterval = 1;
+
+// examples generated by nets more than MaxStaleness iterations old are discarded
+const static int64_t MaxStaleness = 2;
+
+// generator threads wait when this many examples are waiting to be trained on
+const static size_t TDLQueueSize = 2 * PositionsPerBatch;
+
+// remote workers ask for this many root positions per thread at a time (small, so examples are not stale when they
+// arrive), and the trainer never hands out more than MaxRootsPerWorkItem at a time
+const static int64_t WorkerRootsPerThread = 4;
+const static int64_t MaxRootsPerWorkItem = PositionsPerBatch;
+
+// workers wait this long for the trainer to start listening (it only does after the bootstrap iteration)
+const static int WorkerConnectTimeout = 3600; // seconds
+
+// if listenAddress is not empty (a Unix socket path, or host:port), remote workers (TDLWorker()) can connect to it to
+// generate examples, in addition to the localThreads generator threads (-1 for one per core not used by the trainer)
+// the trainer uses up to trainerThreads OpenMP threads once the generators are running
+void TDL(const std::string &positionsFilename, const std::string &listenAddress = "", int64_t localThreads = -1, int64_t trainerThreads = 1);
+
+// generates examples for a TDL trainer on all cores, until the trainer goes away
+void TDLWorker(const std::string &address);
 
 }
 
@@ -21,13 +21,19 @@
 #include <sstream>
 #include <thread>
 #include <mutex>
+#include <algorithm>
+#include <limits>
 
 #include <cstdint>
 
+#include <sys/stat.h>
+
 #include "magic_moves.h"
+#include "slider_attacks.h"
 #include "board_consts.h"
 #include "move.h"
 #include "board.h"
+#include "packed_position.h"
 #include "eval/eval.h"
 #include "see.h"
 #include "search.h"
@@ -41,6 +47,7 @@
 #include "learn.h"
 #include "zobrist.h"
 #include "gtb.h"
+#include "bitbases.h"
 #include "move_evaluator.h"
 #include "static_move_evaluator.h"
 
@@ -48,6 +55,7 @@
 
 const std::string EvalNetFilename = "eval.net";
 const std::string MoveEvalNetFilename = "meval.net";
+const std::string BookFilename = "book.bin";
 
 std::string gVersion;
 
@@ -127,7 +135,188 @@ void InitializeFast()
 
 	initmagicmoves();
 	BoardConstsInit();
+	SliderAttacks::Init();
+
+	std::cout << "# Slider attacks: " << SliderAttacks::BackendToString(SliderAttacks::gBackend) << std::endl;
 	InitializeZobrist();
+	Bitbases::Init();
+}
+
+// identifies what cached features were computed from - the feature layout version, and the size and modification time of
+// the data file (so regenerating a file with the same number of positions is also caught)
+// returns an empty string if the file can't be found
+std::string FeatureSourceTag(const std::string &dataFilename)
+{
+	struct stat st;
+
+	if (stat(dataFilename.c_str(), &st) != 0)
+	{
+		return "";
+	}
+
+	std::stringstream ss;
+
+	ss << "layout " << FeaturesConv::Layout::Version << " size " << st.st_size << " mtime " << st.st_mtime;
+
+#ifdef __linux__
+	ss << "." << st.st_mtim.tv_nsec;
+#endif
+
+	return ss.str();
+}
+
+// evaluates all positions once (on one thread), and returns the time taken in seconds
+// with batched, positions are evaluated in batches with BatchEvaluateForWhite(), otherwise one at a time
+double TimeEvaluationRun(ANNEvaluator &evaluator, std::vector<Board> &boards, std::vector<Score> &scores, bool batched)
+{
+	const size_t BatchSize = 1024;
+
+	scores.resize(boards.size());
+
+	// otherwise we would only be measuring the eval hash
+	evaluator.InvalidateCache();
+
+	double startTime = CurrentTime();
+
+	if (batched)
+	{
+		for (size_t i = 0; i < boards.size(); i += BatchSize)
+		{
+			size_t size = std::min(BatchSize, boards.size() - i);
+			evaluator.BatchEvaluateForWhite(Span<Board>(&boards[i], size), Span<Score>(&scores[i], size));
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < boards.size(); ++i)
+		{
+			scores[i] = evaluator.EvaluateForWhiteImpl(boards[i], SCORE_MIN, SCORE_MAX);
+		}
+	}
+
+	return CurrentTime() - startTime;
+}
+
+struct EvaluationTimes
+{
+	// times per evaluation in microseconds, from the fastest run of each net
+	double timeA;
+	double timeB;
+
+	// median over runs of timeA / timeB
+	double speedup;
+};
+
+// times two nets on the same positions, alternating between them run by run
+// the machine can be much slower for seconds at a time (this happens on VMs even in thread CPU time), which moves the
+// times of both nets, but not the ratio between back-to-back runs, so that is what we use for the speedup
+EvaluationTimes TimeEvaluations(ANNEvaluator &evaluatorA, ANNEvaluator &evaluatorB, std::vector<Board> &boards, std::vector<Score> &scoresA, std::vector<Score> &scoresB, bool batched)
+{
+	const int64_t Reps = 50;
+
+	double bestA = std::numeric_limits<double>::max();
+	double bestB = std::numeric_limits<double>::max();
+	std::vector<double> ratios;
+
+	for (int64_t rep = 0; rep < Reps; ++rep)
+	{
+		double timeA = TimeEvaluationRun(evaluatorA, boards, scoresA, batched);
+		double timeB = TimeEvaluationRun(evaluatorB, boards, scoresB, batched);
+
+		bestA = std::min(bestA, timeA);
+		bestB = std::min(bestB, timeB);
+		ratios.push_back(timeA / timeB);
+	}
+
+	std::nth_element(ratios.begin(), ratios.begin() + ratios.size() / 2, ratios.end());
+
+	EvaluationTimes ret;
+	ret.timeA = bestA / boards.size() * 1000000.0;
+	ret.timeB = bestB / boards.size() * 1000000.0;
+	ret.speedup = ratios[ratios.size() / 2];
+
+	return ret;
+}
+
+// the last 20% of the positions (up to 5000) are held out to compare nets, and the rest are for training
+// returns false if there are not enough positions
+bool SplitHeldOut(Span<const PackedPosition> positions, Span<const PackedPosition> &trainPositions, Span<const PackedPosition> &heldOutPositions)
+{
+	size_t heldOutSize = std::min<size_t>(5000, positions.GetSize() / 5);
+	size_t trainSize = positions.GetSize() - heldOutSize;
+
+	if (heldOutSize == 0)
+	{
+		return false;
+	}
+
+	trainPositions = positions.SubSpan(0, trainSize);
+	heldOutPositions = positions.SubSpan(trainSize, heldOutSize);
+
+	return true;
+}
+
+// evaluates the held out positions with a reference net and a net derived from it (pruned or distilled), and prints
+// their speed (one at a time and batched), mean abs error (if the positions are labelled), and how far apart they are
+void CompareOnHeldOut(Span<const PackedPosition> heldOutPositions, ANNEvaluator &reference, const std::string &referenceName, ANNEvaluator &derived, const std::string &derivedName)
+{
+	std::vector<Board> heldOutBoards;
+
+	for (const auto &pos : heldOutPositions)
+	{
+		heldOutBoards.push_back(Board(pos));
+	}
+
+	std::vector<Score> referenceScores;
+	std::vector<Score> derivedScores;
+
+	// errors are computed from the scores of the last (one at a time) run
+	EvaluationTimes batchTimes = TimeEvaluations(reference, derived, heldOutBoards, referenceScores, derivedScores, true);
+	EvaluationTimes times = TimeEvaluations(reference, derived, heldOutBoards, referenceScores, derivedScores, false);
+
+	double diffTotal = 0.0;
+	double referenceErrorTotal = 0.0;
+	double derivedErrorTotal = 0.0;
+	bool labelled = true;
+
+	for (size_t i = 0; i < heldOutPositions.GetSize(); ++i)
+	{
+		diffTotal += std::abs(derivedScores[i] - referenceScores[i]);
+
+		if (heldOutPositions[i].HasScore())
+		{
+			referenceErrorTotal += std::abs(referenceScores[i] - heldOutPositions[i].score);
+			derivedErrorTotal += std::abs(derivedScores[i] - heldOutPositions[i].score);
+		}
+		else
+		{
+			labelled = false;
+		}
+	}
+
+	double heldOutSize = static_cast<double>(heldOutPositions.GetSize());
+
+	std::cout << "Held out positions: " << heldOutPositions.GetSize() << " (all times on one thread)" << std::endl;
+
+	std::cout << referenceName << " - time per eval: " << times.timeA << "us, batched: " << batchTimes.timeA << "us";
+
+	if (labelled)
+	{
+		std::cout << ", mean abs error: " << (referenceErrorTotal / heldOutSize);
+	}
+
+	std::cout << std::endl;
+
+	std::cout << derivedName << " - time per eval: " << times.timeB << "us, batched: " << batchTimes.timeB << "us";
+
+	if (labelled)
+	{
+		std::cout << ", mean abs error: " << (derivedErrorTotal / heldOutSize);
+	}
+
+	std::cout << ", mean abs difference from " << referenceName << ": " << (diffTotal / heldOutSize) << std::endl;
+
+	std::cout << "Speedup (median of back-to-back runs): " << times.speedup << "x, batched: " << batchTimes.speedup << "x" << std::endl;
 }
 
 int main(int argc, char **argv)
@@ -169,6 +358,20 @@ int main(int argc, char **argv)
 		backend.SetMoveEvaluator(&gStaticMoveEvaluator);
 	}
 
+	if (FileReadable(BookFilename))
+	{
+		std::string error = backend.SetBook(BookFilename);
+
+		if (error == "")
+		{
+			std::cout << "# Using opening book " << BookFilename << std::endl;
+		}
+		else
+		{
+			std::cout << "# " << error << std::endl;
+		}
+	}
+
 	// first we handle special operation modes
 	if (argc >= 2 && std::string(argv[1]) == "tdl")
 	{
@@ -176,16 +379,32 @@ int main(int argc, char **argv)
 
 		if (argc < 3)
 		{
-			std::cout << "Usage: " << argv[0] << " tdl positions" << std::endl;
+			std::cout << "Usage: " << argv[0] << " tdl positions [<listen address> [<local generator threads> [<trainer threads>]]]" << std::endl;
+			std::cout << "With a listen address (Unix socket path or host:port), tdl_worker processes can connect to generate examples (use \"\" for none)" << std::endl;
+			std::cout << "By default, the trainer uses 1 thread, and there is a generator thread for each other core" << std::endl;
 			return 0;
 		}
         //try 
         //{
-	    Learn::TDL(argv[2]);
+	    Learn::TDL(argv[2], (argc >= 4) ? argv[3] : "", (argc >= 5) ? std::stoi(argv[4]) : -1, (argc >= 6) ? std::stoi(argv[5]) : 1);
         //}
         //catch(...){}
 		return 0;
 	}
+	else if (argc >= 2 && std::string(argv[1]) == "tdl_worker")
+	{
+		InitializeSlowBlocking(evaluator, mevaluator);
+
+		if (argc < 3)
+		{
+			std::cout << "Usage: " << argv[0] << " tdl_worker <trainer address>" << std::endl;
+			return 0;
+		}
+
+		Learn::TDLWorker(argv[2]);
+
+		return 0;
+	}
 	else if (argc >= 2 && std::string(argv[1]) == "conv")
 	{
 		InitializeSlowBlocking(evaluator, mevaluator);
@@ -229,36 +448,72 @@ int main(int argc, char **argv)
             std::string epd_path_full = epd_data_path + "/" + filenames[i % filenames.size()];
             std::string label_path_full = epd_label_path + "/" + filenames[i % filenames.size()] + ".xie";
             std::cout << label_path_full << std::endl;
-            std::ifstream epd_file(epd_path_full);
+            PackedPositionFile positions;
+            std::string err = positions.Open(epd_path_full);
+            if (err != "")
+            {
+                std::cerr << err << std::endl;
+                return 1;
+            }
+
+            NNMatrixRM mat_labels = NNMatrixRM(positions.GetSize(), 1);
+
+            // packed files can carry their own labels, otherwise they come from the .xie file
             std::ifstream label_file(label_path_full);
-            std::string fen;
-            std::vector<std::string> fens;
-            //std::cout << "Reading FENS" << std::endl;
-            while(std::getline(epd_file, fen))
+            if (label_file)
             {
-                fens.push_back(fen);
-            } 
-            //std::cout << "Reading labels" << std::endl;
-            
-            std::string label;
-            NNMatrixRM mat_labels = NNMatrixRM(fens.size(), 1);
-            //std::vector<int> labels; 
-            int idx = 0;
-            while(std::getline(label_file, label)){
-                //labels.push_back(stoi(label));
-                mat_labels(idx, 0) = std::stoi(label);
-                idx++; 
+                std::string label;
+                int64_t idx = 0;
+                while(std::getline(label_file, label) && idx < mat_labels.rows()){
+                    mat_labels(idx, 0) = std::stoi(label);
+                    idx++;
+                }
+            }
+            else
+            {
+                for (size_t idx = 0; idx < positions.GetSize(); ++idx)
+                {
+                    if (!positions[idx].HasScore())
+                    {
+                        std::cerr << "No labels for " << epd_path_full << std::endl;
+                        return 1;
+                    }
+
+                    mat_labels(idx, 0) = positions[idx].score;
+                }
+            }
+            // features are computed the first time we see a file, and memory-mapped after that
+            // (they are recomputed if the data file or the feature layout changed since)
+            std::string features_path_full = epd_label_path + "/" + filenames[i % filenames.size()] + ".feats.npy";
+            std::string source_tag = FeatureSourceTag(epd_path_full);
+            FeatureShard features;
+            if (source_tag == "" || FeatureShard::ReadSourceTag(features_path_full) != source_tag ||
+                features.Open(features_path_full) != "" ||
+                features.Rows() != static_cast<int64_t>(positions.GetSize()) ||
+                features.Cols() != static_cast<int64_t>(FeaturesConv::Layout::NumBoardFeatures))
+            {
+                Board dummy;
+                std::vector<FeaturesConv::FeatureDescription> ret;
+                FeaturesConv::ConvertBoardToNN(dummy, ret);
+
+                features.Close();
+                err = FeatureShard::Write(features_path_full, evaluator.BoardsToFeatureRepresentation_(positions.GetPositions(), ret), source_tag);
+                if (err == "")
+                {
+                    err = features.Open(features_path_full);
+                }
+                if (err != "")
+                {
+                    std::cerr << err << std::endl;
+                    return 1;
+                }
             }
-            //std::cout << "Getting feature descriptions" << std::endl;
-            Board dummy;
-            std::vector<FeaturesConv::FeatureDescription> ret;
-            FeaturesConv::ConvertBoardToNN(dummy, ret);
 
             //std::cout << "Starting Training" << std::endl;
             
             std::ofstream outNet(argv[6]);
             //evaluator.Serialize(outNet);
-            evaluator.TrainLoop(fens, mat_labels, 10, ret);
+            evaluator.TrainLoop(features, mat_labels, 10);
             evaluator.Serialize(outNet);
         }
 /*
@@ -301,51 +556,122 @@ int main(int argc, char **argv)
     {
         InitializeSlowBlocking(evaluator, mevaluator);
         
-        std::ifstream inFile(argv[2]);
-        std::ofstream outFile(argv[3]);
-
-        std::string fen;
-        std::vector<std::string> fens;
-        while(std::getline(inFile, fen))
+        PackedPositionFile positions;
+        std::string err = positions.Open(argv[2]);
+        if (err != "")
         {
-            fens.push_back(fen);
-            std::cout << fen << std::endl;
-            /*
-            Board b(fen);
-		    std::vector<FeaturesConv::FeatureDescription> ret;
-		    FeaturesConv::ConvertBoardToNN(b, ret);
-            std::stringstream ss;
-            for (int i = 0; i < ret.size()-1; i++)
-            {
-                ss << ret[i].XieToString() << " ";
-
-            }
-            ss << ret[ret.size() - 1].XieToString();
-            outFile << ss.str() << std::endl;
-            std::cout << ss.str() << std::endl;
-            std::cout << "****" << std::endl;
-            */
+            std::cerr << err << std::endl;
+            return 1;
         }
 
         std::vector<FeaturesConv::FeatureDescription> dummy(363);
 
-        NNMatrixRM ret = evaluator.BoardsToFeatureRepresentation_(fens, dummy);
-        for(int64_t row = 0; row < ret.rows(); ++row)
+        NNMatrixRM ret = evaluator.BoardsToFeatureRepresentation_(positions.GetPositions(), dummy);
+
+        // .npy, so it can be loaded directly with numpy
+        err = FeatureShard::Write(argv[3], ret);
+        if (err != "")
         {
-            for(int64_t col = 0; col < ret.cols(); ++ col)
-            {
-                outFile << ret(row,col) << ' '; 
-            }
-            outFile << '\n';
+            std::cerr << err << std::endl;
+            return 1;
         }
 
+        // optionally also write the scores of labelled positions, for train_stream
+        if (argc >= 5)
+        {
+            NNMatrixRM labels(positions.GetSize(), 1);
+            for (size_t i = 0; i < positions.GetSize(); ++i)
+            {
+                if (!positions[i].HasScore())
+                {
+                    std::cerr << "Position " << i << " has no score" << std::endl;
+                    return 1;
+                }
+
+                labels(i, 0) = positions[i].score;
+            }
 
-        inFile.close();
-        outFile.close();
+            err = FeatureShard::Write(argv[4], labels);
+            if (err != "")
+            {
+                std::cerr << err << std::endl;
+                return 1;
+            }
+        }
 
         return 0;
 
     }
+	else if (argc >= 2 && std::string(argv[1]) == "train_stream")
+	{
+		InitializeSlowBlocking(evaluator, mevaluator);
+
+		if (argc < 5)
+		{
+			std::cout << "Usage: " << argv[0] << " train_stream <shard list file> <epochs> <output net file> [<rank> <num processes> <address>]" << std::endl;
+			std::cout << "Each line in the list is a feature file and a label file (from conv_file), separated by a space" << std::endl;
+			std::cout << "For data-parallel training, start one process per rank (0 to num processes - 1) with the same arguments. ";
+			std::cout << "Address is a Unix socket path or host:port that rank 0 listens on. ";
+			std::cout << "Each process trains on every num processes-th line of the list, and only rank 0 writes the net." << std::endl;
+			return 0;
+		}
+
+		AllReduce allReduce;
+
+		if (argc >= 8)
+		{
+			std::string err = allReduce.Open(argv[7], std::stoi(argv[5]), std::stoi(argv[6]));
+
+			if (err != "")
+			{
+				std::cerr << err << std::endl;
+				return 1;
+			}
+		}
+
+		std::ifstream listFile(argv[2]);
+
+		if (!listFile)
+		{
+			std::cerr << "Failed to open " << argv[2] << " for reading" << std::endl;
+			return 1;
+		}
+
+		std::vector<std::string> featureFiles;
+		std::vector<std::string> labelFiles;
+
+		std::string featureFile;
+		std::string labelFile;
+
+		for (int line = 0; listFile >> featureFile >> labelFile; ++line)
+		{
+			if ((line % allReduce.GetNumProcesses()) == allReduce.GetRank())
+			{
+				featureFiles.push_back(featureFile);
+				labelFiles.push_back(labelFile);
+			}
+		}
+
+		evaluator.TrainLoopStreaming(featureFiles, labelFiles, std::stoi(argv[3]), &allReduce);
+
+		// all processes end up with the same net
+		if (allReduce.GetRank() != 0)
+		{
+			return 0;
+		}
+
+		std::ofstream outfile(argv[4]);
+
+		if (!outfile)
+		{
+			std::cerr << "Failed to open " << argv[4] << " for writing" << std::endl;
+			return 1;
+		}
+
+		evaluator.Serialize(outfile);
+
+		return 0;
+	}
 	else if (argc >= 2 && std::string(argv[1]) == "mconv")
 	{
 		InitializeSlowBlocking(evaluator, mevaluator);
@@ -404,6 +730,308 @@ int main(int argc, char **argv)
 
 		return 0;
 	}
+	else if (argc >= 2 && std::string(argv[1]) == "slider_bench")
+	{
+		SliderAttacks::DebugRunBenchmark();
+
+		return 0;
+	}
+	else if (argc >= 2 && std::string(argv[1]) == "gtb_bench")
+	{
+		if (argc < 3)
+		{
+			std::cout << "Usage: " << argv[0] << " gtb_bench <EPD/FEN file> [tablebase path]..." << std::endl;
+			return 0;
+		}
+
+		// with more than one path (eg. the same tables in different compression schemes), we run the benchmark on each
+		std::vector<std::string> paths(argv + 3, argv + argc);
+
+		if (paths.empty())
+		{
+			paths.push_back("");
+		}
+
+		for (const auto &path : paths)
+		{
+			std::cout << GTB::Init(path);
+
+			GTB::DebugRunProbeBenchmark(argv[2]);
+
+			GTB::DeInit();
+		}
+
+		return 0;
+	}
+	else if (argc >= 2 && std::string(argv[1]) == "gtb_recompress")
+	{
+		if (argc < 5)
+		{
+			std::cout << "Usage: " << argv[0] << " gtb_recompress <source path> <destination path> <none|cp1|cp2|cp3|cp4>" << std::endl;
+			return 0;
+		}
+
+		return GTB::Recompress(argv[2], argv[3], argv[4]) ? 0 : 1;
+	}
+	else if (argc >= 2 && std::string(argv[1]) == "pack")
+	{
+		if (argc < 4)
+		{
+			std::cout << "Usage: " << argv[0] << " pack <EPD/FEN file> <output file> [score file]" << std::endl;
+			return 0;
+		}
+
+		PackedPositionFile infile;
+		std::string err = infile.Open(argv[2]);
+
+		if (err != "")
+		{
+			std::cerr << err << std::endl;
+			return 1;
+		}
+
+		std::ifstream scoreFile;
+
+		if (argc >= 5)
+		{
+			scoreFile.open(argv[4]);
+
+			if (!scoreFile)
+			{
+				std::cerr << "Failed to open " << argv[4] << " for reading" << std::endl;
+				return 1;
+			}
+		}
+
+		PackedPositionWriter outfile;
+		err = outfile.Open(argv[3]);
+
+		if (err != "")
+		{
+			std::cerr << err << std::endl;
+			return 1;
+		}
+
+		for (size_t i = 0; i < infile.GetSize(); ++i)
+		{
+			PackedPosition pos = infile[i];
+
+			std::string score;
+
+			if (scoreFile.is_open())
+			{
+				if (!std::getline(scoreFile, score))
+				{
+					std::cerr << argv[4] << " has fewer scores than positions" << std::endl;
+					return 1;
+				}
+
+				// NoScore is the minimum, so it's never produced here
+				pos.score = std::max(std::min(std::stoi(score), 32767), -32767);
+			}
+
+			outfile.Write(pos);
+		}
+
+		std::cout << infile.GetSize() << " positions written" << std::endl;
+
+		return 0;
+	}
+	else if (argc >= 2 && std::string(argv[1]) == "unpack")
+	{
+		if (argc < 4)
+		{
+			std::cout << "Usage: " << argv[0] << " unpack <packed file> <output file> [score file]" << std::endl;
+			return 0;
+		}
+
+		PackedPositionFile infile;
+		std::string err = infile.Open(argv[2]);
+
+		if (err != "")
+		{
+			std::cerr << err << std::endl;
+			return 1;
+		}
+
+		std::ofstream outfile(argv[3]);
+
+		if (!outfile)
+		{
+			std::cerr << "Failed to open " << argv[3] << " for writing" << std::endl;
+			return 1;
+		}
+
+		std::ofstream scoreFile;
+
+		if (argc >= 5)
+		{
+			scoreFile.open(argv[4]);
+
+			if (!scoreFile)
+			{
+				std::cerr << "Failed to open " << argv[4] << " for writing" << std::endl;
+				return 1;
+			}
+		}
+
+		// best moves are written on their own line after the position, like label_bm used to
+		for (size_t i = 0; i < infile.GetSize(); ++i)
+		{
+			Board b(infile[i]);
+
+			outfile << b.GetFen() << '\n';
+
+			if (infile[i].HasBestMove())
+			{
+				outfile << b.MoveToAlg(PackedPositions::UnpackMove(b, infile[i].bestMove)) << '\n';
+			}
+
+			if (scoreFile.is_open())
+			{
+				if (!infile[i].HasScore())
+				{
+					std::cerr << "Position " << i << " has no score" << std::endl;
+					return 1;
+				}
+
+				scoreFile << infile[i].score << '\n';
+			}
+		}
+
+		return 0;
+	}
+	else if (argc >= 2 && std::string(argv[1]) == "prune")
+	{
+		if (argc < 5)
+		{
+			std::cout << "Usage: " << argv[0] << " prune <net file> <EPD/FEN file> <output net file> [fraction of neurons to remove (0.5)] [fine-tuning epochs (0)]" << std::endl;
+			std::cout << "The last 20% of the positions (up to 5000) are held out to measure accuracy and speed, and the rest are used to choose neurons to remove, and for fine-tuning" << std::endl;
+			return 0;
+		}
+
+		float fraction = (argc >= 6) ? std::stof(argv[5]) : 0.5f;
+		int64_t epochs = (argc >= 7) ? std::stoll(argv[6]) : 0;
+
+		PackedPositionFile positions;
+		std::string err = positions.Open(argv[3]);
+
+		if (err != "")
+		{
+			std::cerr << err << std::endl;
+			return 1;
+		}
+
+		Span<const PackedPosition> trainPositions;
+		Span<const PackedPosition> heldOutPositions;
+
+		if (!SplitHeldOut(positions.GetPositions(), trainPositions, heldOutPositions))
+		{
+			std::cerr << "Not enough positions in " << argv[3] << std::endl;
+			return 1;
+		}
+
+		ANNEvaluator original(argv[2]);
+		ANNEvaluator pruned(argv[2]);
+
+		std::cout << "Pruning " << fraction << " of the neurons of each hidden layer" << std::endl;
+
+		pruned.PruneMainANN(trainPositions, fraction);
+
+		if (epochs > 0)
+		{
+			NNMatrixRM y(trainPositions.GetSize(), 1);
+
+			for (size_t i = 0; i < trainPositions.GetSize(); ++i)
+			{
+				if (!trainPositions[i].HasScore())
+				{
+					std::cerr << "Fine-tuning requires labelled positions" << std::endl;
+					return 1;
+				}
+
+				y(i, 0) = pruned.UnScale(trainPositions[i].score);
+			}
+
+			Board dummy;
+			std::vector<FeaturesConv::FeatureDescription> featureDescriptions;
+			FeaturesConv::ConvertBoardToNN(dummy, featureDescriptions);
+
+			std::cout << "Fine-tuning for " << epochs << " epoch(s)" << std::endl;
+
+			pruned.TrainLoop(trainPositions, y, epochs, featureDescriptions);
+		}
+
+		std::ofstream outNet(argv[4]);
+		pruned.Serialize(outNet);
+
+		CompareOnHeldOut(heldOutPositions, original, "Original", pruned, "Pruned");
+
+		return 0;
+	}
+	else if (argc >= 2 && std::string(argv[1]) == "distill")
+	{
+		if (argc < 5)
+		{
+			std::cout << "Usage: " << argv[0] << " distill <teacher net file> <EPD/FEN file> <output net file> [epochs (10)]" << std::endl;
+			std::cout << "The last 20% of the positions (up to 5000) are held out to compare the nets, and the rest are labelled by the teacher to train a small student net" << std::endl;
+			return 0;
+		}
+
+		int64_t epochs = (argc >= 6) ? std::stoll(argv[5]) : 10;
+
+		PackedPositionFile positions;
+		std::string err = positions.Open(argv[3]);
+
+		if (err != "")
+		{
+			std::cerr << err << std::endl;
+			return 1;
+		}
+
+		Span<const PackedPosition> trainPositions;
+		Span<const PackedPosition> heldOutPositions;
+
+		if (!SplitHeldOut(positions.GetPositions(), trainPositions, heldOutPositions))
+		{
+			std::cerr << "Not enough positions in " << argv[3] << std::endl;
+			return 1;
+		}
+
+		Board dummy;
+		std::vector<FeaturesConv::FeatureDescription> featureDescriptions;
+		FeaturesConv::ConvertBoardToNN(dummy, featureDescriptions);
+
+		ANNEvaluator teacher(argv[2]);
+
+		std::cout << "Labelling " << trainPositions.GetSize() << " positions" << std::endl;
+
+		NNMatrixRM x = teacher.BoardsToFeatureRepresentation_(trainPositions, featureDescriptions);
+		NNMatrixRM y = teacher.EvaluateMainANN(x);
+
+		// the student starts with the teacher's bound nets (loaded with the teacher), and only the main net is replaced
+		ANNEvaluator student(argv[2]);
+		student.ReinitializeMainANN(FeaturesConv::Layout::NumBoardFeatures, true);
+
+		student.TrainLoop(x, y, epochs);
+
+		// the bound nets were trained around the teacher's outputs, so we move them to the student's
+		std::cout << "Training bound nets" << std::endl;
+
+		const size_t BoundsBatchSize = 256;
+
+		for (size_t i = 0; (i + BoundsBatchSize) <= trainPositions.GetSize(); i += BoundsBatchSize)
+		{
+			student.TrainBounds(trainPositions.SubSpan(i, BoundsBatchSize), featureDescriptions, 1.0f);
+		}
+
+		std::ofstream outNet(argv[4]);
+		student.Serialize(outNet);
+
+		CompareOnHeldOut(heldOutPositions, teacher, "Teacher", student, "Student");
+
+		return 0;
+	}
 	else if (argc >= 2 && std::string(argv[1]) == "check_bounds")
 	{
 		InitializeSlowBlocking(evaluator, mevaluator);
@@ -414,11 +1042,12 @@ int main(int argc, char **argv)
 			return 0;
 		}
 
-		std::ifstream infile(argv[2]);
+		PackedPositionFile positions;
+		std::string err = positions.Open(argv[2]);
 
-		if (!infile)
+		if (err != "")
 		{
-			std::cerr << "Failed to open " << argv[2] << " for reading" << std::endl;
+			std::cerr << err << std::endl;
 			return 1;
 		}
 
@@ -426,21 +1055,14 @@ int main(int argc, char **argv)
 		uint64_t total = 0;
 		float windowSizeTotal = 0.0f;
 
-		std::string fen;
-		std::vector<std::string> fens;
-		while (std::getline(infile, fen))
-		{
-			fens.push_back(fen);
-		}
-
 		#pragma omp parallel
 		{
 			auto evaluatorCopy = evaluator;
 
 			#pragma omp for
-			for (size_t i = 0; i < fens.size(); ++i)
+			for (size_t i = 0; i < positions.GetSize(); ++i)
 			{
-				Board b(fens[i]);
+				Board b(positions[i]);
 				float windowSize = 0.0f;
 				bool res = evaluatorCopy.CheckBounds(b, windowSize);
 
@@ -473,11 +1095,12 @@ int main(int argc, char **argv)
 			return 0;
 		}
 
-		std::ifstream infile(argv[2]);
+		PackedPositionFile positions;
+		std::string err = positions.Open(argv[2]);
 
-		if (!infile)
+		if (err != "")
 		{
-			std::cerr << "Failed to open " << argv[2] << " for reading" << std::endl;
+			std::cerr << err << std::endl;
 			return 1;
 		}
 
@@ -485,31 +1108,17 @@ int main(int argc, char **argv)
 		Board dummyBoard;
 		FeaturesConv::ConvertBoardToNN(dummyBoard, featureDescriptions);
 
-		std::string line;
-		std::vector<std::string> fens;
-		while (std::getline(infile, line))
-		{
-			fens.push_back(line);
-		}
-
 		const size_t BlockSize = 256;
 		const size_t PrintInterval = BlockSize * 100;
 
-		for (size_t i = 0; i < (fens.size() - BlockSize); i += BlockSize)
+		for (size_t i = 0; (i + BlockSize) < positions.GetSize(); i += BlockSize)
 		{
 			if (i % PrintInterval == 0)
 			{
-				std::cout << i << "/" << fens.size() << std::endl;
-			}
-
-			std::vector<std::string> positions;
-
-			for (size_t j = 0; j < BlockSize; ++j)
-			{
-				positions.push_back(fens[i + j]);
+				std::cout << i << "/" << positions.GetSize() << std::endl;
 			}
 
-			evaluator.TrainBounds(positions, featureDescriptions, 1.0f);
+			evaluator.TrainBounds(positions.GetPositions().SubSpan(i, BlockSize), featureDescriptions, 1.0f);
 		}
 
 		std::ofstream outfile(argv[3]);
@@ -536,34 +1145,29 @@ int main(int argc, char **argv)
 			return 0;
 		}
 
-		std::ifstream infile(argv[2]);
-		std::ofstream outfile(argv[3]);
+		PackedPositionFile positions;
+		std::string err = positions.Open(argv[2]);
 
-		if (!infile)
+		if (err != "")
 		{
-			std::cerr << "Failed to open " << argv[2] << " for reading" << std::endl;
+			std::cerr << err << std::endl;
 			return 1;
 		}
 
-		std::string fen;
-		std::vector<std::string> fens;
+		std::ofstream outfile(argv[3]);
+
 		static const uint64_t maxPositions = 5000000;
-		uint64_t numPositions = 0;
-		while (std::getline(infile, fen) && numPositions < maxPositions)
-		{
-			fens.push_back(fen);
-			++numPositions;
-		}
+		size_t numPositions = std::min<size_t>(positions.GetSize(), maxPositions);
 
 		#pragma omp parallel
 		{
 			auto evaluatorCopy = evaluator;
 
 			#pragma omp for
-			for (size_t i = 0; i < fens.size(); ++i)
+			for (size_t i = 0; i < numPositions; ++i)
 			{
                 std::cout << i << std::endl;
-				Board b(fens[i]);
+				Board b(positions[i]);
 
 				Search::SyncSearchNodeLimited(b, 1000, &evaluatorCopy, &gStaticMoveEvaluator, nullptr, nullptr);
 			}
@@ -582,38 +1186,42 @@ int main(int argc, char **argv)
 
 		if (argc < 4)
 		{
-			std::cout << "Usage: " << argv[0] << " label_bm <EPD/FEN file> <output file>" << std::endl;
+			std::cout << "Usage: " << argv[0] << " label_bm <EPD/FEN or packed file> <packed output file>" << std::endl;
 			return 0;
 		}
 
-		std::ifstream infile(argv[2]);
-		std::ofstream outfile(argv[3]);
+		PackedPositionFile infile;
+		std::string err = infile.Open(argv[2]);
 
-		if (!infile)
+		if (err != "")
 		{
-			std::cerr << "Failed to open " << argv[2] << " for reading" << std::endl;
+			std::cerr << err << std::endl;
+			return 1;
+		}
+
+		PackedPositionWriter outfile;
+		err = outfile.Open(argv[3]);
+
+		if (err != "")
+		{
+			std::cerr << err << std::endl;
 			return 1;
 		}
 
-		std::string fen;
-		std::vector<std::string> fens;
+		std::vector<PackedPosition> positions;
 		static const uint64_t maxPositions = 5000000;
-		uint64_t numPositions = 0;
-		while (std::getline(infile, fen) && numPositions < maxPositions)
+		for (size_t i = 0; i < infile.GetSize() && positions.size() < maxPositions; ++i)
 		{
-			Board b(fen);
+			Board b(infile[i]);
 
 			if (b.GetGameStatus() != Board::ONGOING)
 			{
 				continue;
 			}
 
-			fens.push_back(fen);
-			++numPositions;
+			positions.push_back(infile[i]);
 		}
 
-		std::vector<std::string> bm(fens.size());
-
 		uint64_t numPositionsDone = 0;
 
 		double lastPrintTime = CurrentTime();
@@ -624,20 +1232,20 @@ int main(int argc, char **argv)
 			auto evaluatorCopy = evaluator;
 
 			#pragma omp for schedule(dynamic)
-			for (size_t i = 0; i < fens.size(); ++i)
+			for (size_t i = 0; i < positions.size(); ++i)
 			{
-				Board b(fens[i]);
+				Board b(positions[i]);
 
 				Search::SearchResult result = Search::SyncSearchNodeLimited(b, 100000, &evaluatorCopy, &gStaticMoveEvaluator, nullptr, nullptr);
 
-				bm[i] = b.MoveToAlg(result.pv[0]);
+				positions[i].bestMove = PackedPositions::PackMove(result.pv[0]);
+				positions[i].score = (b.GetSideToMove() == WHITE) ? result.score : -result.score;
 
 				#pragma omp critical(numPositionsAndOutputFileUpdate)
 				{
 					++numPositionsDone;
 
-					outfile << fens[i] << '\n';
-					outfile << bm[i] << '\n';
+					outfile.Write(positions[i]);
 
 					if (omp_get_thread_num() == 0)
 					{
@@ -645,7 +1253,7 @@ int main(int argc, char **argv)
 						double timeDiff = currentTime - lastPrintTime;
 						if (timeDiff > 1.0)
 						{
-							std::cout << numPositionsDone << '/' << fens.size() << std::endl;
+							std::cout << numPositionsDone << '/' << positions.size() << std::endl;
 							std::cout << "Positions per second: " << static_cast<double>(numPositionsDone - lastDoneCount) / timeDiff << std::endl;
 
 							lastPrintTime = currentTime;
@@ -664,69 +1272,57 @@ int main(int argc, char **argv)
 
 		if (argc < 4)
 		{
-			std::cout << "Usage: " << argv[0] << " train_move_eval <EPD/FEN file> <output file>" << std::endl;
+			std::cout << "Usage: " << argv[0] << " train_move_eval <label_bm output file> <output file>" << std::endl;
 			return 0;
 		}
 
-		std::ifstream infile(argv[2]);
+		PackedPositionFile infile;
+
+		std::cout << "Reading positions from " << argv[2] << std::endl;
+
+		std::string err = infile.Open(argv[2]);
 
-		if (!infile)
+		if (err != "")
 		{
-			std::cerr << "Failed to open " << argv[2] << " for reading" << std::endl;
+			std::cerr << err << std::endl;
 			return 1;
 		}
 
-		std::cout << "Reading positions from " << argv[2] << std::endl;
-
-		std::string fen;
-		std::string bestMove;
-		std::vector<std::string> fens;
-		std::vector<std::string> bestMoves;
+		std::vector<PackedPosition> positions;
 		static const uint64_t MaxPositions = 5000000;
-		uint64_t numPositions = 0;
-		while (std::getline(infile, fen) && std::getline(infile, bestMove) && numPositions < MaxPositions)
+		for (size_t i = 0; i < infile.GetSize() && positions.size() < MaxPositions; ++i)
 		{
-			Board b(fen);
+			Board b(infile[i]);
 
-			if (b.GetGameStatus() != Board::ONGOING)
+			if (!infile[i].HasBestMove() || b.GetGameStatus() != Board::ONGOING)
 			{
 				continue;
 			}
 
-			fens.push_back(fen);
-			bestMoves.push_back(bestMove);
-
-			++numPositions;
+			positions.push_back(infile[i]);
 		}
 
-		assert(bestMoves.size() == fens.size());
+		infile.Close();
 
 		// now we split a part of it out into a withheld test set
-		size_t numTrainExamples = fens.size() * 0.9f;
-		std::vector<std::string> fensTest(fens.begin() + numTrainExamples, fens.end());
-		std::vector<std::string> bestMovesTest(bestMoves.begin() + numTrainExamples, bestMoves.end());
+		size_t numTrainExamples = positions.size() * 0.9f;
 
 		static const uint64_t MaxTestingPositions = 10000;
 
-		if (fensTest.size() > MaxTestingPositions)
-		{
-			fensTest.resize(MaxTestingPositions);
-			bestMovesTest.resize(MaxTestingPositions);
-		}
+		size_t numTestExamples = std::min<size_t>(positions.size() - numTrainExamples, MaxTestingPositions);
 
-		fens.resize(numTrainExamples);
-		bestMoves.resize(numTrainExamples);
+		Span<const PackedPosition> allPositions(positions);
 
 		std::cout << "Num training examples: " << numTrainExamples << std::endl;
-		std::cout << "Num testing examples: " << fensTest.size() << std::endl;
+		std::cout << "Num testing examples: " << numTestExamples << std::endl;
 
 		std::cout << "Starting training" << std::endl;
 
 		ANNMoveEvaluator meval(evaluator);
 
-		meval.Train(fens, bestMoves);
+		meval.Train(allPositions.SubSpan(0, numTrainExamples));
 
-		meval.Test(fensTest, bestMovesTest);
+		meval.Test(allPositions.SubSpan(numTrainExamples, numTestExamples));
 
 		std::ofstream outfile(argv[3]);
 
@@ -796,6 +1392,7 @@ int main(int argc, char **argv)
 							 "debug=1 memory=0 smp=0 done=0" << std::endl;
 
 				std::cout << "feature option=\"GaviotaTbPath -path .\"" << std::endl;
+				std::cout << "feature option=\"BookFile -file " << BookFilename << "\"" << std::endl;
 
 				std::cout << "feature done=1" << std::endl;
 			}
@@ -970,6 +1567,10 @@ int main(int argc, char **argv)
 		{
 			std::cout << backend.DebugGTB() << std::endl;
 		}
+		else if (cmd == "book")
+		{
+			std::cout << backend.DebugBook() << std::endl;
+		}
 		else if (cmd == "runtests")
 		{
 			//SEE::DebugRunSeeTests();
@@ -978,13 +1579,13 @@ int main(int argc, char **argv)
 		}
 		else if (cmd == "gee")
 		{
-			std::vector<Move> pv;
+			SEE::GEEPv pv;
 
 			Board b = backend.GetBoard();
 
 			SEE::GlobalExchangeEvaluation(b, pv);
 
-			for (size_t i = 0; i < pv.size(); ++i)
+			for (size_t i = 0; i < pv.GetSize(); ++i)
 			{
 				std::cout << b.MoveToAlg(pv[i]) << ' ';
 				b.ApplyMove(pv[i]);
@@ -1002,8 +1603,8 @@ int main(int argc, char **argv)
 			uint8_t whiteNumAttackers[64];
 			uint8_t blackNumAttackers[64];
 
-			b.ComputeLeastValuableAttackers(whiteAttackers, whiteNumAttackers, WHITE);
-			b.ComputeLeastValuableAttackers(blackAttackers, blackNumAttackers, BLACK);
+			b.ComputeLeastValuableAttackers<WHITE>(whiteAttackers, whiteNumAttackers);
+			b.ComputeLeastValuableAttackers<BLACK>(blackAttackers, blackNumAttackers);
 
 			auto printAtkBoardFcn = [](PieceType attackers[64])
 			{
@@ -1055,6 +1656,15 @@ int main(int argc, char **argv)
 				{
 					std::cout << GTB::Init(optionValue) << std::endl;
 				}
+				else if (optionName == "BookFile")
+				{
+					std::string error = backend.SetBook(optionValue);
+
+					if (error != "")
+					{
+						std::cout << "Error: " << error << std::endl;
+					}
+				}
 				else
 				{
 					std::cout << "Error: Unknown option - " << optionName << std::endl;
@@ -0,0 +1,49 @@
+/*
+	Copyright (C) 2015 Matthew Lai
+
+	Giraffe is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	Giraffe is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "material_table.h"
+
+MaterialTable::MaterialTable(size_t size)
+	: m_data(size, MaterialEntry{ 0, 0, Bitbases::Handler{ nullptr, WHITE } })
+{
+}
+
+void MaterialTable::Compute_(const Board &b, MaterialEntry &entry)
+{
+	auto count = [&b](PieceType pt) { return b.GetPieceCount(pt); };
+
+	entry.key = b.GetMaterialKey();
+
+	entry.flags = 0;
+
+	if (!(count(WP) + count(BP) + count(WR) + count(BR) + count(WQ) + count(BQ)))
+	{
+		entry.flags |= MaterialFlag_maybeInsufficient;
+	}
+
+	if (!(count(WQ) + count(WR) + count(WB) + count(WN)))
+	{
+		entry.flags |= MaterialFlag_whiteOnlyPawns;
+	}
+
+	if (!(count(BQ) + count(BR) + count(BB) + count(BN)))
+	{
+		entry.flags |= MaterialFlag_blackOnlyPawns;
+	}
+
+	entry.bitbase = Bitbases::FindHandler(b);
+}
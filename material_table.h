@@ -0,0 +1,87 @@
+/*
+	Copyright (C) 2015 Matthew Lai
+
+	Giraffe is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	Giraffe is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MATERIAL_TABLE_H
+#define MATERIAL_TABLE_H
+
+#include <vector>
+
+#include <cstdint>
+
+#include "types.h"
+#include "board.h"
+#include "bitbases.h"
+
+enum MaterialFlags
+{
+	// no pawns, rooks, or queens - Board::HasInsufficientMaterial() may be true (depending on bishop colours)
+	MaterialFlag_maybeInsufficient = 0x1,
+
+	// the side has nothing but king and pawns, so zugzwang is likely (same as Board::IsZugzwangProbable())
+	MaterialFlag_whiteOnlyPawns = 0x2,
+	MaterialFlag_blackOnlyPawns = 0x4
+};
+
+// everything here only depends on piece counts
+struct MaterialEntry
+{
+	uint64_t key;
+
+	uint32_t flags;
+
+	// bitbase for trivial endings
+	Bitbases::Handler bitbase;
+
+	bool IsZugzwangProbable(Color stm) const
+	{
+		return flags & ((stm == WHITE) ? MaterialFlag_whiteOnlyPawns : MaterialFlag_blackOnlyPawns);
+	}
+};
+
+// Cache of material entries, keyed by Board::GetMaterialKey().
+// There are very few different material configurations in a search, so a small table is enough.
+// Not thread-safe, each search should have its own.
+class MaterialTable
+{
+public:
+	MaterialTable(size_t size = 1*KB);
+
+	MaterialTable(const MaterialTable&) = delete;
+	MaterialTable &operator=(const MaterialTable&) = delete;
+
+	const MaterialEntry &Probe(const Board &b)
+	{
+		uint64_t key = b.GetMaterialKey();
+
+		MaterialEntry &entry = m_data[key % m_data.size()];
+
+		if (entry.key != key)
+		{
+			Compute_(b, entry);
+		}
+
+		return entry;
+	}
+
+private:
+	static void Compute_(const Board &b, MaterialEntry &entry);
+
+	// entries start with key 0, which can't be a real key (there are always kings on the board)
+	std::vector<MaterialEntry> m_data;
+};
+
+#endif // MATERIAL_TABLE_H
@@ -39,9 +39,16 @@ struct MatrixRegion
 	int64_t cols;
 };
 
+// Block sparse matrix, with all the blocks packed (column major) into one contiguous buffer, each starting on a new
+// cache line.
 template <typename T>
 struct SemiSparseMatrix
 {
+	typedef typename T::Scalar Scalar;
+	typedef Eigen::Map<const T, Eigen::Aligned> BlockType;
+
+	constexpr static size_t BlockAlignment = 64 / sizeof(Scalar);
+
 	int64_t rows;
 	int64_t cols;
 
@@ -49,10 +56,18 @@ struct SemiSparseMatrix
 	{
 		int64_t i;
 		int64_t j;
-		T m;
+		int64_t rows;
+		int64_t cols;
+		size_t offset; // into data
 	};
 
 	std::vector<SubMatrix> subMatrices;
+	std::vector<Scalar, Eigen::aligned_allocator<Scalar> > data;
+
+	BlockType GetBlock(const SubMatrix &subMatrix) const
+	{
+		return BlockType(&data[subMatrix.offset], subMatrix.rows, subMatrix.cols);
+	}
 };
 
 template <typename T>
@@ -123,6 +138,8 @@ SemiSparseMatrix<T> ToSemiSparse(const T &m, const std::vector<MatrixRegion> &ro
 	ret.rows = m.rows();
 	ret.cols = m.cols();
 
+	size_t totalSize = 0;
+
 	for (const auto &roi : rois)
 	{
 		typename
@@ -130,37 +147,45 @@ SemiSparseMatrix<T> ToSemiSparse(const T &m, const std::vector<MatrixRegion> &ro
 
 		subm.i = roi.i;
 		subm.j = roi.j;
-		subm.m = m.block(roi.i, roi.j, roi.rows, roi.cols);
+		subm.rows = roi.rows;
+		subm.cols = roi.cols;
+		subm.offset = totalSize;
+
+		size_t blockSize = roi.rows * roi.cols;
+		totalSize += (blockSize + SemiSparseMatrix<T>::BlockAlignment - 1) / SemiSparseMatrix<T>::BlockAlignment * SemiSparseMatrix<T>::BlockAlignment;
 
 		ret.subMatrices.push_back(subm);
 	}
 
-	return ret;
-}
-
-template <typename EigenA, typename EigenB, typename EigenC>
-void MultiplyWithSemiSparse(const EigenA &a, const SemiSparseMatrix<EigenB> &b, EigenC &c)
-{
-	// c = a * b
-	c = EigenC::Zero(a.rows(), b.cols);
+	ret.data.resize(totalSize);
 
-	assert(a.rows() == 1);
-
-	for (const auto &subMatrix : b.subMatrices)
+	for (const auto &subm : ret.subMatrices)
 	{
-		c.segment(subMatrix.j, subMatrix.m.cols()) += a.segment(subMatrix.i, subMatrix.m.rows()) * subMatrix.m;
+		Eigen::Map<T, Eigen::Aligned>(&ret.data[subm.offset], subm.rows, subm.cols) = m.block(subm.i, subm.j, subm.rows, subm.cols);
 	}
+
+	return ret;
 }
 
-template <typename EigenA, typename EigenB, typename EigenC>
-void MatrixMultiplyWithSemiSparse(const EigenA &a, const SemiSparseMatrix<EigenB> &b, EigenC &c)
+template <typename EigenA, typename T, typename EigenBias, typename EigenC>
+void MultiplyWithSemiSparse(const EigenA &a, const SemiSparseMatrix<T> &b, const EigenBias &bias, EigenC &c)
 {
-	// c = a * b
-	c = EigenC::Zero(a.rows(), b.cols);
+	// c = a * b + bias
+	assert(a.rows() == 1);
+
+	// starting from the bias instead of zero saves a pass over c
+	c = bias;
 
 	for (const auto &subMatrix : b.subMatrices)
 	{
-		c.block(0, subMatrix.j, c.rows(), subMatrix.m.cols()) += a.block(0, subMatrix.i, a.rows(), subMatrix.m.rows()) * subMatrix.m;
+		auto block = b.GetBlock(subMatrix);
+		auto aSegment = a.segment(subMatrix.i, subMatrix.rows);
+
+		// blocks are small, so we do the dot products directly instead of going through Eigen's matrix-vector product
+		for (int64_t k = 0; k < subMatrix.cols; ++k)
+		{
+			c(0, subMatrix.j + k) += aSegment.dot(block.col(k).transpose());
+		}
 	}
 }
 
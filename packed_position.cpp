@@ -0,0 +1,330 @@
+/*
+	Copyright (C) 2015 Matthew Lai
+
+	Giraffe is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	Giraffe is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "packed_position.h"
+
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "board.h"
+#include "board_consts.h"
+#include "bit_ops.h"
+
+namespace PackedPositions
+{
+
+uint16_t PackMove(Move mv)
+{
+	uint16_t ret = GetFromSquare(mv) | (GetToSquare(mv) << 6);
+
+	if (IsPromotion(mv))
+	{
+		ret |= (GetPromoType(mv) & ~COLOR_MASK) << 12;
+	}
+
+	return ret;
+}
+
+Move UnpackMove(Board &b, uint16_t packedMove)
+{
+	Square from = packedMove & 0x3f;
+	Square to = (packedMove >> 6) & 0x3f;
+	PieceType promoType = (packedMove >> 12) & 0x7;
+
+	MoveList ml;
+	b.GenerateAllLegalMoves<Board::ALL>(ml);
+
+	for (size_t i = 0; i < ml.GetSize(); ++i)
+	{
+		Move mv = ml[i];
+
+		if (GetFromSquare(mv) == from && GetToSquare(mv) == to &&
+			(IsPromotion(mv) ? ((GetPromoType(mv) & ~COLOR_MASK) == promoType) : (promoType == 0)))
+		{
+			return mv;
+		}
+	}
+
+	return 0;
+}
+
+bool IsPackedFile(const std::string &filename)
+{
+	std::ifstream f(filename, std::ios::binary);
+
+	char magic[sizeof(Magic)];
+
+	return f.read(magic, sizeof(magic)) && memcmp(magic, Magic, sizeof(Magic)) == 0;
+}
+
+bool IsValid(const PackedPosition &pos)
+{
+	// there are only 16 bytes of piece codes
+	if (PopCount(pos.occupied) > 32)
+	{
+		return false;
+	}
+
+	uint64_t occupied = pos.occupied;
+	int32_t kings[2] = { 0, 0 };
+
+	for (size_t i = 0; occupied; ++i)
+	{
+		Square sq = Extract(occupied);
+		PieceType pt = (pos.pieces[i / 2] >> (4 * (i % 2))) & 0xf;
+
+		// this also rejects 0x6 and 0x7, which are not pieces (see types.h)
+		if ((pt & ~COLOR_MASK) > P)
+		{
+			return false;
+		}
+
+		if ((pt & ~COLOR_MASK) == K)
+		{
+			++kings[(pt & COLOR_MASK) ? 1 : 0];
+		}
+
+		if ((pt & ~COLOR_MASK) == P && (GetRank(sq) == RANK_1 || GetRank(sq) == RANK_8))
+		{
+			return false;
+		}
+	}
+
+	if (kings[0] != 1 || kings[1] != 1)
+	{
+		return false;
+	}
+
+	if (pos.epSquare != PackedPosition::NoEpSquare)
+	{
+		if (pos.epSquare >= 64 || (GetRank(pos.epSquare) != RANK_3 && GetRank(pos.epSquare) != RANK_6))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+}
+
+PackedPositionFile::PackedPositionFile()
+	: m_data(nullptr), m_size(0), m_mappedSize(0), m_mappedAddr(nullptr)
+{
+}
+
+PackedPositionFile::~PackedPositionFile()
+{
+	Close();
+}
+
+std::string PackedPositionFile::Open(const std::string &filename)
+{
+	Close();
+
+	{
+		std::ifstream f(filename);
+
+		if (!f)
+		{
+			return "Failed to open " + filename;
+		}
+	}
+
+	if (!PackedPositions::IsPackedFile(filename))
+	{
+		std::string err = ReadTextFile_(filename);
+
+		return (err != "") ? err : Validate_(filename);
+	}
+
+	size_t size = 0;
+
+#ifndef _WIN32
+	int fd = open(filename.c_str(), O_RDONLY);
+
+	if (fd < 0)
+	{
+		return "Failed to open " + filename;
+	}
+
+	struct stat st;
+
+	if (fstat(fd, &st) == 0)
+	{
+		size = static_cast<size_t>(st.st_size);
+
+		if (size < PackedPositions::HeaderSize)
+		{
+			close(fd);
+			return filename + " is truncated";
+		}
+
+		void *addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+
+		if (addr != MAP_FAILED)
+		{
+			// training reads the whole file, usually more than once
+			madvise(addr, size, MADV_WILLNEED);
+
+			m_mappedAddr = addr;
+			m_mappedSize = size;
+			m_data = reinterpret_cast<const PackedPosition *>(static_cast<const char *>(addr) + PackedPositions::HeaderSize);
+		}
+	}
+
+	close(fd);
+#endif
+
+	if (m_mappedAddr == nullptr)
+	{
+		std::ifstream f(filename, std::ios::binary);
+
+		f.seekg(0, std::ios::end);
+		size = static_cast<size_t>(f.tellg());
+
+		if (size < PackedPositions::HeaderSize)
+		{
+			return filename + " is truncated";
+		}
+
+		f.seekg(PackedPositions::HeaderSize, std::ios::beg);
+
+		m_buffer.resize((size - PackedPositions::HeaderSize) / sizeof(PackedPosition));
+		f.read(reinterpret_cast<char *>(m_buffer.data()), m_buffer.size() * sizeof(PackedPosition));
+
+		if (!f)
+		{
+			Close();
+			return "Failed to read " + filename;
+		}
+
+		m_data = m_buffer.data();
+	}
+
+	if (((size - PackedPositions::HeaderSize) % sizeof(PackedPosition)) != 0)
+	{
+		Close();
+		return filename + " is truncated";
+	}
+
+	m_size = (size - PackedPositions::HeaderSize) / sizeof(PackedPosition);
+
+	return Validate_(filename);
+}
+
+void PackedPositionFile::Close()
+{
+#ifndef _WIN32
+	if (m_mappedSize != 0)
+	{
+		munmap(const_cast<void *>(m_mappedAddr), m_mappedSize);
+	}
+#endif
+
+	m_data = nullptr;
+	m_size = 0;
+	m_mappedSize = 0;
+	m_mappedAddr = nullptr;
+
+	m_buffer.clear();
+	m_buffer.shrink_to_fit();
+}
+
+std::string PackedPositionFile::Validate_(const std::string &filename)
+{
+	// this is one pass over data that training reads many times, and a damaged or foreign file would otherwise only
+	// show up as corrupted boards
+	for (size_t i = 0; i < m_size; ++i)
+	{
+		if (!PackedPositions::IsValid(m_data[i]))
+		{
+			Close();
+			return "Invalid position in " + filename + " (record " + std::to_string(i) + ")";
+		}
+	}
+
+	return "";
+}
+
+std::string PackedPositionFile::ReadTextFile_(const std::string &filename)
+{
+	std::ifstream f(filename);
+
+	std::string line;
+
+	while (std::getline(f, line))
+	{
+		if (line.empty())
+		{
+			continue;
+		}
+
+		if (line.find('/') == std::string::npos)
+		{
+			if (m_buffer.empty())
+			{
+				Close();
+				return "Move without a position in " + filename + " - " + line;
+			}
+
+			Board b(m_buffer.back());
+
+			Move mv = b.ParseMove(line);
+
+			if (mv == 0)
+			{
+				Close();
+				return "Illegal move in " + filename + " - " + line;
+			}
+
+			m_buffer.back().bestMove = PackedPositions::PackMove(mv);
+		}
+		else
+		{
+			m_buffer.push_back(Board(line).Pack());
+		}
+	}
+
+	m_data = m_buffer.data();
+	m_size = m_buffer.size();
+
+	return "";
+}
+
+std::string PackedPositionWriter::Open(const std::string &filename)
+{
+	m_file.open(filename, std::ios::binary | std::ios::trunc);
+
+	if (!m_file)
+	{
+		return "Failed to open " + filename + " for writing";
+	}
+
+	char header[PackedPositions::HeaderSize] = {};
+	memcpy(header, PackedPositions::Magic, sizeof(PackedPositions::Magic));
+
+	m_file.write(header, sizeof(header));
+
+	return "";
+}
@@ -0,0 +1,159 @@
+/*
+	Copyright (C) 2015 Matthew Lai
+
+	Giraffe is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	Giraffe is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PACKED_POSITION_H
+#define PACKED_POSITION_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <limits>
+
+#include <cstdint>
+
+#include "types.h"
+#include "move.h"
+#include "containers.h"
+
+class Board;
+
+// Fixed size (32 bytes) binary position record, used for training data instead of FEN strings.
+// Pieces are stored as an occupancy bitboard, followed by the piece types of the occupied squares (4 bits each, in square order).
+// Board can be constructed directly from a record (Board(const PackedPosition&)), and Board::Pack() creates one.
+// Records are stored in native byte order (files are not portable to big endian machines).
+struct PackedPosition
+{
+	enum Flags : uint8_t
+	{
+		Flag_blackToMove = 0x1,
+		Flag_whiteShortCastle = 0x2,
+		Flag_whiteLongCastle = 0x4,
+		Flag_blackShortCastle = 0x8,
+		Flag_blackLongCastle = 0x10
+	};
+
+	enum GameResult : uint8_t
+	{
+		Result_unknown,
+		Result_whiteWin,
+		Result_draw,
+		Result_blackWin
+	};
+
+	const static uint8_t NoEpSquare = 0xff;
+	const static int16_t NoScore = std::numeric_limits<int16_t>::min();
+
+	uint64_t occupied;
+	uint8_t pieces[16];
+	uint8_t flags;
+	uint8_t epSquare;
+	uint8_t halfMoves;
+	uint8_t result;
+
+	// optional labels
+	int16_t score; // from white's point of view, NoScore if not labelled
+	uint16_t bestMove; // 0 if not labelled (see PackedPositions::PackMove())
+
+	bool HasScore() const { return score != NoScore; }
+	bool HasBestMove() const { return bestMove != 0; }
+};
+
+static_assert(sizeof(PackedPosition) == 32, "PackedPosition must be 32 bytes");
+
+namespace PackedPositions
+{
+
+// files start with a header of the same size as a record, so records stay aligned when the file is mapped
+const static char Magic[8] = { 'G', 'I', 'R', 'P', 'O', 'S', '0', '1' };
+const static size_t HeaderSize = sizeof(PackedPosition);
+
+// from (6 bits), to (6 bits), promotion piece type without colour (3 bits)
+uint16_t PackMove(Move mv);
+
+// returns 0 if the move is not legal in the position
+Move UnpackMove(Board &b, uint16_t packedMove);
+
+// whether the file starts with the packed position header
+bool IsPackedFile(const std::string &filename);
+
+// whether the record can be turned into a Board - legal piece codes, one king per side, no pawns on the first or last
+// rank, and an ep square (if any) on the third or sixth rank
+// records from files and from the network are checked with this, since Board(const PackedPosition&) trusts its input
+bool IsValid(const PackedPosition &pos);
+
+}
+
+// Read-only view of a position file.
+// Packed files are mapped into memory. For compatibility with existing data, text files are also accepted, and converted
+// once on open - each line is a FEN/EPD position, except that a line without '/' is the best move for the preceding
+// position (the old label_bm format).
+class PackedPositionFile
+{
+public:
+	PackedPositionFile();
+	~PackedPositionFile();
+
+	PackedPositionFile(const PackedPositionFile&) = delete;
+	PackedPositionFile &operator=(const PackedPositionFile&) = delete;
+
+	// returns an empty string on success, and an error message otherwise (including if any record is invalid)
+	std::string Open(const std::string &filename);
+
+	void Close();
+
+	Span<const PackedPosition> GetPositions() const { return Span<const PackedPosition>(m_data, m_size); }
+
+	size_t GetSize() const { return m_size; }
+
+	const PackedPosition &operator[](size_t i) const { return GetPositions()[i]; }
+
+private:
+	std::string ReadTextFile_(const std::string &filename);
+
+	// checks every record with PackedPositions::IsValid(), and closes the file if one fails
+	std::string Validate_(const std::string &filename);
+
+	const PackedPosition *m_data;
+	size_t m_size;
+
+	// 0 if the file is not mapped
+	size_t m_mappedSize;
+	const void *m_mappedAddr;
+
+	// only used if we can't map the file
+	std::vector<PackedPosition> m_buffer;
+};
+
+// streams records to a file, so datasets never have to be held in memory
+class PackedPositionWriter
+{
+public:
+	// returns an empty string on success, and an error message otherwise
+	std::string Open(const std::string &filename);
+
+	void Write(const PackedPosition &pos)
+	{
+		m_file.write(reinterpret_cast<const char *>(&pos), sizeof(pos));
+	}
+
+	void Close() { m_file.close(); }
+
+private:
+	std::ofstream m_file;
+};
+
+#endif // PACKED_POSITION_H
@@ -30,6 +30,7 @@
 #include "eval/eval.h"
 #include "see.h"
 #include "gtb.h"
+#include "bitbases.h"
 #include "countermove.h"
 
 namespace
@@ -303,9 +304,12 @@ Score Search(RootSearchContext &context, std::vector<Move> &pv, Board &board, Sc
 	// we have to check for draws before probing the transposition table, because the ttable
 	// can potentially hide repetitions
 
+	// a copy, since the entry may be replaced while we search the subtree
+	MaterialEntry material = context.materialTable->Probe(board);
+
 	// first we check for hard draws (if ply > 0, we use relaxed rules, which we can't do at ply = 0, because
 	// it would result in empty pv)
-	if (board.HasInsufficientMaterial(ply > 0))
+	if ((material.flags & MaterialFlag_maybeInsufficient) && board.HasInsufficientMaterial(ply > 0))
 	{
 		return DRAW_SCORE;
 	}
@@ -322,10 +326,20 @@ Score Search(RootSearchContext &context, std::vector<Move> &pv, Board &board, Sc
 
 	bool isRoot = ply == 0;
 
+	// bitbase draws are exact, and wins are scored for us (in place of the evaluator)
+	Score bitbaseScore = 0;
+	Bitbases::Result bitbaseResult = material.bitbase.Probe(board, bitbaseScore);
+
+	if (!isRoot && bitbaseResult == Bitbases::Result_draw)
+	{
+		return DRAW_SCORE;
+	}
+
 	// we cannot probe at root because then we would have no move to return
+	// hard probes (that may have to read from disk) are only worth it if the subtree we would save is large
 	if (!isRoot)
 	{
-		GTB::ProbeResult gtbResult = GTB::Probe(board);
+		GTB::ProbeResult gtbResult = GTB::Probe(board, nodeBudget >= MinNodeBudgetForHardTBProbe);
 
 		if (gtbResult)
 		{
@@ -378,12 +392,13 @@ Score Search(RootSearchContext &context, std::vector<Move> &pv, Board &board, Sc
 		}
 	}
 
-	Score staticEval = context.evaluator->EvaluateForSTM(board, alpha, beta);
+	Score staticEval = (bitbaseResult != Bitbases::Result_unknown) ?
+		bitbaseScore : context.evaluator->EvaluateForSTM(board, alpha, beta);
 
 	// try null move
 	if (ENABLE_NULL_MOVE_HEURISTICS && staticEval >= beta && !isPV)
 	{
-		if (nodeBudget >= MinNodeBudgetForNullMove && !board.InCheck() && !board.IsZugzwangProbable() && nullMoveAllowed)
+		if (nodeBudget >= MinNodeBudgetForNullMove && !board.InCheck() && !material.IsZugzwangProbable(board.GetSideToMove()) && nullMoveAllowed)
 		{
 			board.MakeNullMove();
 
@@ -611,13 +626,24 @@ Score QSearch(RootSearchContext &context, std::vector<Move> &pv, Board &board, S
 		return 0;
 	}
 
+	MaterialEntry material = context.materialTable->Probe(board);
+
 	// in QSearch we are only worried about insufficient material
-	if (board.HasInsufficientMaterial())
+	if ((material.flags & MaterialFlag_maybeInsufficient) && board.HasInsufficientMaterial())
+	{
+		return DRAW_SCORE;
+	}
+
+	Score bitbaseScore = 0;
+	Bitbases::Result bitbaseResult = material.bitbase.Probe(board, bitbaseScore);
+
+	if (bitbaseResult == Bitbases::Result_draw)
 	{
 		return DRAW_SCORE;
 	}
 
-	GTB::ProbeResult gtbResult = GTB::Probe(board);
+	// only soft probes in QS, the subtrees here are too small to pay for IO
+	GTB::ProbeResult gtbResult = GTB::Probe(board, false);
 
 	if (gtbResult)
 	{
@@ -633,7 +659,8 @@ Score QSearch(RootSearchContext &context, std::vector<Move> &pv, Board &board, S
 	}
 
 	// we first see if we can stand-pat
-	Score staticEval = context.evaluator->EvaluateForSTM(board, alpha, beta);
+	Score staticEval = (bitbaseResult != Bitbases::Result_unknown) ?
+		bitbaseScore : context.evaluator->EvaluateForSTM(board, alpha, beta);
 
 	if (staticEval >= beta)
 	{
@@ -757,7 +784,7 @@ Score QSearch(RootSearchContext &context, std::vector<Move> &pv, Board &board, S
 	return alpha;
 }
 
-SearchResult SyncSearchNodeLimited(const Board &b, NodeBudget nodeBudget, EvaluatorIface *evaluator, MoveEvaluatorIface *moveEvaluator, Killer *killer, TTable *ttable, CounterMove *counter, History *history)
+SearchResult SyncSearchNodeLimited(const Board &b, NodeBudget nodeBudget, EvaluatorIface *evaluator, MoveEvaluatorIface *moveEvaluator, Killer *killer, TTable *ttable, CounterMove *counter, History *history, MaterialTable *materialTable)
 {
 	SearchResult ret;
 	RootSearchContext context;
@@ -768,6 +795,7 @@ SearchResult SyncSearchNodeLimited(const Board &b, NodeBudget nodeBudget, Evalua
 	std::unique_ptr<TTable> ttable_u;
 	std::unique_ptr<CounterMove> counter_u;
 	std::unique_ptr<History> history_u;
+	std::unique_ptr<MaterialTable> materialTable_u;
 
 	if (killer == nullptr)
 	{
@@ -809,6 +837,16 @@ SearchResult SyncSearchNodeLimited(const Board &b, NodeBudget nodeBudget, Evalua
 		context.history = history;
 	}
 
+	if (materialTable == nullptr)
+	{
+		materialTable_u.reset(new MaterialTable);
+		context.materialTable = materialTable_u.get();
+	}
+	else
+	{
+		context.materialTable = materialTable;
+	}
+
 	context.evaluator = evaluator;
 	context.moveEvaluator = moveEvaluator;
 
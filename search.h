@@ -35,6 +35,7 @@
 #include "ttable.h"
 #include "eval/eval.h"
 #include "killer.h"
+#include "material_table.h"
 #include "evaluator.h"
 #include "move_evaluator.h"
 
@@ -63,6 +64,8 @@ static const float IIDNodeBudgetMultiplier = 0.1f;
 static const bool ENABLE_PVS = true;
 static const NodeBudget MinNodeBudgetForPVS = 16;
 
+static const NodeBudget MinNodeBudgetForHardTBProbe = 1024;
+
 static const bool ENABLE_KILLERS = true;
 
 static const bool ENABLE_COUNTERMOVES = false;
@@ -131,6 +134,7 @@ struct RootSearchContext
 	Killer *killer;
 	CounterMove *counter;
 	History *history;
+	MaterialTable *materialTable;
 
 	EvaluatorIface *evaluator;
 	MoveEvaluatorIface *moveEvaluator;
@@ -184,7 +188,7 @@ Score QSearch(RootSearchContext &context, std::vector<Move> &pv, Board &board, S
 
 // perform a synchronous search (no thread creation)
 // this is used in training only, where we don't want to do a typical root search, and don't want all the overhead
-SearchResult SyncSearchNodeLimited(const Board &b, NodeBudget nodeBudget, EvaluatorIface *evaluator, MoveEvaluatorIface *moveEvaluator, Killer *killer = nullptr, TTable *ttable = nullptr, CounterMove *counter = nullptr, History *history = nullptr);
+SearchResult SyncSearchNodeLimited(const Board &b, NodeBudget nodeBudget, EvaluatorIface *evaluator, MoveEvaluatorIface *moveEvaluator, Killer *killer = nullptr, TTable *ttable = nullptr, CounterMove *counter = nullptr, History *history = nullptr, MaterialTable *materialTable = nullptr);
 
 // print search trees for debugging
 extern bool trace;
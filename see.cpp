@@ -17,6 +17,9 @@
 
 #include "see.h"
 #include "eval/eval_params.h"
+#include "bit_ops.h"
+#include "board_consts.h"
+#include "slider_attacks.h"
 
 #include <algorithm>
 #include <iostream>
@@ -25,109 +28,286 @@
 
 #include <cstdint>
 
-namespace SEE
+namespace
 {
 
-// best tactical result for the moving side
-Score StaticExchangeEvaluation(Board &board, Move mv)
+// attackers of both colors on sq, with the given occupancy
+inline uint64_t AttackersTo_(const Board &board, Square sq, uint64_t occupancy)
 {
-	board.ResetSee();
+	uint64_t diagonalSliders = board.GetPieceTypeBitboard(WB) | board.GetPieceTypeBitboard(BB) | board.GetPieceTypeBitboard(WQ) | board.GetPieceTypeBitboard(BQ);
+	uint64_t straightSliders = board.GetPieceTypeBitboard(WR) | board.GetPieceTypeBitboard(BR) | board.GetPieceTypeBitboard(WQ) | board.GetPieceTypeBitboard(BQ);
+
+	return (KING_ATK[sq] & (board.GetPieceTypeBitboard(WK) | board.GetPieceTypeBitboard(BK))) |
+		(KNIGHT_ATK[sq] & (board.GetPieceTypeBitboard(WN) | board.GetPieceTypeBitboard(BN))) |
+		(PAWN_ATK[sq][1] & board.GetPieceTypeBitboard(WP)) |
+		(PAWN_ATK[sq][0] & board.GetPieceTypeBitboard(BP)) |
+		(SliderAttacks::BishopAttacks(sq, occupancy) & diagonalSliders) |
+		(SliderAttacks::RookAttacks(sq, occupancy) & straightSliders);
+}
 
-	// convert the move to SEE format
-	PieceType pt;
-	Square from;
-	Square to;
+// sliders that were behind a piece that just moved off the line (attackers are not masked with occupancy here)
+template <bool DIAGONAL, bool STRAIGHT>
+inline uint64_t XRayAttackers_(const Board &board, Square sq, uint64_t occupancy)
+{
+	uint64_t ret = 0ULL;
 
-	pt = GetPieceType(mv);
-	from = GetFromSquare(mv);
-	to = GetToSquare(mv);
+	if (DIAGONAL)
+	{
+		ret |= SliderAttacks::BishopAttacks(sq, occupancy) &
+			(board.GetPieceTypeBitboard(WB) | board.GetPieceTypeBitboard(BB) | board.GetPieceTypeBitboard(WQ) | board.GetPieceTypeBitboard(BQ));
+	}
 
-	PieceType capturedPT = board.ApplyMoveSee(pt, from, to);
+	if (STRAIGHT)
+	{
+		ret |= SliderAttacks::RookAttacks(sq, occupancy) &
+			(board.GetPieceTypeBitboard(WR) | board.GetPieceTypeBitboard(BR) | board.GetPieceTypeBitboard(WQ) | board.GetPieceTypeBitboard(BQ));
+	}
 
-	// the first move is forced
-	Score ret = 0;
+	return ret;
+}
 
-	if (capturedPT != EMPTY)
+// removes the least valuable attacker of side from occupancy and attackers (adding x-ray attackers behind it),
+// and returns its piece type, or EMPTY if side has no attacker left
+inline PieceType PopLeastValuableAttacker_(const Board &board, Square sq, Color side, uint64_t &occupancy, uint64_t &attackers)
+{
+	const static PieceType ATTACKER_ORDER[6] = { WP, WN, WB, WR, WQ, WK };
+
+	for (PieceType pt : ATTACKER_ORDER)
 	{
-		ret = SEE_MAT[capturedPT] - StaticExchangeEvaluationSq(board, to);
+		uint64_t bb = attackers & board.GetPieceTypeBitboard(pt | side);
+
+		if (bb)
+		{
+			occupancy &= InvBit(BitScanForward(bb));
+
+			// only pieces that were on a line with sq can uncover sliders
+			// (kings are adjacent to sq, but can still be on a diagonal or a straight line)
+			if (pt == WP || pt == WB)
+			{
+				attackers |= XRayAttackers_<true, false>(board, sq, occupancy);
+			}
+			else if (pt == WR)
+			{
+				attackers |= XRayAttackers_<false, true>(board, sq, occupancy);
+			}
+			else if (pt == WQ || pt == WK)
+			{
+				attackers |= XRayAttackers_<true, true>(board, sq, occupancy);
+			}
+
+			attackers &= occupancy;
+
+			return pt | side;
+		}
 	}
-	else
+
+	return EMPTY;
+}
+
+// value of the capture sequence on sq for side, who is about to capture a piece worth victimValue
+// each side is free to stop capturing at any point
+// occupancy and attackers must already reflect all the captures made so far
+Score CaptureSequenceValue_(const Board &board, Square sq, Color side, Score victimValue, uint64_t occupancy, uint64_t attackers)
+{
+	// swapList[i] is the value of the piece captured by the i-th capture
+	// there can't be more captures than pieces on the board
+	Score swapList[32];
+	size_t numCaptures = 0;
+
+	PieceType pt;
+
+	while ((pt = PopLeastValuableAttacker_(board, sq, side, occupancy, attackers)) != EMPTY)
 	{
-		ret = -StaticExchangeEvaluationSq(board, to);
+		swapList[numCaptures++] = victimValue;
+		victimValue = SEE::SEE_MAT[pt];
+		side ^= COLOR_MASK;
 	}
 
-	board.UndoMoveSee();
+	// back up the values from the end of the sequence
+	Score ret = 0;
+
+	while (numCaptures > 0)
+	{
+		--numCaptures;
+		ret = std::max(0, swapList[numCaptures] - ret);
+	}
 
 	return ret;
 }
 
-Score SEEMap(Board &board, Square sq)
+Score StaticExchangeEvaluation_(const Board &board, Move mv, uint64_t attackersToDst)
 {
-	board.ResetSee();
+	PieceType pt = GetPieceType(mv);
+	Square from = GetFromSquare(mv);
+	Square to = GetToSquare(mv);
+
+	// the first move is forced
+	uint64_t occupancy = (board.GetOccupiedBitboard<WHITE>() | board.GetOccupiedBitboard<BLACK>()) & InvBit(from);
 
-	return -StaticExchangeEvaluationSq(board, sq, true);
+	// the moving piece can be on any line with to (not just the lines it attacks on), so we have to check both
+	uint64_t attackers = (attackersToDst | XRayAttackers_<true, true>(board, to, occupancy)) & occupancy;
+
+	Score capturedValue = SEE::SEE_MAT[board.GetPieceAtSquare(to)];
+
+	return capturedValue - CaptureSequenceValue_(board, to, board.GetSideToMove() ^ COLOR_MASK, SEE::SEE_MAT[pt], occupancy, attackers);
 }
 
-Score StaticExchangeEvaluationSq(Board &board, Square sq, bool forced)
+Score NMStaticExchangeEvaluation_(const Board &board, Square from, uint64_t attackersToSrc)
 {
-	Score ret = 0;
+	if (board.InCheck())
+	{
+		return 0;
+	}
 
-	PieceType pt;
-	Square from;
+	uint64_t occupancy = board.GetOccupiedBitboard<WHITE>() | board.GetOccupiedBitboard<BLACK>();
 
-	bool hasMoreCapture = board.GenerateSmallestCaptureSee(pt, from, sq);
+	// positive value means we should move this piece (opponent can win it otherwise)
+	return CaptureSequenceValue_(board, from, board.GetSideToMove() ^ COLOR_MASK, SEE::SEE_MAT[board.GetPieceAtSquare(from)], occupancy, attackersToSrc);
+}
 
-	if (hasMoreCapture)
+}
+
+namespace SEE
+{
+
+// best tactical result for the moving side
+Score StaticExchangeEvaluation(const Board &board, Move mv)
+{
+	Square to = GetToSquare(mv);
+
+	return StaticExchangeEvaluation_(board, mv, AttackersTo_(board, to, board.GetOccupiedBitboard<WHITE>() | board.GetOccupiedBitboard<BLACK>()));
+}
+
+bool StaticExchangeEvaluationGE(const Board &board, Move mv, Score threshold)
+{
+	PieceType pt = GetPieceType(mv);
+	Square from = GetFromSquare(mv);
+	Square to = GetToSquare(mv);
+
+	// swap is how much the side that just captured has to gain from here on to make the threshold,
+	// from the point of view of the side about to capture
+	Score swap = SEE_MAT[board.GetPieceAtSquare(to)] - threshold;
+
+	// we can't make it even if the opponent doesn't recapture
+	if (swap < 0)
 	{
-		PieceType capturedPT = board.ApplyMoveSee(pt, from, sq);
+		return false;
+	}
 
-		if (forced)
-		{
-			// in forced mode, we are trying to build a SEE map, so we assume the square to be empty
-			// (even if it's not)
-			ret = -StaticExchangeEvaluationSq(board, sq);
-		}
-		else
-		{
-			ret = std::max(0, SEE_MAT[capturedPT] - StaticExchangeEvaluationSq(board, sq));
-		}
+	swap = SEE_MAT[pt] - swap;
 
-		board.UndoMoveSee();
+	// we make it even if the opponent recaptures, and we don't
+	if (swap <= 0)
+	{
+		return true;
 	}
-	else
+
+	uint64_t occupancy = (board.GetOccupiedBitboard<WHITE>() | board.GetOccupiedBitboard<BLACK>()) & InvBit(from);
+	uint64_t attackers = AttackersTo_(board, to, occupancy) & occupancy;
+
+	Color side = board.GetSideToMove();
+
+	// whether the side that made the last capture is us
+	bool ret = true;
+
+	while (true)
 	{
-		if (forced)
+		side ^= COLOR_MASK;
+
+		PieceType attacker = PopLeastValuableAttacker_(board, to, side, occupancy, attackers);
+
+		if (attacker == EMPTY)
 		{
-			// if the move is forced and we don't have a move, return worst result
-			ret = -SEE_MAT[WK];
+			break;
+		}
+
+		ret = !ret;
+
+		// the side capturing now is done as soon as it's ahead even after losing the attacker
+		// (ret is 1 if the capturing side is us, and we need >= instead of >)
+		swap = SEE_MAT[attacker] - swap;
+
+		if (swap < static_cast<Score>(ret))
+		{
+			break;
 		}
 	}
 
 	return ret;
 }
 
-Score NMStaticExchangeEvaluation(Board &board, Move mv)
+Score SEEMap(const Board &board, Square sq)
 {
-	Score ret = 0;
+	uint64_t occupancy = board.GetOccupiedBitboard<WHITE>() | board.GetOccupiedBitboard<BLACK>();
+	uint64_t attackers = AttackersTo_(board, sq, occupancy);
 
-	if (!board.InCheck())
+	// we are trying to build a SEE map, so we assume the square to be empty (even if it's not)
+	PieceType pt = PopLeastValuableAttacker_(board, sq, board.GetSideToMove(), occupancy, attackers);
+
+	if (pt == EMPTY)
 	{
-		board.MakeNullMove();
+		// if we don't have a move, return worst result
+		return SEE_MAT[WK];
+	}
 
-		board.ResetSee();
+	return CaptureSequenceValue_(board, sq, board.GetSideToMove() ^ COLOR_MASK, SEE_MAT[pt], occupancy, attackers);
+}
 
-		// positive value means we should move this piece (opponent can win it otherwise)
-		ret = StaticExchangeEvaluationSq(board, GetFromSquare(mv));
+Score NMStaticExchangeEvaluation(const Board &board, Move mv)
+{
+	Square from = GetFromSquare(mv);
 
-		board.UndoMove();
-	}
+	return NMStaticExchangeEvaluation_(board, from, AttackersTo_(board, from, board.GetOccupiedBitboard<WHITE>() | board.GetOccupiedBitboard<BLACK>()));
+}
 
-	return ret;
+void StaticExchangeEvaluationBatch(const Board &board, const MoveList &ml, Span<Score> see, Span<Score> nmSee)
+{
+#ifdef DEBUG
+	assert(see.GetSize() >= ml.GetSize());
+	assert(nmSee.GetSize() >= ml.GetSize());
+#endif
+
+	uint64_t occupancy = board.GetOccupiedBitboard<WHITE>() | board.GetOccupiedBitboard<BLACK>();
+
+	// many moves share destinations and sources, so we only compute attackers once per square,
+	// and NM SEE once per source square
+	uint64_t attackers[64];
+	uint64_t attackersComputed = 0ULL;
+
+	Score nmSeeScores[64];
+	uint64_t nmSeeComputed = 0ULL;
+
+	auto getAttackers = [&](Square sq) -> uint64_t
+	{
+		if (!(attackersComputed & Bit(sq)))
+		{
+			attackers[sq] = AttackersTo_(board, sq, occupancy);
+			attackersComputed |= Bit(sq);
+		}
+
+		return attackers[sq];
+	};
+
+	for (size_t i = 0; i < ml.GetSize(); ++i)
+	{
+		Move mv = ml[i];
+		Square from = GetFromSquare(mv);
+
+		see[i] = StaticExchangeEvaluation_(board, mv, getAttackers(GetToSquare(mv)));
+
+		if (!(nmSeeComputed & Bit(from)))
+		{
+			nmSeeScores[from] = NMStaticExchangeEvaluation_(board, from, getAttackers(from));
+			nmSeeComputed |= Bit(from);
+		}
+
+		nmSee[i] = nmSeeScores[from];
+	}
 }
 
-Score GlobalExchangeEvaluation(Board &board, std::vector<Move> &pv, Score currentEval, Score lowerBound, Score upperBound)
+Score GlobalExchangeEvaluation(Board &board, GEEPv &pv, Score currentEval, Score lowerBound, Score upperBound)
 {
-	assert(pv.empty());
+	pv.Clear();
 
 	// try standpat
 	if (currentEval >= upperBound)
@@ -142,20 +322,18 @@ Score GlobalExchangeEvaluation(Board &board, std::vector<Move> &pv, Score curren
 	MoveList captures;
 	board.GenerateAllLegalMoves<Board::VIOLENT>(captures);
 
-	std::vector<Move> subPv;
+	GEEPv subPv;
 
 	for (size_t i = 0; i < captures.GetSize(); ++i)
 	{
-		Score see = StaticExchangeEvaluation(board, captures[i]);
-
 		// we only want to search positive SEEs (not even neutral ones), and only if it can possibly improve lowerBound
-		if ((see < 0) || ((currentEval + see) <= lowerBound))
+		// (lowerBound is at least currentEval after standpat, so this threshold is always positive)
+		// the threshold version can stop the exchange early once the result is known
+		if (!StaticExchangeEvaluationGE(board, captures[i], lowerBound - currentEval + 1))
 		{
 			continue;
 		}
 
-		subPv.clear();
-
 		PieceType capturedPt = board.GetCapturedPieceType(captures[i]);
 
 		board.ApplyMove(captures[i]);
@@ -173,31 +351,19 @@ Score GlobalExchangeEvaluation(Board &board, std::vector<Move> &pv, Score curren
 		{
 			lowerBound = score;
 
-			pv.clear();
-			pv.push_back(captures[i]);
-			pv.insert(pv.end(), subPv.begin(), subPv.end());
+			pv.Clear();
+			pv.PushBack(captures[i]);
+
+			for (size_t j = 0; j < subPv.GetSize(); ++j)
+			{
+				pv.PushBack(subPv[j]);
+			}
 		}
 	}
 
 	return lowerBound;
 }
 
-void GEERunFunc(Board &board, std::function<void(Board &b)> func)
-{
-	std::vector<Move> pv;
-
-	GlobalExchangeEvaluation(board, pv);
-
-	board.ApplyVariation(pv);
-
-	func(board);
-
-	for (size_t i = 0; i < pv.size(); ++i)
-	{
-		board.UndoMove();
-	}
-}
-
 bool RunSeeTest(std::string fen, std::string move, Score expectedScore)
 {
 	std::cout << "Checking SEE for " << fen << ", <= " << move << std::endl;
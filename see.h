@@ -21,8 +21,9 @@
 #include "types.h"
 #include "board.h"
 #include "move.h"
+#include "containers.h"
 
-#include <functional>
+#include <vector>
 
 namespace SEE
 {
@@ -47,23 +48,137 @@ static const Score SEE_MAT[14] = {
 };
 
 // returns how good this capture is for the moving side
-Score StaticExchangeEvaluation(Board &board, Move mv);
+Score StaticExchangeEvaluation(const Board &board, Move mv);
 
-// returns the value of the largest piece the opponent can place on the square
-Score SEEMap(Board &board, Square sq);
+// returns whether StaticExchangeEvaluation(board, mv) >= threshold, but stops as soon as the result is known
+bool StaticExchangeEvaluationGE(const Board &board, Move mv, Score threshold);
 
-Score StaticExchangeEvaluationSq(Board &board, Square sq, bool forced = false);
+// returns the value of the largest piece the opponent can place on the square
+Score SEEMap(const Board &board, Square sq);
 
 // returns whether this move is an escape, and the value of the escape (how much the opponent can gain through SEE if we didn't move)
-Score NMStaticExchangeEvaluation(Board &board, Move mv);
+Score NMStaticExchangeEvaluation(const Board &board, Move mv);
+
+// SEE and NM SEE for every move in the list, sharing attacker sets between moves with the same squares
+// see and nmSee must have room for at least ml.GetSize() scores
+void StaticExchangeEvaluationBatch(const Board &board, const MoveList &ml, Span<Score> see, Span<Score> nmSee);
+
+// each capture removes a piece, and kings can't be captured
+const static size_t MAX_GEE_PV_LENGTH = 32;
+
+typedef FixedVector<Move, MAX_GEE_PV_LENGTH> GEEPv;
 
 // this is essentially QSearch, but using SEE evaluation instead of the actual eval function
 // the goal is to discover a reasonable PV quickly
 // scores are biased to 0 at the start position of the search
-Score GlobalExchangeEvaluation(Board &board, std::vector<Move> &pv, Score currentEval = 0, Score lowerBound = -SEE_MAT[WK], Score upperBound = SEE_MAT[WK]);
+Score GlobalExchangeEvaluation(Board &board, GEEPv &pv, Score currentEval = 0, Score lowerBound = -SEE_MAT[WK], Score upperBound = SEE_MAT[WK]);
+
+// A small direct-mapped cache of GEE PVs, keyed on position hash.
+// With the default window, GEE only depends on the position, and sibling positions often
+// lead to the same exchanges, so PVs can be reused. Long PVs (rare) are not cached.
+// Memory is only allocated on first use.
+class GEECache
+{
+public:
+	const static size_t NumEntries = 64 * 1024;
+	const static size_t MaxPvLength = 7;
+
+	// returns whether the PV for this position was found (and written to pv)
+	bool Probe(uint64_t hash, GEEPv &pv) const
+	{
+		if (m_entries.empty())
+		{
+			return false;
+		}
+
+		const Entry &entry = m_entries[hash % NumEntries];
+
+		if (entry.hash != hash)
+		{
+			return false;
+		}
+
+		pv.Clear();
+
+		for (uint32_t i = 0; i < entry.pvLength; ++i)
+		{
+			pv.PushBack(entry.pv[i]);
+		}
+
+		return true;
+	}
+
+	void Store(uint64_t hash, const GEEPv &pv)
+	{
+		if (pv.GetSize() > MaxPvLength)
+		{
+			return;
+		}
+
+		if (m_entries.empty())
+		{
+			m_entries.resize(NumEntries);
+		}
+
+		Entry &entry = m_entries[hash % NumEntries];
+
+		entry.hash = hash;
+		entry.pvLength = pv.GetSize();
+
+		for (size_t i = 0; i < pv.GetSize(); ++i)
+		{
+			entry.pv[i] = pv[i];
+		}
+	}
+
+	void Clear()
+	{
+		m_entries.clear();
+		m_entries.shrink_to_fit();
+	}
+
+private:
+	struct Entry
+	{
+		Entry() : hash(0), pvLength(0) {}
+
+		uint64_t hash;
+		uint32_t pvLength;
+		Move pv[MaxPvLength];
+	};
+
+	std::vector<Entry> m_entries;
+};
 
 // this is a wrapper for GEE that simply runs the supplied function on the leaf of GEE, and undo all the moves
-void GEERunFunc(Board &board, std::function<void(Board &b)> func);
+// if a cache is supplied, it's used to skip the search for positions we have seen before
+template <typename F>
+void GEERunFunc(Board &board, F func, GEECache *cache = nullptr)
+{
+	GEEPv pv;
+
+	if (!cache || !cache->Probe(board.GetHash(), pv))
+	{
+		GlobalExchangeEvaluation(board, pv);
+
+		if (cache)
+		{
+			cache->Store(board.GetHash(), pv);
+		}
+	}
+
+	for (size_t i = 0; i < pv.GetSize(); ++i)
+	{
+		board.ApplyMove(pv[i]);
+	}
+
+	func(board);
+
+	for (size_t i = 0; i < pv.GetSize(); ++i)
+	{
+		board.UndoMove();
+	}
+}
 
 bool RunSeeTest(std::string fen, std::string move, Score expectedScore);
 
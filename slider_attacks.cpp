@@ -0,0 +1,304 @@
+/*
+	Copyright (C) 2015 Matthew Lai
+
+	Giraffe is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	Giraffe is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "slider_attacks.h"
+
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <stdexcept>
+
+#include "bit_ops.h"
+#include "board_consts.h"
+#include "util.h"
+
+namespace
+{
+
+// packed tables shared by the fancy magic and pext backends
+std::vector<uint64_t> gBishopTable;
+std::vector<uint64_t> gRookTable;
+
+const static int32_t BISHOP_DIRECTIONS[4][2] = { {1, 1}, {1, -1}, {-1, 1}, {-1, -1} };
+const static int32_t ROOK_DIRECTIONS[4][2] = { {1, 0}, {-1, 0}, {0, 1}, {0, -1} };
+
+// slow reference generator used to fill the tables
+uint64_t RayAttacks(Square sq, uint64_t occupancy, const int32_t directions[4][2])
+{
+	uint64_t ret = 0ULL;
+
+	for (int32_t d = 0; d < 4; ++d)
+	{
+		for (int32_t i = 1; SqOffset(sq, directions[d][0] * i, directions[d][1] * i); ++i)
+		{
+			uint64_t bit = SqOffset(sq, directions[d][0] * i, directions[d][1] * i);
+
+			ret |= bit;
+
+			if (bit & occupancy)
+			{
+				break;
+			}
+		}
+	}
+
+	return ret;
+}
+
+void BuildPackedTable(
+	SliderAttacks::Backend backend,
+	const U64 masks[64],
+	const U64 magics[64],
+	const unsigned int shifts[64],
+	const int32_t directions[4][2],
+	std::vector<uint64_t> &table,
+	SliderAttacks::SquareEntry entries[64])
+{
+	std::vector<size_t> offsets(64);
+	size_t totalSize = 0;
+
+	for (Square sq = 0; sq < 64; ++sq)
+	{
+		offsets[sq] = totalSize;
+
+		// pext needs exactly 2^popcount entries, while magics may need a larger index space
+		if (backend == SliderAttacks::Backend_pext)
+		{
+			totalSize += 1ULL << PopCount(masks[sq]);
+		}
+		else
+		{
+			totalSize += 1ULL << (64 - shifts[sq]);
+		}
+	}
+
+	table.assign(totalSize, 0ULL);
+
+	for (Square sq = 0; sq < 64; ++sq)
+	{
+		SliderAttacks::SquareEntry &entry = entries[sq];
+
+		entry.attacks = &table[offsets[sq]];
+		entry.mask = masks[sq];
+		entry.magic = magics[sq];
+		entry.shift = shifts[sq];
+
+		// carry-rippler walks through all subsets of the mask in increasing order, which
+		// is also the order of their pext indices
+		uint64_t occupancy = 0ULL;
+		uint64_t pextIdx = 0;
+
+		do
+		{
+			uint64_t attacks = RayAttacks(sq, occupancy, directions);
+
+			uint64_t idx = (backend == SliderAttacks::Backend_pext) ?
+				pextIdx : ((occupancy * entry.magic) >> entry.shift);
+
+			// magics are allowed to have constructive collisions only
+			if (entry.attacks[idx] != 0ULL && entry.attacks[idx] != attacks)
+			{
+				throw std::runtime_error("Bad slider magic for square " + std::to_string(sq));
+			}
+
+			entry.attacks[idx] = attacks;
+
+			occupancy = (occupancy - entry.mask) & entry.mask;
+			++pextIdx;
+		} while (occupancy);
+	}
+}
+
+}
+
+namespace SliderAttacks
+{
+
+Backend gBackend = Backend_magicMoves;
+
+SquareEntry gBishopEntries[64];
+SquareEntry gRookEntries[64];
+
+void Init()
+{
+	if (IsAvailable(Backend_pext))
+	{
+		SetBackend(Backend_pext);
+	}
+	else
+	{
+		SetBackend(Backend_fancyMagic);
+	}
+}
+
+bool IsAvailable(Backend backend)
+{
+	switch (backend)
+	{
+	case Backend_magicMoves:
+	case Backend_fancyMagic:
+		return true;
+	case Backend_pext:
+#ifdef __BMI2__
+		// only possible if we are compiled with BMI2, but check anyways in case the binary was
+		// built elsewhere
+		return __builtin_cpu_supports("bmi2");
+#else
+		return false;
+#endif
+	default:
+		return false;
+	}
+}
+
+void SetBackend(Backend backend)
+{
+	if (!IsAvailable(backend))
+	{
+		throw std::runtime_error("Slider attack backend not available - " + BackendToString(backend));
+	}
+
+	if (backend == Backend_magicMoves)
+	{
+		// these tables are always initialized by initmagicmoves(), and we don't need the packed ones
+		gBishopTable.clear();
+		gBishopTable.shrink_to_fit();
+		gRookTable.clear();
+		gRookTable.shrink_to_fit();
+	}
+	else
+	{
+		BuildPackedTable(backend, magicmoves_b_mask, magicmoves_b_magics, magicmoves_b_shift, BISHOP_DIRECTIONS, gBishopTable, gBishopEntries);
+		BuildPackedTable(backend, magicmoves_r_mask, magicmoves_r_magics, magicmoves_r_shift, ROOK_DIRECTIONS, gRookTable, gRookEntries);
+	}
+
+	gBackend = backend;
+}
+
+std::string BackendToString(Backend backend)
+{
+	switch (backend)
+	{
+	case Backend_magicMoves:
+		return "magic_moves";
+	case Backend_fancyMagic:
+		return "fancy_magic";
+	case Backend_pext:
+		return "pext";
+	default:
+		return "unknown";
+	}
+}
+
+size_t TableFootprint(Backend backend)
+{
+	if (backend == Backend_magicMoves)
+	{
+		return sizeof(magicmovesbdb) + sizeof(magicmovesrdb) +
+			sizeof(magicmoves_b_magics) + sizeof(magicmoves_b_mask) +
+			sizeof(magicmoves_r_magics) + sizeof(magicmoves_r_mask);
+	}
+
+	size_t entries = 0;
+
+	for (Square sq = 0; sq < 64; ++sq)
+	{
+		if (backend == Backend_pext)
+		{
+			entries += (1ULL << PopCount(magicmoves_b_mask[sq])) + (1ULL << PopCount(magicmoves_r_mask[sq]));
+		}
+		else
+		{
+			entries += (1ULL << (64 - magicmoves_b_shift[sq])) + (1ULL << (64 - magicmoves_r_shift[sq]));
+		}
+	}
+
+	return entries * sizeof(uint64_t) + sizeof(gBishopEntries) + sizeof(gRookEntries);
+}
+
+void DebugRunBenchmark()
+{
+	const static size_t NumQueries = 4096;
+	const static size_t NumIterations = 4096;
+
+	// same random queries for all backends
+	// occupancy density is ~25%, which is about what we see in middlegames
+	std::mt19937_64 mt(42);
+
+	std::vector<Square> squares(NumQueries);
+	std::vector<uint64_t> occupancies(NumQueries);
+
+	for (size_t i = 0; i < NumQueries; ++i)
+	{
+		squares[i] = mt() % 64;
+		occupancies[i] = mt() & mt();
+	}
+
+	Backend originalBackend = gBackend;
+
+	uint64_t referenceChecksum = 0;
+
+	for (int32_t b = 0; b < Backend_num; ++b)
+	{
+		Backend backend = static_cast<Backend>(b);
+
+		if (!IsAvailable(backend))
+		{
+			std::cout << std::setw(12) << BackendToString(backend) << ": not available" << std::endl;
+			continue;
+		}
+
+		SetBackend(backend);
+
+		uint64_t checksum = 0;
+
+		double startTime = CurrentTime();
+
+		for (size_t iter = 0; iter < NumIterations; ++iter)
+		{
+			for (size_t i = 0; i < NumQueries; ++i)
+			{
+				// make the occupancy depend on the previous result, so we measure latency
+				// (like in a real attack generation loop) instead of just throughput
+				checksum += QueenAttacks(squares[i], occupancies[i] ^ (checksum & 1));
+			}
+		}
+
+		double elapsed = CurrentTime() - startTime;
+
+		if (b == 0)
+		{
+			referenceChecksum = checksum;
+		}
+		else if (checksum != referenceChecksum)
+		{
+			std::cout << "Checksum mismatch for " << BackendToString(backend) << std::endl;
+		}
+
+		std::cout << std::setw(12) << BackendToString(backend) << ": "
+			<< std::fixed << std::setprecision(2)
+			<< (elapsed * 1e9 / (NumQueries * NumIterations)) << " ns/queen lookup, "
+			<< (TableFootprint(backend) / 1024) << " KB tables" << std::endl;
+	}
+
+	SetBackend(originalBackend);
+
+	std::cout << "Current backend: " << BackendToString(gBackend) << std::endl;
+}
+
+}
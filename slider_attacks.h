@@ -0,0 +1,120 @@
+/*
+	Copyright (C) 2015 Matthew Lai
+
+	Giraffe is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	Giraffe is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SLIDER_ATTACKS_H
+#define SLIDER_ATTACKS_H
+
+#include <string>
+
+#include <cstdint>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+#include "types.h"
+#include "magic_moves.h"
+
+// Slider attack lookups with a backend selected at startup.
+// All backends return exactly the same attack sets, they only differ in how the table index
+// is computed and how big the tables are -
+// magicMoves: the original magic_moves tables (fixed shift, 64 * (4096 + 512) entries)
+// fancyMagic: variable shift magics with all squares packed into one table (~840KB)
+// pext: same packed layout as fancyMagic, but indexed with BMI2 PEXT instead of multiply and shift
+namespace SliderAttacks
+{
+
+enum Backend
+{
+	Backend_magicMoves,
+	Backend_fancyMagic,
+	Backend_pext,
+
+	Backend_num
+};
+
+struct SquareEntry
+{
+	uint64_t *attacks; // start of this square's slice in the packed table
+	uint64_t mask; // relevant occupancy (edges excluded)
+	uint64_t magic; // unused by pext
+	uint32_t shift; // unused by pext
+};
+
+extern Backend gBackend;
+
+extern SquareEntry gBishopEntries[64];
+extern SquareEntry gRookEntries[64];
+
+// builds packed tables for the best available backend
+// initmagicmoves() and BoardConstsInit() must have been called first
+void Init();
+
+bool IsAvailable(Backend backend);
+
+// rebuilds the packed tables for the new backend
+// not thread-safe, and must not be called while a search is running
+void SetBackend(Backend backend);
+
+std::string BackendToString(Backend backend);
+
+// size of the tables the backend reads from in the hot path, in bytes
+size_t TableFootprint(Backend backend);
+
+// compares lookup cost of all available backends, then restores the current one
+void DebugRunBenchmark();
+
+inline uint64_t PackedLookup_(const SquareEntry &entry, uint64_t occupancy)
+{
+#ifdef __BMI2__
+	if (gBackend == Backend_pext)
+	{
+		return entry.attacks[_pext_u64(occupancy, entry.mask)];
+	}
+#endif
+
+	return entry.attacks[((occupancy & entry.mask) * entry.magic) >> entry.shift];
+}
+
+inline uint64_t BishopAttacks(Square sq, uint64_t occupancy)
+{
+	if (gBackend == Backend_magicMoves)
+	{
+		return Bmagic(sq, occupancy);
+	}
+
+	return PackedLookup_(gBishopEntries[sq], occupancy);
+}
+
+inline uint64_t RookAttacks(Square sq, uint64_t occupancy)
+{
+	if (gBackend == Backend_magicMoves)
+	{
+		return Rmagic(sq, occupancy);
+	}
+
+	return PackedLookup_(gRookEntries[sq], occupancy);
+}
+
+inline uint64_t QueenAttacks(Square sq, uint64_t occupancy)
+{
+	return BishopAttacks(sq, occupancy) | RookAttacks(sq, occupancy);
+}
+
+}
+
+#endif // SLIDER_ATTACKS_H
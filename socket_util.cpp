@@ -0,0 +1,367 @@
+/*
+	Copyright (C) 2015 Matthew Lai
+
+	Giraffe is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	Giraffe is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "socket_util.h"
+
+#include <stdexcept>
+#include <chrono>
+#include <thread>
+
+#include <cstring>
+#include <cerrno>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+#ifndef _WIN32
+
+#ifdef MSG_NOSIGNAL
+const int SendFlags = MSG_NOSIGNAL;
+#else
+const int SendFlags = 0;
+#endif
+
+bool IsUnixAddress(const std::string &address)
+{
+	return address.find('/') != std::string::npos;
+}
+
+// whether the path exists and is a socket (we never want to remove anything else, in case of a mistyped address)
+bool IsSocketFile(const std::string &path)
+{
+	struct stat st;
+
+	return lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode);
+}
+
+void SetNoDelay(int fd)
+{
+	// we send many medium sized messages and always wait for the reply
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// creates a socket for the address, and either binds it (listen == true) or connects it
+// returns -1 on error, with the error message in err
+int OpenSocket(const std::string &address, bool listen, std::string &err)
+{
+	if (IsUnixAddress(address))
+	{
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+
+		if (address.size() >= sizeof(addr.sun_path))
+		{
+			err = "Socket path too long: " + address;
+			return -1;
+		}
+
+		strcpy(addr.sun_path, address.c_str());
+
+		if (listen)
+		{
+			// remove a socket left behind by a previous run, but nothing else
+			struct stat st;
+
+			if (lstat(address.c_str(), &st) == 0)
+			{
+				if (!S_ISSOCK(st.st_mode))
+				{
+					err = address + " exists and is not a socket";
+					return -1;
+				}
+
+				unlink(address.c_str());
+			}
+		}
+
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+		if (fd < 0)
+		{
+			err = std::string("socket() failed: ") + strerror(errno);
+			return -1;
+		}
+
+		int ret = listen ? bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) :
+						   connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+
+		if (ret < 0)
+		{
+			err = address + ": " + strerror(errno);
+			close(fd);
+			return -1;
+		}
+
+		return fd;
+	}
+
+	size_t colon = address.rfind(':');
+
+	if (colon == std::string::npos)
+	{
+		err = "Address must be a socket path or host:port - " + address;
+		return -1;
+	}
+
+	std::string host = address.substr(0, colon);
+	std::string port = address.substr(colon + 1);
+
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = listen ? AI_PASSIVE : 0;
+
+	addrinfo *result = nullptr;
+
+	int gaiRet = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result);
+
+	if (gaiRet != 0)
+	{
+		err = address + ": " + gai_strerror(gaiRet);
+		return -1;
+	}
+
+	int fd = -1;
+	err = "Failed to resolve " + address;
+
+	for (addrinfo *ai = result; ai != nullptr; ai = ai->ai_next)
+	{
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+		if (fd < 0)
+		{
+			err = std::string("socket() failed: ") + strerror(errno);
+			continue;
+		}
+
+		if (listen)
+		{
+			int one = 1;
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		}
+		else
+		{
+			SetNoDelay(fd);
+		}
+
+		int ret = listen ? bind(fd, ai->ai_addr, ai->ai_addrlen) : connect(fd, ai->ai_addr, ai->ai_addrlen);
+
+		if (ret == 0)
+		{
+			err.clear();
+			break;
+		}
+
+		err = address + ": " + strerror(errno);
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(result);
+
+	return fd;
+}
+
+#endif // _WIN32
+
+}
+
+namespace SocketUtil
+{
+
+int Listen(const std::string &address, int backlog, std::string &err)
+{
+#ifndef _WIN32
+	int fd = OpenSocket(address, true, err);
+
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	if (listen(fd, backlog) < 0)
+	{
+		err = std::string("listen() failed: ") + strerror(errno);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+#else
+	(void) address; (void) backlog;
+	err = "Sockets are not supported on this platform";
+	return -1;
+#endif
+}
+
+int Accept(int listenFd)
+{
+#ifndef _WIN32
+	int fd;
+
+	do
+	{
+		fd = accept(listenFd, nullptr, nullptr);
+	} while (fd < 0 && errno == EINTR);
+
+	if (fd >= 0)
+	{
+		// this fails harmlessly on Unix sockets
+		SetNoDelay(fd);
+	}
+
+	return fd;
+#else
+	(void) listenFd;
+	return -1;
+#endif
+}
+
+int Connect(const std::string &address, int timeoutSeconds, std::string &err)
+{
+#ifndef _WIN32
+	auto startTime = std::chrono::steady_clock::now();
+
+	int fd = -1;
+
+	while ((fd = OpenSocket(address, false, err)) < 0)
+	{
+		if (std::chrono::steady_clock::now() - startTime > std::chrono::seconds(timeoutSeconds))
+		{
+			return -1;
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	}
+
+	// earlier attempts may have failed
+	err.clear();
+
+	return fd;
+#else
+	(void) address; (void) timeoutSeconds;
+	err = "Sockets are not supported on this platform";
+	return -1;
+#endif
+}
+
+void SendAll(int fd, const void *data, size_t size)
+{
+#ifndef _WIN32
+	const char *p = static_cast<const char *>(data);
+
+	while (size > 0)
+	{
+		ssize_t ret = send(fd, p, size, SendFlags);
+
+		if (ret < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (ret <= 0)
+		{
+			throw std::runtime_error(std::string("send failed: ") + strerror(errno));
+		}
+
+		p += ret;
+		size -= ret;
+	}
+#else
+	(void) fd; (void) data; (void) size;
+	throw std::runtime_error("Sockets are not supported on this platform");
+#endif
+}
+
+void RecvAll(int fd, void *data, size_t size)
+{
+#ifndef _WIN32
+	char *p = static_cast<char *>(data);
+
+	while (size > 0)
+	{
+		ssize_t ret = recv(fd, p, size, 0);
+
+		if (ret < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (ret == 0)
+		{
+			throw std::runtime_error("Peer disconnected");
+		}
+
+		if (ret < 0)
+		{
+			throw std::runtime_error(std::string("recv failed: ") + strerror(errno));
+		}
+
+		p += ret;
+		size -= ret;
+	}
+#else
+	(void) fd; (void) data; (void) size;
+	throw std::runtime_error("Sockets are not supported on this platform");
+#endif
+}
+
+void Shutdown(int fd)
+{
+#ifndef _WIN32
+	shutdown(fd, SHUT_RDWR);
+#else
+	(void) fd;
+#endif
+}
+
+void Close(int fd)
+{
+#ifndef _WIN32
+	close(fd);
+#else
+	(void) fd;
+#endif
+}
+
+void RemoveAddress(const std::string &address)
+{
+#ifndef _WIN32
+	if (IsUnixAddress(address) && IsSocketFile(address))
+	{
+		unlink(address.c_str());
+	}
+#else
+	(void) address;
+#endif
+}
+
+}
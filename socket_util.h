@@ -0,0 +1,56 @@
+/*
+	Copyright (C) 2015 Matthew Lai
+
+	Giraffe is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	Giraffe is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SOCKET_UTIL_H
+#define SOCKET_UTIL_H
+
+#include <string>
+
+#include <cstdint>
+
+// Minimal blocking stream sockets, for communication between training processes.
+// Addresses are Unix socket paths if they have a '/', and host:port otherwise (an empty host listens on all interfaces).
+// Not supported on Windows (all functions fail).
+namespace SocketUtil
+{
+
+// returns a listening socket, or -1 with the error message in err
+// stale Unix socket files are removed first, but it's an error if the path exists and is not a socket
+int Listen(const std::string &address, int backlog, std::string &err);
+
+// returns the connected socket, or -1 on error (eg. when the listener was shut down)
+int Accept(int listenFd);
+
+// keeps retrying for up to timeoutSeconds, since the listener may not be up yet
+// returns the connected socket, or -1 with the error message in err
+int Connect(const std::string &address, int timeoutSeconds, std::string &err);
+
+// these throw std::runtime_error on error or disconnection
+void SendAll(int fd, const void *data, size_t size);
+void RecvAll(int fd, void *data, size_t size);
+
+// wakes up any thread blocked on the socket (without closing it)
+void Shutdown(int fd);
+
+void Close(int fd);
+
+// removes the socket file if the address is a Unix socket path (and the path is a socket)
+void RemoveAddress(const std::string &address);
+
+}
+
+#endif // SOCKET_UTIL_H
@@ -35,7 +35,7 @@ class StaticMoveEvaluator : public MoveEvaluatorIface
 public:
 	std::vector<std::string> samples;
 
-	virtual void EvaluateMoves(Board &board, SearchInfo &si, MoveInfoList &list, MoveList &/*ml*/) override
+	virtual void EvaluateMoves(Board &board, SearchInfo &si, MoveInfoList &list, MoveList &ml) override
 	{
 #ifdef SAMPLING
 		static std::uniform_real_distribution<float> dist;
@@ -65,8 +65,14 @@ public:
 			counterMove = si.counter->GetCounterMove(board);
 		}
 
-		for (auto &mi : list)
+		Score seeScores[MAX_LEGAL_MOVES];
+		Score nmSeeScores[MAX_LEGAL_MOVES];
+
+		SEE::StaticExchangeEvaluationBatch(board, ml, Span<Score>(seeScores, MAX_LEGAL_MOVES), Span<Score>(nmSeeScores, MAX_LEGAL_MOVES));
+
+		for (size_t i = 0; i < list.GetSize(); ++i)
 		{
+			MoveInfo &mi = list[i];
 			Move mv = mi.move;
 
 			PieceType promoType = GetPromoType(mv);
@@ -77,8 +83,8 @@ public:
 			bool isQueenPromo = (promoType == WQ || promoType == BQ);
 			bool isUnderPromo = (isPromo && !isQueenPromo);
 
-			mi.seeScore = SEE::StaticExchangeEvaluation(board, mv);
-			mi.nmSeeScore = SEE::NMStaticExchangeEvaluation(board, mv);
+			mi.seeScore = seeScores[i];
+			mi.nmSeeScore = nmSeeScores[i];
 
 			if (mv == si.hashMove)
 			{
@@ -30,6 +30,8 @@ uint64_t W_LONG_CASTLE_ZOBRIST;
 uint64_t B_SHORT_CASTLE_ZOBRIST;
 uint64_t B_LONG_CASTLE_ZOBRIST;
 
+uint64_t MATERIAL_ZOBRIST[PIECE_TYPE_LAST + 1][MAX_PIECES_PER_TYPE];
+
 void InitializeZobrist()
 {
 	std::mt19937_64 gen(53820873); // using the default seed
@@ -50,4 +52,13 @@ void InitializeZobrist()
 	W_LONG_CASTLE_ZOBRIST = gen();
 	B_SHORT_CASTLE_ZOBRIST = gen();
 	B_LONG_CASTLE_ZOBRIST = gen();
+
+	// these are generated after everything else, so the keys above stay the same
+	for (PieceType pt = 0; pt <= PIECE_TYPE_LAST; ++pt)
+	{
+		for (size_t i = 0; i < MAX_PIECES_PER_TYPE; ++i)
+		{
+			MATERIAL_ZOBRIST[pt][i] = gen();
+		}
+	}
 }
@@ -33,6 +33,12 @@ extern uint64_t W_LONG_CASTLE_ZOBRIST;
 extern uint64_t B_SHORT_CASTLE_ZOBRIST;
 extern uint64_t B_LONG_CASTLE_ZOBRIST;
 
+// material keys are the xor of MATERIAL_ZOBRIST[pt][i] for all i < count of pt, so they only depend on
+// how many of each piece type there are, and can be updated incrementally when a piece is added or removed
+// (sized for the whole board, so custom positions can't overflow it)
+const static size_t MAX_PIECES_PER_TYPE = 64;
+extern uint64_t MATERIAL_ZOBRIST[PIECE_TYPE_LAST + 1][MAX_PIECES_PER_TYPE];
+
 void InitializeZobrist();
 
 #endif // ZOBRIST_H